@@ -10,6 +10,23 @@ end;
 fprintf('Converting %s...',strInputFile);
 [strInputFolder, strSessionName,strExp] = fileparts(strInputFile);
 
+if exist('plxsplit','file') == 3 && (strctOptions.m_bAnalog || strctOptions.m_bStrobe || strctOptions.m_bSpikes)
+    % Native converter (MEX_Code/PlexonSplit). Reads the PLX file once and writes the
+    % same raw files as the code below, which reopens the file for every channel.
+    strctSplitOptions.m_bAnalog = strctOptions.m_bAnalog;
+    strctSplitOptions.m_bStrobe = strctOptions.m_bStrobe;
+    strctSplitOptions.m_bSpikes = strctOptions.m_bSpikes;
+    if ~isempty(hProgress)
+        fnResetWaitbar(hProgress);
+        fnSetWaitbar(hProgress, 0.5);
+    end
+    fprintf('Analog, strobe and spikes (single pass)...');
+    plxsplit(strInputFile, strctSplitOptions);
+    strctOptions.m_bAnalog = false;
+    strctOptions.m_bStrobe = false;
+    strctOptions.m_bSpikes = false;
+end
+
 if strctOptions.m_bAnalog
     if ~isempty(hProgress)
         fnResetWaitbar(hProgress);
@@ -1,53 +1,129 @@
-function fnDumpChannelSpikes(strctChannelInfo,astrctSpikes, strOutFileName)
+function fnDumpChannelSpikes(strctChannelInfo,astrctSpikes, strOutFileName, strctOptions)
 % The astrctSpikes structure contains:
 % m_iUnitIndex
 % m_afTimestamps
 % m_iChannel
 % m_afInterval
 % m_a2fWaveforms
+%
+% Writes a KOFIKO_v1.03S file. Compared to v1.02S, the timestamps of all
+% units are stored in one block followed by the waveforms of all units, and
+% every unit has a coarse time index (the number of spikes before
+% IndexStart + k*IndexBin), so an interval query reads a few index entries and
+% the timestamps it needs without touching the waveforms.
+%
+% Optional strctOptions:
+% m_bInt16Waveforms - store waveforms as int16 with one scale per channel
+%                     (value = int16 * scale). Default: false (single).
+% m_fIndexBinSec    - time index resolution. Default: 10 sec.
+%
+% Layout after the header size (all of it counts in the header size):
+% plx file, channel name, channel id, gain, threshold, filters, sorted,
+% NumUnits, WaveFormLength, UnitIndices, NumSpikes, Intervals (NumUnits x 2),
+% WaveFormClass (0:single, 1:int16), WaveFormScale, IndexBin,
+% IndexStart (NumUnits), IndexLength (NumUnits), Index (sum(IndexLength)).
+% Data: timestamps of unit 1..N, then waveforms of unit 1..N (NumSpikes x WaveFormLength).
+if ~exist('strctOptions','var')
+    strctOptions = [];
+end
+if ~isfield(strctOptions,'m_bInt16Waveforms')
+    strctOptions.m_bInt16Waveforms = false;
+end
+if ~isfield(strctOptions,'m_fIndexBinSec')
+    strctOptions.m_fIndexBinSec = 10;
+end
 
 % check folder exist
 [strPath,strFile]=fileparts(strOutFileName);
-if ~exist(strPath,'dir')
+if ~isempty(strPath) && ~exist(strPath,'dir')
     mkdir(strPath)
 end
 
-Cnt = 0;
-% Dump information to file....
-hFileID = fopen(strOutFileName,'wb+');
-iHeaderPrefix = fwrite(hFileID, 'KOFIKO_v1.02S','char'); % Identifier...
-Cnt=Cnt+8*fwrite(hFileID,0 ,'uint64'); % HeaderSize
-
-% Dump channel information
-Cnt=Cnt+8*fwrite(hFileID,length(strctChannelInfo.m_strPlxFile),'uint64'); 
-Cnt=Cnt+fwrite(hFileID,strctChannelInfo.m_strPlxFile,'char'); 
-Cnt=Cnt+8*fwrite(hFileID,length(strctChannelInfo.m_strChannelName),'uint64'); 
-Cnt=Cnt+fwrite(hFileID,strctChannelInfo.m_strChannelName,'char'); 
-Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_iChannelID,'uint64'); 
-Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_fGain,'double'); 
-Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_fThreshold,'double'); 
-Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_bFiltersActive,'uint64'); 
-Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_bSorted,'uint64'); 
-
 iNumUnits = length(astrctSpikes);
 aiNumSpikes = zeros(1,iNumUnits);
 aiUnitIndices= zeros(1,iNumUnits);
 a2fIntervals = zeros(iNumUnits,2);
+afIndexStart = zeros(1,iNumUnits);
+acIndex = cell(1,iNumUnits);
+fMaxAbs = 0;
+fBin = strctOptions.m_fIndexBinSec;
 for k=1:iNumUnits
+    % The time index needs sorted timestamps
+    afTimestamps = astrctSpikes(k).m_afTimestamps(:);
+    if ~issorted(afTimestamps)
+        [afTimestamps, aiOrder] = sort(afTimestamps);
+        astrctSpikes(k).m_afTimestamps = afTimestamps;
+        if ~isempty(astrctSpikes(k).m_a2fWaveforms)
+            astrctSpikes(k).m_a2fWaveforms = astrctSpikes(k).m_a2fWaveforms(aiOrder,:);
+        end
+    end
     aiUnitIndices(k) = astrctSpikes(k).m_iUnitIndex;
-    aiNumSpikes(k) = length(astrctSpikes(k).m_afTimestamps);
+    aiNumSpikes(k) = length(afTimestamps);
     a2fIntervals(k,:) = astrctSpikes(k).m_afInterval;
+    if ~isempty(afTimestamps)
+        afIndexStart(k) = floor(afTimestamps(1)/fBin)*fBin;
+        afBinStart = afIndexStart(k) + fBin*(0:floor((afTimestamps(end)-afIndexStart(k))/fBin));
+        [afDummy, aiBin] = histc(afTimestamps, [afBinStart, Inf]); %#ok
+        acIndex{k} = [0, cumsum(accumarray(aiBin(:), 1, [length(afBinStart),1]))'];
+        acIndex{k} = acIndex{k}(1:end-1);
+    end
+    fMaxAbs = max([fMaxAbs; abs(double(astrctSpikes(k).m_a2fWaveforms(:)))]);
 end
 iWaveFormLength = size(astrctSpikes(1).m_a2fWaveforms,2);
-Cnt=Cnt+8*fwrite(hFileID,iNumUnits,'uint64'); 
-Cnt=Cnt+8*fwrite(hFileID,iWaveFormLength,'uint64'); 
-Cnt=Cnt+8*fwrite(hFileID,aiUnitIndices,'uint64'); 
-Cnt=Cnt+8*fwrite(hFileID,aiNumSpikes,'uint64'); 
-Cnt=Cnt+8*fwrite(hFileID,a2fIntervals,'double'); 
+aiIndexLength = cellfun(@length, acIndex);
+if strctOptions.m_bInt16Waveforms
+    iWaveFormClass = 1;
+    fWaveFormScale = fMaxAbs / 32767;
+    if fWaveFormScale == 0
+        fWaveFormScale = 1;
+    end
+else
+    iWaveFormClass = 0;
+    fWaveFormScale = 1;
+end
+
+Cnt = 0;
+% Dump information to file....
+hFileID = fopen(strOutFileName,'wb+');
+iHeaderPrefix = fwrite(hFileID, 'KOFIKO_v1.03S','char'); % Identifier...
+Cnt=Cnt+8*fwrite(hFileID,0 ,'uint64'); % HeaderSize
+
+% Dump channel information
+Cnt=Cnt+8*fwrite(hFileID,length(strctChannelInfo.m_strPlxFile),'uint64');
+Cnt=Cnt+fwrite(hFileID,strctChannelInfo.m_strPlxFile,'char');
+Cnt=Cnt+8*fwrite(hFileID,length(strctChannelInfo.m_strChannelName),'uint64');
+Cnt=Cnt+fwrite(hFileID,strctChannelInfo.m_strChannelName,'char');
+Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_iChannelID,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_fGain,'double');
+Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_fThreshold,'double');
+Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_bFiltersActive,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,strctChannelInfo.m_bSorted,'uint64');
 
+Cnt=Cnt+8*fwrite(hFileID,iNumUnits,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,iWaveFormLength,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,aiUnitIndices,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,aiNumSpikes,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,a2fIntervals,'double');
+
+% Waveform storage and time index
+Cnt=Cnt+8*fwrite(hFileID,iWaveFormClass,'uint64');
+Cnt=Cnt+8*fwrite(hFileID,fWaveFormScale,'double');
+Cnt=Cnt+8*fwrite(hFileID,fBin,'double');
+Cnt=Cnt+8*fwrite(hFileID,afIndexStart,'double');
+Cnt=Cnt+8*fwrite(hFileID,aiIndexLength,'uint64');
+for k=1:iNumUnits
+    Cnt=Cnt+8*fwrite(hFileID,acIndex{k},'uint64');
+end
+
+for k=1:iNumUnits
+    fwrite(hFileID,astrctSpikes(k).m_afTimestamps,'double');
+end
 for k=1:iNumUnits
-    fwrite(hFileID,astrctSpikes(k).m_afTimestamps,'double'); 
-    fwrite(hFileID,astrctSpikes(k).m_a2fWaveforms,'single'); 
+    if iWaveFormClass == 1
+        fwrite(hFileID,round(double(astrctSpikes(k).m_a2fWaveforms) / fWaveFormScale),'int16');
+    else
+        fwrite(hFileID,astrctSpikes(k).m_a2fWaveforms,'single');
+    end
 end
 
 fseek(hFileID,iHeaderPrefix,'bof');
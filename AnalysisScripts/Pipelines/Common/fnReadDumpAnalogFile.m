@@ -23,6 +23,20 @@ while iParamCount < length(varargin)
 end
 afTime = [];
 
+[strStoreFile, strMember] = fnSessionStoreMember(strInputFile);
+if ~isempty(strStoreFile)
+    % The raw file was packed into a session store (MEX_Code/SessionStore)
+    switch (strReadMode)
+        case 'Interval'
+            [strctAnalog, afTime] = fnReadStoreInterval(strStoreFile, strMember, fStartTS, fEndTS);
+        case 'Resample'
+            [strctAnalog, afTime] = fnReadStore(strStoreFile, strMember, 'Resample', a2fSampleTimes);
+        otherwise
+            [strctAnalog, afTime] = fnReadStore(strStoreFile, strMember, strReadMode);
+    end
+    return;
+end
+
 
 hFileID = fopen(strInputFile,'rb+');
 strHeader = fread(hFileID, 13,'char=>char'); % Identifier...
@@ -49,9 +63,25 @@ if ( all(strHeader(:) == strKofiko_v100_file(:)))
             end
             
         case 'Interval'
-            [strctAnalog.m_afData,afTime] = fnReadInterval(hFileID, iHeaderSize, strctAnalog, fStartTS, fEndTS);
+            if exist('fnReadDumpAnalog','file') == 3
+                % Native reader, on the time axis of fnReadInterval (NaN in the gaps)
+                afTime = fnIntervalTime(strctAnalog, fStartTS, fEndTS);
+                strctAnalog.m_afData = double(fnReadDumpAnalog(strInputFile, 'Resample', afTime(:)));
+            else
+                [strctAnalog.m_afData,afTime] = fnReadInterval(hFileID, iHeaderSize, strctAnalog, fStartTS, fEndTS);
+            end
         case 'Resample'
-            strctAnalog.m_afData = fnReadIntervalAndResample(hFileID, iHeaderSize, strctAnalog, a2fSampleTimes);
+            if exist('fnReadDumpAnalog','file') == 3
+                % Native reader (MEX_Code/ReadDumpAnalog): maps the file and only touches the
+                % samples around the requested times. Times outside the frames are NaN.
+                if iscell(a2fSampleTimes)
+                    strctAnalog.m_afData = cellfun(@double, fnReadDumpAnalog(strInputFile, 'Resample', a2fSampleTimes),'UniformOutput',false);
+                else
+                    strctAnalog.m_afData = double(fnReadDumpAnalog(strInputFile, 'Resample', a2fSampleTimes));
+                end
+            else
+                strctAnalog.m_afData = fnReadIntervalAndResample(hFileID, iHeaderSize, strctAnalog, a2fSampleTimes);
+            end
     end
     
 end
@@ -189,3 +219,40 @@ else
     afData  = reshape(interp1(afTime, afDataCont, a2fSampleTimes(:)),size(a2fSampleTimes));
 end
 return;
+
+function [strctAnalog, afTime] = fnReadStore(strStoreFile, strMember, strReadMode, varargin)
+afTime = [];
+switch (strReadMode)
+    case 'HeaderOnly'
+        strctAnalog = rmfield(fnSessionStore('Analog', strStoreFile, strMember, 'HeaderOnly'), 'm_afData');
+    case 'Normal'
+        [strctAnalog, afTime] = fnSessionStore('Analog', strStoreFile, strMember);
+        strctAnalog.m_afData = double(strctAnalog.m_afData);
+    case 'Resample'
+        strctAnalog = fnSessionStore('Analog', strStoreFile, strMember, 'Resample', varargin{1});
+        if iscell(strctAnalog.m_afData)
+            strctAnalog.m_afData = cellfun(@double, strctAnalog.m_afData,'UniformOutput',false);
+        else
+            strctAnalog.m_afData = double(strctAnalog.m_afData);
+        end
+end
+return;
+
+function afTime = fnIntervalTime(strctAnalog, fStartTS, fEndTS)
+% Same time axis as fnReadInterval: starts at the sample that precedes fStartTS
+iStartFrame = find(strctAnalog.m_afStartTS <= fStartTS,1,'last');
+fFirstTS = fStartTS;
+if ~isempty(iStartFrame)
+    fFirstTS = strctAnalog.m_afStartTS(iStartFrame) + floor((fStartTS-strctAnalog.m_afStartTS(iStartFrame)) * strctAnalog.m_fSamplingFreq)/strctAnalog.m_fSamplingFreq;
+end
+iNumSamplesRequested = ceil((fEndTS-fStartTS) * strctAnalog.m_fSamplingFreq);
+afTime = fFirstTS + [0:iNumSamplesRequested-1]/strctAnalog.m_fSamplingFreq;
+return;
+
+function [strctAnalog, afTime] = fnReadStoreInterval(strStoreFile, strMember, fStartTS, fEndTS)
+% NaN in the gaps, as fnReadInterval
+strctAnalog = fnSessionStore('Analog', strStoreFile, strMember, 'HeaderOnly');
+afTime = fnIntervalTime(strctAnalog, fStartTS, fEndTS);
+strctAnalog = fnSessionStore('Analog', strStoreFile, strMember, 'Resample', afTime(:));
+strctAnalog.m_afData = double(strctAnalog.m_afData);
+return;
@@ -1,6 +1,19 @@
 function [astrctUnits,strctChannelInfo] = fnReadDumpSpikeFile(strInputFile, varargin)
 strctOpt=fnParseParams(varargin{:});
 
+[strStoreFile, strMember] = fnSessionStoreMember(strInputFile);
+if ~isempty(strStoreFile)
+    % The raw file was packed into a session store (MEX_Code/SessionStore)
+    [astrctUnits,strctChannelInfo] = fnReadWithMex(@(varargin) fnSessionStore('Spikes', strStoreFile, strMember, varargin{:}),strctOpt);
+    return;
+end
+
+if exist('fnReadDumpSpikes','file') == 3
+    % Memory mapped reader (MEX_Code/ReadDumpSpikes), reads all versions
+    [astrctUnits,strctChannelInfo] = fnReadWithMex(@(varargin) fnReadDumpSpikes(strInputFile, varargin{:}),strctOpt);
+    return;
+end
+
 hFileID = fopen(strInputFile,'rb+');
 strHeader = fread(hFileID, 13,'char=>char'); % Identifier...
 if all(strHeader' == 'KOFIKO_v1.01S')
@@ -8,6 +21,8 @@ if all(strHeader' == 'KOFIKO_v1.01S')
     strctChannelInfo = [];
 elseif all(strHeader' == 'KOFIKO_v1.02S')
     [astrctUnits,strctChannelInfo] = fnRead102Version(hFileID,strctOpt);
+elseif all(strHeader' == 'KOFIKO_v1.03S')
+    [astrctUnits,strctChannelInfo] = fnRead103Version(hFileID,strctOpt);
 else
     assert(false);
 end
@@ -20,11 +35,14 @@ iParamCount = 0;
 strctOpt.m_iUnitOfInterest = [];
 strctOpt.m_iChannelOfInterest = [];
 strctOpt.m_bHeaderOnly = false;
+strctOpt.m_bWaveforms = true;
 while iParamCount < length(varargin)
     iParamCount=iParamCount+1;
     switch lower(varargin{iParamCount})
         case 'headeronly'
             strctOpt.m_bHeaderOnly = true;
+        case 'nowaveforms'
+            strctOpt.m_bWaveforms = false;
         case 'singleunit'
             strctOpt.m_iChannelOfInterest = varargin{iParamCount+1}(1);
             strctOpt.m_iUnitOfInterest = varargin{iParamCount+1}(2);
@@ -38,6 +56,23 @@ while iParamCount < length(varargin)
 end
 return;
 
+function [astrctUnits,strctChannelInfo] = fnReadWithMex(fnReader,strctOpt)
+acArgs = {'Waveforms', strctOpt.m_bWaveforms};
+if strctOpt.m_bHeaderOnly
+    acArgs{end+1} = 'HeaderOnly';
+end
+if ~isempty(strctOpt.m_iUnitOfInterest)
+    acArgs = [acArgs, {'Units', strctOpt.m_iUnitOfInterest, 'Channel', strctOpt.m_iChannelOfInterest}];
+    if strctOpt.m_bReadInterval
+        acArgs = [acArgs, {'Interval', [strctOpt.m_fStartTS, strctOpt.m_fEndTS]}];
+    end
+end
+[astrctUnits,strctChannelInfo] = fnReader(acArgs{:});
+for k=1:length(astrctUnits)
+    astrctUnits(k).m_a2fWaveforms = double(astrctUnits(k).m_a2fWaveforms);
+end
+return;
+
 function astrctUnits = fnRead101Version(hFileID,strctOpt)
 iHeaderSize = fread(hFileID, 1,'uint64=>double'); % Identifier...
 
@@ -138,3 +173,123 @@ else
 end
 
 return;
+
+
+function [astrctUnits,strctChannelInfo] = fnRead103Version(hFileID,strctOpt)
+% Timestamps of all units are stored before the waveforms of all units, see fnDumpChannelSpikes
+iHeaderSize = fread(hFileID, 1,'uint64=>double'); % Identifier...
+
+iPLXFileLen = fread(hFileID,1,'uint64=>double');
+strctChannelInfo.m_strPlxFile = fread(hFileID,iPLXFileLen,'char=>char')';
+
+iChannelNameLen = fread(hFileID,1,'uint64=>double');
+strctChannelInfo.m_strChannelName = fread(hFileID,iChannelNameLen,'char=>char')';
+strctChannelInfo.m_iChannelID = fread(hFileID,1,'uint64=>double');
+strctChannelInfo.m_fGain = fread(hFileID,1,'double=>double');
+strctChannelInfo.m_fThreshold = fread(hFileID,1,'double=>double');
+strctChannelInfo.m_bFiltersActive = fread(hFileID,1,'uint64=>double');
+strctChannelInfo.m_bSorted = fread(hFileID,1,'uint64=>double');
+
+iNumUnits = fread(hFileID,1,'uint64=>double');
+iWaveFormLength = fread(hFileID,1,'uint64=>double');
+aiUnitIndices = fread(hFileID,iNumUnits,'uint64=>double');
+aiNumSpikes = fread(hFileID,iNumUnits,'uint64=>double');
+a2fIntervals = reshape(fread(hFileID,2*iNumUnits,'double=>double'),iNumUnits,2);
+
+iWaveFormClass = fread(hFileID,1,'uint64=>double');
+fWaveFormScale = fread(hFileID,1,'double=>double');
+fIndexBin = fread(hFileID,1,'double=>double');
+afIndexStart = fread(hFileID,iNumUnits,'double=>double');
+aiIndexLength = fread(hFileID,iNumUnits,'uint64=>double');
+acIndex = cell(1,iNumUnits);
+for k=1:iNumUnits
+    acIndex{k} = fread(hFileID,aiIndexLength(k),'uint64=>double');
+end
+if iWaveFormClass == 1
+    strPrecision = 'int16';
+    iSampleSize = 2;
+else
+    strPrecision = 'single';
+    iSampleSize = 4;
+end
+
+if strctOpt.m_bHeaderOnly
+    for k=1:iNumUnits
+        astrctUnits(k).m_iUnitIndex = aiUnitIndices(k);
+        astrctUnits(k).m_afTimestamps = [];
+        astrctUnits(k).m_a2fWaveforms = [];
+        astrctUnits(k).m_afInterval = a2fIntervals(k,:);
+    end
+    return;
+end;
+
+if isempty(strctOpt.m_iUnitOfInterest)
+    aiEntries = 1:iNumUnits;
+else
+    aiEntries = find(aiUnitIndices == strctOpt.m_iUnitOfInterest);
+    assert(~isempty(aiEntries) && length(aiEntries) == 1);
+end
+bReadInterval = strctOpt.m_bReadInterval && ~isempty(strctOpt.m_iUnitOfInterest);
+iTimestampsStart = 13+iHeaderSize;
+iWaveformsStart = iTimestampsStart + 8*sum(aiNumSpikes);
+
+for iIter=1:length(aiEntries)
+    k = aiEntries(iIter);
+    iNumSpikesBefore = sum(aiNumSpikes(1:k-1));
+    iNumSpikes = aiNumSpikes(k);
+    % Spikes [iFirst, iFirst+iCount) of the unit are returned
+    iFirst = 0;
+    iCount = iNumSpikes;
+    if bReadInterval
+        % The index holds the number of spikes before IndexStart + j*IndexBin; one bin of
+        % slack on each side absorbs rounding at the bin edges
+        aiIndex = acIndex{k};
+        iLow = 0;
+        iHigh = iNumSpikes;
+        j0 = floor((strctOpt.m_fStartTS - afIndexStart(k))/fIndexBin);
+        j1 = floor((strctOpt.m_fEndTS - afIndexStart(k))/fIndexBin) + 3;
+        if j0 >= 1 && j0 <= length(aiIndex)
+            iLow = aiIndex(j0);
+        elseif j0 > length(aiIndex) && ~isempty(aiIndex)
+            iLow = aiIndex(end);
+        end
+        if j1 >= 1 && j1 <= length(aiIndex)
+            iHigh = aiIndex(j1);
+        elseif j1 < 1
+            iHigh = 0;
+        end
+        iHigh = max(iHigh, iLow);
+        fseek(hFileID,iTimestampsStart + 8*(iNumSpikesBefore+iLow),'bof');
+        afCandidates = fread(hFileID,iHigh-iLow,'double=>double');
+        abInsideInterval = afCandidates >= strctOpt.m_fStartTS & afCandidates <= strctOpt.m_fEndTS;
+        iCount = sum(abInsideInterval);
+        if iCount > 0
+            iFirst = iLow + find(abInsideInterval,1,'first') - 1;
+        end
+        afTimestamps = afCandidates(abInsideInterval);
+    else
+        fseek(hFileID,iTimestampsStart + 8*iNumSpikesBefore,'bof');
+        afTimestamps = fread(hFileID,iNumSpikes,'double=>double');
+    end
+
+    a2fWaveforms = [];
+    if strctOpt.m_bWaveforms
+        if iCount == 0
+            a2fWaveforms = zeros(0,iWaveFormLength);
+        else
+            % Rows iFirst.. of the column major NumSpikes x WaveFormLength matrix
+            fseek(hFileID,iWaveformsStart + iSampleSize*(iNumSpikesBefore*iWaveFormLength + iFirst),'bof');
+            afValues = fread(hFileID,iCount*iWaveFormLength,sprintf('%d*%s=>double',iCount,strPrecision),iSampleSize*(iNumSpikes-iCount));
+            a2fWaveforms = reshape(afValues,iCount,iWaveFormLength);
+            if iWaveFormClass == 1
+                a2fWaveforms = a2fWaveforms * fWaveFormScale;
+            end
+        end
+    end
+    astrctUnits(iIter).m_iUnitIndex = aiUnitIndices(k);
+    astrctUnits(iIter).m_afTimestamps = afTimestamps;
+    astrctUnits(iIter).m_a2fWaveforms = a2fWaveforms;
+    astrctUnits(iIter).m_afInterval = a2fIntervals(k,:);
+end
+
+return;
@@ -1,4 +1,9 @@
 function strctStrobe = fnReadDumpStrobeFile(strInputFile, varargin)
+[strStoreFile, strMember] = fnSessionStoreMember(strInputFile);
+if ~isempty(strStoreFile)
+    strctStrobe = fnSessionStore('Strobe', strStoreFile, strMember);
+    return;
+end
 hFileID = fopen(strInputFile,'rb+');
 strHeader = fread(hFileID, 13,'char=>char'); % Identifier...
 strKofiko_v100_file = 'KOFIKO_v1.00E';
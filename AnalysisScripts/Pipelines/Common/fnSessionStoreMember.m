@@ -0,0 +1,20 @@
+function [strStoreFile, strMember] = fnSessionStoreMember(strRawFile)
+% Raw files that were packed with fnSessionStore('Pack', ...) live in <Session>.kst as the
+% member <Name> (for <Session>-<Name>.raw). Returns empty strings if the raw file itself
+% exists, or if no session store next to it holds it.
+strStoreFile = '';
+strMember = '';
+if exist(strRawFile,'file') || exist('fnSessionStore','file') ~= 3
+    return;
+end
+[strPath, strName] = fileparts(strRawFile);
+aiDash = find(strName == '-');
+for k=1:length(aiDash)
+    strCandidate = fullfile(strPath, [strName(1:aiDash(k)-1),'.kst']);
+    if exist(strCandidate,'file')
+        strStoreFile = strCandidate;
+        strMember = strName(aiDash(k)+1:end);
+        return;
+    end
+end
+return;
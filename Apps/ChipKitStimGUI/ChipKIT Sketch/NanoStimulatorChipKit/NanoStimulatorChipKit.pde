@@ -5,6 +5,8 @@
 #include <LiquidCrystal.h>
 #include <stdio.h>
 #include "AnyROM.h"
+#include <StimProtocol.h>
+#include <StimTrain.h>
 
 #define DEBUG_LCD 0
 #define DEBUG_SERIAL 0
@@ -132,192 +134,31 @@ String Microns_To_String(long usec) {
 }
 
 
-		class stim_train {
+		// The train parameters and the state machine are in StimTrain.h (StimProtocol library), so
+		// that extras/StimTrainBench.cpp can replay trigger sequences through the same code
+		class stim_train : public StimTrain {
 		public:
-			stim_train();
-
-			// train parameters
-			long TriggerDelay_Microns;
-			int SecondPulse;
-			float Pulse_Freq_Hz;
-			long Pulse_Width_Microns;
-			long Train_Length_Microns; 
-			float Train_Freq_Hz;
-			long NumTrains_Per_Trigger;
-			long Second_Pulse_Width_Microns;
-			long Second_Pulse_Delay_Microns;
-			float Amplitude;
-
-			// internally used variables
-			byte Software_Trig;
-			byte Hardware_Trig;
-			int prev_trigger_value;
-			long  TurnOff_TS;
-			long NumTriggers;
-			int State;
-			long SecondPulse_TS;
-			long Pulse_Start_TS;
-			long Train_Start_TS;
-			int Active;
-
-			long NumTrains;
 			byte OutputPin;
 			byte TriggerPin;
 			int ID;  
 
-			int curr_trig_value, prev_trig_value;
 			void  non_block_loop();
-
 		};
 
 		stim_train FSM[2];  
 
-		stim_train::stim_train() {
-			SecondPulse = 1;
-			Pulse_Freq_Hz = 300;
-			Pulse_Width_Microns = 250;
-			Train_Length_Microns = 1000000;
-			Train_Freq_Hz = 1;
-			NumTrains_Per_Trigger = 1;
-			Second_Pulse_Width_Microns = 250;
-			Second_Pulse_Delay_Microns = 150;
-			TriggerDelay_Microns = 0;
-			Amplitude = 1;
-			Active = 1;
-			Hardware_Trig = 0;
-			Software_Trig= 0;
-			prev_trigger_value = 0;
-			TurnOff_TS = 0;
-			NumTriggers =0;
-			State = 0;
-			Pulse_Start_TS =0;
-			Train_Start_TS =0;
-			SecondPulse_TS = 0;
-			NumTrains = 0;
-			curr_trig_value = 0;
-			prev_trig_value = 0;
-
-		}
+		// StimTrain::Step talks to the pins through this
+		struct BoardIO {
+			byte OutputPin;
+			byte TriggerPin;
+			uint32_t Micros() { return micros(); }
+			int ReadTrigger() { return digitalRead(TriggerPin); }
+			void WriteOutput(int iHigh) { digitalWrite(OutputPin, iHigh ? HIGH : LOW); }
+		};
 
 		void stim_train::non_block_loop() {
-			long t;
-			byte Continuous;
-
-			curr_trig_value = digitalRead(TriggerPin);
-			if (curr_trig_value == 1 && prev_trig_value == 0) {
-				Hardware_Trig = 1;
-			}
-			prev_trig_value = curr_trig_value;
-
-			if ( (State == 0) && (Software_Trig || Hardware_Trig)) {  
-				Software_Trig = 0;
-				Hardware_Trig = 0;
-
-				if (State == 0) {
-					State = 1;
-					//Serial.println(String("Trigged ")+String(ID));                    
-				}  
-			}
-
-			t=micros();
-
-			if (State == 1) {
-				NumTriggers++;
-				NumTrains = NumTrains_Per_Trigger;
-				Train_Start_TS = micros();
-				if (TriggerDelay_Microns == 0)
-					State = 4;
-				else
-					State = 2;
-			}
-
-			if (State == 2) {
-				if (t-Train_Start_TS > TriggerDelay_Microns) {
-					Train_Start_TS = micros();        
-					State = 4;
-				}
-			}
-
-			if (State == 4) { // Start pulse
-				if (NumTrains_Per_Trigger == 0) {
-					if (digitalRead(TriggerPin)) {
-
-						digitalWrite(OutputPin, HIGH);
-						Pulse_Start_TS = micros();
-						State = 5;
-					} else {
-						State = 0;
-					}
-				} else  if (( (t-Train_Start_TS) < Train_Length_Microns)) {
-					digitalWrite(OutputPin, HIGH);
-					Pulse_Start_TS = micros();
-					State = 5;
-				} else {
-					// wait inter-train interval
-					if (NumTrains > 1)
-						State = 8;
-					else
-						State = 0;
-				}
-
-			}
-
-			if (State == 5) { // wait for pulse to finish
-				if (t-Pulse_Start_TS > Pulse_Width_Microns) {
-					digitalWrite(OutputPin, LOW);
-					State = 6;
-				}
-			}
-
-			if (State == 6) {
-				// do we have bi-polar pulses?
-				if (SecondPulse > 0) {
-					SecondPulse_TS=micros();
-					State = 9;
-				} else {
-					State = 7;
-				}
-			}       
-
-			if (State == 7) {
-				// wait inter-pulse interval
-				if ( (t-Pulse_Start_TS > 1.0/Pulse_Freq_Hz*1000000) || (1.0/Pulse_Freq_Hz*1000000 > 1.0/Train_Freq_Hz*1000000)) {
-					State = 4; 
-				} 
-			}      
-
-			if (State == 8) {        // wait inter-train interval
-				if (t-Train_Start_TS > 1.0/Train_Freq_Hz*1000000) {
-					if (NumTrains == -1) {
-						State = 4;
-						Train_Start_TS = micros();
-					} else if (NumTrains == 1) {
-						State = 0;
-					} else {
-						State = 4;
-						Train_Start_TS = micros();
-						NumTrains--;
-					}
-				}
-			}
-
-			if (State == 9) { 
-				if (t-SecondPulse_TS > Second_Pulse_Delay_Microns) {
-					digitalWrite(OutputPin, HIGH);          
-					SecondPulse_TS = micros();
-					State = 10;
-				}
-			}
-
-			if (State == 10) { // wait until second pulse is done.
-				if (t-SecondPulse_TS > Second_Pulse_Width_Microns) {
-					digitalWrite(OutputPin, LOW);          
-					State = 7;
-				}
-
-			}
-
-
+			BoardIO Io = { OutputPin, TriggerPin };
+			Step(Io);
 		}
 
 
@@ -846,6 +687,51 @@ String Microns_To_String(long usec) {
 			}  
 		}
 
+		void fnHandleSerialText(char inByte);
+
+		// Binary commands (StimProtocol library) see the trains through this
+		class NanoStimDevice : public StimDevice {
+		public:
+			int NumChannels() { return NUM_CHANNELS; }
+			void GetTrain(int ch, StimTrainParams &P) {
+				P.TriggerDelay_Microns = FSM[ch].TriggerDelay_Microns;
+				P.SecondPulse = FSM[ch].SecondPulse;
+				P.Pulse_Freq_Hz = FSM[ch].Pulse_Freq_Hz;
+				P.Pulse_Width_Microns = FSM[ch].Pulse_Width_Microns;
+				P.Train_Length_Microns = FSM[ch].Train_Length_Microns;
+				P.Train_Freq_Hz = FSM[ch].Train_Freq_Hz;
+				P.NumTrains_Per_Trigger = FSM[ch].NumTrains_Per_Trigger;
+				P.Second_Pulse_Width_Microns = FSM[ch].Second_Pulse_Width_Microns;
+				P.Second_Pulse_Delay_Microns = FSM[ch].Second_Pulse_Delay_Microns;
+				P.Amplitude = FSM[ch].Amplitude;
+				P.Active = FSM[ch].Active;
+			}
+			void SetTrain(int ch, const StimTrainParams &P) {
+				FSM[ch].TriggerDelay_Microns = P.TriggerDelay_Microns;
+				FSM[ch].SecondPulse = P.SecondPulse;
+				FSM[ch].Pulse_Freq_Hz = P.Pulse_Freq_Hz;
+				FSM[ch].Pulse_Width_Microns = P.Pulse_Width_Microns;
+				FSM[ch].Train_Length_Microns = P.Train_Length_Microns;
+				FSM[ch].Train_Freq_Hz = P.Train_Freq_Hz;
+				FSM[ch].NumTrains_Per_Trigger = P.NumTrains_Per_Trigger;
+				FSM[ch].Second_Pulse_Width_Microns = P.Second_Pulse_Width_Microns;
+				FSM[ch].Second_Pulse_Delay_Microns = P.Second_Pulse_Delay_Microns;
+				FSM[ch].Amplitude = P.Amplitude;
+				FSM[ch].Active = P.Active;
+				// just to be safe, turn off and restart machine
+				digitalWrite(FSM[ch].OutputPin, LOW);
+				FSM[ch].State = 0;
+			}
+			void SoftTrigger(int ch) { FSM[ch].Software_Trig = 1; }
+			uint32_t TriggerCount(int ch) { return FSM[ch].NumTriggers; }
+			bool Idle(int ch) { return FSM[ch].State == 0; }
+			void WriteBytes(const unsigned char *pData, int iBytes) { Serial.write((const uint8_t *)pData, iBytes); }
+			void TextByte(unsigned char c) { fnHandleSerialText(c); }
+		};
+
+		NanoStimDevice StimDeviceFSM;
+		StimProtocol BinaryProtocol(StimDeviceFSM);
+
 		void TriggerFS0() {
 			FSM[0].Hardware_Trig = 1;
 		}
@@ -1337,34 +1223,43 @@ String Microns_To_String(long usec) {
 		
 
 
-		void fnHandleSerialCommunication() {
-			if (Serial.available() > 0) {
-				// get incoming byte:
-				char inByte = Serial.read();
-				if (inByte == 10) {  // new line
-					packetBuffer[buffer_index] = 0;
-					//Serial.println(String("Command Recved ") + String(packetBuffer));
-					buffer_index = 0;
-
-					byte successful = apply_command();
-					// send a reply, to the IP address and port that sent us the packet we received
-					if (successful)
-						Serial.println(String("OK! ")+String(packetBuffer));   
-					else
-						Serial.println(String("NOK ")+String(packetBuffer));   
+		// ASCII commands, one byte at a time
+		void fnHandleSerialText(char inByte) {
+			if (inByte == 10) {  // new line
+				packetBuffer[buffer_index] = 0;
+				//Serial.println(String("Command Recved ") + String(packetBuffer));
+				buffer_index = 0;
 
+				byte successful = apply_command();
+				// send a reply, to the IP address and port that sent us the packet we received
+				if (successful)
+					Serial.println(String("OK! ")+String(packetBuffer));   
+				else
+					Serial.println(String("NOK ")+String(packetBuffer));   
 
-				} else {
-					packetBuffer[buffer_index++] = inByte;
-					if (buffer_index >= MAX_BUFFER-1) {
-						buffer_index = MAX_BUFFER-1;
-					}
 
+			} else {
+				packetBuffer[buffer_index++] = inByte;
+				if (buffer_index >= MAX_BUFFER-1) {
+					buffer_index = MAX_BUFFER-1;
 				}
 
 			}
 		}
 
+		void fnHandleSerialCommunication() {
+			if (Serial.available() > 0) {
+				// get incoming byte:
+				char inByte = Serial.read();
+				// binary frames start with 0xA5 0x5A, never in the middle of an ASCII command
+				if (buffer_index > 0 && !BinaryProtocol.Busy())
+					fnHandleSerialText(inByte);
+				else
+					BinaryProtocol.Feed(inByte, millis());
+			} else
+				BinaryProtocol.Poll(millis());
+		}
+
 
 
 
@@ -1445,6 +1340,7 @@ void setup() {
 
 			if (t_ms-t_noncritical >= 100) {
 				check_key_press();
+				BinaryProtocol.ReportTriggers();
 				t_noncritical=t_ms;
 				if (USE_TCP)
 				{
@@ -0,0 +1,330 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#include "StimProtocol.h"
+
+unsigned short StimCrc16(const unsigned char *pData, int iBytes, unsigned short iCrc)
+{
+	for (int k = 0; k < iBytes; k++) {
+		iCrc ^= (unsigned short)(pData[k] << 8);
+		for (int iBit = 0; iBit < 8; iBit++)
+			iCrc = (iCrc & 0x8000) ? (unsigned short)((iCrc << 1) ^ 0x1021) : (unsigned short)(iCrc << 1);
+	}
+	return iCrc;
+}
+
+static void PutInt(unsigned char *&p, int32_t iValue)
+{
+	uint32_t u = (uint32_t)iValue;
+	for (int k = 0; k < 4; k++)
+		*p++ = (unsigned char)(u >> (8 * k));
+}
+
+static void PutFloat(unsigned char *&p, float fValue)
+{
+	int32_t i;
+	memcpy(&i, &fValue, 4);
+	PutInt(p, i);
+}
+
+static int32_t GetInt(const unsigned char *&p)
+{
+	uint32_t u = 0;
+	for (int k = 0; k < 4; k++)
+		u |= (uint32_t)(*p++) << (8 * k);
+	return (int32_t)u;
+}
+
+static float GetFloat(const unsigned char *&p)
+{
+	int32_t i = GetInt(p);
+	float f;
+	memcpy(&f, &i, 4);
+	return f;
+}
+
+void StimEncodeTrain(int iChannel, const StimTrainParams &Params, unsigned char *pBlock)
+{
+	*pBlock++ = (unsigned char)iChannel;
+	*pBlock++ = (unsigned char)((Params.Active > 0 ? STIM_FLAG_ACTIVE : 0) | (Params.SecondPulse > 0 ? STIM_FLAG_SECOND_PULSE : 0));
+	PutFloat(pBlock, Params.Pulse_Freq_Hz);
+	PutInt(pBlock, Params.Pulse_Width_Microns);
+	PutInt(pBlock, Params.Train_Length_Microns);
+	PutFloat(pBlock, Params.Train_Freq_Hz);
+	PutInt(pBlock, Params.NumTrains_Per_Trigger);
+	PutInt(pBlock, Params.Second_Pulse_Width_Microns);
+	PutInt(pBlock, Params.Second_Pulse_Delay_Microns);
+	PutInt(pBlock, Params.TriggerDelay_Microns);
+	PutFloat(pBlock, Params.Amplitude);
+}
+
+void StimDecodeTrain(const unsigned char *pBlock, int &iChannel, StimTrainParams &Params)
+{
+	iChannel = *pBlock++;
+	unsigned char iFlags = *pBlock++;
+	Params.Active = (iFlags & STIM_FLAG_ACTIVE) ? 1 : 0;
+	Params.SecondPulse = (iFlags & STIM_FLAG_SECOND_PULSE) ? 1 : 0;
+	Params.Pulse_Freq_Hz = GetFloat(pBlock);
+	Params.Pulse_Width_Microns = GetInt(pBlock);
+	Params.Train_Length_Microns = GetInt(pBlock);
+	Params.Train_Freq_Hz = GetFloat(pBlock);
+	Params.NumTrains_Per_Trigger = GetInt(pBlock);
+	Params.Second_Pulse_Width_Microns = GetInt(pBlock);
+	Params.Second_Pulse_Delay_Microns = GetInt(pBlock);
+	Params.TriggerDelay_Microns = GetInt(pBlock);
+	Params.Amplitude = GetFloat(pBlock);
+}
+
+static bool ClampFreq(float &fHz)
+{
+	if (fHz >= STIM_MIN_FREQ_HZ && fHz <= STIM_MAX_FREQ_HZ)
+		return true;
+	fHz = fHz > STIM_MAX_FREQ_HZ ? STIM_MAX_FREQ_HZ : STIM_MIN_FREQ_HZ;	// NaN too
+	return false;
+}
+
+static bool ClampMin(int32_t &iValue, int32_t iMin)
+{
+	if (iValue >= iMin)
+		return true;
+	iValue = iMin;
+	return false;
+}
+
+bool StimClampTrain(StimTrainParams &Params)
+{
+	// non_block_loop divides by the frequencies, and treats negative durations as huge ones
+	bool bOK = ClampFreq(Params.Pulse_Freq_Hz);
+	bOK = ClampFreq(Params.Train_Freq_Hz) && bOK;
+	bOK = ClampMin(Params.Pulse_Width_Microns, 1) && bOK;
+	bOK = ClampMin(Params.Train_Length_Microns, 0) && bOK;
+	bOK = ClampMin(Params.NumTrains_Per_Trigger, -1) && bOK;
+	bOK = ClampMin(Params.Second_Pulse_Width_Microns, 0) && bOK;
+	bOK = ClampMin(Params.Second_Pulse_Delay_Microns, 0) && bOK;
+	bOK = ClampMin(Params.TriggerDelay_Microns, 0) && bOK;
+	if (!(Params.Amplitude > -1e30f && Params.Amplitude < 1e30f)) {
+		Params.Amplitude = 0;
+		bOK = false;
+	}
+	return bOK;
+}
+
+StimProtocol::StimProtocol(StimDevice &Device) : m_Device(Device), m_iState(STATE_IDLE), m_iReceived(0), m_iExpected(0),
+	m_iLastByteMs(0), m_bBinaryHost(false), m_iEventSeq(0), m_iNumFrames(0), m_iNumErrors(0)
+{
+	for (int k = 0; k < STIM_MAX_CHANNELS; k++)
+		m_aiReported[k] = 0;
+}
+
+void StimProtocol::Feed(unsigned char c, unsigned long iNowMs)
+{
+	Poll(iNowMs);
+	m_iLastByteMs = iNowMs;
+	switch (Advance(c)) {
+	case BYTE_TEXT:
+		m_Device.TextByte(c);
+		break;
+	case BYTE_BAD_FRAME:
+		Resync();
+		break;
+	}
+}
+
+void StimProtocol::Poll(unsigned long iNowMs)
+{
+	// what the replay leaves behind is just as stale
+	while (m_iState != STATE_IDLE && iNowMs - m_iLastByteMs > STIM_FRAME_GAP_MS) {
+		m_iNumErrors++;
+		Resync();
+	}
+}
+
+// Takes one more byte into m_aFrame; BYTE_BAD_FRAME once the bytes there cannot be a frame
+int StimProtocol::Advance(unsigned char c)
+{
+	if (m_iState == STATE_IDLE) {
+		if (c != STIM_SYNC0)
+			return BYTE_TEXT;
+		m_iState = STATE_SYNC1;
+		m_iReceived = 0;
+	}
+	m_aFrame[m_iReceived++] = c;
+	switch (m_iState) {
+	case STATE_SYNC1:
+		if (m_iReceived == 2) {
+			if (c != STIM_SYNC1)
+				return BYTE_BAD_FRAME;
+			m_iState = STATE_HEADER;
+		}
+		return BYTE_FRAME;
+	case STATE_HEADER:
+		if (m_iReceived == 6) {
+			int iLength = m_aFrame[4] | (m_aFrame[5] << 8);
+			if (iLength > STIM_MAX_PAYLOAD) {
+				m_iNumErrors++;
+				return BYTE_BAD_FRAME;
+			}
+			m_iExpected = 6 + iLength + 2;
+			m_iState = STATE_BODY;
+		}
+		return BYTE_FRAME;
+	default:
+		if (m_iReceived == m_iExpected) {
+			unsigned short iCrc = m_aFrame[m_iExpected - 2] | (m_aFrame[m_iExpected - 1] << 8);
+			if (StimCrc16(m_aFrame + 2, m_iExpected - 4) != iCrc) {
+				m_iNumErrors++;
+				return BYTE_BAD_FRAME;
+			}
+			m_iState = STATE_IDLE;
+			Handle();
+		}
+		return BYTE_FRAME;
+	}
+}
+
+// The bytes in m_aFrame are not a frame: the first one is text, the others are parsed again. Advance
+// writes m_aFrame behind where the replay reads, so it all happens in place.
+void StimProtocol::Resync()
+{
+	bool bBad = true;
+	while (bBad) {
+		int iCount = m_iReceived;
+		bBad = false;
+		m_iState = STATE_IDLE;
+		m_iReceived = 0;
+		m_Device.TextByte(m_aFrame[0]);
+		for (int k = 1; k < iCount && !bBad; k++) {
+			unsigned char c = m_aFrame[k];
+			switch (Advance(c)) {
+			case BYTE_TEXT:
+				m_Device.TextByte(c);
+				break;
+			case BYTE_BAD_FRAME:
+				// start over from the second byte of this candidate, the rest of the replay after it
+				for (int j = k + 1; j < iCount; j++)
+					m_aFrame[m_iReceived++] = m_aFrame[j];
+				bBad = true;
+				break;
+			}
+		}
+	}
+}
+
+void StimProtocol::Handle()
+{
+	unsigned char iType = m_aFrame[2], iSeq = m_aFrame[3];
+	const unsigned char *pPayload = m_aFrame + 6;
+	int iLength = m_iExpected - 8;
+	int iNumChannels = m_Device.NumChannels();
+	int iReply = 1;
+	unsigned char iStatus = STIM_STATUS_OK;
+	m_iNumFrames++;
+	if (iType & 0x80)
+		return;		// events only go the other way
+	m_bBinaryHost = true;
+
+	switch (iType) {
+	case STIM_CMD_SET_TRAINS:
+		if (iLength == 0 || iLength % STIM_TRAIN_BYTES != 0) {
+			iStatus = STIM_STATUS_BAD_LENGTH;
+			break;
+		}
+		for (int iBlock = 0; iBlock < iLength / STIM_TRAIN_BYTES; iBlock++) {
+			const unsigned char *pBlock = pPayload + iBlock * STIM_TRAIN_BYTES;
+			int iChannel;
+			StimTrainParams Params;
+			StimDecodeTrain(pBlock, iChannel, Params);
+			if (iChannel >= iNumChannels) {
+				iStatus = STIM_STATUS_BAD_CHANNEL;
+				memcpy(m_aReply + iReply, pBlock, STIM_TRAIN_BYTES);
+			} else {
+				if (!StimClampTrain(Params) && iStatus == STIM_STATUS_OK)
+					iStatus = STIM_STATUS_CLAMPED;
+				m_Device.SetTrain(iChannel, Params);
+				m_Device.GetTrain(iChannel, Params);
+				StimEncodeTrain(iChannel, Params, m_aReply + iReply);
+			}
+			iReply += STIM_TRAIN_BYTES;
+		}
+		break;
+	case STIM_CMD_GET_TRAINS: {
+		int iCount = iLength == 0 ? iNumChannels : iLength;
+		if (1 + iCount * STIM_TRAIN_BYTES > int(sizeof(m_aReply))) {
+			iStatus = STIM_STATUS_BAD_LENGTH;
+			break;
+		}
+		for (int k = 0; k < iCount; k++) {
+			int iChannel = iLength == 0 ? k : pPayload[k];
+			if (iChannel >= iNumChannels) {
+				iStatus = STIM_STATUS_BAD_CHANNEL;
+				iReply = 1;
+				break;
+			}
+			StimTrainParams Params;
+			m_Device.GetTrain(iChannel, Params);
+			StimEncodeTrain(iChannel, Params, m_aReply + iReply);
+			iReply += STIM_TRAIN_BYTES;
+		}
+		break;
+	}
+	case STIM_CMD_SOFT_TRIGGER:
+		if (iLength == 0) {
+			iStatus = STIM_STATUS_BAD_LENGTH;
+			break;
+		}
+		for (int k = 0; k < iLength; k++)
+			if (pPayload[k] >= iNumChannels)
+				iStatus = STIM_STATUS_BAD_CHANNEL;
+		if (iStatus == STIM_STATUS_OK)
+			for (int k = 0; k < iLength; k++)
+				m_Device.SoftTrigger(pPayload[k]);
+		break;
+	case STIM_CMD_GET_TRIGGERS:
+		for (int iChannel = 0; iChannel < iNumChannels && iChannel < STIM_MAX_CHANNELS; iChannel++) {
+			unsigned char *p = m_aReply + iReply;
+			PutInt(p, (int32_t)m_Device.TriggerCount(iChannel));
+			iReply += 4;
+		}
+		break;
+	case STIM_CMD_PING:
+		m_aReply[iReply++] = STIM_PROTOCOL_VERSION;
+		m_aReply[iReply++] = (unsigned char)iNumChannels;
+		break;
+	default:
+		iStatus = STIM_STATUS_UNKNOWN_COMMAND;
+		break;
+	}
+	m_aReply[0] = iStatus;
+	Reply(iType, iSeq, m_aReply, iReply);
+}
+
+void StimProtocol::Reply(unsigned char iType, unsigned char iSeq, const unsigned char *pPayload, int iBytes)
+{
+	unsigned char aHeader[6] = {STIM_SYNC0, STIM_SYNC1, iType, iSeq, (unsigned char)(iBytes & 0xFF), (unsigned char)(iBytes >> 8)};
+	unsigned short iCrc = StimCrc16(pPayload, iBytes, StimCrc16(aHeader + 2, 4));
+	unsigned char aCrc[2] = {(unsigned char)(iCrc & 0xFF), (unsigned char)(iCrc >> 8)};
+	m_Device.WriteBytes(aHeader, 6);
+	m_Device.WriteBytes(pPayload, iBytes);
+	m_Device.WriteBytes(aCrc, 2);
+}
+
+void StimProtocol::ReportTriggers()
+{
+	if (!m_bBinaryHost)
+		return;
+	for (int iChannel = 0; iChannel < m_Device.NumChannels() && iChannel < STIM_MAX_CHANNELS; iChannel++) {
+		uint32_t iCount = m_Device.TriggerCount(iChannel);
+		if (iCount == m_aiReported[iChannel] || !m_Device.Idle(iChannel))
+			continue;
+		unsigned char aEvent[5];
+		unsigned char *p = aEvent + 1;
+		aEvent[0] = (unsigned char)iChannel;
+		PutInt(p, (int32_t)iCount);
+		Reply(STIM_EVENT_TRIGGER, ++m_iEventSeq, aEvent, 5);
+		m_aiReported[iChannel] = iCount;
+	}
+}
@@ -0,0 +1,138 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef STIM_PROTOCOL_H
+#define STIM_PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+ Binary command protocol of the NanoStimulator, next to the ASCII one. Plain C++ without the Arduino
+ core, the heap or the STL: the sketch uses it as a library (copy this folder next to chipKITEthernet
+ in the libraries folder), the host compiles it for the loopback device of fndllSerialInterface and
+ for extras/StimProtocolFuzz.cpp.
+
+ Frames are the ones of MEX_Code/SerialInterface/SerialFrame.h: 0xA5 0x5A, type, seq, payload length
+ (uint16), payload, CRC-16/CCITT; everything little endian. The device answers every command with a
+ frame of the same type and seq, whose payload starts with a status byte (STIM_STATUS_*).
+
+ A train block (STIM_TRAIN_BYTES) carries the whole parameter set of one channel (StimTrain.h):
+	uint8 channel, uint8 flags (STIM_FLAG_*), float32 pulse freq (Hz), int32 pulse width (us),
+	int32 train length (us), float32 train freq (Hz), int32 trains per trigger, int32 second pulse
+	width (us), int32 second pulse delay (us), int32 trigger delay (us), float32 amplitude
+
+ Commands:
+	STIM_CMD_SET_TRAINS		payload: train blocks. Applies every block, answers with the blocks as
+							applied (values out of range are clamped: STIM_STATUS_CLAMPED)
+	STIM_CMD_GET_TRAINS		payload: channel numbers, none for all. Answers with their train blocks
+	STIM_CMD_SOFT_TRIGGER	payload: channel numbers
+	STIM_CMD_GET_TRIGGERS	answers with uint32 trigger counts, one per channel
+	STIM_CMD_PING			answers with the protocol version and the number of channels (uint8 each)
+ Once the host has sent a good frame, the device also reports the trigger count of a channel whenever
+ a train is over (STIM_EVENT_TRIGGER: uint8 channel, uint32 count), so that the serial writes never
+ fall in the middle of a train.
+
+ A frame that stops for more than STIM_FRAME_GAP_MS, or turns out to have a bad length or CRC, is
+ dropped: its first sync byte goes to the ASCII parser (StimDevice::TextByte) and the bytes after it
+ are parsed again, so that neither a stray 0xA5 in an ASCII command nor a torn frame eats what follows.
+*/
+
+const unsigned char STIM_SYNC0 = 0xA5;
+const unsigned char STIM_SYNC1 = 0x5A;
+const unsigned char STIM_PROTOCOL_VERSION = 1;
+const int STIM_MAX_PAYLOAD = 256;
+const int STIM_MAX_CHANNELS = 8;
+const int STIM_TRAIN_BYTES = 38;
+const unsigned long STIM_FRAME_GAP_MS = 50;	// the host writes a frame at once
+
+const unsigned char STIM_CMD_SOFT_TRIGGER = 11;
+const unsigned char STIM_CMD_PING = 18;
+const unsigned char STIM_CMD_GET_TRIGGERS = 21;
+const unsigned char STIM_CMD_SET_TRAINS = 32;
+const unsigned char STIM_CMD_GET_TRAINS = 33;
+const unsigned char STIM_EVENT_TRIGGER = 0x81;
+
+const unsigned char STIM_STATUS_OK = 0;
+const unsigned char STIM_STATUS_CLAMPED = 1;
+const unsigned char STIM_STATUS_BAD_CHANNEL = 2;
+const unsigned char STIM_STATUS_BAD_LENGTH = 3;
+const unsigned char STIM_STATUS_UNKNOWN_COMMAND = 4;
+
+const unsigned char STIM_FLAG_ACTIVE = 1;
+const unsigned char STIM_FLAG_SECOND_PULSE = 2;
+
+const float STIM_MIN_FREQ_HZ = 0.001f;
+const float STIM_MAX_FREQ_HZ = 100000.0f;
+
+typedef struct {
+	int32_t TriggerDelay_Microns;
+	int32_t SecondPulse;
+	float Pulse_Freq_Hz;
+	int32_t Pulse_Width_Microns;
+	int32_t Train_Length_Microns;
+	float Train_Freq_Hz;
+	int32_t NumTrains_Per_Trigger;	// 0: pulses while the trigger line is high
+	int32_t Second_Pulse_Width_Microns;
+	int32_t Second_Pulse_Delay_Microns;
+	float Amplitude;
+	int32_t Active;
+} StimTrainParams;
+
+// What the protocol needs from the stimulator
+class StimDevice {
+public:
+	virtual ~StimDevice() {}
+	virtual int NumChannels() = 0;
+	virtual void GetTrain(int iChannel, StimTrainParams &Params) = 0;
+	virtual void SetTrain(int iChannel, const StimTrainParams &Params) = 0;	// also stops the channel
+	virtual void SoftTrigger(int iChannel) = 0;
+	virtual uint32_t TriggerCount(int iChannel) = 0;
+	virtual bool Idle(int iChannel) = 0;		// no train going on
+	virtual void WriteBytes(const unsigned char *pData, int iBytes) = 0;
+	virtual void TextByte(unsigned char c) = 0;	// not part of a frame: for the ASCII parser
+};
+
+unsigned short StimCrc16(const unsigned char *pData, int iBytes, unsigned short iCrc = 0xFFFF);
+void StimEncodeTrain(int iChannel, const StimTrainParams &Params, unsigned char *pBlock);
+void StimDecodeTrain(const unsigned char *pBlock, int &iChannel, StimTrainParams &Params);
+bool StimClampTrain(StimTrainParams &Params);	// false if something had to change
+
+class StimProtocol {
+public:
+	StimProtocol(StimDevice &Device);
+	// Bytes from the host, one at a time, with millis(). The ones that are not part of a frame go to
+	// StimDevice::TextByte, in order.
+	void Feed(unsigned char c, unsigned long iNowMs);
+	// Drops a frame that stopped coming; call when no byte came in
+	void Poll(unsigned long iNowMs);
+	bool Busy() const { return m_iState != STATE_IDLE; }
+	// Call when nothing time critical runs: reports the trigger counts that changed
+	void ReportTriggers();
+	long NumFrames() const { return m_iNumFrames; }
+	long NumErrors() const { return m_iNumErrors; }
+private:
+	enum { STATE_IDLE, STATE_SYNC1, STATE_HEADER, STATE_BODY };
+	enum { BYTE_TEXT, BYTE_FRAME, BYTE_BAD_FRAME };
+	int Advance(unsigned char c);
+	void Resync();
+	void Handle();
+	void Reply(unsigned char iType, unsigned char iSeq, const unsigned char *pPayload, int iBytes);
+
+	StimDevice &m_Device;
+	int m_iState;
+	int m_iReceived;	// bytes of the frame, sync bytes included
+	int m_iExpected;
+	unsigned long m_iLastByteMs;
+	unsigned char m_aFrame[2 + 4 + STIM_MAX_PAYLOAD + 2];
+	unsigned char m_aReply[1 + STIM_MAX_PAYLOAD];
+	bool m_bBinaryHost;
+	uint32_t m_aiReported[STIM_MAX_CHANNELS];
+	unsigned char m_iEventSeq;
+	long m_iNumFrames;
+	long m_iNumErrors;
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef STIM_SIMULATED_H
+#define STIM_SIMULATED_H
+
+#include <vector>
+#include "StimProtocol.h"
+#include "StimTrain.h"
+
+/*
+ Stimulator without hardware, for the host (uses the STL: not for the sketch). It keeps the train
+ parameters, counts soft triggers as trains that are over at once, and collects what the protocol
+ writes in m_Output and the bytes it hands to the ASCII parser in m_Text.
+*/
+
+class StimSimulatedDevice : public StimDevice {
+public:
+	StimSimulatedDevice(int iNumChannels = 2) : m_Trains(iNumChannels), m_aiTriggers(iNumChannels, 0) {
+		StimTrain Defaults;
+		for (int k = 0; k < iNumChannels; k++) {
+			StimTrainParams &P = m_Trains[k];
+			P.SecondPulse = Defaults.SecondPulse;
+			P.Pulse_Freq_Hz = Defaults.Pulse_Freq_Hz;
+			P.Pulse_Width_Microns = Defaults.Pulse_Width_Microns;
+			P.Train_Length_Microns = Defaults.Train_Length_Microns;
+			P.Train_Freq_Hz = Defaults.Train_Freq_Hz;
+			P.NumTrains_Per_Trigger = Defaults.NumTrains_Per_Trigger;
+			P.Second_Pulse_Width_Microns = Defaults.Second_Pulse_Width_Microns;
+			P.Second_Pulse_Delay_Microns = Defaults.Second_Pulse_Delay_Microns;
+			P.TriggerDelay_Microns = Defaults.TriggerDelay_Microns;
+			P.Amplitude = Defaults.Amplitude;
+			P.Active = Defaults.Active;
+		}
+	}
+	int NumChannels() { return int(m_Trains.size()); }
+	void GetTrain(int iChannel, StimTrainParams &Params) { Params = m_Trains[iChannel]; }
+	void SetTrain(int iChannel, const StimTrainParams &Params) { m_Trains[iChannel] = Params; }
+	void SoftTrigger(int iChannel) { m_aiTriggers[iChannel]++; }
+	uint32_t TriggerCount(int iChannel) { return m_aiTriggers[iChannel]; }
+	bool Idle(int) { return true; }
+	void WriteBytes(const unsigned char *pData, int iBytes) { m_Output.insert(m_Output.end(), pData, pData + iBytes); }
+	void TextByte(unsigned char c) { m_Text.push_back(c); }
+
+	std::vector<StimTrainParams> m_Trains;
+	std::vector<uint32_t> m_aiTriggers;
+	std::vector<unsigned char> m_Output;
+	std::vector<unsigned char> m_Text;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef STIM_TRAIN_H
+#define STIM_TRAIN_H
+
+#include <stdint.h>
+
+/*
+ Pulse train state machine of the NanoStimulator (was stim_train::non_block_loop in the sketch),
+ header only so that the sketch and the host simulator (extras/StimTrainBench.cpp) run the same code.
+
+ Step polls the clock, the trigger line and drives the output through IO, which provides
+	uint32_t Micros();				// micros() on the board, a virtual clock on the host
+	int ReadTrigger();				// digitalRead(TriggerPin)
+	void WriteOutput(int iHigh);	// digitalWrite(OutputPin, ...)
+ Nothing is timed by interrupts: every edge comes out at the first Step after it is due, so the
+ accuracy of a train is the period of the main loop.
+
+ Fields keep the names and the sizes (32 bit) of the sketch: presets in the EEPROM did not change.
+*/
+
+class StimTrain {
+public:
+	StimTrain() {
+		SecondPulse = 1;
+		Pulse_Freq_Hz = 300;
+		Pulse_Width_Microns = 250;
+		Train_Length_Microns = 1000000;
+		Train_Freq_Hz = 1;
+		NumTrains_Per_Trigger = 1;
+		Second_Pulse_Width_Microns = 250;
+		Second_Pulse_Delay_Microns = 150;
+		TriggerDelay_Microns = 0;
+		Amplitude = 1;
+		Active = 1;
+		Hardware_Trig = 0;
+		Software_Trig = 0;
+		prev_trigger_value = 0;
+		TurnOff_TS = 0;
+		NumTriggers = 0;
+		State = 0;
+		Pulse_Start_TS = 0;
+		Train_Start_TS = 0;
+		SecondPulse_TS = 0;
+		NumTrains = 0;
+		curr_trig_value = 0;
+		prev_trig_value = 0;
+	}
+
+	// train parameters
+	int32_t TriggerDelay_Microns;
+	int SecondPulse;
+	float Pulse_Freq_Hz;
+	int32_t Pulse_Width_Microns;
+	int32_t Train_Length_Microns;
+	float Train_Freq_Hz;
+	int32_t NumTrains_Per_Trigger;
+	int32_t Second_Pulse_Width_Microns;
+	int32_t Second_Pulse_Delay_Microns;
+	float Amplitude;
+
+	// internally used variables
+	unsigned char Software_Trig;
+	unsigned char Hardware_Trig;
+	int prev_trigger_value;
+	int32_t TurnOff_TS;
+	int32_t NumTriggers;
+	int State;
+	int32_t SecondPulse_TS;
+	int32_t Pulse_Start_TS;
+	int32_t Train_Start_TS;
+	int Active;
+	int32_t NumTrains;
+	int curr_trig_value, prev_trig_value;
+
+	template <class IO> void Step(IO &Io);
+
+private:
+	// micros() wraps around every 71 minutes: differences stay right in 32 bit
+	static int32_t Since(uint32_t t, int32_t iStamp) { return (int32_t)(t - (uint32_t)iStamp); }
+};
+
+template <class IO> void StimTrain::Step(IO &Io)
+{
+	uint32_t t;
+
+	curr_trig_value = Io.ReadTrigger();
+	if (curr_trig_value == 1 && prev_trig_value == 0) {
+		Hardware_Trig = 1;
+	}
+	prev_trig_value = curr_trig_value;
+
+	if ((State == 0) && (Software_Trig || Hardware_Trig)) {
+		Software_Trig = 0;
+		Hardware_Trig = 0;
+		State = 1;
+	}
+
+	t = Io.Micros();
+
+	if (State == 1) {
+		NumTriggers++;
+		NumTrains = NumTrains_Per_Trigger;
+		Train_Start_TS = (int32_t)Io.Micros();
+		if (TriggerDelay_Microns == 0)
+			State = 4;
+		else
+			State = 2;
+	}
+
+	if (State == 2) {
+		if (Since(t, Train_Start_TS) > TriggerDelay_Microns) {
+			Train_Start_TS = (int32_t)Io.Micros();
+			State = 4;
+		}
+	}
+
+	if (State == 4) { // Start pulse
+		if (NumTrains_Per_Trigger == 0) {
+			if (Io.ReadTrigger()) {
+				Io.WriteOutput(1);
+				Pulse_Start_TS = (int32_t)Io.Micros();
+				State = 5;
+			} else {
+				State = 0;
+			}
+		} else if (Since(t, Train_Start_TS) < Train_Length_Microns) {
+			Io.WriteOutput(1);
+			Pulse_Start_TS = (int32_t)Io.Micros();
+			State = 5;
+		} else {
+			// wait inter-train interval
+			if (NumTrains > 1)
+				State = 8;
+			else
+				State = 0;
+		}
+	}
+
+	if (State == 5) { // wait for pulse to finish
+		if (Since(t, Pulse_Start_TS) > Pulse_Width_Microns) {
+			Io.WriteOutput(0);
+			State = 6;
+		}
+	}
+
+	if (State == 6) {
+		// do we have bi-polar pulses?
+		if (SecondPulse > 0) {
+			SecondPulse_TS = (int32_t)Io.Micros();
+			State = 9;
+		} else {
+			State = 7;
+		}
+	}
+
+	if (State == 7) {
+		// wait inter-pulse interval
+		if ((Since(t, Pulse_Start_TS) > 1.0 / Pulse_Freq_Hz * 1000000) || (1.0 / Pulse_Freq_Hz * 1000000 > 1.0 / Train_Freq_Hz * 1000000)) {
+			State = 4;
+		}
+	}
+
+	if (State == 8) { // wait inter-train interval
+		if (Since(t, Train_Start_TS) > 1.0 / Train_Freq_Hz * 1000000) {
+			if (NumTrains == -1) {
+				State = 4;
+				Train_Start_TS = (int32_t)Io.Micros();
+			} else if (NumTrains == 1) {
+				State = 0;
+			} else {
+				State = 4;
+				Train_Start_TS = (int32_t)Io.Micros();
+				NumTrains--;
+			}
+		}
+	}
+
+	if (State == 9) {
+		if (Since(t, SecondPulse_TS) > Second_Pulse_Delay_Microns) {
+			Io.WriteOutput(1);
+			SecondPulse_TS = (int32_t)Io.Micros();
+			State = 10;
+		}
+	}
+
+	if (State == 10) { // wait until second pulse is done.
+		if (Since(t, SecondPulse_TS) > Second_Pulse_Width_Microns) {
+			Io.WriteOutput(0);
+			State = 7;
+		}
+	}
+}
+
+#endif
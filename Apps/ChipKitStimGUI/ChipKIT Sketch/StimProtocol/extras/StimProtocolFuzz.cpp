@@ -0,0 +1,225 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../StimProtocol.h"
+#include "../StimSimulated.h"
+
+/*
+ Host check of the NanoStimulator command parser, with the simulated device of StimSimulated.h.
+
+ The parser is fed a mix of good commands (random train blocks, channels and lengths included),
+ corrupted frames and line noise, each followed by an idle gap; after every input the device must hold
+ trains that StimClampTrain accepts as they are, everything it wrote must be well formed frames, one
+ answer per good command, and no byte of a good command may reach the ASCII parser.
+
+	g++ -O2 -fsanitize=address,undefined StimProtocolFuzz.cpp ../StimProtocol.cpp -o StimProtocolFuzz
+	./StimProtocolFuzz [iterations] [seed]
+ or with libFuzzer:
+	clang++ -DSTIM_LIBFUZZER -fsanitize=fuzzer,address StimProtocolFuzz.cpp ../StimProtocol.cpp
+*/
+
+static void Check(bool bCondition, const char *strWhat)
+{
+	if (!bCondition) {
+		fprintf(stderr, "StimProtocolFuzz: %s\n", strWhat);
+		abort();
+	}
+}
+
+// Decodes what the device wrote; returns the number of frames
+static int CheckOutput(const std::vector<unsigned char> &Output, std::vector<unsigned char> &aiTypes)
+{
+	size_t iPos = 0;
+	int iNumFrames = 0;
+	while (iPos < Output.size()) {
+		Check(iPos + 8 <= Output.size() && Output[iPos] == STIM_SYNC0 && Output[iPos + 1] == STIM_SYNC1, "output is not a frame");
+		int iLength = Output[iPos + 4] | (Output[iPos + 5] << 8);
+		Check(iLength >= 1 && iLength <= STIM_MAX_PAYLOAD + 1 && iPos + 8 + iLength <= Output.size(), "bad output length");
+		unsigned short iCrc = Output[iPos + 6 + iLength] | (Output[iPos + 7 + iLength] << 8);
+		Check(StimCrc16(&Output[iPos + 2], 4 + iLength) == iCrc, "bad output crc");
+		aiTypes.push_back(Output[iPos + 2]);
+		iPos += 8 + iLength;
+		iNumFrames++;
+	}
+	return iNumFrames;
+}
+
+static unsigned long s_iNowMs = 0;
+
+static void Run(StimProtocol &Protocol, StimSimulatedDevice &Device, const unsigned char *pData, size_t iBytes, int iExpectedReplies)
+{
+	Device.m_Output.clear();
+	Device.m_Text.clear();
+	for (size_t k = 0; k < iBytes; k++)
+		Protocol.Feed(pData[k], s_iNowMs);
+	s_iNowMs += STIM_FRAME_GAP_MS + 1;
+	Protocol.Poll(s_iNowMs);
+	Check(!Protocol.Busy() && Device.m_Text.size() <= iBytes, "the gap does not flush the input");
+	Protocol.ReportTriggers();
+	std::vector<unsigned char> aiTypes;
+	int iReplies = CheckOutput(Device.m_Output, aiTypes);
+	int iNumEvents = 0;
+	for (size_t k = 0; k < aiTypes.size(); k++)
+		iNumEvents += (aiTypes[k] == STIM_EVENT_TRIGGER);
+	if (iExpectedReplies >= 0) {
+		Check(iReplies - iNumEvents == iExpectedReplies, "one answer per command");
+		Check(Device.m_Text.empty(), "a command went to the ASCII parser");
+	}
+	for (int iChannel = 0; iChannel < Device.NumChannels(); iChannel++) {
+		StimTrainParams Params = Device.m_Trains[iChannel];
+		Check(StimClampTrain(Params), "the device holds a train out of range");
+	}
+}
+
+#ifdef STIM_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *pData, size_t iBytes)
+{
+	StimSimulatedDevice Device;
+	StimProtocol Protocol(Device);
+	Run(Protocol, Device, pData, iBytes, -1);
+	return 0;
+}
+
+#else
+
+static void AppendFrame(std::vector<unsigned char> &Out, unsigned char iType, unsigned char iSeq, const std::vector<unsigned char> &Payload)
+{
+	size_t iStart = Out.size();
+	Out.push_back(STIM_SYNC0);
+	Out.push_back(STIM_SYNC1);
+	Out.push_back(iType);
+	Out.push_back(iSeq);
+	Out.push_back((unsigned char)(Payload.size() & 0xFF));
+	Out.push_back((unsigned char)(Payload.size() >> 8));
+	Out.insert(Out.end(), Payload.begin(), Payload.end());
+	unsigned short iCrc = StimCrc16(&Out[iStart + 2], int(4 + Payload.size()));
+	Out.push_back((unsigned char)(iCrc & 0xFF));
+	Out.push_back((unsigned char)(iCrc >> 8));
+}
+
+static float RandomFloat()
+{
+	switch (rand() % 4) {
+	case 0: { uint32_t u = (uint32_t(rand()) << 16) ^ uint32_t(rand()); float f; memcpy(&f, &u, 4); return f; }
+	case 1: return -float(rand() % 1000);
+	default: return float(rand() % 100000) / 10.0f;
+	}
+}
+
+static int32_t RandomInt()
+{
+	return rand() % 3 == 0 ? int32_t((uint32_t(rand()) << 16) ^ uint32_t(rand())) : int32_t(rand() % 2000000) - 1000;
+}
+
+int main(int argc, char **argv)
+{
+	long iIterations = argc > 1 ? atol(argv[1]) : 200000;
+	srand(argc > 2 ? atoi(argv[2]) : 1);
+	StimSimulatedDevice Device;
+	StimProtocol Protocol(Device);
+	const unsigned char aiTypes[] = {STIM_CMD_SET_TRAINS, STIM_CMD_GET_TRAINS, STIM_CMD_SOFT_TRIGGER, STIM_CMD_GET_TRIGGERS, STIM_CMD_PING, 7, 0x85};
+	long iClamped = 0;
+
+	for (long iIter = 0; iIter < iIterations; iIter++) {
+		unsigned char iType = aiTypes[rand() % sizeof(aiTypes)];
+		std::vector<unsigned char> Payload;
+		if (iType == STIM_CMD_SET_TRAINS) {
+			int iBlocks = rand() % 7;
+			for (int k = 0; k < iBlocks; k++) {
+				StimTrainParams P;
+				P.Active = rand() % 2;
+				P.SecondPulse = rand() % 2;
+				P.Pulse_Freq_Hz = RandomFloat();
+				P.Train_Freq_Hz = RandomFloat();
+				P.Amplitude = RandomFloat();
+				P.Pulse_Width_Microns = RandomInt();
+				P.Train_Length_Microns = RandomInt();
+				P.NumTrains_Per_Trigger = RandomInt() % 5;
+				P.Second_Pulse_Width_Microns = RandomInt();
+				P.Second_Pulse_Delay_Microns = RandomInt();
+				P.TriggerDelay_Microns = RandomInt();
+				unsigned char aBlock[STIM_TRAIN_BYTES];
+				StimEncodeTrain(rand() % 3, P, aBlock);
+				Payload.insert(Payload.end(), aBlock, aBlock + STIM_TRAIN_BYTES);
+			}
+			if (rand() % 10 == 0 && !Payload.empty())
+				Payload.pop_back();
+		} else {
+			int iLength = rand() % 4;
+			for (int k = 0; k < iLength; k++)
+				Payload.push_back((unsigned char)(rand() % 3));
+		}
+
+		std::vector<unsigned char> Input;
+		int iExpected = (iType & 0x80) ? 0 : 1;
+		int iMode = rand() % 10;
+		if (iMode == 0) {
+			// line noise, ASCII commands included
+			int iLength = rand() % 64;
+			for (int k = 0; k < iLength; k++)
+				Input.push_back((unsigned char)(rand() % 2 ? rand() : "0123456789 .\n"[rand() % 13]));
+			iExpected = -1;
+		} else {
+			AppendFrame(Input, iType, (unsigned char)iIter, Payload);
+			if (iMode == 1) {
+				Input[2 + rand() % (Input.size() - 2)] ^= (unsigned char)(1 << (rand() % 8));
+				iExpected = -1;
+			} else if (iMode == 2) {
+				Input.resize(rand() % Input.size());	// the gap drops the truncated frame
+				iExpected = -1;
+			}
+		}
+		Run(Protocol, Device, Input.empty() ? NULL : &Input[0], Input.size(), iExpected);
+		if (iType == STIM_CMD_SET_TRAINS && iExpected == 1 && Device.m_Output.size() > 6 && Device.m_Output[6] == STIM_STATUS_CLAMPED)
+			iClamped++;
+	}
+	printf("%ld inputs, %ld frames, %ld bad frames, %ld batches clamped\n", iIterations, Protocol.NumFrames(), Protocol.NumErrors(), iClamped);
+
+	// A batch comes back as applied
+	StimTrainParams P = Device.m_Trains[0];
+	P.Pulse_Freq_Hz = -5;
+	P.Pulse_Width_Microns = 100;
+	std::vector<unsigned char> Payload(2 * STIM_TRAIN_BYTES), Input;
+	StimEncodeTrain(0, P, &Payload[0]);
+	StimEncodeTrain(1, P, &Payload[STIM_TRAIN_BYTES]);
+	std::vector<unsigned char> aiReplies;
+	AppendFrame(Input, STIM_CMD_SET_TRAINS, 1, Payload);
+	Run(Protocol, Device, &Input[0], Input.size(), 1);
+	Check(Device.m_Output[6] == STIM_STATUS_CLAMPED && Device.m_Trains[1].Pulse_Freq_Hz == STIM_MIN_FREQ_HZ && Device.m_Trains[1].Pulse_Width_Microns == 100, "batch not applied");
+	int iChannel;
+	StimTrainParams Applied;
+	StimDecodeTrain(&Device.m_Output[7 + STIM_TRAIN_BYTES], iChannel, Applied);
+	Check(iChannel == 1 && memcmp(&Applied, &Device.m_Trains[1], sizeof(Applied)) == 0, "answer is not what was applied");
+
+	// A stray sync byte does not eat an ASCII command
+	const char strLine[] = "\xA5" "12 0\xA5\n";
+	Run(Protocol, Device, (const unsigned char *)strLine, sizeof(strLine) - 1, -1);
+	Check(Device.m_Output.empty() && Device.m_Text.size() == sizeof(strLine) - 1 && memcmp(&Device.m_Text[0], strLine, sizeof(strLine) - 1) == 0, "ASCII command lost");
+
+	// A frame torn by a gap goes to the ASCII parser, the next one is answered
+	std::vector<unsigned char> Ping;
+	AppendFrame(Ping, STIM_CMD_PING, 2, std::vector<unsigned char>());
+	Run(Protocol, Device, &Ping[0], 5, -1);
+	Check(Device.m_Output.empty() && Device.m_Text.size() == 5, "torn frame not dropped");
+	Run(Protocol, Device, &Ping[0], Ping.size(), 1);
+
+	// A frame with a bad CRC is parsed again: the good one inside it is answered, the rest is text
+	Input.clear();
+	AppendFrame(Input, STIM_CMD_GET_TRIGGERS, 3, Ping);
+	Input.back() ^= 1;
+	Run(Protocol, Device, &Input[0], Input.size(), -1);
+	CheckOutput(Device.m_Output, aiReplies);
+	Check(aiReplies.size() == 1 && aiReplies[0] == STIM_CMD_PING && Device.m_Text.size() == Input.size() - Ping.size(), "no resync after a bad CRC");
+	printf("ok\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,391 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../StimTrain.h"
+
+/*
+ Replays trigger sequences through the NanoStimulator train state machine (StimTrain.h) on a virtual
+ clock, and compares the pulses with the ones of an ideal loop (one step per microsecond, nothing
+ else to do). The main loop of the sketch is modelled by what it costs: every channel step, the rest
+ of an iteration (serial parsing), and the non critical block every 100 ms (keys, LCD, TCP).
+
+	g++ -O2 StimTrainBench.cpp -o StimTrainBench
+	./StimTrainBench [options]
+	-t file			triggers, one per line: time (ms), channel (0/1), [width (ms), default 1]
+	-r rate -d sec	or random triggers, rate per second per channel, for sec seconds (default 2 Hz, 10 s)
+	-p ch:name=value,...	train parameters: pulse_hz width_us train_us train_hz ntrains second
+					width2_us delay2_us delay_us active (defaults of the sketch otherwise)
+	-c us			cost of one channel step (default 3)
+	-l us			cost of the rest of a loop iteration (default 2), -j us: plus a random part up to this
+	-s us			cost of the non critical block, every -P ms (default 1000 us every 100 ms)
+	-seed n
+ Reported per channel: triggers taken (a trigger during a train starts the next one when it is over),
+ pulses missed and extra; start of the train, onset (from the first pulse of the train), interval and
+ width of the pulses against the ideal loop; then how long both outputs were high at once.
+*/
+
+const int NUM_CHANNELS = 2;
+
+typedef struct {
+	uint64_t m_iTime;	// us
+	int m_iChannel;
+	uint64_t m_iWidth;
+} Trigger;
+
+typedef struct {
+	uint64_t m_iOn;
+	uint64_t m_iOff;
+} Pulse;
+
+// A trigger the state machine took, and the pulses of its train
+typedef struct {
+	uint64_t m_iTime;
+	int m_iTrigger;		// index in the triggers of the channel: the last edge before m_iTime
+	std::vector<Pulse> m_Pulses;
+} Train;
+
+typedef struct {
+	double m_fStepUs;
+	double m_fLoopUs;
+	double m_fLoopJitterUs;
+	double m_fSlowUs;
+	double m_fSlowPeriodUs;
+} LoopCost;
+
+class Board {
+public:
+	Board(const std::vector<Trigger> &Triggers, const StimTrain *pTrains) : m_fNow(0) {
+		for (int k = 0; k < NUM_CHANNELS; k++) {
+			m_Trains[k] = pTrains[k];
+			m_aiNext[k] = 0;
+			m_abHigh[k] = false;
+		}
+		for (size_t k = 0; k < Triggers.size(); k++)
+			m_Triggers[Triggers[k].m_iChannel].push_back(Triggers[k]);
+	}
+
+	// The sketch's loop(): both channels, serial, and the non critical block every so often
+	void Run(uint64_t iEnd, const LoopCost &Cost) {
+		double fNextSlow = Cost.m_fSlowPeriodUs;
+		while (m_fNow < iEnd) {
+			for (int k = 0; k < NUM_CHANNELS; k++) {
+				if (m_Trains[k].Active > 0) {
+					IO Io = {this, k};
+					int32_t iTaken = m_Trains[k].NumTriggers;
+					m_Trains[k].Step(Io);
+					if (m_Trains[k].NumTriggers != iTaken)
+						Take(k);
+				}
+				m_fNow += Cost.m_fStepUs;
+			}
+			m_fNow += Cost.m_fLoopUs + Cost.m_fLoopJitterUs * (rand() / (RAND_MAX + 1.0));
+			if (Cost.m_fSlowUs > 0 && m_fNow >= fNextSlow) {
+				m_fNow += Cost.m_fSlowUs;
+				fNextSlow += Cost.m_fSlowPeriodUs;
+			}
+		}
+		for (int k = 0; k < NUM_CHANNELS; k++)
+			if (m_abHigh[k])
+				m_Pulses[k].back().m_iOff = uint64_t(m_fNow);
+	}
+
+	// Each pulse goes to the last train started before it
+	std::vector<Train> Trains(int iChannel) const {
+		std::vector<Train> Trains = m_Taken[iChannel];
+		size_t iTrain = 0;
+		for (size_t k = 0; k < m_Pulses[iChannel].size(); k++) {
+			const Pulse &P = m_Pulses[iChannel][k];
+			while (iTrain + 1 < Trains.size() && Trains[iTrain + 1].m_iTime <= P.m_iOn)
+				iTrain++;
+			if (iTrain < Trains.size() && Trains[iTrain].m_iTime <= P.m_iOn)
+				Trains[iTrain].m_Pulses.push_back(P);
+		}
+		return Trains;
+	}
+
+	std::vector<Pulse> m_Pulses[NUM_CHANNELS];
+	StimTrain m_Trains[NUM_CHANNELS];
+
+private:
+	struct IO {
+		Board *m_pBoard;
+		int m_iChannel;
+		uint32_t Micros() { return uint32_t(uint64_t(m_pBoard->m_fNow)); }
+		int ReadTrigger() { return m_pBoard->TriggerLevel(m_iChannel); }
+		void WriteOutput(int iHigh) { m_pBoard->Output(m_iChannel, iHigh != 0); }
+	};
+
+	int TriggerLevel(int iChannel) {
+		std::vector<Trigger> &Triggers = m_Triggers[iChannel];
+		size_t &iNext = m_aiNext[iChannel];
+		while (iNext < Triggers.size() && Triggers[iNext].m_iTime + Triggers[iNext].m_iWidth <= m_fNow)
+			iNext++;
+		return iNext < Triggers.size() && Triggers[iNext].m_iTime <= m_fNow;
+	}
+
+	void Take(int iChannel) {
+		Train T;
+		T.m_iTime = uint64_t(m_fNow);
+		T.m_iTrigger = -1;
+		const std::vector<Trigger> &Triggers = m_Triggers[iChannel];
+		for (size_t k = 0; k < Triggers.size() && Triggers[k].m_iTime <= T.m_iTime; k++)
+			T.m_iTrigger = int(k);
+		m_Taken[iChannel].push_back(T);
+	}
+
+	void Output(int iChannel, bool bHigh) {
+		if (bHigh == m_abHigh[iChannel])
+			return;
+		m_abHigh[iChannel] = bHigh;
+		uint64_t iNow = uint64_t(m_fNow);
+		if (bHigh) {
+			Pulse P = {iNow, iNow};
+			m_Pulses[iChannel].push_back(P);
+		} else
+			m_Pulses[iChannel].back().m_iOff = iNow;
+	}
+
+	double m_fNow;
+	std::vector<Trigger> m_Triggers[NUM_CHANNELS];
+	std::vector<Train> m_Taken[NUM_CHANNELS];
+	size_t m_aiNext[NUM_CHANNELS];
+	bool m_abHigh[NUM_CHANNELS];
+};
+
+static bool SetParameter(StimTrain &Train, const std::string &strName, double fValue)
+{
+	if (strName == "pulse_hz") Train.Pulse_Freq_Hz = float(fValue);
+	else if (strName == "width_us") Train.Pulse_Width_Microns = int32_t(fValue);
+	else if (strName == "train_us") Train.Train_Length_Microns = int32_t(fValue);
+	else if (strName == "train_hz") Train.Train_Freq_Hz = float(fValue);
+	else if (strName == "ntrains") Train.NumTrains_Per_Trigger = int32_t(fValue);
+	else if (strName == "second") Train.SecondPulse = int(fValue);
+	else if (strName == "width2_us") Train.Second_Pulse_Width_Microns = int32_t(fValue);
+	else if (strName == "delay2_us") Train.Second_Pulse_Delay_Microns = int32_t(fValue);
+	else if (strName == "delay_us") Train.TriggerDelay_Microns = int32_t(fValue);
+	else if (strName == "active") Train.Active = int(fValue);
+	else return false;
+	return true;
+}
+
+static void ParseParameters(const char *strArg, StimTrain *pTrains)
+{
+	int iChannel = atoi(strArg);
+	const char *p = strchr(strArg, ':');
+	if (p == NULL || iChannel < 0 || iChannel >= NUM_CHANNELS) {
+		fprintf(stderr, "Expecting -p ch:name=value,...\n");
+		exit(1);
+	}
+	std::string strList(p + 1);
+	size_t iStart = 0;
+	while (iStart < strList.size()) {
+		size_t iEnd = strList.find(',', iStart);
+		if (iEnd == std::string::npos)
+			iEnd = strList.size();
+		std::string strItem = strList.substr(iStart, iEnd - iStart);
+		size_t iEqual = strItem.find('=');
+		if (iEqual == std::string::npos || !SetParameter(pTrains[iChannel], strItem.substr(0, iEqual), atof(strItem.c_str() + iEqual + 1))) {
+			fprintf(stderr, "Unknown train parameter %s\n", strItem.c_str());
+			exit(1);
+		}
+		iStart = iEnd + 1;
+	}
+}
+
+static std::vector<Trigger> ReadTriggers(const char *strFile)
+{
+	std::vector<Trigger> Triggers;
+	FILE *pFile = fopen(strFile, "r");
+	if (pFile == NULL) {
+		fprintf(stderr, "Cannot open %s\n", strFile);
+		exit(1);
+	}
+	char strLine[256];
+	while (fgets(strLine, sizeof(strLine), pFile) != NULL) {
+		double fTimeMS, fWidthMS = 1;
+		int iChannel;
+		if (strLine[0] == '#' || sscanf(strLine, "%lf %d %lf", &fTimeMS, &iChannel, &fWidthMS) < 2)
+			continue;
+		if (iChannel < 0 || iChannel >= NUM_CHANNELS || fTimeMS < 0)
+			continue;
+		Trigger T = {uint64_t(fTimeMS * 1e3), iChannel, uint64_t(std::max(1.0, fWidthMS * 1e3))};
+		Triggers.push_back(T);
+	}
+	fclose(pFile);
+	return Triggers;
+}
+
+static std::vector<Trigger> RandomTriggers(double fRate, double fDurationSec)
+{
+	std::vector<Trigger> Triggers;
+	for (int iChannel = 0; iChannel < NUM_CHANNELS; iChannel++) {
+		double fTime = 0;
+		while (true) {
+			fTime += -log(1.0 - rand() / (RAND_MAX + 1.0)) / fRate;
+			if (fTime >= fDurationSec)
+				break;
+			Trigger T = {uint64_t(fTime * 1e6), iChannel, 1000};
+			Triggers.push_back(T);
+		}
+	}
+	return Triggers;
+}
+
+static bool Earlier(const Trigger &A, const Trigger &B)
+{
+	return A.m_iTime < B.m_iTime;
+}
+
+typedef struct {
+	std::vector<double> m_afValues;
+	void Add(double f) { m_afValues.push_back(f); }
+	void Print(const char *strName) {
+		if (m_afValues.empty()) {
+			printf("  %-22s -\n", strName);
+			return;
+		}
+		std::sort(m_afValues.begin(), m_afValues.end());
+		double fSum = 0, fSum2 = 0;
+		for (size_t k = 0; k < m_afValues.size(); k++) {
+			fSum += m_afValues[k];
+			fSum2 += m_afValues[k] * m_afValues[k];
+		}
+		double fMean = fSum / m_afValues.size();
+		double fStd = sqrt(std::max(0.0, fSum2 / m_afValues.size() - fMean * fMean));
+		printf("  %-22s mean %8.1f  std %7.1f  p99 %8.1f  max %8.1f us\n", strName, fMean, fStd,
+			m_afValues[size_t(0.99 * (m_afValues.size() - 1))], m_afValues.back());
+	}
+} Stats;
+
+// Trains are paired by the trigger that started them, pulses by their rank in the train: a late pulse
+// delays the ones after it (each waits for an interval after the previous one), which shows as drift
+static void Compare(int iChannel, const std::vector<Train> &Ideal, const std::vector<Train> &Actual,
+	const std::vector<Trigger> &Triggers)
+{
+	Stats Start, Onset, Interval, Width;
+	int iMissed = 0, iExtra = 0, iIdealPulses = 0, iActualPulses = 0, iNumTriggers = 0;
+	for (size_t k = 0; k < Triggers.size(); k++)
+		if (Triggers[k].m_iChannel == iChannel)
+			iNumTriggers++;
+
+	size_t iActual = 0;
+	for (size_t iIdeal = 0; iIdeal < Ideal.size(); iIdeal++) {
+		const Train &I = Ideal[iIdeal];
+		iIdealPulses += int(I.m_Pulses.size());
+		while (iActual < Actual.size() && Actual[iActual].m_iTrigger < I.m_iTrigger) {
+			iExtra += int(Actual[iActual].m_Pulses.size());
+			iActualPulses += int(Actual[iActual++].m_Pulses.size());
+		}
+		if (iActual == Actual.size() || Actual[iActual].m_iTrigger != I.m_iTrigger) {
+			iMissed += int(I.m_Pulses.size());
+			continue;
+		}
+		const Train &A = Actual[iActual++];
+		iActualPulses += int(A.m_Pulses.size());
+		size_t iCommon = std::min(I.m_Pulses.size(), A.m_Pulses.size());
+		iMissed += int(I.m_Pulses.size() - iCommon);
+		iExtra += int(A.m_Pulses.size() - iCommon);
+		for (size_t k = 0; k < iCommon; k++) {
+			const Pulse &PI = I.m_Pulses[k], &PA = A.m_Pulses[k];
+			Onset.Add(double(PA.m_iOn - A.m_Pulses[0].m_iOn) - double(PI.m_iOn - I.m_Pulses[0].m_iOn));
+			Width.Add(double(PA.m_iOff - PA.m_iOn) - double(PI.m_iOff - PI.m_iOn));
+			if (k > 0)
+				Interval.Add(double(PA.m_iOn - A.m_Pulses[k - 1].m_iOn) - double(PI.m_iOn - I.m_Pulses[k - 1].m_iOn));
+		}
+		if (iCommon > 0)
+			Start.Add(double(A.m_Pulses[0].m_iOn) - double(I.m_Pulses[0].m_iOn));
+	}
+	for (; iActual < Actual.size(); iActual++) {
+		iExtra += int(Actual[iActual].m_Pulses.size());
+		iActualPulses += int(Actual[iActual].m_Pulses.size());
+	}
+	printf("Channel %d: %d triggers, %d taken (ideal %d); %d pulses (ideal %d), %d missed, %d extra\n", iChannel, iNumTriggers,
+		int(Actual.size()), int(Ideal.size()), iActualPulses, iIdealPulses, iMissed, iExtra);
+	Start.Print("train start - ideal");
+	Onset.Print("onset in train - ideal");
+	Interval.Print("interval - ideal");
+	Width.Print("width - ideal");
+}
+
+static void Overlap(const std::vector<Pulse> &A, const std::vector<Pulse> &B)
+{
+	uint64_t iOverlap = 0;
+	int iNumOverlapping = 0;
+	size_t j = 0;
+	for (size_t i = 0; i < A.size(); i++) {
+		while (j < B.size() && B[j].m_iOff <= A[i].m_iOn)
+			j++;
+		bool bAny = false;
+		for (size_t k = j; k < B.size() && B[k].m_iOn < A[i].m_iOff; k++) {
+			iOverlap += std::min(A[i].m_iOff, B[k].m_iOff) - std::max(A[i].m_iOn, B[k].m_iOn);
+			bAny = true;
+		}
+		iNumOverlapping += bAny;
+	}
+	printf("Both outputs high: %.3f ms in total, %d channel 0 pulses overlap channel 1\n", iOverlap / 1e3, iNumOverlapping);
+}
+
+int main(int argc, char **argv)
+{
+	StimTrain Trains[NUM_CHANNELS];
+	LoopCost Cost = {3, 2, 0, 1000, 100000};
+	const char *strTriggerFile = NULL;
+	double fRate = 2, fDurationSec = 10;
+	int iSeed = 1;
+	for (int k = 1; k < argc; k++) {
+		std::string strOption = argv[k];
+		if (k + 1 >= argc) {
+			fprintf(stderr, "Missing value after %s\n", argv[k]);
+			return 1;
+		}
+		const char *strValue = argv[++k];
+		if (strOption == "-t") strTriggerFile = strValue;
+		else if (strOption == "-r") fRate = atof(strValue);
+		else if (strOption == "-d") fDurationSec = atof(strValue);
+		else if (strOption == "-p") ParseParameters(strValue, Trains);
+		else if (strOption == "-c") Cost.m_fStepUs = atof(strValue);
+		else if (strOption == "-l") Cost.m_fLoopUs = atof(strValue);
+		else if (strOption == "-j") Cost.m_fLoopJitterUs = atof(strValue);
+		else if (strOption == "-s") Cost.m_fSlowUs = atof(strValue);
+		else if (strOption == "-P") Cost.m_fSlowPeriodUs = atof(strValue) * 1e3;
+		else if (strOption == "-seed") iSeed = atoi(strValue);
+		else {
+			fprintf(stderr, "Unknown option %s\n", argv[k - 1]);
+			return 1;
+		}
+	}
+	srand(iSeed);
+	std::vector<Trigger> Triggers = strTriggerFile != NULL ? ReadTriggers(strTriggerFile) : RandomTriggers(fRate, fDurationSec);
+	std::sort(Triggers.begin(), Triggers.end(), Earlier);
+
+	// Run until the last train is surely over
+	uint64_t iEnd = Triggers.empty() ? 0 : Triggers.back().m_iTime + Triggers.back().m_iWidth;
+	double fLongest = 0;
+	for (int k = 0; k < NUM_CHANNELS; k++) {
+		double fTrains = std::max(1, int(Trains[k].NumTrains_Per_Trigger));
+		fLongest = std::max(fLongest, Trains[k].TriggerDelay_Microns + fTrains * std::max(double(Trains[k].Train_Length_Microns), 1e6 / Trains[k].Train_Freq_Hz));
+	}
+	iEnd += uint64_t(fLongest) + 100000;
+
+	LoopCost Ideal = {0, 1, 0, 0, 1};
+	Board IdealBoard(Triggers, Trains), ActualBoard(Triggers, Trains);
+	IdealBoard.Run(iEnd, Ideal);
+	ActualBoard.Run(iEnd, Cost);
+
+	printf("%d triggers over %.1f s; loop: %.1f us per channel + %.1f us (+ up to %.1f), %.0f us every %.0f ms\n", int(Triggers.size()), iEnd / 1e6,
+		Cost.m_fStepUs, Cost.m_fLoopUs, Cost.m_fLoopJitterUs, Cost.m_fSlowUs, Cost.m_fSlowPeriodUs / 1e3);
+	for (int k = 0; k < NUM_CHANNELS; k++)
+		Compare(k, IdealBoard.Trains(k), ActualBoard.Trains(k), Triggers);
+	Overlap(ActualBoard.m_Pulses[0], ActualBoard.m_Pulses[1]);
+	return 0;
+}
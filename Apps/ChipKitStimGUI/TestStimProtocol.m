@@ -0,0 +1,32 @@
+% Binary commands against the firmware parser on a simulated stimulator (pseudo terminal, Linux/Mac)
+strPort = fndllSerialInterface('StartLoopback', 0, 0, 'nanostimulator');
+hLink = fndllSerialInterface('OpenFramed', strPort, 115200, 0);
+
+acResponses = fndllSerialInterface('Transact', hLink, 18, {[]});
+assert(isequal(acResponses{1}, uint8([0 1 2])));	% status, protocol version, channels
+
+% Both channels in one round trip
+strctParams = fnStimulationParamsArrayToStruct(1, [101 200 500000 2 1 1 150 250 0 1 1 0 0 0]);
+strctChannel2 = fnStimulationParamsArrayToStruct(2, [102 300 250000 4 -1 0 150 250 1000 0.5 1 0 0 0]);
+strctParams.m_astrctChannels(2) = strctChannel2.m_astrctChannels(2);
+fStart = GetSecs();
+[bOK, strctApplied] = fnSetStimulationTrains(hLink, 1:2, strctParams);
+fprintf('Two channels in %.2f ms\n', (GetSecs()-fStart)*1e3);
+assert(bOK && isequal(strctApplied, strctParams));
+
+% Out of range values come back clamped
+strctParams.m_astrctChannels(2).m_fPulseFrequencyHz = 0;
+strctParams.m_astrctChannels(2).m_iPulse_Width_Microns = -5;
+[bOK, strctApplied] = fnSetStimulationTrains(hLink, 2, strctParams);
+assert(~bOK && strctApplied.m_astrctChannels(2).m_fPulseFrequencyHz > 0 && strctApplied.m_astrctChannels(2).m_iPulse_Width_Microns == 1);
+
+% Soft triggers come back as trigger count events
+fndllSerialInterface('Transact', hLink, 11, {uint8([0 1 1])});
+WaitSecs(0.05);
+[aiTypes, acEvents] = fndllSerialInterface('GetEvents', hLink);
+assert(all(aiTypes == 129) && length(acEvents) == 2);
+acCounts = fndllSerialInterface('Transact', hLink, 21, {[]});
+assert(isequal(double(typecast(acCounts{1}(2:end), 'uint32')), [1 2]));
+
+fndllSerialInterface('CloseFramed', hLink);
+fndllSerialInterface('StopLoopback');
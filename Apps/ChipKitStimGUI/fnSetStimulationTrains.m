@@ -0,0 +1,54 @@
+function [bOK, strctApplied] = fnSetStimulationTrains(hLink, aiChannels, strctParams)
+% Sends the trains of several channels (1 or 2) in one binary command over a framed link
+% (fndllSerialInterface('OpenFramed',...)) and returns what the stimulator applied: values out of
+% range come back clamped (bOK is false then). See StimProtocol.h in the sketch folder.
+STIM_CMD_SET_TRAINS = 32;
+STIM_STATUS_OK = 0;
+
+abPayload = zeros(1,0,'uint8');
+for iChannel=aiChannels(:)'
+    abPayload = [abPayload, fnEncodeTrain(iChannel-1, strctParams.m_astrctChannels(iChannel))]; %#ok<AGROW>
+end
+[acResponses, aiTypes] = fndllSerialInterface('Transact', hLink, STIM_CMD_SET_TRAINS, {abPayload});
+strctApplied = strctParams;
+if aiTypes(1) ~= STIM_CMD_SET_TRAINS || isempty(acResponses{1})
+    fprintf('No answer from the Nano Stimulator\n');
+    bOK = false;
+    return;
+end
+abResponse = acResponses{1};
+bOK = abResponse(1) == STIM_STATUS_OK;
+iNumBlocks = floor((length(abResponse)-1) / 38);
+for iBlock=1:iNumBlocks
+    abBlock = abResponse(2+(iBlock-1)*38:1+iBlock*38);
+    iChannel = double(abBlock(1))+1;
+    strctApplied.m_astrctChannels(iChannel) = fnDecodeTrain(abBlock, strctParams.m_astrctChannels(iChannel));
+end
+return
+
+function abBlock = fnEncodeTrain(iChannel, strctChannel)
+iFlags = (strctChannel.m_bActive > 0) + 2 * (strctChannel.m_bSecondPulse > 0);
+abBlock = [uint8([iChannel, iFlags]), ...
+    typecast(single(strctChannel.m_fPulseFrequencyHz), 'uint8'), ...
+    typecast(int32([strctChannel.m_iPulse_Width_Microns, strctChannel.m_iTrain_Length_Microns]), 'uint8'), ...
+    typecast(single(strctChannel.m_fTrain_Freq_Hz), 'uint8'), ...
+    typecast(int32([strctChannel.m_iNumTrains_Per_Trigger, strctChannel.m_iSecond_Pulse_Width_Microns, ...
+        strctChannel.m_iSecond_Pulse_Delay_Microns, strctChannel.m_iTriggerDelay_Microns]), 'uint8'), ...
+    typecast(single(strctChannel.m_fAmplitude), 'uint8')];
+return
+
+function strctChannel = fnDecodeTrain(abBlock, strctChannel)
+strctChannel.m_bActive = double(bitand(abBlock(2), 1) > 0);
+strctChannel.m_bSecondPulse = double(bitand(abBlock(2), 2) > 0);
+strctChannel.m_fPulseFrequencyHz = double(typecast(abBlock(3:6), 'single'));
+aiValues = double(typecast(abBlock(7:14), 'int32'));
+strctChannel.m_iPulse_Width_Microns = aiValues(1);
+strctChannel.m_iTrain_Length_Microns = aiValues(2);
+strctChannel.m_fTrain_Freq_Hz = double(typecast(abBlock(15:18), 'single'));
+aiValues = double(typecast(abBlock(19:34), 'int32'));
+strctChannel.m_iNumTrains_Per_Trigger = aiValues(1);
+strctChannel.m_iSecond_Pulse_Width_Microns = aiValues(2);
+strctChannel.m_iSecond_Pulse_Delay_Microns = aiValues(3);
+strctChannel.m_iTriggerDelay_Microns = aiValues(4);
+strctChannel.m_fAmplitude = double(typecast(abBlock(35:38), 'single'));
+return
@@ -15,6 +15,27 @@ end
 iNumFiles=length(acFiles);
 fprintf('%d PLX files were found!\n', iNumFiles);
 fnResetWaitbar(hMajorWait);
+if exist('plxsplit','file') == 3 && iNumFiles > 0 && (strctOptions.m_bAnalog || strctOptions.m_bStrobe || strctOptions.m_bSpikes)
+    % Convert all files concurrently with the native converter. Files that were completed
+    % by a previous (interrupted) batch are skipped.
+    strctSplitOptions.m_bAnalog = strctOptions.m_bAnalog;
+    strctSplitOptions.m_bStrobe = strctOptions.m_bStrobe;
+    strctSplitOptions.m_bSpikes = strctOptions.m_bSpikes;
+    strctSplitOptions.m_bResume = true;
+    [acOutputFiles, acErrors, abSkipped] = plxsplit(acFiles, strctSplitOptions);
+    for iFileIter=find(~cellfun(@isempty, acErrors))
+        fprintf('Failed to convert %s: %s\n', acFiles{iFileIter}, acErrors{iFileIter});
+    end
+    fprintf('%d files converted, %d were already converted.\n', sum(cellfun(@isempty, acErrors) & ~abSkipped), sum(abSkipped));
+    fnSetWaitbar(hMajorWait,0.5);
+    strctOptions.m_bAnalog = false;
+    strctOptions.m_bStrobe = false;
+    strctOptions.m_bSpikes = false;
+    if ~strctOptions.m_bSync
+        fprintf('Done!\n');
+        return;
+    end
+end
 for iFileIter=1:iNumFiles
     fnConvertPLXtoFastDataAccess(acFiles{iFileIter},strctOptions,hMinorWait);
     fnSetWaitbar(hMajorWait,iFileIter/iNumFiles);
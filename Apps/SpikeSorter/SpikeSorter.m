@@ -1437,6 +1437,13 @@ end
 
 aiIntervalsUniqueID = cat(1,astrctUnitIntervals.m_iUniqueID);
 
+% Render all units in one call when the multi-layer density renderer is available
+bMultiUnitDensity = exist('fnWaveformDensity','file') == 3;
+if bMultiUnitDensity
+    [abDummy, aiSpikeLayer] = ismember(aiReducedSpikeAssociation, aiUnitsInRange);
+    a3fAllUnitWaves = fnWaveformDensity(-a2fReducedWaves, afRangeXwave([1,end]), iNumPtsX,afRangeYwave([1,end]), iNumPtsY, double(aiSpikeLayer(:)));
+end
+
 for iIter=1:iNumUnitsInRange
     iUnitOfInterest = aiUnitsInRange(iIter);
     iIndex = find(aiIntervalsUniqueID == iUnitOfInterest);
@@ -1450,7 +1457,11 @@ for iIter=1:iNumUnitsInRange
         afAllRangeY = linspace(min(afSpikePCAY),max(afSpikePCAY),iNumPtsY);
 
         
-        a3fWaves(:,:,iIter) = sqrt(Bresenham(a2fUnitWaves, afRangeXwave([1,end]), iNumPtsX,afRangeYwave([1,end]), iNumPtsY));
+        if bMultiUnitDensity
+            a3fWaves(:,:,iIter) = sqrt(a3fAllUnitWaves(:,:,iIter));
+        else
+            a3fWaves(:,:,iIter) = sqrt(Bresenham(a2fUnitWaves, afRangeXwave([1,end]), iNumPtsX,afRangeYwave([1,end]), iNumPtsY));
+        end
         
         
         [a2fMean(:,iIter), a3fCov(:,:,iIter)]=fnFitGaussian([afSpikePCAX(:),afSpikePCAY(:)]);
@@ -42,8 +42,8 @@ aiSortedTetrodeCh = aiCh(aiInd);
 a2fTetrodeWaves = a2fWaveForms(abTetrodeEvent,:);
 a2fSortedWaveForms =a2fTetrodeWaves(aiInd,:);
 
-[a2iTetrodeEventToTetrodeNumber, a2fGrouppedWaves] = GroupChannelsToTetrode(afSortedTetrode_TS,aiSortedTetrodeCh, a2fSortedWaveForms,a2iTetrodeChannelTable);
-afTetrodeEventTS = afSortedTetrode_TS(a2iTetrodeEventToTetrodeNumber(1,:));
+% a2iTetrodeEventToTetrodeNumber is (4+1) x NumEvents int32: the spike of every channel and the tetrode in the last row
+[a2iTetrodeEventToTetrodeNumber, a2fGrouppedWaves, afTetrodeEventTS] = GroupChannelsToTetrode(afSortedTetrode_TS,aiSortedTetrodeCh, a2fSortedWaveForms,a2iTetrodeChannelTable);
  
 %% Update Buffers
 
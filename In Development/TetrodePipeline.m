@@ -20,39 +20,11 @@ abSingleElectrodeEvent = abSingleChannels(aiChRaw+1);
 [afSortedTS, aiInd]=sort(afTS);
 aiSortedCh = aiCh(aiInd);
 
+% (4+1) x NumEvents int32: the spike of every channel and the tetrode in the last row
 a2iRegroupping = GroupChannelsToTetrode(afSortedTS,aiSortedCh, a2iTetrodeChannelTable);
 
-
-% 1.3 build table
-iNumUniqueTS= sum(diff(afSortedTS)>0);
-iNumTS = length(afSortedTS);
-% Build the tetrode timestamp/channel table ( This needs to be a mex
-% function because it is too slow)
-iActiveEntry = 1;
-fPrevTS = afSortedTS(1);
-a2iInd = zeros(4, iNumTetrodes);
-a2fSortedEventsTable = zeros(iNumTetrodes*iNumUniqueTS, 5);  % indices to wave forms/ts. last column denotes which tetrode was triggered
-iActiveLine = 1;
-for iIter=1:iNumTS
-    fCurrentTS = afSortedTS(iIter);
-    iCurrentChannel = aiSortedCh(iIter);
-        if fCurrentTS == fPrevTS
-            a2iInd(iCurrentChannel)=iIter;
-        else
-            % Time to add events to the table....
-            abValidEntries = sum(a2iInd' == 0,2)==0;
-            aiValidTetrodes = find(abValidEntries);
-            iNumValidEntries=sum(abValidEntries);
-            if iNumValidEntries > 0
-                a2fSortedEventsTable(iActiveLine:iActiveLine+iNumValidEntries-1,:) = [a2iInd(:,abValidEntries)',aiValidTetrodes(:)];
-                iActiveLine=iActiveLine+iNumValidEntries;
-                a2iInd = zeros(4, iNumTetrodes);
-            end
-            fPrevTS = fCurrentTS ;
-            a2iInd(iCurrentChannel)=iIter;
-        end
-end
-a2fGroupEvents = a2fSortedEventsTable(1:iActiveLine-1,:);
+% 1.3 build table: indices to wave forms/ts. last column denotes which tetrode was triggered
+a2fGroupEvents = double(a2iRegroupping');
 save('DebugForGrouping','aiSortedCh','afSortedTS','a2iTetrodeChannelTable','a2fGroupEvents');
 
 % if training...
@@ -14,3 +14,22 @@ a2Output= 1e3*conv2(a2fTemp2,afSmoothingKernelMS ,'same');
 B=GetSecs();
 
 round((B-A)*1e3)
+
+%% Compare against the matlab implementation on synthetic data (counts, SEM, logical input)
+a2bRaster = rand(1000,300) > 0.9;
+aiStimuli = ceil(rand(1,1000)*50);
+acConditions = {1:10, [3 3 4], 49, 51};
+[a2fAvg, aiCount, a2fSEM] = fnAverageRaster(a2bRaster, aiStimuli, acConditions);
+a2fAvgDouble = fnAverageRaster(double(a2bRaster), aiStimuli, acConditions);
+for iConditionIter=1:length(acConditions)
+    abRelevant = ismember(aiStimuli, acConditions{iConditionIter});
+    assert(aiCount(iConditionIter) == sum(abRelevant));
+    if sum(abRelevant) == 0
+        assert(all(isnan(a2fAvg(iConditionIter,:))));
+        continue;
+    end
+    a2fSub = double(a2bRaster(abRelevant,:));
+    assert(max(abs(a2fAvg(iConditionIter,:) - mean(a2fSub,1))) < 1e-10);
+    assert(max(abs(a2fSEM(iConditionIter,:) - std(a2fSub,[],1)/sqrt(sum(abRelevant)))) < 1e-10);
+end
+assert(isequalwithequalnans(a2fAvg, a2fAvgDouble));
@@ -5,69 +5,196 @@
 % the Free Software Foundation (see GPL.txt)
 */
 #include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <unordered_map>
 #include "mex.h"
-void mexFunction( int nlhs, mxArray *plhs[], 
-				 int nrhs, const mxArray *prhs[] ) 
-{
 
-	// Syntax:
-	// [a2fAvg] = fnAverageByCell(a2bRaster, aiStimulusIndex,  acConditionInd)
+/*
+ Syntax:
+ [a2fAvg, aiCount, a2fSEM] = fnAverageRaster(a2bRaster, aiStimulusIndex, acConditionInd)
 
-	
-	double *Raster = (double*)mxGetData(prhs[0]);
+ a2bRaster       : NumTrials x NumTimePoints (double, single, logical or uint8)
+ aiStimulusIndex : NumTrials stimulus indices (one per raster row)
+ acConditionInd  : cell array, each cell holds the stimulus indices that make up a condition
 
-	const int *input_dim_array = mxGetDimensions(prhs[0]);
-	int NumTrials = input_dim_array[0];
-	int NumTimePoints = input_dim_array[1];	
+ a2fAvg  : NumConditions x NumTimePoints average (NaN for conditions without trials)
+ aiCount : NumConditions x 1 number of trials that went into each condition
+ a2fSEM  : NumConditions x NumTimePoints standard error of the mean (only computed if requested)
 
-	double *Stimuli = (double*)mxGetData(prhs[1]);
-	int iNumStimuli = mxGetNumberOfElements(prhs[1]);
-		
-	int iNumConditions = mxGetNumberOfElements(prhs[2]);
+ Instead of comparing every stimulus against every condition, a stimulus -> conditions
+ table is built once. The raster is then traversed a single time in memory order
+ (one column of trials per time point), and every sample is added to all the conditions
+ its trial belongs to.
+*/
 
-	double NaN = mxGetNaN();
+// Copies an index vector of any numeric class to doubles.
+void fnGetIndexVector(const mxArray *A, std::vector<double> &afOut)
+{
+	int iNumElements = int(mxGetNumberOfElements(A));
+	afOut.resize(iNumElements);
+	void *pData = mxGetData(A);
+	for (int k=0;k<iNumElements;k++) {
+		switch (mxGetClassID(A)) {
+			case mxDOUBLE_CLASS: afOut[k] = ((double*)pData)[k]; break;
+			case mxSINGLE_CLASS: afOut[k] = ((float*)pData)[k]; break;
+			case mxINT32_CLASS:  afOut[k] = ((int*)pData)[k]; break;
+			case mxUINT32_CLASS: afOut[k] = ((unsigned int*)pData)[k]; break;
+			case mxINT16_CLASS:  afOut[k] = ((short*)pData)[k]; break;
+			case mxUINT16_CLASS: afOut[k] = ((unsigned short*)pData)[k]; break;
+			case mxINT8_CLASS:   afOut[k] = ((signed char*)pData)[k]; break;
+			case mxUINT8_CLASS:  afOut[k] = ((unsigned char*)pData)[k]; break;
+			default:
+				mexErrMsgTxt("Stimulus and condition indices must be numeric.");
+		}
+	}
+}
 
-	int output_dim_array[2];
-	output_dim_array[0] = iNumConditions;
-	output_dim_array[1] = NumTimePoints;
-	plhs[0] = mxCreateNumericArray(2, output_dim_array, mxDOUBLE_CLASS, mxREAL);
-	double *PSTH = (double*) mxGetPr(plhs[0]);
+template<class T> void AccumulateRaster(const T *Raster, int NumTrials, int NumTimePoints, int iNumConditions,
+										const std::vector<int> &aiActiveTrials,
+										const std::vector<int> &aiTrialOffset, const std::vector<int> &aiTrialConditions,
+										double *Sum, double *SumSqr)
+{
+	int iNumActive = int(aiActiveTrials.size());
+	for (int t=0;t<NumTimePoints;t++) {
+		const T *Column = Raster + (size_t)t * NumTrials;
+		double *SumColumn = Sum + (size_t)t * iNumConditions;
+		double *SumSqrColumn = (SumSqr != NULL) ? SumSqr + (size_t)t * iNumConditions : NULL;
+
+		for (int a=0;a<iNumActive;a++) {
+			int iTrial = aiActiveTrials[a];
+			double fValue = double(Column[iTrial]);
+			if (fValue == 0)
+				continue; // rasters are mostly zeros, nothing to add
+			for (int j=aiTrialOffset[iTrial];j<aiTrialOffset[iTrial+1];j++) {
+				SumColumn[aiTrialConditions[j]] += fValue;
+				if (SumSqrColumn != NULL)
+					SumSqrColumn[aiTrialConditions[j]] += fValue*fValue;
+			}
+		}
+	}
+}
 
-	for (int k=0;k<iNumConditions*NumTimePoints;k++)
-		PSTH[k] = NaN;
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 3 || !mxIsCell(prhs[2])) {
+		mexErrMsgTxt("Usage: [a2fAvg, aiCount, a2fSEM] = fnAverageRaster(a2bRaster, aiStimulusIndex, acConditionInd)");
+		return;
+	}
 
-	double *TMP_PSTH = new double[NumTimePoints];
+	const mwSize *input_dim_array = mxGetDimensions(prhs[0]);
+	int NumTrials = int(input_dim_array[0]);
+	int NumTimePoints = int(input_dim_array[1]);
 
+	std::vector<double> Stimuli;
+	fnGetIndexVector(prhs[1], Stimuli);
+	if (int(Stimuli.size()) != NumTrials) {
+		mexErrMsgTxt("Number of stimulus indices must match the number of raster rows.");
+		return;
+	}
+
+	int iNumConditions = int(mxGetNumberOfElements(prhs[2]));
+	bool bComputeSEM = nlhs > 2;
+
+	// Stimulus index -> list of conditions containing it
+	std::unordered_map<double, std::vector<int> > StimulusToConditions;
+	std::vector<double> ConditionInd;
 	for (int iConditionIter=0;iConditionIter<iNumConditions;iConditionIter++) {
 		mxArray *M = mxGetCell(prhs[2],iConditionIter);
-		int iNumStimuliInCondition = mxGetNumberOfElements(M);
-		double *ConditionInd = (double*)mxGetPr(M);
-		
-		for (int t=0;t<NumTimePoints;t++)
-			TMP_PSTH[t] = 0;
-		
-		int iNumMatches = 0;
-		for (int iStimuliIter=0;iStimuliIter<iNumStimuli;iStimuliIter++) {
-			for (int i=0;i<iNumStimuliInCondition;i++) {
-
-				if (Stimuli[iStimuliIter] == ConditionInd[i]) {
-					// Add to PSTH
-					for (int t=0;t<NumTimePoints;t++) {
-						TMP_PSTH[t] += Raster[t * iNumStimuli + iStimuliIter ];
-					}
-					iNumMatches++;
-				}
+		if (M == NULL)
+			continue;
+		fnGetIndexVector(M, ConditionInd);
+		for (size_t i=0;i<ConditionInd.size();i++) {
+			std::vector<int> &aiConditions = StimulusToConditions[ConditionInd[i]];
+			// a condition may list the same stimulus twice, count the trial only once (same as ismember)
+			if (aiConditions.empty() || aiConditions.back() != iConditionIter)
+				aiConditions.push_back(iConditionIter);
+		}
+	}
 
+	// Trial -> conditions, stored as one flat array with per trial offsets
+	std::vector<int> aiTrialOffset(NumTrials+1, 0);
+	std::vector<int> aiTrialConditions;
+	std::vector<int> aiActiveTrials;
+	std::vector<double> afCount(iNumConditions, 0);
+	for (int iTrial=0;iTrial<NumTrials;iTrial++) {
+		std::unordered_map<double, std::vector<int> >::const_iterator it = StimulusToConditions.find(Stimuli[iTrial]);
+		if (it != StimulusToConditions.end()) {
+			aiActiveTrials.push_back(iTrial);
+			for (size_t j=0;j<it->second.size();j++) {
+				aiTrialConditions.push_back(it->second[j]);
+				afCount[it->second[j]]++;
 			}
 		}
+		aiTrialOffset[iTrial+1] = int(aiTrialConditions.size());
+	}
+
+	mwSize output_dim_array[2];
+	output_dim_array[0] = iNumConditions;
+	output_dim_array[1] = NumTimePoints;
+	plhs[0] = mxCreateNumericArray(2, output_dim_array, mxDOUBLE_CLASS, mxREAL);
+	double *PSTH = (double*) mxGetPr(plhs[0]);
 
-		for (int t=0;t<NumTimePoints;t++) {
-			PSTH[t* iNumConditions + iConditionIter] = TMP_PSTH[t] / iNumMatches;
+	std::vector<double> SumSqr;
+	if (bComputeSEM)
+		SumSqr.resize((size_t)iNumConditions*NumTimePoints, 0);
+	double *pSumSqr = bComputeSEM ? &SumSqr[0] : NULL;
+
+	// Accumulate sums directly in the output buffer (it is zero initialized)
+	if (NumTrials > 0 && NumTimePoints > 0 && iNumConditions > 0) {
+		switch (mxGetClassID(prhs[0])) {
+			case mxDOUBLE_CLASS:
+				AccumulateRaster((double*)mxGetData(prhs[0]), NumTrials, NumTimePoints, iNumConditions, aiActiveTrials, aiTrialOffset, aiTrialConditions, PSTH, pSumSqr);
+				break;
+			case mxSINGLE_CLASS:
+				AccumulateRaster((float*)mxGetData(prhs[0]), NumTrials, NumTimePoints, iNumConditions, aiActiveTrials, aiTrialOffset, aiTrialConditions, PSTH, pSumSqr);
+				break;
+			case mxLOGICAL_CLASS:
+				AccumulateRaster((mxLogical*)mxGetData(prhs[0]), NumTrials, NumTimePoints, iNumConditions, aiActiveTrials, aiTrialOffset, aiTrialConditions, PSTH, pSumSqr);
+				break;
+			case mxUINT8_CLASS:
+				AccumulateRaster((unsigned char*)mxGetData(prhs[0]), NumTrials, NumTimePoints, iNumConditions, aiActiveTrials, aiTrialOffset, aiTrialConditions, PSTH, pSumSqr);
+				break;
+			default:
+				mexErrMsgTxt("Raster must be double, single, logical or uint8.");
+				return;
 		}
 	}
 
+	double NaN = mxGetNaN();
+	double *SEM = NULL;
+	if (bComputeSEM) {
+		plhs[2] = mxCreateNumericArray(2, output_dim_array, mxDOUBLE_CLASS, mxREAL);
+		SEM = (double*) mxGetPr(plhs[2]);
+	}
 
-	delete [] TMP_PSTH;
+	for (int t=0;t<NumTimePoints;t++) {
+		for (int c=0;c<iNumConditions;c++) {
+			size_t k = (size_t)t * iNumConditions + c;
+			double n = afCount[c];
+			if (n == 0) {
+				PSTH[k] = NaN;
+				if (bComputeSEM)
+					SEM[k] = NaN;
+				continue;
+			}
+			double fMean = PSTH[k] / n;
+			PSTH[k] = fMean;
+			if (bComputeSEM) {
+				// unbiased std (same as matlab's std) divided by sqrt(n)
+				double fVar = (n > 1) ? (SumSqr[k] - n * fMean * fMean) / (n - 1) : 0;
+				SEM[k] = (fVar > 0) ? sqrt(fVar / n) : 0;
+			}
+		}
+	}
+
+	if (nlhs > 1) {
+		plhs[1] = mxCreateDoubleMatrix(iNumConditions, 1, mxREAL);
+		double *Count = mxGetPr(plhs[1]);
+		for (int c=0;c<iNumConditions;c++)
+			Count[c] = afCount[c];
+	}
 }
 
 
@@ -83,4 +210,4 @@ for iConditionIter=1:iNumConditions
         a2fAvg(iConditionIter,:) = mean(a2bRaster(aiRelevantRasterInd,:),1);
     end
 end
-*/
\ No newline at end of file
+*/
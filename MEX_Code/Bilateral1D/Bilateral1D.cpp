@@ -7,24 +7,228 @@
 #include <stdio.h>
 #include "mex.h"
 #include "math.h"
+#include <vector>
 #define MAX(x,y)(x>y)?(x):(y)
 #define MIN(x,y)(x<y)?(x):(y)
 #define SQR(x)((x)*(x))
 
-void mexFunction( int nlhs, mxArray *plhs[], 
-				 int nrhs, const mxArray *prhs[] ) 
+const int RANGE_LUT_SIZE = 4096;
+const int MAX_NUM_LAYERS = 256;
+
+/*
+ Exact filter (original implementation). O(N * Width).
+*/
+void ExactBilateral(const double *afOriginalSignal, double *Out, int iSignalLength,
+					int fWidth, const double *afGaussian, double fEdgeSigma)
+{
+	double fEdgeDeno = 2*SQR(fEdgeSigma);
+	for (int k=0;k<iSignalLength;k++) {
+
+         int iMin = MAX(k-fWidth,0);
+         int iMax = MIN(k+fWidth,iSignalLength-1);
+
+		 double S=0;
+		 double Sd = 0;
+		 for (int i=iMin;i<=iMax;i++) {
+			double fValue = afOriginalSignal[i];
+		    double Hi = exp(-SQR(fValue-afOriginalSignal[k])/fEdgeDeno);
+			double Di = Hi * afGaussian[i-k+fWidth];
+			Sd+= Di;
+			S+=Di * afOriginalSignal[i];
+		 }
+		 Out[k] = S / Sd;
+	}
+}
+
+/*
+ Young & van Vliet recursive gaussian (causal + anti-causal 3rd order IIR).
+ Runs in place, zero padded at both ends. Cost does not depend on sigma.
+*/
+class RecursiveGaussian {
+public:
+	RecursiveGaussian(double fSigma) {
+		double q;
+		if (fSigma >= 2.5)
+			q = 0.98711*fSigma - 0.96330;
+		else
+			q = 3.97156 - 4.14554*sqrt(1-0.26891*(fSigma < 0.5 ? 0.5 : fSigma));
+		double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+		b1 = (2.44413*q + 2.85619*q*q + 1.26661*q*q*q) / b0;
+		b2 = -(1.4281*q*q + 1.26661*q*q*q) / b0;
+		b3 = (0.422205*q*q*q) / b0;
+		B = 1 - (b1+b2+b3);
+	}
+
+	// Filters the range weights and the weighted signal together (two independent recursions per sample)
+	void Filter(double *w, double *j, int n) const {
+		double w1=0,w2=0,w3=0,j1=0,j2=0,j3=0;
+		for (int i=0;i<n;i++) {
+			double wn = B*w[i] + b1*w1 + b2*w2 + b3*w3;
+			double jn = B*j[i] + b1*j1 + b2*j2 + b3*j3;
+			w3 = w2; w2 = w1; w1 = wn;
+			j3 = j2; j2 = j1; j1 = jn;
+			w[i] = wn;
+			j[i] = jn;
+		}
+		w1=w2=w3=j1=j2=j3=0;
+		for (int i=n-1;i>=0;i--) {
+			double wn = B*w[i] + b1*w1 + b2*w2 + b3*w3;
+			double jn = B*j[i] + b1*j1 + b2*j2 + b3*j3;
+			w3 = w2; w2 = w1; w1 = wn;
+			j3 = j2; j2 = j1; j1 = jn;
+			w[i] = wn;
+			j[i] = jn;
+		}
+	}
+private:
+	double B,b1,b2,b3;
+};
+
+/*
+ Piecewise-linear bilateral approximation (Durand & Dorsey 2002, Yang et al. 2009).
+ The intensity range is quantized to iNumLayers levels. For every level the range
+ weights (taken from a lookup table) and the weighted signal are smoothed spatially with
+ the recursive gaussian, and each output sample is linearly interpolated between the two
+ levels that bracket its value. O(N * Layers), independent of the spatial support.
+ NaN samples get zero weight and stay NaN in the output.
+*/
+void LayeredBilateral(const double *afOriginalSignal, double *Out, int iSignalLength,
+					  const RecursiveGaussian &Spatial, double fEdgeSigma, int iNumLayers)
+{
+	double NaN = mxGetNaN();
+	double fMin = 0, fMax = 0;
+	bool bFirst = true;
+	for (int k=0;k<iSignalLength;k++) {
+		double v = afOriginalSignal[k];
+		if (v != v)
+			continue;
+		if (bFirst || v < fMin) fMin = v;
+		if (bFirst || v > fMax) fMax = v;
+		bFirst = false;
+	}
+
+	if (bFirst) {
+		for (int k=0;k<iSignalLength;k++)
+			Out[k] = NaN;
+		return;
+	}
+
+	if (fMax == fMin) {
+		// constant signal, nothing to smooth
+		for (int k=0;k<iSignalLength;k++)
+			Out[k] = afOriginalSignal[k];
+		return;
+	}
+
+	double fStep = (fMax-fMin) / (iNumLayers-1);
+
+	// Range kernel lookup table over [0, fMax-fMin]
+	std::vector<double> afRangeLUT(RANGE_LUT_SIZE+1);
+	double fLUTScale = RANGE_LUT_SIZE / (fMax-fMin);
+	double fEdgeDeno = 2*SQR(fEdgeSigma);
+	for (int j=0;j<=RANGE_LUT_SIZE;j++) {
+		double d = j / fLUTScale;
+		afRangeLUT[j] = exp(-d*d/fEdgeDeno);
+	}
+
+	std::vector<double> W(iSignalLength), J(iSignalLength), PrevLayer(iSignalLength), CurrLayer(iSignalLength);
+
+	for (int iLayer=0;iLayer<iNumLayers;iLayer++) {
+		double fLevel = fMin + iLayer*fStep;
+		for (int k=0;k<iSignalLength;k++) {
+			double v = afOriginalSignal[k];
+			if (v != v) {
+				W[k] = J[k] = 0;
+				continue;
+			}
+			int iLUT = int(fabs(v-fLevel) * fLUTScale + 0.5);
+			W[k] = afRangeLUT[MIN(iLUT,RANGE_LUT_SIZE)];
+			J[k] = W[k] * v;
+		}
+		Spatial.Filter(&W[0], &J[0], iSignalLength);
+
+		for (int k=0;k<iSignalLength;k++)
+			CurrLayer[k] = (W[k] > 1e-300) ? J[k] / W[k] : fLevel;
+
+		if (iLayer == 0) {
+			PrevLayer.swap(CurrLayer);
+			continue;
+		}
+
+		// Samples that fall between the previous level and this one are now complete. The interval of a
+		// sample comes from its value alone, so that every sample lands in exactly one (the top one is closed)
+		double fPrevLevel = fMin + (iLayer-1)*fStep;
+		for (int k=0;k<iSignalLength;k++) {
+			double v = afOriginalSignal[k];
+			if (v != v) {
+				Out[k] = NaN;
+				continue;
+			}
+			int iInterval = int((v-fMin) / fStep);
+			if (iInterval > iNumLayers-2)
+				iInterval = iNumLayers-2;
+			if (iInterval != iLayer-1)
+				continue;
+			double fAlpha = (v - fPrevLevel) / fStep;
+			if (fAlpha < 0)
+				fAlpha = 0;
+			if (fAlpha > 1)
+				fAlpha = 1;
+			Out[k] = (1-fAlpha) * PrevLayer[k] + fAlpha * CurrLayer[k];
+		}
+		PrevLayer.swap(CurrLayer);
+	}
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
 {
   if (nrhs < 4 || nlhs != 1) {
-    mexErrMsgTxt("Usage: afFilteredSignal = fnBiLateral1D(afOriginalSignal,fWidth,fBlurSigma,fEdgeSigma)");
+    mexErrMsgTxt("Usage: afFilteredSignal = fnBiLateral1D(afOriginalSignal,fWidth,fBlurSigma,fEdgeSigma, [iNumLayers])\n"
+		"afOriginalSignal can be a vector or a matrix with one channel per column (e.g., [afEyeX(:),afEyeY(:)]).\n"
+		"iNumLayers > 0 selects the fast piecewise-linear approximation (8-32 layers are usually enough). It uses\n"
+		"an untruncated recursive gaussian of fBlurSigma, so fWidth is ignored in that mode.");
 	return;
-  } 
+  }
+	if (!mxIsDouble(prhs[0])) {
+		mexErrMsgTxt("Input signal must be double.");
+		return;
+	}
 
 	double *afOriginalSignal = (double*)mxGetData(prhs[0]);
 	int  fWidth= (int) *(double*)mxGetData(prhs[1]);
 	double fBlurSigma= *(double*)mxGetData(prhs[2]);
 	double fEdgeSigma= *(double*)mxGetData(prhs[3]);
+	int iNumLayers = 0;
+	if (nrhs > 4)
+		iNumLayers = (int) *(double*)mxGetData(prhs[4]);
+
+	if (iNumLayers > MAX_NUM_LAYERS)
+		iNumLayers = MAX_NUM_LAYERS;
+	if (iNumLayers == 1)
+		iNumLayers = 2;
+
+	// A vector is a single channel (either orientation), a matrix is one channel per column
+	const mwSize* dim = mxGetDimensions(prhs[0]);
+	int iNumElements = int(mxGetNumberOfElements(prhs[0]));
+	int iNumChannels = 1;
+	if (mxGetNumberOfDimensions(prhs[0]) == 2 && dim[0] > 1 && dim[1] > 1)
+		iNumChannels = int(dim[1]);
+	int iSignalLength = iNumChannels > 0 ? iNumElements / iNumChannels : 0;
+
+	plhs[0] = mxCreateNumericArray(mxGetNumberOfDimensions(prhs[0]), dim, mxDOUBLE_CLASS, mxREAL);
+	double *Out = (double*)mxGetPr(plhs[0]);
 
-	int iSignalLength = mxGetNumberOfElements(prhs[0]);
+	if (iSignalLength == 0)
+		return;
+
+	if (iNumLayers > 0) {
+		RecursiveGaussian Spatial(fBlurSigma);
+		for (int iChannel=0;iChannel<iNumChannels;iChannel++)
+			LayeredBilateral(afOriginalSignal + iChannel*iSignalLength, Out + iChannel*iSignalLength, iSignalLength,
+							 Spatial, fEdgeSigma, iNumLayers);
+		return;
+	}
 
 	// Pre-compute Gaussian distance weights.
 	double *afGaussian = new double[2*fWidth+1];
@@ -33,24 +237,10 @@ void mexFunction( int nlhs, mxArray *plhs[],
 		double x = j-fWidth;
 		afGaussian[j] = exp(-(x*x)/deno);
 	}
-	const int* dim = mxGetDimensions(prhs[0]);
-	plhs[0] = mxCreateNumericArray(2, dim, mxDOUBLE_CLASS, mxREAL);
-	double *Out = (double*)mxGetPr(plhs[0]);
 
-	for (int k=0;k<iSignalLength;k++) {
+	for (int iChannel=0;iChannel<iNumChannels;iChannel++)
+		ExactBilateral(afOriginalSignal + iChannel*iSignalLength, Out + iChannel*iSignalLength, iSignalLength,
+					   fWidth, afGaussian, fEdgeSigma);
 
-         int iMin = MAX(k-fWidth,0);
-         int iMax = MIN(k+fWidth,iSignalLength-1);
-
-		 double S=0;
-		 double Sd = 0;
-		 for (int i=iMin;i<=iMax;i++) {
-			double fValue = afOriginalSignal[i];
-		    double Hi = exp(-SQR(fValue-afOriginalSignal[k])/(2*SQR(fEdgeSigma)));
-			double Di = Hi * afGaussian[i-k+fWidth];
-			Sd+= Di;
-			S+=Di * afOriginalSignal[i];
-		 }
-		 Out[k] = S / Sd;
-	}
+	delete [] afGaussian;
 }
@@ -2,3 +2,29 @@ addpath(genpath('W:\'));
 afEyeXpix=rand(1,1000);
 Y=fnBiLateral1D(afEyeXpix,70,60,30);
 Ymex=fndllBilateral1D(afEyeXpix,70,60,30);
+
+% Fast (layered) mode on two channels at once vs. the exact filter. The fast mode uses an
+% untruncated gaussian, so the exact one gets a support of 4 sigma to be comparable.
+rng(0);
+afT = 1:60000;
+a2fEye = [100+300*(mod(floor(afT/3000),2))', 200*sin(afT/5000)'] + randn(60000,2);
+tic; a2fExact = fndllBilateral1D(a2fEye,240,60,30); toc
+tic; a2fFast = fndllBilateral1D(a2fEye,240,60,30,16); toc
+fMaxDiff = max(abs(a2fExact(:)-a2fFast(:)));
+fprintf('Max abs difference %.4f pixels\n', fMaxDiff);
+assert(fMaxDiff < 0.5);
+
+% Samples exactly on a level (fMin + k*fStep) must still be filtered
+iNumLayers = 16;
+afLevels = 0.1 + (0:iNumLayers-1) * ((1.6-0.1)/(iNumLayers-1));
+afOnLevels = repmat(afLevels, 1, 20);
+afFast = fndllBilateral1D(afOnLevels(:),20,5,0.1,iNumLayers);
+afExact = fndllBilateral1D(afOnLevels(:),20,5,0.1);
+assert(all(afFast ~= 0));
+assert(max(abs(afFast-afExact)) < 0.1);
+
+% NaN samples stay NaN
+afWithNaN = a2fEye(:,1);
+afWithNaN(1000:1010) = NaN;
+afFast = fndllBilateral1D(afWithNaN,240,60,30,16);
+assert(all(isnan(afFast(1000:1010))) && ~any(isnan(afFast([1:999,1011:end]))));
@@ -0,0 +1,178 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+#include <algorithm>
+#include <system_error>
+#include "DaqAcquisition.h"
+
+const double POLL_SEC = 1e-3;
+const double MAX_DRIFT = 100e-6;	// seconds per second
+const int READ_SCANS = 1024;
+
+SampleRing::SampleRing(int iNumChannels, int iCapacity) :
+	m_iNumChannels(iNumChannels), m_iCapacity(iCapacity),
+	m_aiValues(size_t(iNumChannels) * iCapacity), m_afTimes(iCapacity), m_iWritten(0)
+{
+}
+
+void SampleRing::Push(const unsigned short *pScan, double fTime)
+{
+	long long iScan = m_iWritten.load(std::memory_order_relaxed);
+	size_t iSlot = size_t(iScan % m_iCapacity);
+	std::copy(pScan, pScan + m_iNumChannels, m_aiValues.begin() + iSlot * m_iNumChannels);
+	m_afTimes[iSlot] = fTime;
+	m_iWritten.store(iScan + 1, std::memory_order_release);
+}
+
+long long SampleRing::Read(long long iFrom, long long iTo, std::vector<unsigned short> &Values, std::vector<double> &Times) const
+{
+	long long iWritten = Written();
+	iTo = std::min(iTo, iWritten);
+	// leave one slot: the writer may be filling it
+	iFrom = std::max(iFrom, iWritten - m_iCapacity + 1);
+	Values.clear();
+	Times.clear();
+	if (iFrom >= iTo)
+		return iTo;
+
+	for (long long iScan = iFrom; iScan < iTo; iScan++) {
+		size_t iSlot = size_t(iScan % m_iCapacity);
+		Values.insert(Values.end(), m_aiValues.begin() + iSlot * m_iNumChannels, m_aiValues.begin() + (iSlot + 1) * m_iNumChannels);
+		Times.push_back(m_afTimes[iSlot]);
+	}
+
+	// Drop whatever the writer overwrote while it was copied: the fence keeps the copy above
+	// from being read after the count below
+	std::atomic_thread_fence(std::memory_order_acquire);
+	long long iOldest = Written() - m_iCapacity + 1;
+	if (iOldest > iFrom) {
+		long long iDrop = std::min(iOldest - iFrom, iTo - iFrom);
+		Values.erase(Values.begin(), Values.begin() + size_t(iDrop) * m_iNumChannels);
+		Times.erase(Times.begin(), Times.begin() + size_t(iDrop));
+		iFrom += iDrop;
+	}
+	return iFrom;
+}
+
+long long SampleRing::FirstAfter(double fTime) const
+{
+	long long iHigh = Written();
+	long long iLow = std::max(0LL, iHigh - m_iCapacity + 1);
+	while (iLow < iHigh) {
+		long long iMid = iLow + (iHigh - iLow) / 2;
+		if (Time(iMid) > fTime)
+			iHigh = iMid;
+		else
+			iLow = iMid + 1;
+	}
+	return iLow;
+}
+
+int DaqAcquisition::Start(const std::vector<int> &aiChannels, double *pfRate, double fBufferSec)
+{
+	Stop();
+	int ULStat = m_pBoard->StartScan(&aiChannels[0], int(aiChannels.size()), pfRate);
+	if (ULStat != 0)
+		return ULStat;
+	m_aiChannels = aiChannels;
+	m_fRate = *pfRate;
+	m_pRing = new SampleRing(int(aiChannels.size()), std::max(2, int(fBufferSec * m_fRate)));
+	m_bStop = false;
+	m_iLost = 0;
+	m_iError = 0;
+	try {
+		m_Thread = std::thread(&DaqAcquisition::Loop, this);
+	} catch (const std::system_error &) {
+		m_pBoard->StopScan();
+		return -1;
+	}
+	return 0;
+}
+
+void DaqAcquisition::Stop()
+{
+	if (Running()) {
+		m_bStop = true;
+		m_Thread.join();
+		m_pBoard->StopScan();
+	}
+	delete m_pRing;
+	m_pRing = NULL;
+}
+
+int DaqAcquisition::ChannelIndex(int iChannel) const
+{
+	for (size_t k = 0; k < m_aiChannels.size(); k++)
+		if (m_aiChannels[k] == iChannel)
+			return int(k);
+	return -1;
+}
+
+void DaqAcquisition::SetDetector(EyeDetector *pDetector)
+{
+	std::lock_guard<std::mutex> Guard(m_DetectorLock);
+	m_pDetector = pDetector;
+}
+
+void DaqAcquisition::Loop()
+{
+#ifdef _WIN32
+	timeBeginPeriod(1);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+#endif
+	int iNumChannels = m_pRing->NumChannels();
+	std::vector<unsigned short> Scans(size_t(READ_SCANS) * iNumChannels);
+	long long iNextScan = 0;	// lost scans included
+	double fFirstScan = 0, fLastPoll = 0, fLastStamp = -1e300;
+	bool bHaveFirst = false;
+
+	while (!m_bStop.load(std::memory_order_relaxed)) {
+		int iScans, iLost;
+		int ULStat = m_pBoard->ReadScan(&Scans[0], READ_SCANS, &iScans, &iLost);
+		double fNow = DaqGetSecs();
+		if (ULStat != 0) {
+			m_iError = ULStat;
+			DaqSleepSecs(POLL_SEC);
+			continue;
+		}
+		m_iLost += iLost;
+		iNextScan += iLost;
+		if (iScans == 0) {
+			DaqSleepSecs(POLL_SEC);
+			continue;
+		}
+
+		// The last of these scans ended at fNow at the latest
+		double fCandidate = fNow - double(iNextScan + iScans - 1) / m_fRate;
+		if (!bHaveFirst || fCandidate < fFirstScan)
+			fFirstScan = fCandidate;
+		else
+			fFirstScan += std::min(fCandidate - fFirstScan, MAX_DRIFT * (fNow - fLastPoll));
+		bHaveFirst = true;
+		fLastPoll = fNow;
+
+		{
+			std::lock_guard<std::mutex> Guard(m_DetectorLock);
+			for (int s = 0; s < iScans; s++, iNextScan++) {
+				double fStamp = std::max(fFirstScan + double(iNextScan) / m_fRate, fLastStamp + 1e-7);
+				const unsigned short *pScan = &Scans[size_t(s) * iNumChannels];
+				m_pRing->Push(pScan, fStamp);
+				if (m_pDetector != NULL)
+					m_pDetector->Process(pScan, fStamp);
+				fLastStamp = fStamp;
+			}
+		}
+		if (iScans < READ_SCANS)
+			DaqSleepSecs(POLL_SEC);
+	}
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
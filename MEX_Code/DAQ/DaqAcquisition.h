@@ -0,0 +1,87 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef DAQ_ACQUISITION_H
+#define DAQ_ACQUISITION_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DaqBoard.h"
+#include "DaqEyeDetector.h"
+
+/*
+ Continuous analog acquisition: a thread drains the hardware paced scan of the board (DaqBoard::ReadScan)
+ into a ring of timestamped scans, so eye position is sampled at an even rate whatever MATLAB is doing.
+
+ Scan i since StartAcquisition (lost scans included) is stamped t0 + i / Rate on the GetSecs clock.
+ Lost scans are not in the ring, they only leave a gap in the stamps. t0 is the lower envelope of
+ (time of the poll - time the scans that arrived took at the nominal rate): the poll that came back
+ soonest after a scan ended bounds it best. It is allowed to creep up by MAX_DRIFT (the board and
+ the PC clocks do not run at exactly the same rate). Stamps are kept strictly increasing.
+
+ The ring has a single writer (the thread). Readers copy what they need and check afterwards that
+ the writer did not overwrite it in the meantime. An eye detector (DaqEyeDetector.h) can be attached:
+ the thread passes it every scan as soon as the scan is in the ring.
+*/
+
+class SampleRing {
+public:
+	SampleRing(int iNumChannels, int iCapacity);
+	int NumChannels() const { return m_iNumChannels; }
+	int Capacity() const { return m_iCapacity; }
+	long long Written() const { return m_iWritten.load(std::memory_order_acquire); }
+
+	void Push(const unsigned short *pScan, double fTime);	// writer only
+
+	// Copies scans [iFrom, iTo) (scan after scan). Scans that are not in the ring anymore are skipped:
+	// returns the number of the first scan copied.
+	long long Read(long long iFrom, long long iTo, std::vector<unsigned short> &Values, std::vector<double> &Times) const;
+	long long FirstAfter(double fTime) const;	// first scan stamped later than fTime (Written() if none)
+	double Time(long long iScan) const { return m_afTimes[iScan % m_iCapacity]; }
+private:
+	int m_iNumChannels;
+	int m_iCapacity;
+	std::vector<unsigned short> m_aiValues;
+	std::vector<double> m_afTimes;
+	std::atomic<long long> m_iWritten;
+};
+
+class DaqAcquisition {
+public:
+	explicit DaqAcquisition(DaqBoard *pBoard) : m_pBoard(pBoard), m_pRing(NULL), m_fRate(0), m_bStop(false),
+		m_iLost(0), m_iError(0), m_pDetector(NULL) {}
+	~DaqAcquisition() { Stop(); }
+
+	int Start(const std::vector<int> &aiChannels, double *pfRate, double fBufferSec);
+	void Stop();
+	bool Running() const { return m_Thread.joinable(); }
+
+	const SampleRing *Ring() const { return m_pRing; }
+	int ChannelIndex(int iChannel) const;	// column of a channel in the ring, -1 if it is not scanned
+	double Rate() const { return m_fRate; }
+	long long Lost() const { return m_iLost.load(); }
+	int Error() const { return m_iError.load(); }	// last error of ReadScan
+
+	void SetDetector(EyeDetector *pDetector);	// NULL detaches. The caller keeps ownership
+
+private:
+	void Loop();
+
+	DaqBoard *m_pBoard;
+	SampleRing *m_pRing;
+	std::vector<int> m_aiChannels;
+	double m_fRate;
+	std::atomic<bool> m_bStop;
+	std::atomic<long long> m_iLost;
+	std::atomic<int> m_iError;
+	std::mutex m_DetectorLock;
+	EyeDetector *m_pDetector;
+	std::thread m_Thread;
+};
+
+#endif
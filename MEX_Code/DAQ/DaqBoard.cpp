@@ -0,0 +1,321 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifdef _WIN32
+#include <windows.h>
+#include "cbw.h"
+#endif
+#include <math.h>
+#include <algorithm>
+#include "DaqBoard.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+
+const int SCAN_BUFFER_SEC = 2;
+
+double DaqGetSecs()
+{
+	return ClockGetSecs();
+}
+
+void DaqSleepSecs(double fSec)
+{
+	// 1 ms resolution on Windows only while the timer period is 1 ms (timeBeginPeriod)
+	ClockSleepSecs(fSec);
+}
+
+/* Simulated board */
+
+void SimulatedBoard::Change(unsigned int iLines)
+{
+	// called with m_Lock held
+	if (iLines == m_iLines)
+		return;
+	m_iLines = iLines;
+	LineChange C;
+	C.m_fTime = DaqGetSecs();
+	C.m_iLines = iLines;
+	m_Log.push_back(C);
+}
+
+int SimulatedBoard::Configure()
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	Change(0);
+	return 0;
+}
+
+int SimulatedBoard::SetPort(int iPort, unsigned char Value)
+{
+	if (iPort < 0 || iPort >= DAQ_NUM_PORTS)
+		return 1;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	unsigned int iMask = DaqPortMask(iPort);
+	Change((m_iLines & ~iMask) | ((unsigned int)Value << DaqPortFirstBit(iPort) & iMask));
+	return 0;
+}
+
+int SimulatedBoard::SetBit(int iBit, int iValue)
+{
+	if (iBit < 0 || iBit >= DAQ_NUM_BITS)
+		return 1;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	unsigned int iMask = 1u << iBit;
+	Change(iValue ? (m_iLines | iMask) : (m_iLines & ~iMask));
+	return 0;
+}
+
+int SimulatedBoard::GetAnalog(int iChannel, unsigned short *pValue)
+{
+	if (iChannel < 0)
+		return 1;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	// mid scale, i.e. 0V on a +-5V range, away from the eye channels
+	double fValue = iChannel < 2 ? m_afEye[iChannel] : 2048;
+	*pValue = (unsigned short)floor(fValue + 0.5);
+	return 0;
+}
+
+int SimulatedBoard::StartScan(const int *aiChannels, int iNumChannels, double *pfRate)
+{
+	if (iNumChannels <= 0 || *pfRate <= 0)
+		return 1;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	m_aiChannels.assign(aiChannels, aiChannels + iNumChannels);
+	m_fScanRate = *pfRate;
+	m_fScanStart = DaqGetSecs();
+	m_iScans = 0;
+	m_iRandom = 12345;
+	for (int k = 0; k < 2; k++)
+		m_afEye[k] = m_afFrom[k] = m_afTarget[k] = 2048;
+	m_iSaccadeStart = -1;
+	m_iNextSaccade = (long long)(0.3 * m_fScanRate);
+	return 0;
+}
+
+// Eye position in a/d counts: fixations of 250-800 ms, minimum jerk saccades to random targets
+unsigned short SimulatedBoard::Synthetic(int iChannel)
+{
+	double fNoise = 0;
+	for (int k = 0; k < 2; k++) {
+		m_iRandom = m_iRandom * 1664525u + 1013904223u;
+		fNoise += double(m_iRandom >> 8) / double(1 << 24) - 0.5;
+	}
+	double fValue;
+	if (iChannel == 0 || iChannel == 1)
+		fValue = m_afEye[iChannel] + 2 * fNoise;
+	else
+		fValue = 2048 + 500 * sin(2 * 3.14159265358979 * double(m_iScans) / m_fScanRate) + 2 * fNoise;
+	return (unsigned short)std::max(0.0, std::min(4095.0, floor(fValue + 0.5)));
+}
+
+int SimulatedBoard::ReadScan(unsigned short *pData, int iMaxScans, int *piScans, int *piLost)
+{
+	*piScans = 0;
+	*piLost = 0;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	if (m_fScanRate <= 0)
+		return 1;
+	long long iAvailable = (long long)((DaqGetSecs() - m_fScanStart) * m_fScanRate) - m_iScans;
+	int iScans = int(std::min<long long>(iAvailable, iMaxScans));
+	int iNumChannels = int(m_aiChannels.size());
+	for (int s = 0; s < iScans; s++, m_iScans++) {
+		if (m_iScans == m_iNextSaccade) {
+			m_iRandom = m_iRandom * 1664525u + 1013904223u;
+			m_afFrom[0] = m_afEye[0];
+			m_afFrom[1] = m_afEye[1];
+			m_afTarget[0] = 2048 + double(int(m_iRandom % 1201) - 600);
+			m_afTarget[1] = 2048 + double(int((m_iRandom >> 11) % 1201) - 600);
+			m_iSaccadeStart = m_iScans;
+		}
+		if (m_iSaccadeStart >= 0) {
+			double fAmplitude = hypot(m_afTarget[0] - m_afFrom[0], m_afTarget[1] - m_afFrom[1]);
+			double fDuration = (0.02 + fAmplitude * 4e-5) * m_fScanRate;
+			double u = std::min(1.0, double(m_iScans - m_iSaccadeStart) / fDuration);
+			double fShape = u * u * u * (10 - 15 * u + 6 * u * u);
+			for (int k = 0; k < 2; k++)
+				m_afEye[k] = m_afFrom[k] + fShape * (m_afTarget[k] - m_afFrom[k]);
+			if (u >= 1) {
+				m_iSaccadeStart = -1;
+				m_iNextSaccade = m_iScans + (long long)((0.25 + 0.55 * double(m_iRandom >> 22) / 1024.0) * m_fScanRate);
+			}
+		}
+		for (int c = 0; c < iNumChannels; c++)
+			*pData++ = Synthetic(m_aiChannels[c]);
+	}
+	*piScans = iScans;
+	return 0;
+}
+
+int SimulatedBoard::StopScan()
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	m_fScanRate = 0;
+	return 0;
+}
+
+void SimulatedBoard::TakeLog(std::vector<LineChange> &Out)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	Out.swap(m_Log);
+	m_Log.clear();
+}
+
+/* Measurement Computing board */
+
+#ifdef _WIN32
+static int PortType(int iPort)
+{
+	static const int aiPortType[DAQ_NUM_PORTS] = {FIRSTPORTA, FIRSTPORTB, FIRSTPORTCL, FIRSTPORTCH};
+	return aiPortType[iPort];
+}
+
+int CbwBoard::Configure()
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	float RevLevel = (float)CURRENTREVNUM;
+	cbDeclareRevision(&RevLevel);
+	cbErrHandling(DONTPRINT, DONTSTOP);
+
+	// Setup all digital ports to be "OUT"
+	int ULStat = NOERRORS;
+	for (int iPort = 0; iPort < DAQ_NUM_PORTS; iPort++) {
+		int ULStatPort = cbDConfigPort(m_iBoardNum, PortType(iPort), DIGITALOUT);
+		if (ULStat == NOERRORS)
+			ULStat = ULStatPort;
+	}
+	// Zero out all lines
+	for (int Bit = 0; Bit < DAQ_NUM_BITS; Bit++) {
+		int ULStatBit = cbDBitOut(m_iBoardNum, FIRSTPORTA, Bit, 0);
+		if (ULStatBit != NOERRORS) {
+			if (ULStat == NOERRORS)
+				ULStat = ULStatBit;
+			break;
+		}
+	}
+	return ULStat;
+}
+
+int CbwBoard::SetPort(int iPort, unsigned char Value)
+{
+	if (iPort < 0 || iPort >= DAQ_NUM_PORTS)
+		return BADPORTNUM;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	return cbDOut(m_iBoardNum, PortType(iPort), Value);
+}
+
+int CbwBoard::SetBit(int iBit, int iValue)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	return cbDBitOut(m_iBoardNum, FIRSTPORTA, iBit, iValue ? 1 : 0);
+}
+
+int CbwBoard::GetAnalog(int iChannel, unsigned short *pValue)
+{
+	// assume +- 5V
+	WORD Data = 0;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	int UDStat = cbAIn(m_iBoardNum, iChannel, BIP5VOLTS, &Data);
+	*pValue = Data;
+	return UDStat;
+}
+
+int CbwBoard::StartScan(const int *aiChannels, int iNumChannels, double *pfRate)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	StopScanLocked();
+	if (iNumChannels <= 0)
+		return BADADCHAN;
+	// cbAInScan scans a range of channels, the requested ones are picked out of every scan
+	int iLow = *std::min_element(aiChannels, aiChannels + iNumChannels);
+	int iHigh = *std::max_element(aiChannels, aiChannels + iNumChannels);
+	m_iLowChan = iLow;
+	m_iScanChannels = iHigh - iLow + 1;
+	m_aiPick.resize(iNumChannels);
+	for (int c = 0; c < iNumChannels; c++)
+		m_aiPick[c] = aiChannels[c] - iLow;
+
+	long iScans = (long(*pfRate * SCAN_BUFFER_SEC) / 512 + 1) * 512;
+	m_iBufferPoints = iScans * m_iScanChannels;
+	m_hBuffer = cbWinBufAlloc(m_iBufferPoints);
+	if (m_hBuffer == NULL)
+		return NOWINDOWSMEMORY;
+	m_Points.resize(m_iBufferPoints);
+	m_iReadPoints = 0;
+	m_iTotalPoints = 0;
+	m_iLastCount = 0;
+
+	long Rate = long(*pfRate + 0.5);
+	int ULStat = cbAInScan(m_iBoardNum, iLow, iHigh, m_iBufferPoints, &Rate, BIP5VOLTS, (HGLOBAL)m_hBuffer, BACKGROUND | CONTINUOUS);
+	if (ULStat != NOERRORS) {
+		cbWinBufFree((HGLOBAL)m_hBuffer);
+		m_hBuffer = NULL;
+		return ULStat;
+	}
+	*pfRate = double(Rate);
+	return NOERRORS;
+}
+
+int CbwBoard::ReadScan(unsigned short *pData, int iMaxScans, int *piScans, int *piLost)
+{
+	*piScans = 0;
+	*piLost = 0;
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	if (m_hBuffer == NULL)
+		return BADADCHAN;
+
+	short Status;
+	long CurCount, CurIndex;
+	int ULStat = cbGetStatus(m_iBoardNum, &Status, &CurCount, &CurIndex, AIFUNCTION);
+	if (ULStat != NOERRORS)
+		return ULStat;
+	m_iTotalPoints += (unsigned long)(CurCount - m_iLastCount);
+	m_iLastCount = CurCount;
+
+	// Whatever the board overwrote before it was read is lost. Keep half a buffer of slack.
+	long long iOldest = m_iTotalPoints - m_iBufferPoints / 2;
+	if (m_iReadPoints < iOldest) {
+		long long iSkip = (iOldest - m_iReadPoints + m_iScanChannels - 1) / m_iScanChannels;
+		*piLost = int(iSkip);
+		m_iReadPoints += iSkip * m_iScanChannels;
+	}
+	long long iScans = std::min<long long>((m_iTotalPoints - m_iReadPoints) / m_iScanChannels, iMaxScans);
+	if (iScans <= 0)
+		return NOERRORS;
+
+	long iCount = long(iScans * m_iScanChannels);
+	long iFirst = long(m_iReadPoints % m_iBufferPoints);
+	long iPart = std::min(iCount, m_iBufferPoints - iFirst);
+	ULStat = cbWinBufToArray((HGLOBAL)m_hBuffer, &m_Points[0], iFirst, iPart);
+	if (ULStat == NOERRORS && iPart < iCount)
+		ULStat = cbWinBufToArray((HGLOBAL)m_hBuffer, &m_Points[iPart], 0, iCount - iPart);
+	if (ULStat != NOERRORS)
+		return ULStat;
+
+	int iNumChannels = int(m_aiPick.size());
+	for (long long s = 0; s < iScans; s++)
+		for (int c = 0; c < iNumChannels; c++)
+			*pData++ = m_Points[s * m_iScanChannels + m_aiPick[c]];
+	m_iReadPoints += iCount;
+	*piScans = int(iScans);
+	return NOERRORS;
+}
+
+int CbwBoard::StopScan()
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	return StopScanLocked();
+}
+
+int CbwBoard::StopScanLocked()
+{
+	if (m_hBuffer == NULL)
+		return NOERRORS;
+	int ULStat = cbStopBackground(m_iBoardNum, AIFUNCTION);
+	cbWinBufFree((HGLOBAL)m_hBuffer);
+	m_hBuffer = NULL;
+	return ULStat;
+}
+#endif
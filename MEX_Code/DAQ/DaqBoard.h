@@ -0,0 +1,132 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef DAQ_BOARD_H
+#define DAQ_BOARD_H
+
+#include <vector>
+#include <mutex>
+
+/*
+ Digital/analog I/O of the acquisition card, as used by fnDAQ.
+
+ The 24 digital lines are FIRSTPORTA (bits 0..7), FIRSTPORTB (bits 8..15), FIRSTPORTCL (bits 16..19)
+ and FIRSTPORTCH (bits 20..23); a port is addressed by its number 0..3, a line by its bit 0..23.
+ Every call returns 0 on success, or the error code of the board.
+
+ Analog channels are either read one value at a time (GetAnalog), or scanned continuously at a
+ hardware paced rate: StartScan starts the scan, ReadScan copies the scans that arrived since the
+ previous call (iNumChannels values per scan, in the order of aiChannels) without blocking, and
+ reports how many scans were lost because they were not read in time.
+
+ The board is shared by the MATLAB thread (GetAnalog, Init, commands emitted right away), the output
+ sequencer and the acquisition thread: every implementation serializes its calls with a mutex, so
+ a call may wait for the one in progress on another thread (a few tens of us for cbAIn).
+
+ CbwBoard talks to a Measurement Computing board through the universal library (Windows only).
+ SimulatedBoard keeps the state of the lines in memory and logs every change with its time, so
+ the output sequencer can be run and checked without a card (and on Linux). Its scan is a
+ synthetic eye signal (fixations and saccades on channels 0 and 1) paced by the clock; GetAnalog
+ returns the last scanned eye position on channels 0 and 1 (mid scale before a scan) and mid scale
+ on the other channels.
+*/
+
+class DaqBoard {
+public:
+	virtual ~DaqBoard() {}
+	virtual int Configure() = 0;	// all digital ports as outputs, all lines low
+	virtual int SetPort(int iPort, unsigned char Value) = 0;
+	virtual int SetBit(int iBit, int iValue) = 0;
+	virtual int GetAnalog(int iChannel, unsigned short *pValue) = 0;
+
+	virtual int StartScan(const int *aiChannels, int iNumChannels, double *pfRate) = 0; // *pfRate: scans per second, requested and actual
+	virtual int ReadScan(unsigned short *pData, int iMaxScans, int *piScans, int *piLost) = 0;
+	virtual int StopScan() = 0;
+};
+
+const int DAQ_NUM_PORTS = 4;
+const int DAQ_NUM_BITS = 24;
+
+inline int DaqPortFirstBit(int iPort) {
+	static const int aiFirstBit[DAQ_NUM_PORTS] = {0, 8, 16, 20};
+	return aiFirstBit[iPort];
+}
+
+inline unsigned int DaqPortMask(int iPort) {
+	return (iPort < 2 ? 0xFFu : 0x0Fu) << DaqPortFirstBit(iPort);
+}
+
+double DaqGetSecs(); // same time base as GetSecs (QueryPerformanceCounter on Windows)
+void DaqSleepSecs(double fSec);
+
+typedef struct {
+	double m_fTime;
+	unsigned int m_iLines;	// state of the 24 lines after the change
+} LineChange;
+
+class SimulatedBoard : public DaqBoard {
+public:
+	SimulatedBoard() : m_iLines(0), m_fScanRate(0), m_fScanStart(0), m_iScans(0) {
+		m_afEye[0] = m_afEye[1] = 2048;
+	}
+	int Configure();
+	int SetPort(int iPort, unsigned char Value);
+	int SetBit(int iBit, int iValue);
+	int GetAnalog(int iChannel, unsigned short *pValue);
+	int StartScan(const int *aiChannels, int iNumChannels, double *pfRate);
+	int ReadScan(unsigned short *pData, int iMaxScans, int *piScans, int *piLost);
+	int StopScan();
+
+	void TakeLog(std::vector<LineChange> &Out); // moves the logged changes to Out
+private:
+	void Change(unsigned int iLines);
+	unsigned short Synthetic(int iChannel);
+	std::mutex m_Lock;
+	unsigned int m_iLines;
+	std::vector<LineChange> m_Log;
+
+	// synthetic scan
+	std::vector<int> m_aiChannels;
+	double m_fScanRate;
+	double m_fScanStart;
+	long long m_iScans;
+	unsigned int m_iRandom;
+	double m_afEye[2], m_afFrom[2], m_afTarget[2];
+	long long m_iSaccadeStart, m_iNextSaccade;
+};
+
+#ifdef _WIN32
+class CbwBoard : public DaqBoard {
+public:
+	explicit CbwBoard(int iBoardNum) : m_iBoardNum(iBoardNum), m_hBuffer(NULL) {}
+	~CbwBoard() { StopScan(); }
+	int Configure();
+	int SetPort(int iPort, unsigned char Value);
+	int SetBit(int iBit, int iValue);
+	int GetAnalog(int iChannel, unsigned short *pValue);
+	int StartScan(const int *aiChannels, int iNumChannels, double *pfRate);
+	int ReadScan(unsigned short *pData, int iMaxScans, int *piScans, int *piLost);
+	int StopScan();
+	int BoardNum() const { return m_iBoardNum; }
+private:
+	int StopScanLocked();
+	int m_iBoardNum;
+	std::mutex m_Lock;	// the universal library is not documented as thread safe
+
+	// background scan of channels m_iLowChan..m_iLowChan+m_iScanChannels-1 into a circular buffer
+	void *m_hBuffer;
+	int m_iLowChan;
+	int m_iScanChannels;
+	long m_iBufferPoints;
+	long long m_iReadPoints;	// points copied out of the buffer so far
+	long long m_iTotalPoints;	// points acquired so far
+	long m_iLastCount;		// CurCount of the previous status (wraps at 2^31)
+	std::vector<int> m_aiPick;	// index of the requested channels within a scan
+	std::vector<unsigned short> m_Points;
+};
+#endif
+
+#endif
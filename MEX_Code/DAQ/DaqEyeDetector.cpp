@@ -0,0 +1,217 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <math.h>
+#include <algorithm>
+#include "DaqEyeDetector.h"
+
+#define SQR(x)((x)*(x))
+
+const int EYE_EVENT_QUEUE_SIZE = 4096;
+
+void EyeDetectorDefaults(EyeDetectorParams &Params)
+{
+	for (int k = 0; k < 2; k++) {
+		Params.m_afCenter[k] = 2048;
+		Params.m_afGain[k] = 1;
+		Params.m_afOffset[k] = 0;
+	}
+	Params.m_iFilter = EYE_FILTER_MEDIAN;
+	Params.m_iFilterLength = 5;
+	Params.m_fRangeSigma = 20;
+	Params.m_iVelocityScans = 4;
+	Params.m_fSaccadeVelocity = 2000;
+	Params.m_fSaccadeOffVelocity = 1500;
+	Params.m_fSaccadeAcceleration = 0;
+	Params.m_iMinSaccadeScans = 2;
+	Params.m_fMinFixationSec = 0.1;
+	Params.m_fBreakSec = 0;
+}
+
+EyeDetector::EyeDetector(int iColumnX, int iColumnY, const EyeDetectorParams &Params) :
+	m_Params(Params), m_iHistory(0), m_fSpeed(0),
+	m_iAbove(0), m_fAboveStart(0), m_fAboveSpeed(0), m_fMaxAcceleration(0), m_bSaccade(false), m_fPeakSpeed(0),
+	m_Events(EYE_EVENT_QUEUE_SIZE), m_iDropped(0)
+{
+	m_aiColumn[0] = iColumnX;
+	m_aiColumn[1] = iColumnY;
+	m_Params.m_iFilterLength = std::max(1, std::min(MAX_EYE_FILTER, m_Params.m_iFilterLength));
+	m_Params.m_iVelocityScans = std::max(1, std::min(MAX_EYE_FILTER - 1, m_Params.m_iVelocityScans));
+	m_afPos[0] = m_afPos[1] = 0;
+
+	// trailing half of a gaussian, sigma = half the length
+	double fSigma = std::max(0.5, m_Params.m_iFilterLength / 2.0);
+	for (int iLag = 0; iLag < MAX_EYE_FILTER; iLag++)
+		m_afGaussian[iLag] = exp(-SQR(double(iLag)) / (2 * SQR(fSigma)));
+}
+
+void EyeDetector::SetCalibration(const double *afCenter, const double *afGain, const double *afOffset)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	for (int k = 0; k < 2; k++) {
+		m_Params.m_afCenter[k] = afCenter[k];
+		m_Params.m_afGain[k] = afGain[k];
+		m_Params.m_afOffset[k] = afOffset[k];
+	}
+}
+
+void EyeDetector::SetTargets(const std::vector<FixationTarget> &Targets)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	// targets that stay keep their state
+	std::vector<Window> Windows;
+	for (size_t k = 0; k < Targets.size(); k++) {
+		Window W;
+		W.m_Target = Targets[k];
+		W.m_bInside = W.m_bAcquired = false;
+		W.m_fEntered = W.m_fLeft = 0;
+		for (size_t j = 0; j < m_Windows.size(); j++)
+			if (m_Windows[j].m_Target.m_iId == Targets[k].m_iId &&
+				m_Windows[j].m_Target.m_fX == Targets[k].m_fX && m_Windows[j].m_Target.m_fY == Targets[k].m_fY) {
+				W = m_Windows[j];
+				W.m_Target.m_fRadius = Targets[k].m_fRadius;
+			}
+		Windows.push_back(W);
+	}
+	m_Windows.swap(Windows);
+}
+
+void EyeDetector::TakeEvents(std::vector<EyeEvent> &Out)
+{
+	EyeEvent E;
+	while (m_Events.Pop(E))
+		Out.push_back(E);
+}
+
+void EyeDetector::State(double *afState)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	afState[0] = m_afPos[0];
+	afState[1] = m_afPos[1];
+	afState[2] = m_fSpeed;
+	afState[3] = m_bSaccade;
+	afState[4] = 0;
+	for (size_t k = 0; k < m_Windows.size(); k++)
+		if (m_Windows[k].m_bAcquired) {
+			afState[4] = m_Windows[k].m_Target.m_iId;
+			break;
+		}
+}
+
+void EyeDetector::Emit(int iType, int iTarget, double fTime, double fValue)
+{
+	EyeEvent E;
+	E.m_iType = iType;
+	E.m_iTarget = iTarget;
+	E.m_fTime = fTime;
+	E.m_fX = m_afPos[0];
+	E.m_fY = m_afPos[1];
+	E.m_fValue = fValue;
+	if (!m_Events.Push(E))
+		m_iDropped++;
+}
+
+// Filtered value of the newest position of an axis
+double EyeDetector::Filter(int iAxis)
+{
+	int iLength = std::min(m_iHistory, m_Params.m_iFilterLength);
+	const double *afHistory = m_aafHistory[iAxis];
+	int iNewest = (m_iHistory - 1) % MAX_EYE_FILTER;
+	double fNewest = afHistory[iNewest];
+
+	if (m_Params.m_iFilter == EYE_FILTER_MEDIAN && iLength > 2) {
+		double afWindow[MAX_EYE_FILTER];
+		for (int iLag = 0; iLag < iLength; iLag++)
+			afWindow[iLag] = afHistory[(iNewest - iLag + MAX_EYE_FILTER) % MAX_EYE_FILTER];
+		std::nth_element(afWindow, afWindow + iLength / 2, afWindow + iLength);
+		return afWindow[iLength / 2];
+	}
+	if (m_Params.m_iFilter == EYE_FILTER_BILATERAL && iLength > 1) {
+		double fEdgeDeno = 2 * SQR(m_Params.m_fRangeSigma);
+		double S = 0, Sd = 0;
+		for (int iLag = 0; iLag < iLength; iLag++) {
+			double fValue = afHistory[(iNewest - iLag + MAX_EYE_FILTER) % MAX_EYE_FILTER];
+			double Di = exp(-SQR(fValue - fNewest) / fEdgeDeno) * m_afGaussian[iLag];
+			Sd += Di;
+			S += Di * fValue;
+		}
+		return S / Sd;
+	}
+	return fNewest;
+}
+
+void EyeDetector::Process(const unsigned short *pScan, double fTime)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+
+	int iSlot = m_iHistory % MAX_EYE_FILTER;
+	for (int k = 0; k < 2; k++)
+		m_aafHistory[k][iSlot] = (double(pScan[m_aiColumn[k]]) - m_Params.m_afCenter[k]) * m_Params.m_afGain[k] + m_Params.m_afOffset[k];
+	m_afTimes[iSlot] = fTime;
+	m_iHistory++;
+
+	for (int k = 0; k < 2; k++)
+		m_afPos[k] = m_aafFiltered[k][iSlot] = Filter(k);
+
+	// Saccades
+	int iSpan = m_Params.m_iVelocityScans;
+	double fPrevSpeed = m_fSpeed;
+	int iPrevSlot = (iSlot - 1 + MAX_EYE_FILTER) % MAX_EYE_FILTER;
+	int iFromSlot = (iSlot - iSpan + MAX_EYE_FILTER) % MAX_EYE_FILTER;
+	if (m_iHistory > iSpan && fTime > m_afTimes[iFromSlot]) {
+		m_fSpeed = sqrt(SQR(m_afPos[0] - m_aafFiltered[0][iFromSlot]) + SQR(m_afPos[1] - m_aafFiltered[1][iFromSlot])) /
+			(fTime - m_afTimes[iFromSlot]);
+		double fSpeed = m_fSpeed;
+		double fAcceleration = m_iHistory > iSpan + 1 ? (fSpeed - fPrevSpeed) / (fTime - m_afTimes[iPrevSlot]) : 0;
+
+		if (!m_bSaccade) {
+			if (fSpeed > m_Params.m_fSaccadeVelocity) {
+				if (m_iAbove == 0) {
+					m_fAboveStart = fTime;
+					m_fAboveSpeed = fSpeed;
+					m_fMaxAcceleration = fAcceleration;
+				}
+				m_fMaxAcceleration = std::max(m_fMaxAcceleration, fAcceleration);
+				m_iAbove++;
+				if (m_iAbove >= m_Params.m_iMinSaccadeScans &&
+					(m_Params.m_fSaccadeAcceleration <= 0 || m_fMaxAcceleration >= m_Params.m_fSaccadeAcceleration)) {
+					m_bSaccade = true;
+					m_fPeakSpeed = fSpeed;
+					Emit(EYE_SACCADE_ONSET, 0, m_fAboveStart, m_fAboveSpeed);
+				}
+			} else
+				m_iAbove = 0;
+		} else {
+			m_fPeakSpeed = std::max(m_fPeakSpeed, fSpeed);
+			if (fSpeed < m_Params.m_fSaccadeOffVelocity) {
+				m_bSaccade = false;
+				m_iAbove = 0;
+				Emit(EYE_SACCADE_OFFSET, 0, fTime, m_fPeakSpeed);
+			}
+		}
+	}
+	if (m_iHistory >= 2 * MAX_EYE_FILTER)
+		m_iHistory -= MAX_EYE_FILTER; // keeps the slot of the newest position, and a full history
+
+	// Fixation windows
+	for (size_t k = 0; k < m_Windows.size(); k++) {
+		Window &W = m_Windows[k];
+		bool bInside = SQR(m_afPos[0] - W.m_Target.m_fX) + SQR(m_afPos[1] - W.m_Target.m_fY) <= SQR(W.m_Target.m_fRadius);
+		if (bInside && !W.m_bInside)
+			W.m_fEntered = fTime;
+		if (!bInside && W.m_bInside)
+			W.m_fLeft = fTime;
+		W.m_bInside = bInside;
+
+		if (!W.m_bAcquired && bInside && fTime - W.m_fEntered >= m_Params.m_fMinFixationSec) {
+			W.m_bAcquired = true;
+			Emit(EYE_FIXATION_ACQUIRED, W.m_Target.m_iId, fTime, W.m_fEntered);
+		} else if (W.m_bAcquired && !bInside && fTime - W.m_fLeft >= m_Params.m_fBreakSec) {
+			W.m_bAcquired = false;
+			Emit(EYE_FIXATION_BROKEN, W.m_Target.m_iId, fTime, W.m_fLeft);
+		}
+	}
+}
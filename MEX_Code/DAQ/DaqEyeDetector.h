@@ -0,0 +1,125 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef DAQ_EYE_DETECTOR_H
+#define DAQ_EYE_DETECTOR_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "SpscRing.h"
+
+/*
+ Online fixation / saccade detection on the continuous eye position scan.
+
+ The acquisition thread hands every scan to Process, right after it was stored in the ring, so
+ events are stamped with the time of the scan that caused them, not with the time MATLAB got to
+ look at it. Per scan:
+  1. Calibration, as in fnKofikoCycleClean: (raw - Center) * Gain + Offset, per axis. Positions,
+     speeds and window radii are all in these units (screen pixels in Kofiko).
+  2. A short causal filter over the last m_iFilterLength positions: running median, or the
+     trailing half of the bilateral filter of fnBiLateral1D (gaussian in the lag, gaussian of
+     width m_fRangeSigma in the distance to the newest position).
+  3. Speed from the filtered positions m_iVelocityScans scans apart (a difference over a few
+     scans: at 1-2 kHz one a/d count between consecutive scans is already a fast eye movement),
+     acceleration from consecutive speeds.
+     A saccade starts once the speed stayed above m_fSaccadeVelocity for m_iMinSaccadeScans scans
+     and the acceleration crossed m_fSaccadeAcceleration on the way (0: not checked). The onset
+     is stamped at the first of these scans. It ends at the first scan below m_fSaccadeOffVelocity.
+  4. Fixation windows: circles around the targets. A target is acquired once the eye stayed in
+     its window for m_fMinFixationSec, and broken once the eye stayed out of it for m_fBreakSec.
+
+ Events go into a single producer/single consumer ring read by 'GetEyeEvents'.
+*/
+
+enum {
+	EYE_SACCADE_ONSET = 1,
+	EYE_SACCADE_OFFSET = 2,
+	EYE_FIXATION_ACQUIRED = 3,
+	EYE_FIXATION_BROKEN = 4
+};
+
+enum {
+	EYE_FILTER_NONE = 0,
+	EYE_FILTER_MEDIAN = 1,
+	EYE_FILTER_BILATERAL = 2
+};
+
+typedef struct {
+	int m_iType;
+	int m_iTarget;		// target id for fixation events, 0 for saccades
+	double m_fTime;
+	double m_fX, m_fY;	// filtered, calibrated position
+	double m_fValue;	// onset: speed. offset: peak speed. acquired: time the eye entered the window.
+						// broken: time the eye left the window
+} EyeEvent;
+
+typedef struct {
+	int m_iId;
+	double m_fX, m_fY, m_fRadius;
+} FixationTarget;
+
+typedef struct {
+	double m_afCenter[2], m_afGain[2], m_afOffset[2];
+	int m_iFilter;
+	int m_iFilterLength;	// scans, at most MAX_EYE_FILTER
+	double m_fRangeSigma;
+	int m_iVelocityScans;	// at most MAX_EYE_FILTER - 1
+	double m_fSaccadeVelocity, m_fSaccadeOffVelocity, m_fSaccadeAcceleration;
+	int m_iMinSaccadeScans;
+	double m_fMinFixationSec, m_fBreakSec;
+} EyeDetectorParams;
+
+const int MAX_EYE_FILTER = 64;
+
+void EyeDetectorDefaults(EyeDetectorParams &Params);
+
+class EyeDetector {
+public:
+	EyeDetector(int iColumnX, int iColumnY, const EyeDetectorParams &Params);
+
+	void Process(const unsigned short *pScan, double fTime);	// acquisition thread only
+
+	void SetCalibration(const double *afCenter, const double *afGain, const double *afOffset);
+	void SetTargets(const std::vector<FixationTarget> &Targets);
+	void TakeEvents(std::vector<EyeEvent> &Out);
+	long long Dropped() const { return m_iDropped.load(); }
+
+	// latest filtered position, speed, 1 during a saccade, id of the acquired target (0 if none)
+	void State(double *afState);
+
+private:
+	typedef struct {
+		FixationTarget m_Target;
+		bool m_bInside, m_bAcquired;
+		double m_fEntered, m_fLeft;
+	} Window;
+
+	double Filter(int iAxis);
+	void Emit(int iType, int iTarget, double fTime, double fValue);
+
+	int m_aiColumn[2];
+	EyeDetectorParams m_Params;
+	std::mutex m_Lock;	// calibration, targets and state, between MATLAB and the acquisition thread
+	std::vector<Window> m_Windows;
+
+	double m_aafHistory[2][MAX_EYE_FILTER];
+	int m_iHistory;		// positions seen so far (wraps between MAX_EYE_FILTER and 2 * MAX_EYE_FILTER)
+	double m_afGaussian[MAX_EYE_FILTER];
+
+	double m_aafFiltered[2][MAX_EYE_FILTER];	// same slots as m_aafHistory
+	double m_afTimes[MAX_EYE_FILTER];
+	double m_afPos[2], m_fSpeed;
+	int m_iAbove;			// consecutive scans above the saccade velocity
+	double m_fAboveStart, m_fAboveSpeed, m_fMaxAcceleration;
+	bool m_bSaccade;
+	double m_fPeakSpeed;
+
+	SpscRing<EyeEvent> m_Events;
+	std::atomic<long long> m_iDropped;
+};
+
+#endif
@@ -0,0 +1,302 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+#include <algorithm>
+#include <system_error>
+#include "DaqSequencer.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+
+const int COMMAND_QUEUE_SIZE = 4096;
+const int EMITTED_QUEUE_SIZE = 16384;
+const double IDLE_POLL_SEC = 1e-3; // longest sleep between two looks at the command queue
+
+enum {
+	EDGE_BIT,
+	EDGE_PORT,
+	EDGE_STROBE_ON,
+	EDGE_STROBE_OFF
+};
+
+typedef struct {
+	double m_fWhen;
+	unsigned long long m_iSeq;	// keeps edges of the same time in the order they were generated
+	int m_iOp;
+	int m_iLine;
+	int m_iValue;
+	bool m_bFirst;				// first edge of its command: its emission is reported
+	SeqEmission m_Report;
+} Edge;
+
+struct EdgeLater {
+	bool operator()(const Edge &A, const Edge &B) const {
+		return A.m_fWhen > B.m_fWhen || (A.m_fWhen == B.m_fWhen && A.m_iSeq > B.m_iSeq);
+	}
+};
+
+void DaqSequencer::WaitUntil(double fTime, double fSpinSec)
+{
+	ClockWaitUntil(fTime, fSpinSec);
+}
+
+static void AddEdge(std::vector<Edge> &Edges, unsigned long long &iSeq, const SeqCommand &Cmd,
+					double fWhen, int iOp, int iLine, int iValue)
+{
+	Edge E;
+	E.m_fWhen = fWhen;
+	E.m_iSeq = iSeq++;
+	E.m_iOp = iOp;
+	E.m_iLine = iLine;
+	E.m_iValue = iValue;
+	E.m_bFirst = false;
+	E.m_Report.m_iId = Cmd.m_iId;
+	E.m_Report.m_iType = Cmd.m_iType;
+	E.m_Report.m_iValue = Cmd.m_iType == SEQ_STROBE || Cmd.m_iType == SEQ_SET_PORT ? Cmd.m_iValue : Cmd.m_iLine;
+	E.m_Report.m_iStatus = 0;
+	E.m_Report.m_fScheduled = fWhen;
+	E.m_Report.m_fEmitted = 0;
+	Edges.push_back(E);
+}
+
+// Appends the edges of a command. fStrobeFree is the earliest time the next strobe word may go out.
+static void Expand(const SeqCommand &Cmd, double fNow, double &fStrobeFree, unsigned long long &iSeq, std::vector<Edge> &Edges)
+{
+	size_t iFirst = Edges.size();
+	double t = Cmd.m_fWhen > 0 ? Cmd.m_fWhen : fNow;
+	const double *P = Cmd.m_afParam;
+
+	switch (Cmd.m_iType) {
+		case SEQ_STROBE:
+			t = std::max(t, fStrobeFree);
+			AddEdge(Edges, iSeq, Cmd, t, EDGE_STROBE_ON, 0, Cmd.m_iValue);
+			AddEdge(Edges, iSeq, Cmd, t + STROBE_PULSE_SEC, EDGE_STROBE_OFF, 0, 0);
+			fStrobeFree = t + 2 * STROBE_PULSE_SEC;
+			break;
+		case SEQ_TTL:
+			AddEdge(Edges, iSeq, Cmd, t, EDGE_BIT, Cmd.m_iLine, 1);
+			AddEdge(Edges, iSeq, Cmd, t + P[0], EDGE_BIT, Cmd.m_iLine, 0);
+			break;
+		case SEQ_PULSE_TRAIN:
+			for (int k = 0; k < Cmd.m_iCount; k++) {
+				AddEdge(Edges, iSeq, Cmd, t + k * P[1], EDGE_BIT, Cmd.m_iLine, 1);
+				AddEdge(Edges, iSeq, Cmd, t + k * P[1] + P[0], EDGE_BIT, Cmd.m_iLine, 0);
+			}
+			break;
+		case SEQ_SET_BIT:
+			AddEdge(Edges, iSeq, Cmd, t, EDGE_BIT, Cmd.m_iLine, Cmd.m_iValue);
+			break;
+		case SEQ_SET_PORT:
+			AddEdge(Edges, iSeq, Cmd, t, EDGE_PORT, Cmd.m_iLine, Cmd.m_iValue);
+			break;
+		case SEQ_DELAYED_TRIGGER: {
+			// Gate shuts down the head stage amplifier just before the two stimulation pulses
+			double fFirst = t + P[0];
+			double fSecond = fFirst + P[2] + P[4];
+			AddEdge(Edges, iSeq, Cmd, t, EDGE_BIT, Cmd.m_iLine, 1);
+			AddEdge(Edges, iSeq, Cmd, fFirst, EDGE_BIT, Cmd.m_iLine2, 1);
+			AddEdge(Edges, iSeq, Cmd, fFirst + P[2], EDGE_BIT, Cmd.m_iLine2, 0);
+			AddEdge(Edges, iSeq, Cmd, fSecond, EDGE_BIT, Cmd.m_iLine2, 1);
+			AddEdge(Edges, iSeq, Cmd, fSecond + P[3], EDGE_BIT, Cmd.m_iLine2, 0);
+			AddEdge(Edges, iSeq, Cmd, std::max(t + P[1], fSecond + P[3]), EDGE_BIT, Cmd.m_iLine, 0);
+			break;
+		}
+	}
+	if (Edges.size() > iFirst)
+		Edges[iFirst].m_bFirst = true;
+}
+
+static int Apply(DaqBoard *pBoard, const Edge &E)
+{
+	int ULStat = 0, ULStat2 = 0, ULStat3 = 0;
+	switch (E.m_iOp) {
+		case EDGE_BIT:
+			ULStat = pBoard->SetBit(E.m_iLine, E.m_iValue);
+			break;
+		case EDGE_PORT:
+			ULStat = pBoard->SetPort(E.m_iLine, (unsigned char)E.m_iValue);
+			break;
+		case EDGE_STROBE_ON:
+			ULStat = pBoard->SetPort(0, (unsigned char)(E.m_iValue & 255));
+			ULStat2 = pBoard->SetPort(1, (unsigned char)((E.m_iValue >> 8) & 127)); // Set strobe to zero
+			ULStat3 = pBoard->SetBit(15, 1); // Trigger strobe
+			break;
+		case EDGE_STROBE_OFF:
+			ULStat = pBoard->SetPort(0, 0);
+			ULStat2 = pBoard->SetPort(1, 0);
+			break;
+	}
+	return ULStat != 0 ? ULStat : (ULStat2 != 0 ? ULStat2 : ULStat3);
+}
+
+// Tracks the lines an edge leaves high until a later edge of the same command lowers them
+static void TrackHigh(const Edge &E, bool &bStrobeHigh, unsigned int &iPulseLines)
+{
+	switch (E.m_iOp) {
+		case EDGE_STROBE_ON:
+			bStrobeHigh = true;
+			break;
+		case EDGE_STROBE_OFF:
+			bStrobeHigh = false;
+			break;
+		case EDGE_BIT:
+			if (E.m_iLine < 0 || E.m_iLine >= DAQ_NUM_BITS)
+				break;
+			// a level set with SetBit is meant to stay
+			if (E.m_iValue != 0 && E.m_Report.m_iType != SEQ_SET_BIT)
+				iPulseLines |= 1u << E.m_iLine;
+			else
+				iPulseLines &= ~(1u << E.m_iLine);
+			break;
+		case EDGE_PORT:
+			if (E.m_iLine >= 0 && E.m_iLine < DAQ_NUM_PORTS)
+				iPulseLines &= ~DaqPortMask(E.m_iLine);
+			break;
+	}
+}
+
+int DaqSequencer::RunNow(DaqBoard *pBoard, const SeqCommand &Cmd, double fSpinSec)
+{
+	std::vector<Edge> Edges;
+	double fStrobeFree = 0;
+	unsigned long long iSeq = 0;
+	Expand(Cmd, DaqGetSecs(), fStrobeFree, iSeq, Edges);
+	std::sort(Edges.begin(), Edges.end(), [](const Edge &A, const Edge &B) { return EdgeLater()(B, A); });
+
+	int iStatus = 0;
+	for (size_t k = 0; k < Edges.size(); k++) {
+		WaitUntil(Edges[k].m_fWhen, fSpinSec);
+		int ULStat = Apply(pBoard, Edges[k]);
+		if (iStatus == 0)
+			iStatus = ULStat;
+	}
+	return iStatus;
+}
+
+DaqSequencer::DaqSequencer(DaqBoard *pBoard, double fSpinSec) :
+	m_pBoard(pBoard), m_fSpinSec(fSpinSec), m_iNextId(0),
+	m_Commands(COMMAND_QUEUE_SIZE), m_Emitted(EMITTED_QUEUE_SIZE),
+	m_bStop(false), m_iPendingEdges(0), m_iDropped(0), m_iDiscardedCommands(0), m_iDiscardedEdges(0), m_bStrobeHigh(false), m_iPulseLines(0)
+{
+}
+
+DaqSequencer::~DaqSequencer()
+{
+	Stop();
+}
+
+bool DaqSequencer::Start()
+{
+	if (Running())
+		return true;
+	m_bStop = false;
+	m_iDiscardedCommands = 0;
+	m_iDiscardedEdges = 0;
+	try {
+		m_Thread = std::thread(&DaqSequencer::Loop, this);
+	} catch (const std::system_error &) {
+		return false;
+	}
+	return true;
+}
+
+int DaqSequencer::Stop()
+{
+	if (!Running())
+		return 0;
+	m_bStop = true;
+	m_Thread.join();
+
+	SeqCommand Cmd;
+	while (m_Commands.Pop(Cmd))
+		m_iDiscardedCommands++;
+	m_iPendingEdges = 0;
+	if (m_bStrobeHigh) {
+		m_pBoard->SetPort(0, 0);
+		m_pBoard->SetPort(1, 0);
+	}
+	for (int iBit = 0; iBit < DAQ_NUM_BITS; iBit++)
+		if (m_iPulseLines & (1u << iBit))
+			m_pBoard->SetBit(iBit, 0);
+	m_bStrobeHigh = false;
+	m_iPulseLines = 0;
+	return m_iDiscardedCommands;
+}
+
+bool DaqSequencer::Queue(SeqCommand &Cmd)
+{
+	Cmd.m_iId = m_iNextId + 1;
+	if (!m_Commands.Push(Cmd))
+		return false;
+	m_iNextId++;
+	return true;
+}
+
+void DaqSequencer::TakeEmitted(std::vector<SeqEmission> &Out)
+{
+	SeqEmission E;
+	while (m_Emitted.Pop(E))
+		Out.push_back(E);
+}
+
+void DaqSequencer::Loop()
+{
+#ifdef _WIN32
+	timeBeginPeriod(1);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+	std::vector<Edge> Heap;
+	double fStrobeFree = 0;
+	unsigned long long iSeq = 0;
+	bool bStrobeHigh = false;
+	unsigned int iPulseLines = 0;
+
+	while (!m_bStop.load(std::memory_order_relaxed)) {
+		SeqCommand Cmd;
+		while (m_Commands.Pop(Cmd)) {
+			size_t iOld = Heap.size();
+			Expand(Cmd, DaqGetSecs(), fStrobeFree, iSeq, Heap);
+			for (size_t k = iOld + 1; k <= Heap.size(); k++)
+				std::push_heap(Heap.begin(), Heap.begin() + k, EdgeLater());
+		}
+		m_iPendingEdges = int(Heap.size());
+		if (Heap.empty()) {
+			DaqSleepSecs(IDLE_POLL_SEC);
+			continue;
+		}
+
+		double fRemaining = Heap.front().m_fWhen - DaqGetSecs();
+		if (fRemaining > m_fSpinSec) {
+			DaqSleepSecs(std::min(fRemaining - m_fSpinSec, IDLE_POLL_SEC));
+			continue;
+		}
+		while (DaqGetSecs() < Heap.front().m_fWhen) ;
+
+		// Emit everything that is due
+		do {
+			std::pop_heap(Heap.begin(), Heap.end(), EdgeLater());
+			Edge E = Heap.back();
+			Heap.pop_back();
+			int ULStat = Apply(m_pBoard, E);
+			TrackHigh(E, bStrobeHigh, iPulseLines);
+			if (E.m_bFirst) {
+				E.m_Report.m_fEmitted = DaqGetSecs();
+				E.m_Report.m_iStatus = ULStat;
+				if (!m_Emitted.Push(E.m_Report))
+					m_iDropped++;
+			}
+		} while (!Heap.empty() && Heap.front().m_fWhen <= DaqGetSecs());
+		m_iPendingEdges = int(Heap.size());
+	}
+	m_iDiscardedEdges = int(Heap.size());
+	m_bStrobeHigh = bStrobeHigh;
+	m_iPulseLines = iPulseLines;
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
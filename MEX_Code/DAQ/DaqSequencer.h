@@ -0,0 +1,105 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef DAQ_SEQUENCER_H
+#define DAQ_SEQUENCER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "DaqBoard.h"
+#include "SpscRing.h"
+
+/*
+ Output sequencer: a thread that owns the digital lines of the board and emits strobe words, TTLs,
+ pulse trains and delayed triggers at their scheduled GetSecs time, so MATLAB never waits for a
+ pulse to end.
+
+ MATLAB pushes commands into a single producer/single consumer ring. The thread expands every
+ command into its edges (line changes), keeps them ordered by time and waits for the next one by
+ sleeping until m_fSpinSec before it and spinning the rest of the way. For every command the time
+ at which its first edge was written to the board is pushed into a second ring, read back with
+ 'GetEmitted'.
+
+ Strobe words are serialized: a word is held for STROBE_PULSE_SEC and the next word is not put on
+ the lines before another STROBE_PULSE_SEC has passed, whatever time it was scheduled for.
+
+ Stop only lowers the lines the sequencer left high in the middle of a command (a strobe word that
+ was not released, a TTL or pulse cut short): levels set with SetBit/SetByte, and lines driven by
+ anyone else, are kept.
+*/
+
+const double STROBE_PULSE_SEC = 250e-6; // Plexon manual says pulse width must be >= 250 usec.
+const int SEQ_MAX_PULSES = 100000;		// pulses in a train: the thread holds two edges per pulse
+
+enum {
+	SEQ_STROBE = 1,
+	SEQ_TTL = 2,
+	SEQ_PULSE_TRAIN = 3,
+	SEQ_SET_BIT = 4,
+	SEQ_SET_PORT = 5,
+	SEQ_DELAYED_TRIGGER = 6
+};
+
+typedef struct {
+	int m_iType;
+	int m_iId;			// assigned by Queue
+	double m_fWhen;		// GetSecs time of the first edge, 0 for as soon as possible
+	int m_iLine;		// bit (TTL, pulse train, set bit, gate of a delayed trigger) or port (set port)
+	int m_iLine2;		// trigger bit of a delayed trigger
+	int m_iValue;		// strobe word, port value or bit value
+	int m_iCount;		// pulses in a train
+	double m_afParam[5];	// seconds. TTL: width. Pulse train: width, period.
+						// Delayed trigger: delay, gate period, first pulse, second pulse, inter pulse interval
+} SeqCommand;
+
+typedef struct {
+	int m_iId;
+	int m_iType;
+	int m_iValue;
+	int m_iStatus;		// error code of the board when the first edge was written, 0 on success
+	double m_fScheduled;
+	double m_fEmitted;	// GetSecs time right after the first edge was written
+} SeqEmission;
+
+class DaqSequencer {
+public:
+	DaqSequencer(DaqBoard *pBoard, double fSpinSec);
+	~DaqSequencer();
+
+	bool Start();
+	int Stop();		// discards what was not emitted yet and releases the pulses it cut short. Returns the number of discarded commands
+	int DiscardedEdges() const { return m_iDiscardedEdges; }	// edges already taken off the queue but not written, at the last Stop
+	bool Running() const { return m_Thread.joinable(); }
+
+	bool Queue(SeqCommand &Cmd);	// false if the queue is full
+	void TakeEmitted(std::vector<SeqEmission> &Out);
+	int Pending() const { return int(m_Commands.Size()) + m_iPendingEdges.load(); }
+	long long Dropped() const { return m_iDropped.load(); }
+
+	// Emits a command on the calling thread, returns when its last edge was written
+	static int RunNow(DaqBoard *pBoard, const SeqCommand &Cmd, double fSpinSec);
+	static void WaitUntil(double fTime, double fSpinSec);
+
+private:
+	void Loop();
+
+	DaqBoard *m_pBoard;
+	double m_fSpinSec;
+	int m_iNextId;
+	SpscRing<SeqCommand> m_Commands;
+	SpscRing<SeqEmission> m_Emitted;
+	std::atomic<bool> m_bStop;
+	std::atomic<int> m_iPendingEdges;
+	std::atomic<long long> m_iDropped;
+	int m_iDiscardedCommands;
+	int m_iDiscardedEdges;
+	bool m_bStrobeHigh;			// left by the thread when it ends
+	unsigned int m_iPulseLines;
+	std::thread m_Thread;
+};
+
+#endif
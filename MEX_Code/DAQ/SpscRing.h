@@ -0,0 +1,41 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <vector>
+
+// Lock free ring between one producer thread and one consumer thread
+template <class T> class SpscRing {
+public:
+	explicit SpscRing(size_t iSize) : m_Slots(iSize), m_iMask(iSize - 1), m_iHead(0), m_iTail(0) {} // iSize: power of 2
+	bool Push(const T &Item) {
+		size_t iHead = m_iHead.load(std::memory_order_relaxed);
+		if (iHead - m_iTail.load(std::memory_order_acquire) == m_Slots.size())
+			return false;
+		m_Slots[iHead & m_iMask] = Item;
+		m_iHead.store(iHead + 1, std::memory_order_release);
+		return true;
+	}
+	bool Pop(T &Item) {
+		size_t iTail = m_iTail.load(std::memory_order_relaxed);
+		if (iTail == m_iHead.load(std::memory_order_acquire))
+			return false;
+		Item = m_Slots[iTail & m_iMask];
+		m_iTail.store(iTail + 1, std::memory_order_release);
+		return true;
+	}
+	size_t Size() const { return m_iHead.load(std::memory_order_acquire) - m_iTail.load(std::memory_order_acquire); }
+private:
+	std::vector<T> m_Slots;
+	size_t m_iMask;
+	std::atomic<size_t> m_iHead;
+	std::atomic<size_t> m_iTail;
+};
+
+#endif
@@ -0,0 +1,40 @@
+% Scan the synthetic eye signal of the simulated board at 2 kHz and read it back
+fnDAQ('Init', 0, 1);
+fRate = fnDAQ('StartAcquisition', [0 1], 2000, 10);
+assert(fRate == 2000);
+
+WaitSecs(1);
+[a2fEye, afTimes] = fnDAQ('GetSince', 0);
+fprintf('%d scans in the first second\n', size(a2fEye,1));
+assert(size(a2fEye,2) == 2 && abs(size(a2fEye,1) - 2000) < 50);
+assert(all(diff(afTimes) > 0));
+fprintf('Median spacing %.1f us\n', median(diff(afTimes))*1e6);
+
+% Only what arrived since the last read
+WaitSecs(0.1);
+[a2fMore, afMoreTimes] = fnDAQ('GetSince', afTimes(end));
+assert(afMoreTimes(1) > afTimes(end) && abs(size(a2fMore,1) - 200) < 50);
+
+% GetAnalog returns the latest scan while the board scans
+[afLatest, fLatest] = fnDAQ('GetLatest');
+fprintf('Latest scan is %.1f ms old\n', (fnDAQ('GetTime') - fLatest)*1e3);
+assert(size(afLatest,2) == 2);
+assert(length(fnDAQ('GetAnalog', [1 0])) == 2);
+% and refuses a channel that is not scanned instead of interrupting the scan
+bFailed = false;
+try
+    fnDAQ('GetAnalog', 5);
+catch
+    bFailed = true;
+end
+assert(bFailed);
+
+[fRate, iNumScans, iNumLost] = fnDAQ('GetAcquisitionStatus');
+assert(iNumLost == 0);
+fnDAQ('StopAcquisition');
+
+figure;
+plot(afTimes - afTimes(1), a2fEye);
+xlabel('Time (sec)');
+ylabel('A/D counts');
+legend('X','Y');
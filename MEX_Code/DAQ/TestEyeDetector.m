@@ -0,0 +1,42 @@
+% Saccade and fixation events on the synthetic eye signal of the simulated board
+% (fixations around 2048 counts, saccades of up to 600 counts in between)
+fnDAQ('Init', 0, 1);
+fnDAQ('StartAcquisition', [0 1], 2000, 10);
+
+strctParams.m_afCenter = [2048 2048];
+strctParams.m_afGain = [1 1];
+strctParams.m_afOffset = [0 0];
+strctParams.m_strFilter = 'median';
+strctParams.m_iFilterLength = 5;
+strctParams.m_fSaccadeVelocity = 3000;
+strctParams.m_fMinFixationSec = 0.05;
+fnDAQ('StartEyeDetector', 0, 1, strctParams);
+fnDAQ('SetFixationTargets', [7 0 0 100]);
+
+WaitSecs(4);
+[a2fEvents, iDropped] = fnDAQ('GetEyeEvents');
+afState = fnDAQ('GetEyeState');
+fnDAQ('StopAcquisition');
+assert(iDropped == 0);
+
+% Onsets and offsets alternate, offsets come after their onsets
+afSaccades = a2fEvents(a2fEvents(:,1) <= 2, :);
+fprintf('%d saccades in 4 sec\n', sum(afSaccades(:,1) == 1));
+assert(sum(afSaccades(:,1) == 1) >= 3);
+assert(all(afSaccades(1:2:end,1) == 1) && all(afSaccades(2:2:end,1) == 2));
+aiOnsets = find(afSaccades(:,1) == 1);
+aiOnsets = aiOnsets(aiOnsets < size(afSaccades,1));
+afDuration = afSaccades(aiOnsets+1,3) - afSaccades(aiOnsets,3);
+fprintf('Saccade duration %.1f - %.1f ms\n', min(afDuration)*1e3, max(afDuration)*1e3);
+assert(all(afDuration > 0 & afDuration < 0.1));
+
+% The eye starts on the target: it is acquired first, and every break follows an acquisition
+afFixation = a2fEvents(a2fEvents(:,1) >= 3, :);
+assert(~isempty(afFixation) && afFixation(1,1) == 3 && afFixation(1,2) == 7);
+assert(all(diff(afFixation(:,1)) ~= 0));
+assert(length(afState) == 5);
+
+figure;
+plot(afSaccades(:,3) - a2fEvents(1,3), afSaccades(:,6), '.');
+xlabel('Time (sec)');
+ylabel('Speed (counts/sec)');
@@ -0,0 +1,52 @@
+% Run the output sequencer on a simulated board and check what reached the lines
+fnDAQ('Init', 0, 1);
+fnDAQ('StartSequencer');
+
+fNow = fnDAQ('GetTime');
+tic
+for k=1:5
+    fnDAQ('StrobeWord', 100+k);
+end
+fnDAQ('TTL', 17, 1e-3, fNow + 0.01);
+fnDAQ('PulseTrain', 18, 0.5e-3, 2e-3, 5, fNow + 0.02);
+fprintf('Queued 7 commands in %.1f us\n', toc*1e6);
+
+WaitSecs(0.05);
+[a2fEmitted, aiCounts] = fnDAQ('GetEmitted');
+assert(size(a2fEmitted,1) == 7 && all(aiCounts == 0));
+assert(all(a2fEmitted(:,6) == 0));
+afLate = (a2fEmitted(:,5) - a2fEmitted(:,4)) * 1e6;
+fprintf('Emitted late by %.1f us (median), %.1f us (max)\n', median(afLate), max(afLate));
+
+% Strobe words are held 250 us and never overlap
+a2fLog = fnDAQ('GetSimulatedLog');
+aiStrobe = find(bitand(a2fLog(:,2), 2^15) & [true; ~bitand(a2fLog(1:end-1,2), 2^15)]);
+assert(length(aiStrobe) == 5);
+assert(isequal(bitand(a2fLog(aiStrobe,2), 2^15-1), (101:105)'));
+assert(all(diff(a2fLog(aiStrobe,1)) >= 500e-6 - 1e-6));
+
+% Five pulses on bit 18
+abBit18 = bitand(a2fLog(:,2), 2^18) > 0;
+assert(sum(diff([false; abBit18]) == 1) == 5);
+
+% Stopping lowers a pulse that was cut short, and keeps the levels set with SetBit
+fnDAQ('SetBit', 20, 1);
+fnDAQ('TTL', 17, 1);
+WaitSecs(0.01);
+[iCommands, iEdges] = fnDAQ('StopSequencer');
+assert(iCommands == 0 && iEdges == 1);
+a2fLog = fnDAQ('GetSimulatedLog');
+assert(bitand(a2fLog(end,2), 2^17) == 0 && bitand(a2fLog(end,2), 2^20) > 0);
+
+% Bad arguments are refused before anything is queued
+acBad = {{'TTL', 17, 0}, {'TTL', 24, 1e-3}, {'TTL', 17}, {'PulseTrain', 18, 2e-3, 1e-3, 5}, ...
+    {'PulseTrain', 18, 0.5e-3, 2e-3, 1e9}, {'PulseTrain', 18, NaN, 2e-3, 5}, {'DelayedTrigger', 1, 2, 1, 1, 0, 1, 1}};
+for k=1:length(acBad)
+    bFailed = false;
+    try
+        fnDAQ(acBad{k}{:});
+    catch
+        bFailed = true;
+    end
+    assert(bFailed);
+end
@@ -3,6 +3,7 @@
 #include <math.h>
 #include "cbw.h"
 #include <mmsystem.h>
+#include "../GetSecs_x64/PrecisionClock.h"
 const int Pow2[15] = {1,2,4,8,16,32,64,128,256,512,1024,2048,4096,8192, 16384};
 const int Pow2Rev[15] = {16384, 8192, 4096, 2048, 1024, 512, 256, 128, 64, 32, 16, 8, 4, 2, 1};
 
@@ -11,23 +12,7 @@ const int EYE_X_PORT = 0; // hard wired for a faster implementation, but can alw
 const int EYE_Y_PORT = 1;
 
 void fnSleep(double fWaitSecHighPerc) {
-
-	LARGE_INTEGER prevTime;
-	LARGE_INTEGER curTime;
-	LARGE_INTEGER freqValue;
-	double timeDifference;
-
-
-	QueryPerformanceFrequency(&freqValue);
-	QueryPerformanceCounter(&prevTime);
-
-	while (1)
-	{
-		QueryPerformanceCounter(&curTime);
-		timeDifference = curTime.QuadPart - prevTime.QuadPart;
-		if (timeDifference / freqValue.QuadPart >= fWaitSecHighPerc )
-			break;
-	}     
+	ClockWaitSecs(fWaitSecHighPerc);
 }
 void fnPrintUsage()
 {
@@ -1,92 +1,314 @@
 #include <stdio.h>
 #include <math.h>
+#include <limits>
+#include <vector>
+#include <thread>
 #include "mex.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
-#define BILINEAR(x,y,V00,V10,V01,V11)((V00*(1-x)*(1-y)+V10*(x)*(1-y)+V01*(1-x)*(y)+V11*(x)*(y)))
 #define MAX(x,y)(x>y)?(x):(y)
 
-#define ACCESS_IMAGE(imag, indx, maxindx,NaNValue)(indx>=0 && indx<maxindx) ? imag[indx] : NaNValue;
+/* This dll is the implementation of fndllFastInterp2 function.
+It is a fast implementation of interp2. The advantage is that we do not need to pass
+as arguments the image grid. It is assumed that input image coordinates are 1..N,1..M
+(and 1..Z for the volume variant).
 
-/* This dll is the implementation of fndllFastInterp3 function.
-It is a fast implementation of interp3. The advantage is that we do not need to pass
-as arguments the volume grid. It is assumed that input volume coordinates are 1..N,1..M,1..Z
-% Input type is float
-% Output type is float
+ afValues = fnFastInterp2(a2Image, Cols (Nx1), Rows (Nx1), [NaN value])
+	a2Image may be M x N x P (e.g., RGB). Every plane is sampled at the same points
+	and the output is Npoints x P.
+
+ afValues = fnFastInterp2(a3Volume, Cols (Nx1), Rows (Nx1), Slices (Nx1), NaN value)
+	Trilinear sampling of a volume (a 4th dimension is treated as planes).
+
+ Input type is double, single, int8, uint8, int16, uint16 or logical.
+ Output type is float.
+ Neighbours that fall outside the image are replaced by the NaN value. Points with a NaN coordinate,
+ or one too far out to index (beyond +-2^30), are NaN.
+
+ Points are processed in blocks: the integer offsets and weights of a whole block are computed
+ first (a branch free loop the compiler vectorizes), then the neighbours are gathered for every
+ plane. With AVX2 enabled, single precision images use hardware gathers for points whose
+ neighbours are all inside the image. Large point sets are split across threads.
 */
 
-template<class T> void CalcInterpolation(T* input_image, float *output_vector, 
-										 int iNumPoints, double *rows, double *cols,int in_rows,int in_cols, float NaNValue) {
-	float V00,V01,V10,V11;
-	int curr_row, curr_col;
-	double dx,dy;
-	int num_input_voxels = in_rows * in_cols;
-	for (int iPointIter = 0; iPointIter < iNumPoints; iPointIter++) {
-
-		curr_row = int(floor(rows[iPointIter]-1));
-		curr_col = int(floor(cols[iPointIter]-1));
-		dy = (rows[iPointIter]-1) -curr_row; 
-		dx = (cols[iPointIter]-1) -curr_col; 
-		int in_curpos = curr_col*in_rows + curr_row;
-		V00 = ACCESS_IMAGE(input_image,in_curpos+0, num_input_voxels,NaNValue);
-		V01 = ACCESS_IMAGE(input_image,in_curpos+1, num_input_voxels,NaNValue);
-		V10 = ACCESS_IMAGE(input_image,in_curpos+in_rows, num_input_voxels,NaNValue);
-		V11 = ACCESS_IMAGE(input_image,in_curpos+in_rows+1, num_input_voxels,NaNValue);
-		output_vector[iPointIter] = float(BILINEAR(dx, dy, V00,V10,V01,V11));
+const int POINT_BLOCK = 64;
+const int MIN_POINTS_PER_THREAD = 1 << 15;
+const int MAX_THREADS = 16;
+const double MAX_COORDINATE = double(1 << 30);
+
+typedef struct {
+	int Rows;
+	int Cols;
+	int Slices;		// 1 for 2D sampling
+	int NumPlanes;
+	size_t PlaneStride;
+	bool Volume;
+} Grid_struct;
+
+typedef struct {
+	const double *Rows;
+	const double *Cols;
+	const double *Slices;
+	int NumPoints;
+	float NaNValue;
+	float *Output;	// NumPoints x NumPlanes
+} Points_struct;
+
+// Integer base coordinate and fractional weight along one axis. A coordinate exactly on the
+// last sample uses the previous cell with weight 1, so the far neighbour is never required.
+// False (and no neighbour) for a coordinate that cannot be converted to int: NaN or too large.
+inline bool AxisCoordinate(double fCoord, int iSize, int &iBase, float &fFrac)
+{
+	double f = fCoord - 1;
+	if (!(f > -MAX_COORDINATE && f < MAX_COORDINATE)) {
+		iBase = -2;
+		fFrac = 0;
+		return false;
 	}
+	double fFloor = floor(f);
+	iBase = int(fFloor);
+	fFrac = float(f - fFloor);
+	if (iBase == iSize-1 && fFrac == 0 && iSize > 1) {
+		iBase--;
+		fFrac = 1;
+	}
+	return true;
 }
 
-void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
-	if (nlhs != 1 || nrhs < 3) {
-		mexErrMsgTxt("Usage: [afValues] = fndllFastInterp2(a2Image, Cols (Nx1),Rows (Nx1), NaN value (optional))");
-		return;
-	} 
-	float NaNValue = 0;
-	if (nrhs == 4) {
-		double *pNaNValue = (double *)mxGetData(prhs[3]);
-		NaNValue = *pNaNValue;
+template<class T> struct IsSinglePrecision { static const bool Value = false; };
+template<> struct IsSinglePrecision<float> { static const bool Value = true; };
+
+template<class T> inline float FetchValue(const T *Plane, bool bValid, ptrdiff_t iIndex, float NaNValue)
+{
+	return bValid ? float(Plane[iIndex]) : NaNValue;
+}
+
+#ifdef __AVX2__
+// Bilinear samples of 8 interior points of one float plane
+inline void GatherBilinear8(const float *Plane, const int *aiIndex, const float *afDx, const float *afDy, int Rows, float *Out)
+{
+	__m256i Index = _mm256_loadu_si256((const __m256i*)aiIndex);
+	__m256i IndexRight = _mm256_add_epi32(Index, _mm256_set1_epi32(Rows));
+	__m256 V00 = _mm256_i32gather_ps(Plane, Index, 4);
+	__m256 V01 = _mm256_i32gather_ps(Plane + 1, Index, 4);
+	__m256 V10 = _mm256_i32gather_ps(Plane, IndexRight, 4);
+	__m256 V11 = _mm256_i32gather_ps(Plane + 1, IndexRight, 4);
+	__m256 Dx = _mm256_loadu_ps(afDx);
+	__m256 Dy = _mm256_loadu_ps(afDy);
+	__m256 Top = _mm256_add_ps(V00, _mm256_mul_ps(Dx, _mm256_sub_ps(V10, V00)));
+	__m256 Bottom = _mm256_add_ps(V01, _mm256_mul_ps(Dx, _mm256_sub_ps(V11, V01)));
+	_mm256_storeu_ps(Out, _mm256_add_ps(Top, _mm256_mul_ps(Dy, _mm256_sub_ps(Bottom, Top))));
+}
+#endif
+
+template<class T> inline void BilinearRange(const T *Plane, int Rows, const int *aiIndex, const unsigned char *aiValid,
+											const float *afDx, const float *afDy, float NaNValue, int iFirst, int iLast, float *Out)
+{
+	for (int k=iFirst;k<iLast;k++) {
+		ptrdiff_t i = aiIndex[k];
+		unsigned char v = aiValid[k];
+		if (v & 16) {
+			Out[k] = std::numeric_limits<float>::quiet_NaN();
+			continue;
+		}
+		float V00 = FetchValue(Plane, (v & 1) != 0, i, NaNValue);
+		float V01 = FetchValue(Plane, (v & 2) != 0, i + 1, NaNValue);
+		float V10 = FetchValue(Plane, (v & 4) != 0, i + Rows, NaNValue);
+		float V11 = FetchValue(Plane, (v & 8) != 0, i + Rows + 1, NaNValue);
+		float Top = V00 + afDx[k] * (V10 - V00);
+		float Bottom = V01 + afDx[k] * (V11 - V01);
+		Out[k] = Top + afDy[k] * (Bottom - Top);
 	}
+}
+
+template<class T> void Interp2Block(const T *Image, const Grid_struct &G, const Points_struct &P, int iFirst, int iCount)
+{
+	int aiIndex[POINT_BLOCK];
+	float afDx[POINT_BLOCK], afDy[POINT_BLOCK];
+	unsigned char aiValid[POINT_BLOCK]; // bit 0: (r,c) 1: (r+1,c) 2: (r,c+1) 3: (r+1,c+1) 4: undefined point
+
+	for (int k=0;k<iCount;k++) {
+		int r, c;
+		bool bDefined = AxisCoordinate(P.Rows[iFirst+k], G.Rows, r, afDy[k]);
+		bDefined = AxisCoordinate(P.Cols[iFirst+k], G.Cols, c, afDx[k]) && bDefined;
+		if (!bDefined) {
+			aiValid[k] = 16;
+			aiIndex[k] = 0;
+			continue;
+		}
+		bool bRow0 = r >= 0 && r < G.Rows, bRow1 = r+1 >= 0 && r+1 < G.Rows;
+		bool bCol0 = c >= 0 && c < G.Cols, bCol1 = c+1 >= 0 && c+1 < G.Cols;
+		aiValid[k] = (unsigned char)((bRow0 && bCol0) | ((bRow1 && bCol0) << 1) | ((bRow0 && bCol1) << 2) | ((bRow1 && bCol1) << 3));
+		aiIndex[k] = aiValid[k] ? c * G.Rows + r : 0;
+	}
+
+	for (int iPlane=0;iPlane<G.NumPlanes;iPlane++) {
+		const T *Plane = Image + iPlane * G.PlaneStride;
+		float *Out = P.Output + (size_t)iPlane * P.NumPoints + iFirst;
+		int k = 0;
+#ifdef __AVX2__
+		if (IsSinglePrecision<T>::Value) {
+			for (;k+8<=iCount;k+=8) {
+				bool bInterior = true;
+				for (int j=0;j<8;j++)
+					bInterior = bInterior && aiValid[k+j] == 15;
+				if (bInterior)
+					GatherBilinear8((const float*)Plane, aiIndex+k, afDx+k, afDy+k, G.Rows, Out+k);
+				else
+					BilinearRange(Plane, G.Rows, aiIndex, aiValid, afDx, afDy, P.NaNValue, k, k+8, Out);
+			}
+		}
+#endif
+		BilinearRange(Plane, G.Rows, aiIndex, aiValid, afDx, afDy, P.NaNValue, k, iCount, Out);
+	}
+}
+
+template<class T> void Interp3Block(const T *Volume, const Grid_struct &G, const Points_struct &P, int iFirst, int iCount)
+{
+	ptrdiff_t SliceStride = (ptrdiff_t)G.Rows * G.Cols;
+	for (int k=0;k<iCount;k++) {
+		int r, c, s;
+		float dy, dx, dz;
+		bool bDefined = AxisCoordinate(P.Rows[iFirst+k], G.Rows, r, dy);
+		bDefined = AxisCoordinate(P.Cols[iFirst+k], G.Cols, c, dx) && bDefined;
+		bDefined = AxisCoordinate(P.Slices[iFirst+k], G.Slices, s, dz) && bDefined;
+		if (!bDefined) {
+			for (int iPlane=0;iPlane<G.NumPlanes;iPlane++)
+				P.Output[(size_t)iPlane * P.NumPoints + iFirst + k] = std::numeric_limits<float>::quiet_NaN();
+			continue;
+		}
 
-	/* Get the number of dimensions in the input argument. */
-	if (mxGetNumberOfDimensions(prhs[0]) != 2) {
-		mexErrMsgTxt("Input volume must be 2D. ");
+		bool bRow[2] = {r >= 0 && r < G.Rows, r+1 >= 0 && r+1 < G.Rows};
+		bool bCol[2] = {c >= 0 && c < G.Cols, c+1 >= 0 && c+1 < G.Cols};
+		bool bSlice[2] = {s >= 0 && s < G.Slices, s+1 >= 0 && s+1 < G.Slices};
+		bool bAny = (bRow[0] || bRow[1]) && (bCol[0] || bCol[1]) && (bSlice[0] || bSlice[1]);
+		ptrdiff_t i = bAny ? (ptrdiff_t)s * SliceStride + (ptrdiff_t)c * G.Rows + r : 0;
+
+		for (int iPlane=0;iPlane<G.NumPlanes;iPlane++) {
+			const T *Plane = Volume + iPlane * G.PlaneStride;
+			float V[2][2][2];
+			for (int a=0;a<2;a++)
+				for (int b=0;b<2;b++)
+					for (int e=0;e<2;e++)
+						V[a][b][e] = FetchValue(Plane, bRow[a] && bCol[b] && bSlice[e], i + a + b * G.Rows + e * SliceStride, P.NaNValue);
+			float C00 = V[0][0][0] + dy * (V[1][0][0] - V[0][0][0]);
+			float C10 = V[0][1][0] + dy * (V[1][1][0] - V[0][1][0]);
+			float C01 = V[0][0][1] + dy * (V[1][0][1] - V[0][0][1]);
+			float C11 = V[0][1][1] + dy * (V[1][1][1] - V[0][1][1]);
+			float C0 = C00 + dx * (C10 - C00);
+			float C1 = C01 + dx * (C11 - C01);
+			P.Output[(size_t)iPlane * P.NumPoints + iFirst + k] = C0 + dz * (C1 - C0);
+		}
+	}
+}
+
+template<class T> void CalcInterpolationRange(const T *Image, Grid_struct G, Points_struct P, int iFirst, int iLast)
+{
+	for (int k=iFirst;k<iLast;k+=POINT_BLOCK) {
+		int iCount = (iLast - k < POINT_BLOCK) ? iLast - k : POINT_BLOCK;
+		if (G.Volume)
+			Interp3Block(Image, G, P, k, iCount);
+		else
+			Interp2Block(Image, G, P, k, iCount);
+	}
+}
+
+template<class T> void CalcInterpolation(const T *Image, const Grid_struct &G, const Points_struct &P)
+{
+	int iNumThreads = P.NumPoints / MIN_POINTS_PER_THREAD;
+	int iNumCores = int(std::thread::hardware_concurrency());
+	if (iNumThreads > iNumCores) iNumThreads = iNumCores;
+	if (iNumThreads > MAX_THREADS) iNumThreads = MAX_THREADS;
+
+	if (iNumThreads <= 1) {
+		CalcInterpolationRange(Image, G, P, 0, P.NumPoints);
 		return;
 	}
 
-	const int *input_dim_array = mxGetDimensions(prhs[0]);
-	int in_rows = input_dim_array[0];
-	int in_cols = input_dim_array[1];
+	// Blocks are multiples of POINT_BLOCK so that threads never share an output cache line block
+	int iPerThread = ((P.NumPoints + iNumThreads - 1) / iNumThreads + POINT_BLOCK - 1) / POINT_BLOCK * POINT_BLOCK;
+	std::vector<std::thread> Workers;
+	for (int iThread=0;iThread<iNumThreads;iThread++) {
+		int iFirst = iThread * iPerThread;
+		int iLast = (iFirst + iPerThread < P.NumPoints) ? iFirst + iPerThread : P.NumPoints;
+		if (iFirst >= iLast)
+			break;
+		Workers.push_back(std::thread(CalcInterpolationRange<T>, Image, G, P, iFirst, iLast));
+	}
+	for (size_t k=0;k<Workers.size();k++)
+		Workers[k].join();
+}
 
-	double *rows = (double *)mxGetData(prhs[2]);
-	double *cols = (double *)mxGetData(prhs[1]);
-	
-	const int *tmp = mxGetDimensions(prhs[1]);
-	int iNumPoints = MAX(tmp[0], tmp[1]);
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
+	if (nlhs != 1 || nrhs < 3) {
+		mexErrMsgTxt("Usage: [afValues] = fndllFastInterp2(a2Image, Cols (Nx1),Rows (Nx1), NaN value (optional))\n"
+					 "       [afValues] = fndllFastInterp2(a3Volume, Cols (Nx1),Rows (Nx1), Slices (Nx1), NaN value)");
+		return;
+	}
 
-	int output_dim_array[2];
-	output_dim_array[0] = iNumPoints;
-	output_dim_array[1] = 1;
-	plhs[0] = mxCreateNumericArray(2, output_dim_array, mxSINGLE_CLASS, mxREAL);
-	float *output_vector = (float*)mxGetPr(plhs[0]);
+	Grid_struct G;
+	Points_struct P;
+	G.Volume = nrhs >= 5;
 
-	
-	if (mxIsSingle(prhs[0])) {
-		float *input_image = (float*)mxGetData(prhs[0]);
-		CalcInterpolation(input_image, output_vector,iNumPoints, rows, cols, in_rows,in_cols,NaNValue);
+	P.NaNValue = 0;
+	int iNaNArg = G.Volume ? 4 : 3;
+	if (nrhs > iNaNArg) {
+		double *pNaNValue = (double *)mxGetData(prhs[iNaNArg]);
+		P.NaNValue = float(*pNaNValue);
 	}
 
-	if (mxIsDouble(prhs[0])) {
-		double *input_image = (double*)mxGetData(prhs[0]);
-		CalcInterpolation(input_image, output_vector,iNumPoints, rows, cols, in_rows,in_cols,NaNValue);
+	for (int k=1;k<(G.Volume ? 4 : 3);k++) {
+		if (!mxIsDouble(prhs[k])) {
+			mexErrMsgTxt("Coordinates must be double.");
+			return;
+		}
 	}
 
-	if (mxIsUint16(prhs[0]) || mxIsInt16(prhs[0])) {
-		short *input_image = (short*)mxGetData(prhs[0]);
-		CalcInterpolation(input_image, output_vector,iNumPoints, rows, cols, in_rows,in_cols,NaNValue);
+	int iNumDims = int(mxGetNumberOfDimensions(prhs[0]));
+	const mwSize *input_dim_array = mxGetDimensions(prhs[0]);
+	G.Rows = int(input_dim_array[0]);
+	G.Cols = int(input_dim_array[1]);
+	G.Slices = 1;
+	int iFirstPlaneDim = 2;
+	if (G.Volume) {
+		G.Slices = iNumDims > 2 ? int(input_dim_array[2]) : 1;
+		iFirstPlaneDim = 3;
 	}
+	G.NumPlanes = 1;
+	for (int d=iFirstPlaneDim;d<iNumDims;d++)
+		G.NumPlanes *= int(input_dim_array[d]);
+	G.PlaneStride = (size_t)G.Rows * G.Cols * G.Slices;
 
-	if (mxIsUint8(prhs[0])) {
-		unsigned char *input_image = (unsigned char *)mxGetData(prhs[0]);
-		CalcInterpolation(input_image, output_vector,iNumPoints, rows, cols,in_rows,in_cols,NaNValue);
+	P.Rows = (double *)mxGetData(prhs[2]);
+	P.Cols = (double *)mxGetData(prhs[1]);
+	P.Slices = G.Volume ? (double *)mxGetData(prhs[3]) : NULL;
+	P.NumPoints = int(mxGetNumberOfElements(prhs[1]));
+	if (int(mxGetNumberOfElements(prhs[2])) != P.NumPoints || (G.Volume && int(mxGetNumberOfElements(prhs[3])) != P.NumPoints)) {
+		mexErrMsgTxt("All coordinate vectors must have the same length.");
+		return;
 	}
 
-}
\ No newline at end of file
+	mwSize output_dim_array[2];
+	output_dim_array[0] = P.NumPoints;
+	output_dim_array[1] = G.NumPlanes;
+	plhs[0] = mxCreateNumericArray(2, output_dim_array, mxSINGLE_CLASS, mxREAL);
+	P.Output = (float*)mxGetPr(plhs[0]);
+
+	if (P.NumPoints == 0 || G.PlaneStride == 0 || G.NumPlanes == 0)
+		return;
+
+	const void *Image = mxGetData(prhs[0]);
+	switch (mxGetClassID(prhs[0])) {
+		case mxSINGLE_CLASS:  CalcInterpolation((const float*)Image, G, P); break;
+		case mxDOUBLE_CLASS:  CalcInterpolation((const double*)Image, G, P); break;
+		case mxINT16_CLASS:   CalcInterpolation((const short*)Image, G, P); break;
+		case mxUINT16_CLASS:  CalcInterpolation((const unsigned short*)Image, G, P); break;
+		case mxINT8_CLASS:    CalcInterpolation((const signed char*)Image, G, P); break;
+		case mxUINT8_CLASS:   CalcInterpolation((const unsigned char*)Image, G, P); break;
+		case mxLOGICAL_CLASS: CalcInterpolation((const mxLogical*)Image, G, P); break;
+		default:
+			mexErrMsgTxt("Unsupported image class.");
+	}
+}
@@ -34,7 +34,9 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "mex.h"
+#ifdef _WIN32
 #include <windows.h>
 
 typedef HANDLE					psych_condition;		
@@ -1028,18 +1030,116 @@ int PsychTimedWaitCondition(psych_condition* condition, psych_mutex* mutex, doub
 	// rc will tell the caller what happened: 0 = Signalled, 0x00000102L == WAIT_TIMEOUT for timeout.
 	return(rc);
 }
-void mexFunction( int nlhs, mxArray *plhs[], 
-				 int nrhs, const mxArray *prhs[] ) 
+#endif
+
+/*
+ GetSecs                                   time on the shared clock (PrecisionClock.h)
+ GetSecs('WaitSecs', fSec [, fSpinSec])    precise wait, returns how late it woke up
+ GetSecs('WaitUntil', fWhen [, fSpinSec])
+ GetSecs('YieldSecs', fSec)                releases the cpu for at least fSec
+ GetSecs('TSC'), GetSecs('CalibrateTSC' [, fSec])
+ GetSecs('SetPlexonSync', afLocalSecs, afPlexonTicks [, fTicksPerSec]), GetSecs('PlexonToSecs', afTicks),
+ GetSecs('SecsToPlexon', afSecs)
+ GetSecs('Benchmark' [, iNumReads, iNumWaits, fWaitSec, fSpinSec])
+*/
+#include "PrecisionClock.h"
+
+static PlexonSync g_PlexonSync = {PLEXON_TICKS_PER_SEC, 0, 1, 0};
+
+static double fnArg(int nrhs, const mxArray *prhs[], int iArg, double fDefault)
 {
+	return nrhs > iArg && mxGetNumberOfElements(prhs[iArg]) > 0 ? mxGetScalar(prhs[iArg]) : fDefault;
+}
 
-if (!init_mod) {
-	init_mod = true;
-	PsychInitTimeGlue();
+static mxArray *fnRow(const double *afValues, int N)
+{
+	mxArray *Out = mxCreateDoubleMatrix(1, N, mxREAL);
+	for (int k = 0; k < N; k++)
+		mxGetPr(Out)[k] = afValues[k];
+	return Out;
 }
 
-	double now;
-    PsychGetAdjustedPrecisionTimerSeconds(&now);
-	plhs[0] = mxCreateDoubleScalar(now);
+static void fnPrintPercentiles(const char *strName, const double *afSec)
+{
+	mexPrintf("%-28s", strName);
+	for (int p = 0; p < CLOCK_NUM_PERCENTILES; p++)
+		mexPrintf("%10.1f", afSec[p] * 1e6);
+	mexPrintf("\n");
+}
 
+void mexFunction( int nlhs, mxArray *plhs[], 
+				 int nrhs, const mxArray *prhs[] ) 
+{
+	if (nrhs == 0 || !mxIsChar(prhs[0])) {
+#ifdef _WIN32
+		if (!init_mod) {
+			init_mod = true;
+			PsychInitTimeGlue();
+		}
+		double now;
+		PsychGetAdjustedPrecisionTimerSeconds(&now);
+		plhs[0] = mxCreateDoubleScalar(now);
+#else
+		plhs[0] = mxCreateDoubleScalar(ClockGetSecs());
+#endif
+		return;
+	}
 
-}
\ No newline at end of file
+	char Command[128];
+	mxGetString(prhs[0], Command, sizeof(Command));
+
+	if (strcmp(Command, "WaitSecs") == 0) {
+		double fLate = ClockWaitSecs(fnArg(nrhs, prhs, 1, 0), fnArg(nrhs, prhs, 2, CLOCK_SPIN_SEC));
+		plhs[0] = mxCreateDoubleScalar(fLate);
+	} else if (strcmp(Command, "WaitUntil") == 0) {
+		double fLate = ClockWaitUntil(fnArg(nrhs, prhs, 1, 0), fnArg(nrhs, prhs, 2, CLOCK_SPIN_SEC));
+		plhs[0] = mxCreateDoubleScalar(fLate);
+	} else if (strcmp(Command, "YieldSecs") == 0) {
+		ClockSleepSecs(fnArg(nrhs, prhs, 1, 0));
+	} else if (strcmp(Command, "TSC") == 0) {
+		plhs[0] = mxCreateDoubleScalar(ClockGetSecsTSC());
+	} else if (strcmp(Command, "CalibrateTSC") == 0) {
+		bool bValid = ClockCalibrateTSC(fnArg(nrhs, prhs, 1, 0.05));
+		double afOut[2] = {double(bValid), bValid ? 1.0 / ClockTSC().m_fSecPerTick : 0};
+		plhs[0] = fnRow(afOut, 2);
+	} else if (strcmp(Command, "SetPlexonSync") == 0) {
+		if (nrhs < 3 || mxGetNumberOfElements(prhs[1]) != mxGetNumberOfElements(prhs[2]) || !mxIsDouble(prhs[1]) || !mxIsDouble(prhs[2]))
+			mexErrMsgTxt("SetPlexonSync: local times and Plexon timestamps must be double vectors of the same length.");
+		PlexonSyncFit(g_PlexonSync, mxGetPr(prhs[1]), mxGetPr(prhs[2]), int(mxGetNumberOfElements(prhs[1])),
+			fnArg(nrhs, prhs, 3, PLEXON_TICKS_PER_SEC));
+		double afOut[3] = {g_PlexonSync.m_fOffset, g_PlexonSync.m_fSlope, g_PlexonSync.m_fResidualSec};
+		plhs[0] = fnRow(afOut, 3);
+	} else if (strcmp(Command, "PlexonToSecs") == 0 || strcmp(Command, "SecsToPlexon") == 0) {
+		if (nrhs < 2 || !mxIsDouble(prhs[1]))
+			mexErrMsgTxt("Expecting a double array.");
+		bool bToSecs = strcmp(Command, "PlexonToSecs") == 0;
+		plhs[0] = mxCreateNumericArray(mxGetNumberOfDimensions(prhs[1]), mxGetDimensions(prhs[1]), mxDOUBLE_CLASS, mxREAL);
+		const double *In = mxGetPr(prhs[1]);
+		double *Out = mxGetPr(plhs[0]);
+		size_t N = mxGetNumberOfElements(prhs[1]);
+		for (size_t k = 0; k < N; k++)
+			Out[k] = bToSecs ? PlexonTicksToSecs(g_PlexonSync, In[k]) : SecsToPlexonTicks(g_PlexonSync, In[k]);
+	} else if (strcmp(Command, "Benchmark") == 0) {
+		ClockBenchmarkResult R;
+		ClockBenchmark(R, int(fnArg(nrhs, prhs, 1, 1e6)), int(fnArg(nrhs, prhs, 2, 1000)), fnArg(nrhs, prhs, 3, 1e-3),
+			fnArg(nrhs, prhs, 4, CLOCK_SPIN_SEC));
+		if (nlhs == 0) {
+			mexPrintf("Read: %.1f ns (TSC %.1f ns)\n", R.m_fReadSec * 1e9, R.m_fReadTSCSec * 1e9);
+			mexPrintf("%-28s%10s%10s%10s%10s%10s\n", "[us]", "50%", "90%", "99%", "99.9%", "max");
+			fnPrintPercentiles("Step between reads", R.m_afStepSec);
+			fnPrintPercentiles("WaitUntil lateness", R.m_afLateSec);
+			fnPrintPercentiles("Sleep lateness", R.m_afSleepLateSec);
+			return;
+		}
+		const char *astrFields[] = {"m_fReadSec", "m_fReadTSCSec", "m_afPercentiles", "m_afStepSec", "m_afLateSec", "m_afSleepLateSec"};
+		plhs[0] = mxCreateStructMatrix(1, 1, 6, astrFields);
+		mxSetField(plhs[0], 0, "m_fReadSec", mxCreateDoubleScalar(R.m_fReadSec));
+		mxSetField(plhs[0], 0, "m_fReadTSCSec", mxCreateDoubleScalar(R.m_fReadTSCSec));
+		mxSetField(plhs[0], 0, "m_afPercentiles", fnRow(CLOCK_PERCENTILES, CLOCK_NUM_PERCENTILES));
+		mxSetField(plhs[0], 0, "m_afStepSec", fnRow(R.m_afStepSec, CLOCK_NUM_PERCENTILES));
+		mxSetField(plhs[0], 0, "m_afLateSec", fnRow(R.m_afLateSec, CLOCK_NUM_PERCENTILES));
+		mxSetField(plhs[0], 0, "m_afSleepLateSec", fnRow(R.m_afSleepLateSec, CLOCK_NUM_PERCENTILES));
+	} else {
+		mexErrMsgTxt("Unknown command. Commands: WaitSecs, WaitUntil, YieldSecs, TSC, CalibrateTSC, SetPlexonSync, PlexonToSecs, SecsToPlexon, Benchmark.");
+	}
+}
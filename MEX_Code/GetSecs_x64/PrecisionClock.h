@@ -0,0 +1,329 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef PRECISION_CLOCK_H
+#define PRECISION_CLOCK_H
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <time.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#endif
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+/*
+ Monotonic clock and precise waits shared by the MEX files (header only: include it with
+ "../GetSecs_x64/PrecisionClock.h", nothing to link).
+
+ ClockGetSecs is the GetSecs time base: QueryPerformanceCounter on Windows (what PsychTimeGlue
+ returns), CLOCK_MONOTONIC elsewhere. Times from different MEX files can be compared directly.
+
+ ClockGetSecsTSC reads the cpu time stamp counter instead, mapped onto the same time base by a
+ calibration against ClockGetSecs (ClockCalibrateTSC, done on the first call). It only exists on
+ x86 cpus with an invariant TSC (constant rate, synchronized across cores); elsewhere it is
+ ClockGetSecs. It is cheaper to read, but drifts away slowly: calibrate again every few minutes
+ if stamps from both clocks are mixed.
+
+ ClockWaitUntil sleeps until fSpinSec before the deadline and spins on the clock for the rest,
+ the way PsychWaitUntilSeconds does. The OS wakes a sleeping thread up late by up to a timer
+ period (1 ms on Windows with timeBeginPeriod(1), 15.6 ms without; ~50-100 us on Linux), which
+ is what CLOCK_SPIN_SEC covers.
+
+ Plexon timestamps are counts of a 40 kHz clock (PLEXON_TICKS_PER_SEC) on the acquisition box.
+ PlexonSync maps them onto the local clock: a straight line fitted to pairs of (local time a
+ strobe word was sent, Plexon timestamp of the strobe word), as fnAnalysisSyncComputers does
+ offline.
+*/
+
+#ifdef _WIN32
+const double CLOCK_SPIN_SEC = 2e-3;
+#else
+const double CLOCK_SPIN_SEC = 2e-4;
+#endif
+const double PLEXON_TICKS_PER_SEC = 40000;
+
+inline double ClockGetSecs()
+{
+#ifdef _WIN32
+	static double fTicksToSec = 0;
+	LARGE_INTEGER Count;
+	if (fTicksToSec == 0) {
+		LARGE_INTEGER Freq;
+		QueryPerformanceFrequency(&Freq);
+		fTicksToSec = 1.0 / double(Freq.QuadPart);
+	}
+	QueryPerformanceCounter(&Count);
+	return double(Count.QuadPart) * fTicksToSec;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + 1e-9 * double(ts.tv_nsec);
+#endif
+}
+
+// Releases the cpu for at least fSec (a timer period or more on Windows). 0 yields.
+inline void ClockSleepSecs(double fSec)
+{
+#ifdef _WIN32
+	DWORD iMS = DWORD(fSec * 1000.0);
+	if (iMS > 0)
+		Sleep(iMS);
+	else
+		SwitchToThread();
+#else
+	if (fSec <= 0) {
+		sched_yield();
+		return;
+	}
+	struct timespec ts;
+	ts.tv_sec = time_t(fSec);
+	ts.tv_nsec = long((fSec - double(ts.tv_sec)) * 1e9);
+	nanosleep(&ts, NULL);
+#endif
+}
+
+// Returns how late the deadline was met (0 if it had already passed on entry)
+inline double ClockWaitUntil(double fWhen, double fSpinSec = CLOCK_SPIN_SEC)
+{
+	double fNow = ClockGetSecs();
+	if (fNow >= fWhen)
+		return 0;
+	while (fWhen - fNow > fSpinSec) {
+		ClockSleepSecs(fWhen - fNow - fSpinSec);
+		fNow = ClockGetSecs();
+	}
+	while (fNow < fWhen)
+		fNow = ClockGetSecs();
+	return fNow - fWhen;
+}
+
+inline double ClockWaitSecs(double fSec, double fSpinSec = CLOCK_SPIN_SEC)
+{
+	return ClockWaitUntil(ClockGetSecs() + fSec, fSpinSec);
+}
+
+/* Time stamp counter */
+
+typedef struct {
+	bool m_bValid;
+	unsigned long long m_iTick0;
+	double m_fSec0, m_fSecPerTick;
+} ClockTSCCalibration;
+
+inline ClockTSCCalibration &ClockTSC()
+{
+	static ClockTSCCalibration Calibration = {false, 0, 0, 0};
+	return Calibration;
+}
+
+inline bool ClockHasInvariantTSC()
+{
+#if defined(_WIN32) && (defined(_M_X64) || defined(_M_IX86))
+	int aiRegs[4];
+	__cpuid(aiRegs, 0x80000000);
+	if ((unsigned int)aiRegs[0] < 0x80000007)
+		return false;
+	__cpuid(aiRegs, 0x80000007);
+	return (aiRegs[3] & (1 << 8)) != 0;
+#elif defined(__x86_64__) || defined(__i386__)
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+		return false;
+	return (d & (1 << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+inline unsigned long long ClockReadTSC()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// One (TSC, clock) pair, taken from the tightest of a few TSC / clock / TSC brackets
+inline void ClockTSCPair(unsigned long long *piTick, double *pfSec)
+{
+	unsigned long long iBest = ~0ULL;
+	*piTick = 0;
+	*pfSec = 0;
+	for (int k = 0; k < 16; k++) {
+		unsigned long long iBefore = ClockReadTSC();
+		double fSec = ClockGetSecs();
+		unsigned long long iAfter = ClockReadTSC();
+		if (iAfter - iBefore < iBest) {
+			iBest = iAfter - iBefore;
+			*piTick = iBefore + (iAfter - iBefore) / 2;
+			*pfSec = fSec;
+		}
+	}
+}
+
+// Measures the TSC rate over fSec (longer is more accurate: the error is ~1 us / fSec)
+inline bool ClockCalibrateTSC(double fSec = 0.05)
+{
+	ClockTSCCalibration &C = ClockTSC();
+	if (!ClockHasInvariantTSC()) {
+		C.m_bValid = false;
+		return false;
+	}
+	unsigned long long iTick0 = 0, iTick1 = 0;
+	double fSec0 = 0, fSec1 = 0;
+	ClockTSCPair(&iTick0, &fSec0);
+	ClockWaitSecs(fSec);
+	ClockTSCPair(&iTick1, &fSec1);
+	if (iTick1 <= iTick0 || fSec1 <= fSec0) {
+		C.m_bValid = false;
+		return false;
+	}
+	C.m_fSecPerTick = (fSec1 - fSec0) / double(iTick1 - iTick0);
+	C.m_iTick0 = iTick1;
+	C.m_fSec0 = fSec1;
+	C.m_bValid = true;
+	return true;
+}
+
+inline double ClockGetSecsTSC()
+{
+	static bool bCalibrated = ClockCalibrateTSC();
+	(void)bCalibrated;
+	const ClockTSCCalibration &C = ClockTSC();
+	if (!C.m_bValid)
+		return ClockGetSecs();
+	return C.m_fSec0 + double((long long)(ClockReadTSC() - C.m_iTick0)) * C.m_fSecPerTick;
+}
+
+/* Plexon */
+
+typedef struct {
+	double m_fTicksPerSec;
+	double m_fOffset, m_fSlope;	// local = m_fOffset + m_fSlope * ticks / m_fTicksPerSec
+	double m_fResidualSec;		// rms of the fit
+} PlexonSync;
+
+inline void PlexonSyncIdentity(PlexonSync &Sync, double fTicksPerSec = PLEXON_TICKS_PER_SEC)
+{
+	Sync.m_fTicksPerSec = fTicksPerSec;
+	Sync.m_fOffset = 0;
+	Sync.m_fSlope = 1;
+	Sync.m_fResidualSec = 0;
+}
+
+// Least squares line through the pairs. With a single pair only the offset is fitted.
+inline bool PlexonSyncFit(PlexonSync &Sync, const double *afLocalSec, const double *afTicks, int iNumPairs,
+						  double fTicksPerSec = PLEXON_TICKS_PER_SEC)
+{
+	PlexonSyncIdentity(Sync, fTicksPerSec);
+	if (iNumPairs < 1)
+		return false;
+	// centered sums, the raw values are too large for the textbook formula
+	double fMeanX = 0, fMeanY = 0;
+	for (int k = 0; k < iNumPairs; k++) {
+		fMeanX += afTicks[k] / fTicksPerSec;
+		fMeanY += afLocalSec[k];
+	}
+	fMeanX /= iNumPairs;
+	fMeanY /= iNumPairs;
+	double Sxx = 0, Sxy = 0;
+	for (int k = 0; k < iNumPairs; k++) {
+		double dx = afTicks[k] / fTicksPerSec - fMeanX;
+		Sxx += dx * dx;
+		Sxy += dx * (afLocalSec[k] - fMeanY);
+	}
+	if (Sxx > 0)
+		Sync.m_fSlope = Sxy / Sxx;
+	Sync.m_fOffset = fMeanY - Sync.m_fSlope * fMeanX;
+
+	double fSquares = 0;
+	for (int k = 0; k < iNumPairs; k++) {
+		double fResidual = afLocalSec[k] - (Sync.m_fOffset + Sync.m_fSlope * afTicks[k] / fTicksPerSec);
+		fSquares += fResidual * fResidual;
+	}
+	Sync.m_fResidualSec = sqrt(fSquares / iNumPairs);
+	return true;
+}
+
+inline double PlexonTicksToSecs(const PlexonSync &Sync, double fTicks)
+{
+	return Sync.m_fOffset + Sync.m_fSlope * fTicks / Sync.m_fTicksPerSec;
+}
+
+inline double SecsToPlexonTicks(const PlexonSync &Sync, double fSec)
+{
+	return (fSec - Sync.m_fOffset) / Sync.m_fSlope * Sync.m_fTicksPerSec;
+}
+
+/* Benchmark */
+
+// Percentile of an unsorted vector (sorts it)
+inline double ClockPercentile(std::vector<double> &afValues, double fPercent)
+{
+	if (afValues.empty())
+		return 0;
+	std::sort(afValues.begin(), afValues.end());
+	size_t iIndex = size_t(fPercent / 100.0 * double(afValues.size() - 1) + 0.5);
+	return afValues[std::min(iIndex, afValues.size() - 1)];
+}
+
+const int CLOCK_NUM_PERCENTILES = 5;
+const double CLOCK_PERCENTILES[CLOCK_NUM_PERCENTILES] = {50, 90, 99, 99.9, 100};
+
+typedef struct {
+	double m_fReadSec, m_fReadTSCSec;					// mean cost of one read
+	double m_afStepSec[CLOCK_NUM_PERCENTILES];			// between consecutive reads (resolution, preemption)
+	double m_afLateSec[CLOCK_NUM_PERCENTILES];			// ClockWaitUntil lateness
+	double m_afSleepLateSec[CLOCK_NUM_PERCENTILES];		// ClockSleepSecs lateness, no spinning
+} ClockBenchmarkResult;
+
+inline void ClockBenchmark(ClockBenchmarkResult &R, int iNumReads, int iNumWaits, double fWaitSec, double fSpinSec = CLOCK_SPIN_SEC)
+{
+	iNumReads = std::max(iNumReads, 2);
+	std::vector<double> afTimes(iNumReads);
+	double fStart = ClockGetSecs();
+	for (int k = 0; k < iNumReads; k++)
+		afTimes[k] = ClockGetSecs();
+	R.m_fReadSec = (afTimes[iNumReads - 1] - fStart) / iNumReads;
+
+	volatile double fSink = 0;
+	ClockGetSecsTSC();	// calibration out of the timed loop
+	fStart = ClockGetSecs();
+	for (int k = 0; k < iNumReads; k++)
+		fSink = ClockGetSecsTSC();
+	R.m_fReadTSCSec = (ClockGetSecs() - fStart) / iNumReads;
+	(void)fSink;
+
+	std::vector<double> afSteps(iNumReads - 1);
+	for (int k = 1; k < iNumReads; k++)
+		afSteps[k - 1] = afTimes[k] - afTimes[k - 1];
+
+	std::vector<double> afLate(iNumWaits), afSleepLate(iNumWaits);
+	for (int k = 0; k < iNumWaits; k++)
+		afLate[k] = ClockWaitUntil(ClockGetSecs() + fWaitSec, fSpinSec);
+	for (int k = 0; k < iNumWaits; k++) {
+		double fWhen = ClockGetSecs() + fWaitSec;
+		ClockSleepSecs(fWaitSec);
+		afSleepLate[k] = ClockGetSecs() - fWhen;
+	}
+
+	for (int p = 0; p < CLOCK_NUM_PERCENTILES; p++) {
+		R.m_afStepSec[p] = ClockPercentile(afSteps, CLOCK_PERCENTILES[p]);
+		R.m_afLateSec[p] = ClockPercentile(afLate, CLOCK_PERCENTILES[p]);
+		R.m_afSleepLateSec[p] = ClockPercentile(afSleepLate, CLOCK_PERCENTILES[p]);
+	}
+}
+
+#endif
@@ -0,0 +1,28 @@
+% Shared clock: waits, TSC calibration, Plexon conversion and the jitter benchmark
+t0 = GetSecs();
+fLate = GetSecs('WaitSecs', 0.01);
+fElapsed = GetSecs() - t0;
+fprintf('WaitSecs(10 ms) took %.3f ms, %.1f us late\n', fElapsed*1e3, fLate*1e6);
+assert(fElapsed >= 0.01 && fElapsed < 0.015 && fLate >= 0);
+
+fWhen = GetSecs() + 0.005;
+GetSecs('WaitUntil', fWhen);
+assert(GetSecs() >= fWhen);
+
+afTSC = GetSecs('CalibrateTSC', 0.1);
+if afTSC(1)
+    fprintf('Invariant TSC at %.3f MHz, %.2f us from GetSecs\n', afTSC(2)/1e6, (GetSecs('TSC') - GetSecs())*1e6);
+    assert(abs(GetSecs('TSC') - GetSecs()) < 1e-4);
+end
+
+% Strobe words sent at afLocal arrive at Plexon on a clock that started 90 sec earlier and runs 10 ppm fast
+afLocal = 100 + cumsum(rand(1,50));
+afTicks = round((afLocal - 90) * 40000 * (1 + 10e-6));
+afFit = GetSecs('SetPlexonSync', afLocal, afTicks);
+fprintf('Offset %.6f sec, slope %.8f, residual %.2f us\n', afFit(1), afFit(2), afFit(3)*1e6);
+assert(max(abs(GetSecs('PlexonToSecs', afTicks) - afLocal)) < 25e-6);
+assert(max(abs(GetSecs('SecsToPlexon', afLocal) - afTicks)) < 1);
+
+GetSecs('Benchmark', 1e6, 1000, 1e-3);
+strctBench = GetSecs('Benchmark', 1e5, 200, 1e-3);
+assert(strctBench.m_afLateSec(1) < strctBench.m_afSleepLateSec(1));
@@ -5,124 +5,249 @@
 % the Free Software Foundation (see GPL.txt)
 */
 #include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 #include "mex.h"
-#define MAX(x,y)(x>y)?(x):(y)
-#define MIN(x,y)(x<y)?(x):(y)
 
-void mexFunction( int nlhs, mxArray *plhs[], 
-				 int nrhs, const mxArray *prhs[] ) 
+/*
+ Groups threshold crossings of single channels into tetrode / polytrode events.
+
+ [a2iEvents, a2fGroupedWaves, afEventTS] = GroupChannelsToTetrode(afSortedTS, aiSortedCh, a2fSortedWaves, a2iGroupTable, [fJitter])
+ a2iEvents = GroupChannelsToTetrode(afSortedTS, aiSortedCh, a2iGroupTable, [fJitter])
+
+	afSortedTS     - spike timestamps, sorted
+	aiSortedCh     - channel of every spike
+	a2fSortedWaves - NumSpikes x L waveforms (double or single)
+	a2iGroupTable  - NumGroups x GroupSize channel table (4 columns for tetrodes, 8-32 for silicon
+	                 probe groups). Groups with fewer channels are padded with 0.
+	fJitter        - spikes that are at most fJitter after the first spike of an event of their group
+	                 belong to that event (default 0: identical timestamps only)
+
+	a2iEvents       - (GroupSize+1) x NumEvents int32: the (1-based) spike of every slot of the group,
+	                  0 for padded slots, and the group number in the last row
+	a2fGroupedWaves - NumEvents x (GroupSize*L): the waveforms of the slots, side by side
+	afEventTS       - timestamp of the first spike of every event
+
+ Every group keeps its own event window, opened by the first crossing on one of its channels, so
+ crossings on other groups never cut an event short. An event is reported for a group when every
+ channel of the group crossed within the window. If a channel crossed more than once, its first
+ spike is used. Events are reported in the order of their first spike (table order for ties).
+
+ Channels are mapped to their (group, slot) through a lookup table, so every spike costs O(1)
+ whatever the number of groups, and the state of a group is only reset when it was touched.
+*/
+
+typedef struct {
+	int m_iGroup;
+	int m_iSlot;
+} ChannelSlot_struct;
+
+class EventGrouper {
+public:
+	EventGrouper(const double *a2fGroupTable, int iNumGroups, int iGroupSize);
+
+	bool IsValid() const { return m_strError == NULL; }
+	const char *GetError() const { return m_strError; }
+
+	// Spikes must come in time order; iSpike is 0-based
+	void AddSpike(double fTimestamp, int iChannel, int iSpike);
+	void Flush();
+
+	int GroupSize() const { return m_iGroupSize; }
+	const std::vector<int> &Events() const { return m_aiEvents; } // (GroupSize+1) per event, 1-based
+	const std::vector<double> &EventTimes() const { return m_afEventTS; }
+
+	double m_fJitter;
+
+private:
+	int m_iGroupSize;
+	std::vector<ChannelSlot_struct> m_Lookup;	// indexed by channel
+	std::vector<int> m_aiRequired;				// channels per group
+	std::vector<int> m_aiSlots;					// spike+1 of every slot of the current event, NumGroups x GroupSize
+	std::vector<int> m_aiFilled;				// filled slots per group, 0: no open event
+	std::vector<double> m_afGroupStart;			// first spike of the open event of every group
+	std::vector<int> m_aiOpen;					// groups with an open event, in the order they opened
+	size_t m_iFirstOpen;						// m_aiOpen before this index are closed already
+	std::vector<int> m_aiClosing;
+
+	void CloseEvents(double fTimestamp, bool bAll);
+	std::vector<int> m_aiEvents;
+	std::vector<double> m_afEventTS;
+	const char *m_strError;
+};
+
+EventGrouper::EventGrouper(const double *a2fGroupTable, int iNumGroups, int iGroupSize) :
+	m_fJitter(0), m_iGroupSize(iGroupSize), m_iFirstOpen(0), m_strError(NULL)
 {
-	double *SortedTS = (double*)mxGetData(prhs[0]);
-	double *Channels = (double*)mxGetData(prhs[1]);
-	double *Waves = (double*)mxGetData(prhs[2]);
-	double *TetrodeTable= (double*)mxGetData(prhs[3]);
-
-	const int *dimwaves = mxGetDimensions(prhs[2]);
-	int iNumWavePts= dimwaves[1];
-	int iNumInWaves= dimwaves[0];
-
-	const int *dim = mxGetDimensions(prhs[3]);
-	int iNumTetrodes = dim[0];
-
-	int iNumTS = mxGetNumberOfElements(prhs[0]);
-
-	int iNumUniqueTS = 0;
-	for (int k=0;k<iNumTS-1;k++) 
-		iNumUniqueTS+= (SortedTS[k] == SortedTS[k+1]);
-	
-	int iActiveEntry = 1;
-	int iActiveLine = 0;
-	double fPrevTS = SortedTS[0];
-	int *a2iInd = new int[4 *iNumTetrodes]; //4 x iNumTetrodes
-	for (int k=0;k<4*iNumTetrodes;k++) 
-		a2iInd[k] = 0;
-
-	double *a2fSortedEventsTable = new double [iNumTetrodes*iNumUniqueTS * 5]; //, 5);  % indices to wave forms/ts. last column denotes which tetrode was triggered
-
-
-
-	for (int iIter=0;iIter < iNumTS;iIter++) {
-
-		double fCurrentTS = SortedTS[iIter];
-		int iCurrentChannel = (int)Channels[iIter];
-	
-		int iTetrodeNumber=0, iChannelInTetrode;
-		int  iIndex = -1;
-		for (iTetrodeNumber=0;iTetrodeNumber<iNumTetrodes;iTetrodeNumber++) {
-			for (iChannelInTetrode=0;iChannelInTetrode<4;iChannelInTetrode++) {
-				if (iCurrentChannel == TetrodeTable[iTetrodeNumber + iChannelInTetrode*iNumTetrodes]) {
-				iIndex = iNumTetrodes*iChannelInTetrode + iTetrodeNumber;
-				break;
-				}
+	ChannelSlot_struct Unused = {-1, -1};
+	m_aiRequired.assign(iNumGroups, 0);
+	m_aiSlots.assign(size_t(iNumGroups) * iGroupSize, 0);
+	m_aiFilled.assign(iNumGroups, 0);
+	m_afGroupStart.assign(iNumGroups, 0);
+	for (int g=0;g<iNumGroups;g++) {
+		for (int s=0;s<iGroupSize;s++) {
+			double fChannel = a2fGroupTable[g + s * iNumGroups];
+			if (fChannel == 0)
+				continue;
+			if (!(fChannel > 0 && fChannel < 1e6) || fChannel != double(int(fChannel))) {
+				m_strError = "Group table entries must be positive channel numbers (0 for unused slots).";
+				return;
 			}
-			if (iIndex > 0)
-				break;
-		}
-		
-
-		if (fCurrentTS == fPrevTS) {
-			if (iIndex >= 0 && iIndex < iNumTetrodes*4)
-				a2iInd[iIndex] = iIter+1;
-
-		} else {
-			// add events to the table...
-			
-			// find valid entries in a2iInd (i.e., those with full information).
-			for (int iTetrodeIter=0;iTetrodeIter<iNumTetrodes;iTetrodeIter++) {
-				bool bAllEventsPresent = a2iInd[iNumTetrodes*0 + iTetrodeIter] > 0 &&
-										 a2iInd[iNumTetrodes*1 + iTetrodeIter] > 0 &&
-										 a2iInd[iNumTetrodes*2 + iTetrodeIter] > 0 &&
-										 a2iInd[iNumTetrodes*3 + iTetrodeIter] > 0;
-
-				if (bAllEventsPresent) {
-					// Add this event.
-					a2fSortedEventsTable[iActiveLine*5+0] = a2iInd[iNumTetrodes*0 + iTetrodeIter];
-					a2fSortedEventsTable[iActiveLine*5+1] = a2iInd[iNumTetrodes*1 + iTetrodeIter];
-					a2fSortedEventsTable[iActiveLine*5+2] = a2iInd[iNumTetrodes*2 + iTetrodeIter];
-					a2fSortedEventsTable[iActiveLine*5+3] = a2iInd[iNumTetrodes*3 + iTetrodeIter];
-					a2fSortedEventsTable[iActiveLine*5+4] = iTetrodeIter+1;
-					iActiveLine++;
-				}
-
+			size_t iChannel = size_t(fChannel);
+			if (iChannel >= m_Lookup.size())
+				m_Lookup.resize(iChannel + 1, Unused);
+			if (m_Lookup[iChannel].m_iGroup >= 0) {
+				m_strError = "A channel appears more than once in the group table.";
+				return;
 			}
-
-			for (int k=0;k<4*iNumTetrodes;k++) 
-				a2iInd[k] = 0;
-			
-			fPrevTS = fCurrentTS ;	
-			if (iIndex >= 0 && iIndex < iNumTetrodes*4)
-				a2iInd[iIndex] = iIter+1;
+			m_Lookup[iChannel].m_iGroup = g;
+			m_Lookup[iChannel].m_iSlot = s;
+			m_aiRequired[g]++;
 		}
-
-
 	}
+}
 
-	int dim_out[2] ={5,iActiveLine};
-	plhs[0] = mxCreateNumericArray(2, dim_out, mxDOUBLE_CLASS, mxREAL);
-	double *Out = (double*)mxGetPr(plhs[0]);
-
-	int dim_wave_out[2] ={iActiveLine,4*iNumWavePts};
-	plhs[1] = mxCreateNumericArray(2, dim_wave_out, mxDOUBLE_CLASS, mxREAL);
-	double *WaveOut = (double*)mxGetPr(plhs[1]);
+void EventGrouper::AddSpike(double fTimestamp, int iChannel, int iSpike)
+{
+	CloseEvents(fTimestamp, false);
+	if (iChannel < 0 || size_t(iChannel) >= m_Lookup.size() || m_Lookup[iChannel].m_iGroup < 0)
+		return;
+	const ChannelSlot_struct &C = m_Lookup[iChannel];
+	int &iSlot = m_aiSlots[size_t(C.m_iGroup) * m_iGroupSize + C.m_iSlot];
+	if (iSlot != 0)
+		return;
+	iSlot = iSpike + 1;
+	if (m_aiFilled[C.m_iGroup]++ == 0) {
+		m_afGroupStart[C.m_iGroup] = fTimestamp;
+		m_aiOpen.push_back(C.m_iGroup);
+	}
+}
 
-	for (int i=0;i<iActiveLine;i++) {
+void EventGrouper::Flush()
+{
+	CloseEvents(0, true);
+}
 
-		for (int j=0;j<5;j++) {
-			Out[i*5+j]=a2fSortedEventsTable[i*5+j];
+// Closes the events whose window ended before fTimestamp (all of them if bAll). Since spikes come in
+// time order, the groups opened in time order and the expired events are at the front of m_aiOpen.
+void EventGrouper::CloseEvents(double fTimestamp, bool bAll)
+{
+	m_aiClosing.clear();
+	while (m_iFirstOpen < m_aiOpen.size()) {
+		int g = m_aiOpen[m_iFirstOpen];
+		if (!bAll && fTimestamp - m_afGroupStart[g] <= m_fJitter)
+			break;
+		m_aiClosing.push_back(g);
+		m_iFirstOpen++;
+	}
+	if (m_iFirstOpen == m_aiOpen.size()) {
+		m_aiOpen.clear();
+		m_iFirstOpen = 0;
+	}
+	if (m_aiClosing.empty())
+		return;
+
+	// events that started together are reported in table order, as the old grouper did
+	for (size_t k=1;k<m_aiClosing.size();k++) {
+		int g = m_aiClosing[k];
+		size_t j = k;
+		for (;j > 0 && m_afGroupStart[m_aiClosing[j-1]] == m_afGroupStart[g] && m_aiClosing[j-1] > g;j--)
+			m_aiClosing[j] = m_aiClosing[j-1];
+		m_aiClosing[j] = g;
+	}
+	for (size_t k=0;k<m_aiClosing.size();k++) {
+		int g = m_aiClosing[k];
+		int *aiSlots = &m_aiSlots[size_t(g) * m_iGroupSize];
+		if (m_aiFilled[g] == m_aiRequired[g]) {
+			m_aiEvents.insert(m_aiEvents.end(), aiSlots, aiSlots + m_iGroupSize);
+			m_aiEvents.push_back(g + 1);
+			m_afEventTS.push_back(m_afGroupStart[g]);
 		}
+		memset(aiSlots, 0, sizeof(int) * m_iGroupSize);
+		m_aiFilled[g] = 0;
+	}
+}
 
-		// build the groupped wave data
-		for (int j=0;j<4;j++) {
-			int index = a2fSortedEventsTable[i*5+j]-1;
-			for (int w=0;w<iNumWavePts;w++) {
-				WaveOut[iActiveLine*(w+j*iNumWavePts)+i] = Waves[w*iNumInWaves+index];
-			}
+template <class T>
+mxArray *GroupWaves(const EventGrouper &Grouper, const T *Waves, size_t iNumSpikes, size_t L, mxClassID ClassID)
+{
+	const std::vector<int> &aiEvents = Grouper.Events();
+	size_t S = size_t(Grouper.GroupSize());
+	size_t iNumEvents = aiEvents.size() / (S + 1);
+	mxArray *Out = mxCreateNumericMatrix(iNumEvents, S * L, ClassID, mxREAL);
+	T *WaveOut = (T *)mxGetData(Out);
+	for (size_t s=0;s<S;s++) {
+		for (size_t i=0;i<iNumEvents;i++) {
+			int iSpike = aiEvents[i * (S + 1) + s] - 1;
+			if (iSpike < 0 || size_t(iSpike) >= iNumSpikes)
+				continue;
+			for (size_t w=0;w<L;w++)
+				WaveOut[iNumEvents * (w + s * L) + i] = Waves[w * iNumSpikes + iSpike];
 		}
-
 	}
+	return Out;
+}
 
-	delete [] a2iInd;
-	delete [] a2fSortedEventsTable;
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	// The waveform argument is optional: (TS, Ch, Table, [Jitter]) or (TS, Ch, Waves, Table, [Jitter])
+	bool bWaves = nrhs == 5 || (nrhs == 4 && mxGetNumberOfElements(prhs[3]) != 1);
+	int iTable = bWaves ? 3 : 2;
+	if (nrhs < 3 || nrhs > iTable + 2 || !mxIsDouble(prhs[0]) || !mxIsDouble(prhs[1]) || !mxIsDouble(prhs[iTable]) ||
+		(bWaves && !mxIsDouble(prhs[2]) && !mxIsSingle(prhs[2]))) {
+		mexErrMsgTxt("Usage: [a2iEvents, a2fGroupedWaves, afEventTS] = GroupChannelsToTetrode(afSortedTS, aiSortedCh, [a2fSortedWaves], a2iGroupTable, [fJitter])");
+		return;
+	}
+	const double *SortedTS = mxGetPr(prhs[0]);
+	const double *Channels = mxGetPr(prhs[1]);
+	size_t iNumTS = mxGetNumberOfElements(prhs[0]);
+	if (mxGetNumberOfElements(prhs[1]) != iNumTS) {
+		mexErrMsgTxt("Timestamps and channels must have the same length.");
+		return;
+	}
+	if (bWaves && mxGetM(prhs[2]) != iNumTS && iNumTS > 0) {
+		mexErrMsgTxt("Waveforms must have one row per timestamp.");
+		return;
+	}
 
+	EventGrouper Grouper(mxGetPr(prhs[iTable]), int(mxGetM(prhs[iTable])), int(mxGetN(prhs[iTable])));
+	if (!Grouper.IsValid()) {
+		mexErrMsgTxt(Grouper.GetError());
+		return;
+	}
+	if (nrhs > iTable + 1)
+		Grouper.m_fJitter = mxGetScalar(prhs[iTable + 1]);
 
+	for (size_t k=0;k<iNumTS;k++) {
+		if (k > 0 && SortedTS[k] < SortedTS[k-1]) {
+			mexErrMsgTxt("Timestamps must be sorted.");
+			return;
+		}
+		double fChannel = Channels[k];
+		Grouper.AddSpike(SortedTS[k], fChannel >= 0 && fChannel < 1e6 ? int(fChannel) : -1, int(k));
+	}
+	Grouper.Flush();
+
+	const std::vector<int> &aiEvents = Grouper.Events();
+	size_t S = size_t(Grouper.GroupSize());
+	plhs[0] = mxCreateNumericMatrix(S + 1, aiEvents.size() / (S + 1), mxINT32_CLASS, mxREAL);
+	if (!aiEvents.empty())
+		memcpy(mxGetData(plhs[0]), &aiEvents[0], sizeof(int) * aiEvents.size());
+
+	if (nlhs > 1) {
+		if (!bWaves)
+			plhs[1] = mxCreateDoubleMatrix(0, 0, mxREAL);
+		else if (mxIsSingle(prhs[2]))
+			plhs[1] = GroupWaves(Grouper, (const float *)mxGetData(prhs[2]), iNumTS, mxGetN(prhs[2]), mxSINGLE_CLASS);
+		else
+			plhs[1] = GroupWaves(Grouper, mxGetPr(prhs[2]), iNumTS, mxGetN(prhs[2]), mxDOUBLE_CLASS);
+	}
+	if (nlhs > 2) {
+		const std::vector<double> &afEventTS = Grouper.EventTimes();
+		plhs[2] = mxCreateDoubleMatrix(1, afEventTS.size(), mxREAL);
+		if (!afEventTS.empty())
+			memcpy(mxGetPr(plhs[2]), &afEventTS[0], sizeof(double) * afEventTS.size());
+	}
 }
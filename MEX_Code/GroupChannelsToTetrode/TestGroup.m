@@ -1,5 +1,43 @@
-addpath('Z:\MEX\win32');
-load('Z:\DebugForGrouping')
-whos
-a2iRegroupping = GroupChannelsToTetrode(afSortedTS,aiSortedCh, a2iTetrodeChannelTable);
-a2iRegroupping' == a2fGroupEvents
\ No newline at end of file
+rng(0);
+% Two 8-channel silicon probe groups (the second one padded to 6 channels) with jittered crossings
+a2iGroupTable = [1:8; 9:14, 0, 0];
+fJitter = 2/40000;
+iNumEvents = 1000;
+afEventTS = sort(rand(1,iNumEvents)*600);
+aiEventGroup = 1+(rand(1,iNumEvents) > 0.5);
+afTS = [];
+aiCh = [];
+for k=1:iNumEvents
+    aiChannels = a2iGroupTable(aiEventGroup(k), a2iGroupTable(aiEventGroup(k),:) > 0);
+    afTS = [afTS, afEventTS(k), afEventTS(k) + rand(1,length(aiChannels)-1)*fJitter];
+    aiCh = [aiCh, aiChannels];
+end
+% Crossings on a single channel never make an event
+afTS = [afTS, rand(1,500)*600];
+aiCh = [aiCh, ceil(rand(1,500)*14)];
+[afSortedTS, aiSort] = sort(afTS);
+aiSortedCh = aiCh(aiSort);
+a2fSortedWaves = single(randn(length(afSortedTS), 32));
+
+[a2iEvents, a2fGroupedWaves, afGroupedTS] = GroupChannelsToTetrode(afSortedTS, aiSortedCh, a2fSortedWaves, a2iGroupTable, fJitter);
+assert(isa(a2iEvents,'int32') && size(a2iEvents,1) == 9);
+assert(all(ismember(afEventTS, afGroupedTS)));
+for k=1:size(a2iEvents,2)
+    iGroup = a2iEvents(end,k);
+    aiSpikes = a2iEvents(1:8,k);
+    abUsed = a2iGroupTable(iGroup,:) > 0;
+    assert(all(aiSpikes(~abUsed) == 0));
+    assert(isequal(aiSortedCh(aiSpikes(abUsed)), a2iGroupTable(iGroup,abUsed)));
+    assert(max(afSortedTS(aiSpikes(abUsed))) - afGroupedTS(k) <= fJitter);
+    iSlot = find(abUsed, 1, 'last');
+    assert(isequal(a2fGroupedWaves(k, (iSlot-1)*32+1:iSlot*32), a2fSortedWaves(aiSpikes(iSlot),:)));
+end
+
+% Tetrodes with identical timestamps, without waveforms
+a2iTetrodeChannelTable = reshape(1:16, 4, 4)';
+a2iEvents = GroupChannelsToTetrode([1 1 1 1 2 2 2 3 3 3 3], [5 6 7 8 1 2 3 13 14 15 16], a2iTetrodeChannelTable);
+assert(isequal(a2iEvents, int32([1 2 3 4 2; 8 9 10 11 4]')));
+
+% A lone crossing on one tetrode does not cut short an event of another tetrode that opens inside its window
+a2iEvents = GroupChannelsToTetrode([0 0.5 0.9 1.2 1.4], [1 5 6 7 8], [1:4; 5:8], 1);
+assert(isequal(a2iEvents, int32([2 3 4 5 2]')));
@@ -0,0 +1,325 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifdef _WIN32
+#define _WIN32_WINNT 0x501
+#include <windows.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <system_error>
+#include "InputDevices.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+
+const double SIMULATED_POLL_SEC = 10e-3;	// the simulated wheels check for Stop at least this often
+
+InputService::InputService(InputBackend *pBackend, int iRingSize) : m_pBackend(pBackend), m_iRingSize(1)
+{
+	while (m_iRingSize < iRingSize)
+		m_iRingSize *= 2;
+}
+
+InputService::~InputService()
+{
+	Stop();
+	for (size_t k = 0; k < m_aDevices.size(); k++)
+		delete m_aDevices[k];
+	delete m_pBackend;
+}
+
+bool InputService::Start(std::string &strError)
+{
+	Stop();
+	for (size_t k = 0; k < m_aDevices.size(); k++)
+		delete m_aDevices[k];
+	m_aDevices.clear();
+
+	std::vector<std::string> astrNames;
+	if (!m_pBackend->Open(astrNames, strError))
+		return false;
+	for (size_t k = 0; k < astrNames.size(); k++) {
+		m_aDevices.push_back(new InputDevice(m_iRingSize));
+		m_aDevices.back()->m_strName = astrNames[k];
+	}
+	try {
+		m_Thread = std::thread(&InputBackend::Run, m_pBackend, this);
+	} catch (const std::system_error &) {
+		strError = "Unable to start the reader thread.";
+		return false;
+	}
+	return true;
+}
+
+void InputService::Stop()
+{
+	if (Running()) {
+		m_pBackend->Stop();
+		m_Thread.join();
+	}
+}
+
+void InputService::Post(int iDevice, double fTime, int iDelta)
+{
+	InputDevice *pDevice = m_aDevices[iDevice];
+	pDevice->m_iPosition += iDelta;
+	WheelEvent Event;
+	Event.m_fTime = fTime;
+	Event.m_iDelta = iDelta;
+	if (!pDevice->m_Ring.Push(Event))
+		pDevice->m_iLost++;
+}
+
+void InputService::Drain(int iDevice, std::vector<WheelEvent> &Events)
+{
+	WheelEvent Event;
+	while (m_aDevices[iDevice]->m_Ring.Pop(Event))
+		Events.push_back(Event);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool SimulatedBackend::Open(std::vector<std::string> &astrNames, std::string &strError)
+{
+	if (m_iNumDevices < 1 || !(m_fRate > 0)) {
+		strError = "Simulated wheels need at least one device and a positive rate.";
+		return false;
+	}
+	char strName[64];
+	for (int k = 0; k < m_iNumDevices; k++) {
+		sprintf(strName, "Simulated wheel %d", k);
+		astrNames.push_back(strName);
+	}
+	m_bStop = false;
+	return true;
+}
+
+// The wheels step in turns: step s belongs to device s % N and is due at t0 + (s+1) / (N * fRate)
+void SimulatedBackend::Run(InputService *pService)
+{
+	double fStart = ClockGetSecs();
+	for (long long iStep = 0; !m_bStop; iStep++) {
+		double fDue = fStart + double(iStep + 1) / (m_fRate * m_iNumDevices);
+		while (!m_bStop && ClockGetSecs() < fDue)
+			ClockWaitUntil(std::min(fDue, ClockGetSecs() + SIMULATED_POLL_SEC));
+		if (m_bStop)
+			break;
+		long long iEvent = iStep / m_iNumDevices;
+		pService->Post(int(iStep % m_iNumDevices), fDue, (iEvent % 3 == 2) ? -1 : 1);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+static bool IsRdpMouse(const char *strName)
+{
+	return strncmp(strName, "\\??\\Root#RDP_MOU#0000#", 22) == 0;
+}
+
+// Same devices, in the same order, as init_raw_mouse(0, 0, 1) of fndllMiceHook
+bool RawInputBackend::Open(std::vector<std::string> &astrNames, std::string &strError)
+{
+	m_ahDevices.clear();
+	m_iThreadId = 0;
+	m_bStop = false;
+
+	UINT iNumDevices = 0;
+	if (GetRawInputDeviceList(NULL, &iNumDevices, sizeof(RAWINPUTDEVICELIST)) != 0) {
+		strError = "Unable to count raw input devices.";
+		return false;
+	}
+	std::vector<RAWINPUTDEVICELIST> aList(iNumDevices + 1);
+	iNumDevices = GetRawInputDeviceList(&aList[0], &iNumDevices, sizeof(RAWINPUTDEVICELIST));
+	if (iNumDevices == (UINT)-1) {
+		strError = "Unable to get the raw input device list.";
+		return false;
+	}
+
+	for (UINT k = 0; k < iNumDevices; k++) {
+		if (aList[k].dwType != RIM_TYPEMOUSE && aList[k].dwType != RIM_TYPEHID)
+			continue;
+		UINT iSize = 0;
+		GetRawInputDeviceInfoA(aList[k].hDevice, RIDI_DEVICENAME, NULL, &iSize);
+		std::vector<char> strName(iSize + 1, 0);
+		if (iSize > 0 && (int)GetRawInputDeviceInfoA(aList[k].hDevice, RIDI_DEVICENAME, &strName[0], &iSize) < 0)
+			continue;
+		if (IsRdpMouse(&strName[0]))
+			continue;
+		m_ahDevices.push_back(aList[k].hDevice);
+		astrNames.push_back(&strName[0]);
+	}
+	return true;
+}
+
+void RawInputBackend::Run(InputService *pService)
+{
+	m_iThreadId = GetCurrentThreadId();
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+	const char *strClass = "KofikoInputDevices";
+	WNDCLASSEXA WndClass;
+	memset(&WndClass, 0, sizeof(WndClass));
+	WndClass.cbSize = sizeof(WndClass);
+	WndClass.lpfnWndProc = DefWindowProcA;
+	WndClass.hInstance = GetModuleHandle(NULL);
+	WndClass.lpszClassName = strClass;
+	RegisterClassExA(&WndClass);
+	HWND hWnd = CreateWindowExA(0, strClass, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, WndClass.hInstance, NULL);
+
+	RAWINPUTDEVICE Rid;
+	Rid.usUsagePage = 0x01;	// mice
+	Rid.usUsage = 0x02;
+	Rid.dwFlags = RIDEV_INPUTSINK;	// also when Matlab is not in the foreground
+	Rid.hwndTarget = hWnd;
+	RegisterRawInputDevices(&Rid, 1, sizeof(Rid));
+
+	MSG Msg;
+	while (!m_bStop) {
+		MsgWaitForMultipleObjects(0, NULL, FALSE, INFINITE, QS_ALLINPUT);
+		while (PeekMessage(&Msg, NULL, 0, 0, PM_REMOVE)) {
+			if (Msg.message == WM_INPUT) {
+				double fTime = ClockGetSecs();
+				RAWINPUT Raw;
+				UINT iSize = sizeof(Raw);
+				if (GetRawInputData((HRAWINPUT)Msg.lParam, RID_INPUT, &Raw, &iSize, sizeof(RAWINPUTHEADER)) != (UINT)-1 &&
+					Raw.header.dwType == RIM_TYPEMOUSE && (Raw.data.mouse.usButtonFlags & RI_MOUSE_WHEEL)) {
+					SHORT iData = (SHORT)Raw.data.mouse.usButtonData;
+					int iDelta = (iData > 0) - (iData < 0);
+					for (size_t k = 0; k < m_ahDevices.size(); k++)
+						if (m_ahDevices[k] == Raw.header.hDevice && iDelta != 0)
+							pService->Post(int(k), fTime, iDelta);
+				}
+			}
+			DispatchMessage(&Msg);
+		}
+	}
+
+	Rid.dwFlags = RIDEV_REMOVE;
+	Rid.hwndTarget = NULL;
+	RegisterRawInputDevices(&Rid, 1, sizeof(Rid));
+	DestroyWindow(hWnd);
+	UnregisterClassA(strClass, WndClass.hInstance);
+}
+
+void RawInputBackend::Stop()
+{
+	m_bStop = true;
+	// the thread may not have its message queue yet: keep knocking until it has
+	while (true) {
+		DWORD iThreadId = m_iThreadId;
+		if (iThreadId != 0 && PostThreadMessage(iThreadId, WM_NULL, 0, 0))
+			break;
+		Sleep(1);
+	}
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+const int EVDEV_MAX_DEVICES = 64;
+
+EvdevBackend::~EvdevBackend()
+{
+	for (size_t k = 0; k < m_aiFiles.size(); k++)
+		close(m_aiFiles[k]);
+	for (int k = 0; k < 2; k++)
+		if (m_aiWake[k] >= 0)
+			close(m_aiWake[k]);
+}
+
+bool EvdevBackend::Open(std::vector<std::string> &astrNames, std::string &strError)
+{
+	for (size_t k = 0; k < m_aiFiles.size(); k++)
+		close(m_aiFiles[k]);
+	m_aiFiles.clear();
+	for (int k = 0; k < 2; k++) {
+		if (m_aiWake[k] >= 0)
+			close(m_aiWake[k]);
+		m_aiWake[k] = -1;
+	}
+
+	for (int iEvent = 0; iEvent < EVDEV_MAX_DEVICES; iEvent++) {
+		char strPath[64];
+		sprintf(strPath, "/dev/input/event%d", iEvent);
+		int iFile = open(strPath, O_RDONLY | O_NONBLOCK);
+		if (iFile < 0)
+			continue;
+		unsigned long aiRelative[1] = {0};
+		int iClock = CLOCK_MONOTONIC;
+		if (ioctl(iFile, EVIOCGBIT(EV_REL, sizeof(aiRelative)), aiRelative) < 0 || !(aiRelative[0] & (1UL << REL_WHEEL)) ||
+			ioctl(iFile, EVIOCSCLOCKID, &iClock) < 0) {
+			close(iFile);
+			continue;
+		}
+		char strName[256] = "";
+		ioctl(iFile, EVIOCGNAME(sizeof(strName) - 1), strName);
+		m_aiFiles.push_back(iFile);
+		astrNames.push_back(std::string(strName) + " (" + strPath + ")");
+	}
+	if (m_aiFiles.empty()) {
+		strError = "No wheel in /dev/input (is the user allowed to read the event devices?).";
+		return false;
+	}
+	if (pipe(m_aiWake) != 0) {
+		strError = "Unable to create a pipe.";
+		return false;
+	}
+	return true;
+}
+
+void EvdevBackend::Run(InputService *pService)
+{
+	size_t iNumFiles = m_aiFiles.size();
+	std::vector<struct pollfd> aPoll(iNumFiles + 1);
+	for (size_t k = 0; k <= iNumFiles; k++) {
+		aPoll[k].fd = k < iNumFiles ? m_aiFiles[k] : m_aiWake[0];
+		aPoll[k].events = POLLIN;
+	}
+
+	struct input_event aEvents[64];
+	while (poll(&aPoll[0], aPoll.size(), -1) >= 0 || errno == EINTR) {
+		if (aPoll[iNumFiles].revents != 0)
+			break;
+		for (size_t k = 0; k < iNumFiles; k++) {
+			if (aPoll[k].revents == 0)
+				continue;
+			ssize_t iBytes;
+			while ((iBytes = read(aPoll[k].fd, aEvents, sizeof(aEvents))) > 0) {
+				for (size_t i = 0; i < size_t(iBytes) / sizeof(aEvents[0]); i++) {
+					const struct input_event &Event = aEvents[i];
+					if (Event.type != EV_REL || Event.code != REL_WHEEL || Event.value == 0)
+						continue;
+#ifdef input_event_sec
+					double fTime = Event.input_event_sec + Event.input_event_usec * 1e-6;
+#else
+					double fTime = Event.time.tv_sec + Event.time.tv_usec * 1e-6;
+#endif
+					pService->Post(int(k), fTime, Event.value);
+				}
+			}
+			if (iBytes < 0 && errno != EAGAIN)
+				aPoll[k].fd = -1;	// unplugged: poll ignores it from now on
+		}
+	}
+}
+
+void EvdevBackend::Stop()
+{
+	char Byte = 0;
+	if (write(m_aiWake[1], &Byte, 1) != 1)
+		perror("EvdevBackend::Stop");
+}
+#endif
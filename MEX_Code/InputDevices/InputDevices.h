@@ -0,0 +1,122 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef INPUT_DEVICES_H
+#define INPUT_DEVICES_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../DAQ/SpscRing.h"
+
+/*
+ Scroll wheels of the electrode advancers (and of any other mouse), read by a thread of their own.
+
+ Every wheel step becomes an event (time on the GetSecs clock, delta) in the ring of its device,
+ and is added to the running position of the device. The caller drains the rings whenever it likes:
+ nothing is lost between two calls unless a ring fills up (then the event is counted as lost, the
+ position is still right).
+
+ The reading itself is done by a backend, on the thread of the service:
+ RawInputBackend  Windows raw input (WM_INPUT) on a message only window. Devices are numbered as
+				  in fndllMiceHook, one step per wheel message. Raw input is registered once per
+				  process, so it can not run in the same Matlab as fndllMiceHook('Init').
+ EvdevBackend     Linux /dev/input/event* devices that have a wheel (REL_WHEEL). The kernel stamps
+				  events on CLOCK_MONOTONIC (EVIOCSCLOCKID), the clock of GetSecs on Linux.
+ SimulatedBackend iNumDevices wheels that step at fRate steps per second, +1 +1 -1 over and over.
+*/
+
+typedef struct {
+	double m_fTime;
+	int m_iDelta;
+} WheelEvent;
+
+class InputService;
+
+class InputBackend {
+public:
+	virtual ~InputBackend() {}
+	virtual bool Open(std::vector<std::string> &astrNames, std::string &strError) = 0; // finds the devices
+	virtual void Run(InputService *pService) = 0;	// the reader thread, returns once Stop is called
+	virtual void Stop() = 0;						// called from another thread
+};
+
+const int INPUT_DEFAULT_RING = 4096;
+
+class InputService {
+public:
+	InputService(InputBackend *pBackend, int iRingSize); // takes ownership of pBackend
+	~InputService();
+
+	bool Start(std::string &strError);
+	void Stop();
+	bool Running() const { return m_Thread.joinable(); }
+
+	int NumDevices() const { return int(m_aDevices.size()); }
+	const std::string &DeviceName(int iDevice) const { return m_aDevices[iDevice]->m_strName; }
+
+	void Post(int iDevice, double fTime, int iDelta);		// reader thread only
+	void Drain(int iDevice, std::vector<WheelEvent> &Events); // appends the events since the previous Drain
+	long long Position(int iDevice) const { return m_aDevices[iDevice]->m_iPosition.load(); }
+	long long Lost(int iDevice) const { return m_aDevices[iDevice]->m_iLost.load(); }
+
+private:
+	typedef struct InputDevice {
+		explicit InputDevice(int iRingSize) : m_Ring(iRingSize), m_iPosition(0), m_iLost(0) {}
+		std::string m_strName;
+		SpscRing<WheelEvent> m_Ring;
+		std::atomic<long long> m_iPosition;
+		std::atomic<long long> m_iLost;
+	} InputDevice;
+
+	InputBackend *m_pBackend;
+	int m_iRingSize;
+	std::vector<InputDevice *> m_aDevices;
+	std::thread m_Thread;
+};
+
+class SimulatedBackend : public InputBackend {
+public:
+	SimulatedBackend(int iNumDevices, double fRate) : m_iNumDevices(iNumDevices), m_fRate(fRate), m_bStop(false) {}
+	bool Open(std::vector<std::string> &astrNames, std::string &strError);
+	void Run(InputService *pService);
+	void Stop() { m_bStop = true; }
+private:
+	int m_iNumDevices;
+	double m_fRate;
+	std::atomic<bool> m_bStop;
+};
+
+#ifdef _WIN32
+class RawInputBackend : public InputBackend {
+public:
+	RawInputBackend() : m_iThreadId(0), m_bStop(false) {}
+	bool Open(std::vector<std::string> &astrNames, std::string &strError);
+	void Run(InputService *pService);
+	void Stop();
+private:
+	std::vector<void *> m_ahDevices;	// HANDLE of every device, in device order
+	std::atomic<unsigned long> m_iThreadId;
+	std::atomic<bool> m_bStop;
+};
+#endif
+
+#ifdef __linux__
+class EvdevBackend : public InputBackend {
+public:
+	EvdevBackend() { m_aiWake[0] = m_aiWake[1] = -1; }
+	~EvdevBackend();
+	bool Open(std::vector<std::string> &astrNames, std::string &strError);
+	void Run(InputService *pService);
+	void Stop();
+private:
+	std::vector<int> m_aiFiles;
+	int m_aiWake[2];	// pipe: Stop writes a byte to wake the poll up
+};
+#endif
+
+#endif
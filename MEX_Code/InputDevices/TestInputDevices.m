@@ -0,0 +1,45 @@
+% Background wheel reader, simulated wheels: +1 +1 -1 steps in turns at fRate steps per second each
+fRate = 200;
+acNames = fnInputDevices('Start', 'simulated', 3, fRate);
+assert(length(acNames) == 3 && fnInputDevices('GetNumDevices') == 3);
+fStart = GetSecs();
+WaitSecs(0.5);
+[afTime, aiDelta, aiDevice] = fnInputDevices('Drain');
+fprintf('%d steps in %.0f ms\n', length(afTime), (GetSecs()-fStart)*1e3);
+assert(all(diff(afTime) > 0) && all(afTime < GetSecs()) && abs(length(afTime) - 3*fRate*0.5) < 3*fRate*0.1);
+assert(max(abs(diff(afTime) - 1/(3*fRate))) < 1e-9);
+for iDevice=0:2
+    aiSteps = aiDelta(aiDevice == iDevice);
+    assert(isequal(aiSteps(3:3:end), -ones(floor(length(aiSteps)/3),1)));
+end
+
+% Positions add up every step, drained or not
+WaitSecs(0.1);
+aiPosition = fnInputDevices('GetPositions');
+[afTime2, aiDelta2, aiDevice2] = fnInputDevices('Drain', [0 2]);
+assert(all(ismember(aiDevice2, [0 2])) && all(afTime2 > afTime(end)));
+[afTime1, aiDelta1] = fnInputDevices('Drain', 1);
+aiNewPosition = fnInputDevices('GetPositions');
+for iDevice=0:2
+    iDrained = sum(aiDelta(aiDevice == iDevice)) + sum(aiDelta2(aiDevice2 == iDevice)) + (iDevice == 1) * sum(aiDelta1);
+    assert(iDrained >= aiPosition(iDevice+1) && iDrained <= aiNewPosition(iDevice+1));
+end
+
+% A small ring overflows when nobody drains it: the position is still right
+fnInputDevices('Start', 'simulated', 1, 1000, 64);
+WaitSecs(0.5);
+iLost = fnInputDevices('GetLost');
+afTime = fnInputDevices('Drain');
+assert(length(afTime) == 64 && iLost > 0);
+fprintf('%d steps lost, position %d\n', iLost, fnInputDevices('GetPositions'));
+fnInputDevices('Stop');
+
+% Advancer depth changes joined onto spike times, as StatServer would log them
+fnInputDevices('Start', 'simulated', 2, 50);
+WaitSecs(0.3);
+[afTime, aiDelta, aiDevice] = fnInputDevices('Drain', 0);
+afDepthSteps = cumsum(aiDelta);
+afSpikeTimes = sort(afTime(1) + rand(1,100) * (afTime(end) - afTime(1)));
+afDepthAtSpike = fnMyInterp1(afTime, afDepthSteps, afSpikeTimes);
+assert(all(afDepthAtSpike >= min(afDepthSteps) & afDepthAtSpike <= max(afDepthSteps)));
+fnInputDevices('Stop');
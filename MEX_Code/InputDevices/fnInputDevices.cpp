@@ -0,0 +1,200 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "mex.h"
+#include "InputDevices.h"
+
+/*
+ Advancer wheels read in the background (see InputDevices.h). Devices are numbered from 0, as in fndllMiceHook.
+
+ Matlab:
+   acNames = fnInputDevices('Start', [strBackend], [iRingSize])
+	strBackend: 'rawinput' (Windows, default there), 'evdev' (Linux, default there)
+   acNames = fnInputDevices('Start', 'simulated', iNumDevices, fRate, [iRingSize])
+   fnInputDevices('Stop')
+   iNumDevices = fnInputDevices('GetNumDevices'), acNames = fnInputDevices('GetDeviceNames')
+   [afTime, aiDelta, aiDevice] = fnInputDevices('Drain', [aiDevices])
+	every wheel step since the previous Drain of these devices (default all), in time order.
+	afTime is on the GetSecs clock.
+   aiPosition = fnInputDevices('GetPositions', [aiDevices])	sum of all the steps since Start
+   aiLost = fnInputDevices('GetLost', [aiDevices])			steps that did not fit in the ring before a Drain
+*/
+
+static InputService *g_pService = NULL;
+
+static void fnExit()
+{
+	delete g_pService;
+	g_pService = NULL;
+}
+
+static std::string GetString(const mxArray *pArray)
+{
+	char *pString = mxArrayToString(pArray);
+	if (pString == NULL)
+		mexErrMsgTxt("Expecting a string.");
+	std::string str(pString);
+	mxFree(pString);
+	return str;
+}
+
+static InputService *Service()
+{
+	if (g_pService == NULL || !g_pService->Running())
+		mexErrMsgTxt("Call fnInputDevices('Start') first.");
+	return g_pService;
+}
+
+static mxArray *DeviceNames(const InputService *pService)
+{
+	mxArray *Names = mxCreateCellMatrix(1, pService->NumDevices());
+	for (int k = 0; k < pService->NumDevices(); k++)
+		mxSetCell(Names, k, mxCreateString(pService->DeviceName(k).c_str()));
+	return Names;
+}
+
+static std::vector<int> GetDevices(const InputService *pService, int nrhs, const mxArray *prhs[], int iArg)
+{
+	std::vector<int> aiDevices;
+	if (nrhs <= iArg) {
+		for (int k = 0; k < pService->NumDevices(); k++)
+			aiDevices.push_back(k);
+		return aiDevices;
+	}
+	if (!mxIsDouble(prhs[iArg]))
+		mexErrMsgTxt("Device numbers must be double.");
+	const double *afDevices = mxGetPr(prhs[iArg]);
+	for (size_t k = 0; k < mxGetNumberOfElements(prhs[iArg]); k++) {
+		int iDevice = int(afDevices[k]);
+		if (iDevice < 0 || iDevice >= pService->NumDevices())
+			mexErrMsgTxt("No such device.");
+		aiDevices.push_back(iDevice);
+	}
+	return aiDevices;
+}
+
+typedef struct {
+	double m_fTime;
+	int m_iDelta;
+	int m_iDevice;
+} DrainedEvent;
+
+static bool EarlierEvent(const DrainedEvent &A, const DrainedEvent &B)
+{
+	return A.m_fTime < B.m_fTime;
+}
+
+static void Drain(InputService *pService, const std::vector<int> &aiDevices, int nlhs, mxArray *plhs[])
+{
+	std::vector<DrainedEvent> aEvents;
+	std::vector<WheelEvent> aDevice;
+	for (size_t k = 0; k < aiDevices.size(); k++) {
+		if (std::find(aiDevices.begin(), aiDevices.begin() + k, aiDevices[k]) != aiDevices.begin() + k)
+			continue;
+		aDevice.clear();
+		pService->Drain(aiDevices[k], aDevice);
+		for (size_t i = 0; i < aDevice.size(); i++) {
+			DrainedEvent Event = {aDevice[i].m_fTime, aDevice[i].m_iDelta, aiDevices[k]};
+			aEvents.push_back(Event);
+		}
+	}
+	// each device is in order already
+	std::stable_sort(aEvents.begin(), aEvents.end(), EarlierEvent);
+
+	mwSize N = mwSize(aEvents.size());
+	plhs[0] = mxCreateDoubleMatrix(N, 1, mxREAL);
+	for (mwSize i = 0; i < N; i++)
+		mxGetPr(plhs[0])[i] = aEvents[i].m_fTime;
+	if (nlhs > 1) {
+		plhs[1] = mxCreateDoubleMatrix(N, 1, mxREAL);
+		for (mwSize i = 0; i < N; i++)
+			mxGetPr(plhs[1])[i] = aEvents[i].m_iDelta;
+	}
+	if (nlhs > 2) {
+		plhs[2] = mxCreateDoubleMatrix(N, 1, mxREAL);
+		for (mwSize i = 0; i < N; i++)
+			mxGetPr(plhs[2])[i] = aEvents[i].m_iDevice;
+	}
+}
+
+static void Start(int nrhs, const mxArray *prhs[], mxArray *plhs[])
+{
+#ifdef _WIN32
+	std::string strBackend = "rawinput";
+#else
+	std::string strBackend = "evdev";
+#endif
+	if (nrhs > 1)
+		strBackend = GetString(prhs[1]);
+
+	InputBackend *pBackend = NULL;
+	int iRingArg = 2;
+	if (strBackend == "simulated") {
+		if (nrhs < 4)
+			mexErrMsgTxt("Start: 'simulated' needs the number of devices and the rate.");
+		pBackend = new SimulatedBackend(int(mxGetScalar(prhs[2])), mxGetScalar(prhs[3]));
+		iRingArg = 4;
+#ifdef _WIN32
+	} else if (strBackend == "rawinput") {
+		pBackend = new RawInputBackend();
+#endif
+#ifdef __linux__
+	} else if (strBackend == "evdev") {
+		pBackend = new EvdevBackend();
+#endif
+	} else
+		mexErrMsgTxt("Start: unknown or unavailable backend.");
+	int iRingSize = nrhs > iRingArg ? int(mxGetScalar(prhs[iRingArg])) : INPUT_DEFAULT_RING;
+
+	fnExit();
+	mexAtExit(fnExit);
+	g_pService = new InputService(pBackend, iRingSize > 1 ? iRingSize : 2);
+	std::string strError;
+	if (!g_pService->Start(strError)) {
+		fnExit();
+		mexErrMsgTxt(strError.c_str());
+	}
+	plhs[0] = DeviceNames(g_pService);
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 1 || !mxIsChar(prhs[0])) {
+		mexErrMsgTxt("Usage: acNames = fnInputDevices('Start', ['rawinput' | 'evdev'], [iRingSize])\n"
+					 "       acNames = fnInputDevices('Start', 'simulated', iNumDevices, fRate, [iRingSize]), fnInputDevices('Stop')\n"
+					 "       [afTime, aiDelta, aiDevice] = fnInputDevices('Drain', [aiDevices])\n"
+					 "       aiPosition = fnInputDevices('GetPositions', [aiDevices]), aiLost = fnInputDevices('GetLost', [aiDevices])\n"
+					 "       iNumDevices = fnInputDevices('GetNumDevices'), acNames = fnInputDevices('GetDeviceNames')");
+		return;
+	}
+	std::string strCommand = GetString(prhs[0]);
+
+	if (strCommand == "Drain") {
+		InputService *pService = Service();
+		Drain(pService, GetDevices(pService, nrhs, prhs, 1), nlhs, plhs);
+	} else if (strCommand == "GetPositions" || strCommand == "GetLost") {
+		InputService *pService = Service();
+		std::vector<int> aiDevices = GetDevices(pService, nrhs, prhs, 1);
+		plhs[0] = mxCreateDoubleMatrix(1, aiDevices.size(), mxREAL);
+		for (size_t k = 0; k < aiDevices.size(); k++)
+			mxGetPr(plhs[0])[k] = double(strCommand == "GetLost" ? pService->Lost(aiDevices[k]) : pService->Position(aiDevices[k]));
+	} else if (strCommand == "Start") {
+		Start(nrhs, prhs, plhs);
+	} else if (strCommand == "Stop") {
+		fnExit();
+	} else if (strCommand == "GetNumDevices") {
+		plhs[0] = mxCreateDoubleScalar(g_pService != NULL ? g_pService->NumDevices() : 0);
+	} else if (strCommand == "GetDeviceNames") {
+		plhs[0] = DeviceNames(Service());
+	} else
+		mexErrMsgTxt("Unknown command.");
+}
@@ -0,0 +1,258 @@
+/*
+% Copyright (c) 2008 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef RESAMPLE_1D_H
+#define RESAMPLE_1D_H
+
+/*
+ Shared implementation of fnMyInterp1 / fnMyHist (and the copy in fnDICOM).
+
+ Syntax:
+ Out = fnMyInterp1(Timestamp, Values, SampleTS, [strMode])
+
+ Timestamp : N sorted time stamps (double)
+ Values    : N values, or an N x C matrix (one column per parameter stream sharing the time stamps).
+			 double, single, int8..int32, uint8..uint32 and logical are read without conversion.
+ SampleTS  : M query times (double), any order (sorted queries are the fast path)
+ strMode   : 'hold' (default, value of the last time stamp <= query), 'nearest' or 'linear'
+
+ Queries before the first time stamp get the first value, queries after the last one get the last value.
+ hold / nearest return the class of Values; linear returns single for single input and double otherwise.
+ If Values is a vector the output has the shape of SampleTS, otherwise it is M x C.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <limits>
+#include <vector>
+#include <thread>
+#include "mex.h"
+
+enum ResampleMode {
+	RESAMPLE_HOLD = 0,
+	RESAMPLE_NEAREST,
+	RESAMPLE_LINEAR
+};
+
+// Queries are split across threads only above this many output elements
+const int RESAMPLE_MIN_PARALLEL_WORK = 1 << 17;
+const int RESAMPLE_MAX_THREADS = 16;
+
+/*
+ Returns the last index i with Timestamp[i] <= t, or -1 if t precedes all time stamps.
+ Gallops outward from iHint (the answer of the previous query), so a sorted query
+ stream costs O(log gap) per query instead of O(log N), and an unsorted one is still correct.
+*/
+inline int FindLastLessOrEqual(const double *Timestamp, int iNumInputs, double t, int iHint)
+{
+	if (iHint < 0) iHint = 0;
+	if (iHint > iNumInputs-1) iHint = iNumInputs-1;
+
+	int lo, hi; // invariant: Timestamp[lo] <= t < Timestamp[hi], with lo=-1 / hi=N as sentinels
+	if (Timestamp[iHint] <= t) {
+		lo = iHint;
+		int iStep = 1;
+		hi = lo + 1;
+		while (hi < iNumInputs && Timestamp[hi] <= t) {
+			lo = hi;
+			iStep *= 2;
+			hi = lo + iStep;
+		}
+		if (hi > iNumInputs) hi = iNumInputs;
+	} else {
+		hi = iHint;
+		int iStep = 1;
+		lo = hi - 1;
+		while (lo >= 0 && Timestamp[lo] > t) {
+			hi = lo;
+			iStep *= 2;
+			lo = hi - iStep;
+		}
+		if (lo < -1) lo = -1;
+	}
+
+	while (hi - lo > 1) {
+		int mid = lo + (hi - lo) / 2;
+		if (Timestamp[mid] <= t)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+template<class T> inline T ResampleMissingValue() { return T(0); }
+template<> inline double ResampleMissingValue<double>() { return std::numeric_limits<double>::quiet_NaN(); }
+template<> inline float ResampleMissingValue<float>() { return std::numeric_limits<float>::quiet_NaN(); }
+
+template<class T, class O> void ResampleRange(const double *Timestamp, int iNumInputs, const T *Values, int iNumColumns,
+											  const double *SampleTS, int iNumSamples, int iFirst, int iLast,
+											  ResampleMode Mode, O *Out)
+{
+	int iPos = (iFirst == 0) ? 0 : FindLastLessOrEqual(Timestamp, iNumInputs, SampleTS[iFirst], iNumInputs / 2);
+	for (int k=iFirst;k<iLast;k++) {
+		double t = SampleTS[k];
+		if (t != t) {
+			for (int c=0;c<iNumColumns;c++)
+				Out[(size_t)c*iNumSamples + k] = ResampleMissingValue<O>();
+			continue;
+		}
+		iPos = FindLastLessOrEqual(Timestamp, iNumInputs, t, iPos);
+
+		int i0 = iPos, i1 = iPos + 1;
+		if (i0 < 0) i0 = 0;
+		if (i1 > iNumInputs-1) i1 = iNumInputs-1;
+
+		if (Mode == RESAMPLE_HOLD || i0 == i1 || iPos < 0) {
+			for (int c=0;c<iNumColumns;c++)
+				Out[(size_t)c*iNumSamples + k] = O(Values[(size_t)c*iNumInputs + i0]);
+		} else if (Mode == RESAMPLE_NEAREST) {
+			int iNearest = (t - Timestamp[i0] < Timestamp[i1] - t) ? i0 : i1;
+			for (int c=0;c<iNumColumns;c++)
+				Out[(size_t)c*iNumSamples + k] = O(Values[(size_t)c*iNumInputs + iNearest]);
+		} else {
+			double fSpan = Timestamp[i1] - Timestamp[i0];
+			double fAlpha = (fSpan > 0) ? (t - Timestamp[i0]) / fSpan : 0;
+			for (int c=0;c<iNumColumns;c++) {
+				double v0 = double(Values[(size_t)c*iNumInputs + i0]);
+				double v1 = double(Values[(size_t)c*iNumInputs + i1]);
+				Out[(size_t)c*iNumSamples + k] = O(v0 + fAlpha * (v1 - v0));
+			}
+		}
+	}
+}
+
+template<class T, class O> void Resample(const double *Timestamp, int iNumInputs, const T *Values, int iNumColumns,
+										 const double *SampleTS, int iNumSamples, ResampleMode Mode, O *Out)
+{
+	int iNumThreads = 1;
+	if ((double)iNumSamples * iNumColumns >= RESAMPLE_MIN_PARALLEL_WORK) {
+		iNumThreads = int(std::thread::hardware_concurrency());
+		if (iNumThreads > RESAMPLE_MAX_THREADS) iNumThreads = RESAMPLE_MAX_THREADS;
+		if (iNumThreads < 1) iNumThreads = 1;
+	}
+
+	if (iNumThreads == 1) {
+		ResampleRange(Timestamp, iNumInputs, Values, iNumColumns, SampleTS, iNumSamples, 0, iNumSamples, Mode, Out);
+		return;
+	}
+
+	// Each thread gets a contiguous block of queries and locates its own starting point
+	std::vector<std::thread> Workers;
+	int iBlock = (iNumSamples + iNumThreads - 1) / iNumThreads;
+	for (int iThread=0;iThread<iNumThreads;iThread++) {
+		int iFirst = iThread * iBlock;
+		int iLast = iFirst + iBlock < iNumSamples ? iFirst + iBlock : iNumSamples;
+		if (iFirst >= iLast)
+			break;
+		Workers.push_back(std::thread(ResampleRange<T,O>, Timestamp, iNumInputs, Values, iNumColumns,
+									  SampleTS, iNumSamples, iFirst, iLast, Mode, Out));
+	}
+	for (size_t k=0;k<Workers.size();k++)
+		Workers[k].join();
+}
+
+template<class T> void ResampleDispatchOutput(const double *Timestamp, int iNumInputs, const T *Values, int iNumColumns,
+											  const double *SampleTS, int iNumSamples, ResampleMode Mode,
+											  mxClassID InputClass, mxArray *OutArray)
+{
+	if (Mode != RESAMPLE_LINEAR || InputClass == mxDOUBLE_CLASS)
+		Resample(Timestamp, iNumInputs, Values, iNumColumns, SampleTS, iNumSamples, Mode, (T*)mxGetData(OutArray));
+	else if (InputClass == mxSINGLE_CLASS)
+		Resample(Timestamp, iNumInputs, Values, iNumColumns, SampleTS, iNumSamples, Mode, (float*)mxGetData(OutArray));
+	else
+		Resample(Timestamp, iNumInputs, Values, iNumColumns, SampleTS, iNumSamples, Mode, (double*)mxGetData(OutArray));
+}
+
+inline void ResampleMexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], const char *strFunctionName)
+{
+	if (nrhs < 3) {
+		char strUsage[256];
+		sprintf(strUsage, "Usage: Out = %s(Timestamp, Values, SampleTS, ['hold' | 'nearest' | 'linear'])", strFunctionName);
+		mexErrMsgTxt(strUsage);
+		return;
+	}
+	if (nlhs > 1) {
+		mexErrMsgTxt("Too many output arguments.");
+		return;
+	}
+	if (!mxIsDouble(prhs[0]) || !mxIsDouble(prhs[2])) {
+		mexErrMsgTxt("Timestamp and SampleTS must be double.");
+		return;
+	}
+
+	ResampleMode Mode = RESAMPLE_HOLD;
+	if (nrhs > 3) {
+		char *strMode = mxArrayToString(prhs[3]);
+		if (strMode == NULL) {
+			mexErrMsgTxt("Mode must be a string.");
+			return;
+		}
+		if (strcmp(strMode, "hold") == 0)
+			Mode = RESAMPLE_HOLD;
+		else if (strcmp(strMode, "nearest") == 0)
+			Mode = RESAMPLE_NEAREST;
+		else if (strcmp(strMode, "linear") == 0)
+			Mode = RESAMPLE_LINEAR;
+		else {
+			mxFree(strMode);
+			mexErrMsgTxt("Unknown mode. Use 'hold', 'nearest' or 'linear'.");
+			return;
+		}
+		mxFree(strMode);
+	}
+
+	const double *Timestamp = (const double*)mxGetData(prhs[0]);
+	const double *SampleTS = (const double*)mxGetData(prhs[2]);
+	int iNumInputs = int(mxGetNumberOfElements(prhs[0]));
+	int iNumSamples = int(mxGetNumberOfElements(prhs[2]));
+	int iNumValues = int(mxGetNumberOfElements(prhs[1]));
+
+	int iNumColumns = 1;
+	bool bVectorInput = iNumValues == iNumInputs;
+	if (!bVectorInput) {
+		if (mxGetNumberOfDimensions(prhs[1]) != 2 || int(mxGetM(prhs[1])) != iNumInputs) {
+			mexErrMsgTxt("Values must have one entry (or one row) per time stamp.");
+			return;
+		}
+		iNumColumns = int(mxGetN(prhs[1]));
+	}
+
+	mxClassID InputClass = mxGetClassID(prhs[1]);
+	mxClassID OutputClass = InputClass;
+	if (Mode == RESAMPLE_LINEAR && InputClass != mxSINGLE_CLASS)
+		OutputClass = mxDOUBLE_CLASS;
+
+	if (bVectorInput) {
+		plhs[0] = mxCreateNumericArray(mxGetNumberOfDimensions(prhs[2]), mxGetDimensions(prhs[2]), OutputClass, mxREAL);
+	} else {
+		mwSize dim[2];
+		dim[0] = iNumSamples;
+		dim[1] = iNumColumns;
+		plhs[0] = mxCreateNumericArray(2, dim, OutputClass, mxREAL);
+	}
+
+	if (iNumInputs == 0 || iNumSamples == 0 || iNumColumns == 0)
+		return;
+
+	const void *Values = mxGetData(prhs[1]);
+	switch (InputClass) {
+		case mxDOUBLE_CLASS:  ResampleDispatchOutput(Timestamp, iNumInputs, (const double*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxSINGLE_CLASS:  ResampleDispatchOutput(Timestamp, iNumInputs, (const float*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxINT8_CLASS:    ResampleDispatchOutput(Timestamp, iNumInputs, (const signed char*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxUINT8_CLASS:   ResampleDispatchOutput(Timestamp, iNumInputs, (const unsigned char*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxLOGICAL_CLASS: ResampleDispatchOutput(Timestamp, iNumInputs, (const mxLogical*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxINT16_CLASS:   ResampleDispatchOutput(Timestamp, iNumInputs, (const short*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxUINT16_CLASS:  ResampleDispatchOutput(Timestamp, iNumInputs, (const unsigned short*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxINT32_CLASS:   ResampleDispatchOutput(Timestamp, iNumInputs, (const int*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		case mxUINT32_CLASS:  ResampleDispatchOutput(Timestamp, iNumInputs, (const unsigned int*)Values, iNumColumns, SampleTS, iNumSamples, Mode, InputClass, plhs[0]); break;
+		default:
+			mexErrMsgTxt("Unsupported value class.");
+	}
+}
+
+#endif
@@ -0,0 +1,65 @@
+% Resample1D.h (fnMyInterp1, fnMyHist, fnDICOM) against interp1
+rng(0);
+afTimestamp = cumsum(0.5 + rand(1000,1));
+afValues = randn(1000,1) * 100;
+afSampleTS = sort(afTimestamp(1) + rand(5000,1) * (afTimestamp(end) - afTimestamp(1)));
+
+% Inside the time stamps: hold is 'previous', nearest and linear are interp1's
+assert(isequal(fnMyInterp1(afTimestamp, afValues, afSampleTS), interp1(afTimestamp, afValues, afSampleTS, 'previous')));
+assert(isequal(fnMyInterp1(afTimestamp, afValues, afSampleTS, 'nearest'), interp1(afTimestamp, afValues, afSampleTS, 'nearest')));
+assert(max(abs(fnMyInterp1(afTimestamp, afValues, afSampleTS, 'linear') - interp1(afTimestamp, afValues, afSampleTS, 'linear'))) < 1e-9);
+assert(isequal(fnMyInterp1(afTimestamp, afValues, afSampleTS(end:-1:1)), interp1(afTimestamp, afValues, afSampleTS(end:-1:1), 'previous')));
+assert(isequal(fnMyInterp1(afTimestamp, afValues, afTimestamp), afValues));
+
+% Out of range queries get the first / last value, NaN queries get NaN
+afOutside = [afTimestamp(1) - [10;1]; afTimestamp(end) + [1;10]; NaN];
+acModes = {'hold', 'nearest', 'linear'};
+for iMode=1:length(acModes)
+    afOut = fnMyInterp1(afTimestamp, afValues, afOutside, acModes{iMode});
+    assert(isequal(afOut(1:4), afValues([1;1;end;end])) && isnan(afOut(5)));
+end
+
+% Shape follows SampleTS for vector input
+assert(isequal(size(fnMyInterp1(afTimestamp, afValues, afSampleTS')), [1 5000]));
+
+% Typed inputs: hold / nearest keep the class, linear returns single for single and double otherwise
+acClasses = {'single', 'int8', 'uint8', 'int16', 'uint16', 'int32', 'uint32', 'logical'};
+for iClass=1:length(acClasses)
+    if strcmp(acClasses{iClass}, 'logical')
+        aTyped = afValues > 0;
+    else
+        aTyped = cast(afValues, acClasses{iClass});
+    end
+    aHold = fnMyInterp1(afTimestamp, aTyped, afSampleTS);
+    assert(isa(aHold, acClasses{iClass}));
+    assert(isequal(double(aHold), interp1(afTimestamp, double(aTyped), afSampleTS, 'previous')));
+    aNearest = fnMyInterp1(afTimestamp, aTyped, afSampleTS, 'nearest');
+    assert(isa(aNearest, acClasses{iClass}));
+    assert(isequal(double(aNearest), interp1(afTimestamp, double(aTyped), afSampleTS, 'nearest')));
+    aLinear = fnMyInterp1(afTimestamp, aTyped, afSampleTS, 'linear');
+    if strcmp(acClasses{iClass}, 'single')
+        assert(isa(aLinear, 'single'));
+        fTolerance = 1e-3;
+    else
+        assert(isa(aLinear, 'double'));
+        fTolerance = 1e-9;
+    end
+    afExpected = interp1(afTimestamp, double(aTyped), afSampleTS, 'linear');
+    assert(max(abs(double(aLinear) - afExpected)) < fTolerance * max(1, max(abs(afExpected))));
+end
+
+% Multi-column input: one column per stream, M x C output
+a2fValues = [afValues, -afValues, (1:1000)'];
+a2fOut = fnMyInterp1(afTimestamp, a2fValues, afSampleTS, 'linear');
+assert(isequal(size(a2fOut), [5000 3]));
+assert(max(max(abs(a2fOut - interp1(afTimestamp, a2fValues, afSampleTS, 'linear')))) < 1e-9);
+a2iOut = fnMyInterp1(afTimestamp, int16(a2fValues), afOutside(1:4));
+assert(isa(a2iOut, 'int16') && isequal(a2iOut, int16(a2fValues([1 1 end end],:))));
+
+% Large query sets are split across threads: same answer
+afManySamples = sort(afTimestamp(1) + rand(1e6,1) * (afTimestamp(end) - afTimestamp(1)));
+assert(isequal(fnMyInterp1(afTimestamp, afValues, afManySamples), interp1(afTimestamp, afValues, afManySamples, 'previous')));
+
+% fnMyHist shares the code
+assert(isequal(fnMyHist(afTimestamp, afValues, afSampleTS), fnMyInterp1(afTimestamp, afValues, afSampleTS)));
+fprintf('All resample tests passed\n');
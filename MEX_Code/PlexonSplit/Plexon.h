@@ -122,7 +122,19 @@ struct	PL_FileHeader {
 	int		FastRead; // not used
 	int		WaveformFreq; // waveform sampling rate; ADFrequency above is timestamp freq 
 	double	LastTimestamp; // duration of the experimental session, in ticks
-	char	Padding[56]; // so that this part of the header is 256 bytes
+	// The following 6 items are only valid if Version >= 103
+	char	Trodalness; // 1 for single, 2 for stereotrode, 4 for tetrode
+	char	DataTrodalness; // trodalness of the data representation
+	char	BitsPerSpikeSample; // ADC resolution for spike waveforms in bits (usually 12)
+	char	BitsPerSlowSample; // ADC resolution for slow-channel data in bits (usually 12)
+	unsigned short SpikeMaxMagnitudeMV; // zero-to-peak voltage in mV for spike waveform adc values (usually 3000)
+	unsigned short SlowMaxMagnitudeMV; // zero-to-peak voltage in mV for slow-channel adc values (usually 5000)
+	// Only valid if Version >= 105
+	unsigned short SpikePreAmpGain; // usually either 1000 or 500
+	// Only valid if Version >= 106
+	char	AcquiringSoftware[18];
+	char	ProcessingSoftware[18];
+	char	Padding[10]; // so that this part of the header is 256 bytes
 	// counters
 	int		TSCounts[130][5]; // number of timestamps[channel][unit]
 	int		WFCounts[130][5]; // number of waveforms[channel][unit]
@@ -162,16 +174,23 @@ struct PL_SlowChannelHeader {
 	int		ADFreq; 
 	int		Gain;
 	int		Enabled;
-	int		Padding[62];
+	int		PreAmpGain; // Version >= 104, gain at the preamp
+	int		SpikeChannel; // Version >= 104, associated DSP channel (<=0 if none)
+	char	Comment[128]; // Version >= 105
+	unsigned char SrcId; // Version >= 106
+	unsigned char reserved;
+	unsigned short ChanId;
+	int		Padding[27];
 };
 
 // the record header used in the datafile (*.plx)
 // it is followed by NumberOfWaveforms*NumberOfWordsInWaveform
 // short integers that represent the waveform(s)
+// (TimeStamp is declared int rather than long so the layout is the same on 64 bit unix)
 struct PL_DataBlockHeader{
 	short	Type;
-	short	UpperByteOf5ByteTimestamp;
-	long	TimeStamp;
+	unsigned short	UpperByteOf5ByteTimestamp; // upper 8 bits of the 40 bit timestamp
+	unsigned int	TimeStamp; // lower 32 bits of the 40 bit timestamp
 	short	Channel;
 	short	Unit;
 	short	NumberOfWaveforms;
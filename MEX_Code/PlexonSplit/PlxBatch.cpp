@@ -0,0 +1,190 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "PlxBatch.h"
+
+const int MAX_BATCH_THREADS = 64;
+
+static long long FileSize(const std::string &strFileName)
+{
+	FILE *fp = fopen(strFileName.c_str(), "rb");
+	if (fp == NULL)
+		return -1;
+#ifdef _WIN32
+	_fseeki64(fp, 0, SEEK_END);
+	long long iSize = _ftelli64(fp);
+#else
+	fseeko(fp, 0, SEEK_END);
+	long long iSize = (long long)ftello(fp);
+#endif
+	fclose(fp);
+	return iSize;
+}
+
+static std::string MarkerFileName(const std::string &strPlxFile, const PlxDemuxOptions_struct &Options)
+{
+	return PlxOutputPrefix(strPlxFile, Options.m_strOutputFolder) + "plxsplit.done";
+}
+
+// The options that change what is written, as the second line of the marker
+static std::string MarkerOptions(const PlxDemuxOptions_struct &Options)
+{
+	char Line[256];
+	sprintf(Line, "analog %d strobe %d spikes %d int16 %d indexbin %.17g", int(Options.m_bAnalog), int(Options.m_bStrobe),
+		int(Options.m_bSpikes), int(Options.m_bInt16Waveforms), Options.m_fSpikeIndexBinSec);
+	return Line;
+}
+
+static bool ReadLine(FILE *fp, std::string &strLine)
+{
+	char Line[2048];
+	if (fgets(Line, sizeof(Line), fp) == NULL)
+		return false;
+	size_t n = strlen(Line);
+	while (n > 0 && (Line[n-1] == '\n' || Line[n-1] == '\r'))
+		Line[--n] = 0;
+	strLine = Line;
+	return true;
+}
+
+// A marker is valid if it was written for a plx file of the same size, with the same options, and all
+// its outputs exist
+static bool ReadMarker(const std::string &strMarker, long long iPlxSize, const std::string &strOptions,
+					   std::vector<std::string> &acOutputFiles)
+{
+	FILE *fp = fopen(strMarker.c_str(), "r");
+	if (fp == NULL)
+		return false;
+	std::string strLine;
+	bool bOK = ReadLine(fp, strLine) && atoll(strLine.c_str()) == iPlxSize && ReadLine(fp, strLine) && strLine == strOptions;
+	acOutputFiles.clear();
+	while (bOK && ReadLine(fp, strLine)) {
+		if (strLine.empty())
+			continue;
+		acOutputFiles.push_back(strLine);
+		bOK = FileSize(strLine) >= 0;
+	}
+	fclose(fp);
+	return bOK;
+}
+
+// Written to a temporary name first, so a crash never leaves a marker that looks complete
+static bool WriteMarker(const std::string &strMarker, long long iPlxSize, const std::string &strOptions,
+						const std::vector<std::string> &acOutputFiles)
+{
+	std::string strTemp = strMarker + ".part";
+	FILE *fp = fopen(strTemp.c_str(), "w");
+	if (fp == NULL)
+		return false;
+	bool bOK = fprintf(fp, "%lld\n%s\n", iPlxSize, strOptions.c_str()) > 0;
+	for (size_t k=0;k<acOutputFiles.size();k++)
+		bOK = bOK && fprintf(fp, "%s\n", acOutputFiles[k].c_str()) > 0;
+	bOK = (fclose(fp) == 0) && bOK;
+	remove(strMarker.c_str());
+	bOK = bOK && rename(strTemp.c_str(), strMarker.c_str()) == 0;
+	if (!bOK)
+		remove(strTemp.c_str());
+	return bOK;
+}
+
+void PlxDefaultBatchOptions(PlxBatchOptions_struct &Options)
+{
+	Options.m_iNumThreads = 0;
+	Options.m_iMaxConcurrentIO = 2;
+	Options.m_bResume = false;
+}
+
+static void ConvertOne(const std::string &strPlxFile, long long iPlxSize, const PlxDemuxOptions_struct &DemuxOptions,
+					   bool bResume, PlxBatchResult_struct &Result)
+{
+	Result.m_strPlxFile = strPlxFile;
+	Result.m_bOK = false;
+	Result.m_bSkipped = false;
+	Result.m_strError.clear();
+	Result.m_acOutputFiles.clear();
+
+	if (iPlxSize < 0) {
+		Result.m_strError = "Cannot open " + strPlxFile;
+		return;
+	}
+
+	std::string strMarker = MarkerFileName(strPlxFile, DemuxOptions);
+	std::string strOptions = MarkerOptions(DemuxOptions);
+	if (bResume && ReadMarker(strMarker, iPlxSize, strOptions, Result.m_acOutputFiles)) {
+		Result.m_bOK = true;
+		Result.m_bSkipped = true;
+		return;
+	}
+	remove(strMarker.c_str());
+
+	PlxDemultiplexer Demux(DemuxOptions);
+	if (!Demux.Run(strPlxFile)) {
+		Result.m_strError = Demux.GetError();
+		return;
+	}
+	Result.m_acOutputFiles = Demux.GetOutputFiles();
+	if (!WriteMarker(strMarker, iPlxSize, strOptions, Result.m_acOutputFiles)) {
+		Result.m_strError = "Cannot write " + strMarker;
+		return;
+	}
+	Result.m_bOK = true;
+}
+
+void PlxBatchConvert(const std::vector<std::string> &acPlxFiles, const PlxDemuxOptions_struct &DemuxOptions,
+					 const PlxBatchOptions_struct &BatchOptions, std::vector<PlxBatchResult_struct> &Results)
+{
+	int iNumFiles = int(acPlxFiles.size());
+	Results.resize(iNumFiles);
+	if (iNumFiles == 0)
+		return;
+
+	// Largest files first
+	std::vector<long long> aiSize(iNumFiles);
+	std::vector<int> aiOrder(iNumFiles);
+	for (int k=0;k<iNumFiles;k++) {
+		aiSize[k] = FileSize(acPlxFiles[k]);
+		aiOrder[k] = k;
+	}
+	std::stable_sort(aiOrder.begin(), aiOrder.end(), [&aiSize](int a, int b) { return aiSize[a] > aiSize[b]; });
+
+	IOGate Gate(BatchOptions.m_iMaxConcurrentIO);
+	PlxDemuxOptions_struct Options = DemuxOptions;
+	Options.m_pIOGate = BatchOptions.m_iMaxConcurrentIO > 0 ? &Gate : NULL;
+
+	int iNumThreads = BatchOptions.m_iNumThreads;
+	if (iNumThreads <= 0)
+		iNumThreads = int(std::thread::hardware_concurrency());
+	if (iNumThreads > MAX_BATCH_THREADS)
+		iNumThreads = MAX_BATCH_THREADS;
+	if (iNumThreads > iNumFiles)
+		iNumThreads = iNumFiles;
+	if (iNumThreads < 1)
+		iNumThreads = 1;
+
+	std::atomic<int> iNext(0);
+	auto Worker = [&]() {
+		int i;
+		while ((i = iNext++) < iNumFiles) {
+			int iFile = aiOrder[i];
+			ConvertOne(acPlxFiles[iFile], aiSize[iFile], Options, BatchOptions.m_bResume, Results[iFile]);
+		}
+	};
+
+	if (iNumThreads == 1) {
+		Worker();
+		return;
+	}
+	std::vector<std::thread> Workers;
+	for (int k=0;k<iNumThreads;k++)
+		Workers.push_back(std::thread(Worker));
+	for (size_t k=0;k<Workers.size();k++)
+		Workers[k].join();
+}
@@ -0,0 +1,47 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef PLX_BATCH_H
+#define PLX_BATCH_H
+
+#include "PlxDemux.h"
+
+/*
+ Converts many PLX files concurrently.
+
+ A pool of m_iNumThreads workers takes files from a queue (largest first, so a long
+ recording does not start last). Each worker runs a PlxDemultiplexer; block parsing, sample
+ conversion and waveform packing run freely on the workers, while the disk reads and the
+ final file assembly go through an IOGate that admits at most m_iMaxConcurrentIO streams,
+ so a batch does not turn sequential reads into seeks.
+
+ When a file is done, a <Session>-plxsplit.done marker is written next to its raw files
+ (the plx size, the options that change the output, and the files written). With m_bResume,
+ files whose marker matches are skipped, so a batch that was interrupted restarts only the
+ unfinished files, and a batch with other options converts them again.
+*/
+
+typedef struct {
+	int m_iNumThreads;		// files converted at the same time, 0: number of cores
+	int m_iMaxConcurrentIO;	// 0: unrestricted
+	bool m_bResume;
+} PlxBatchOptions_struct;
+
+typedef struct {
+	std::string m_strPlxFile;
+	bool m_bOK;
+	bool m_bSkipped;		// converted by a previous run
+	std::string m_strError;
+	std::vector<std::string> m_acOutputFiles;
+} PlxBatchResult_struct;
+
+void PlxDefaultBatchOptions(PlxBatchOptions_struct &Options);
+
+// Results are in the same order as acPlxFiles
+void PlxBatchConvert(const std::vector<std::string> &acPlxFiles, const PlxDemuxOptions_struct &DemuxOptions,
+					 const PlxBatchOptions_struct &BatchOptions, std::vector<PlxBatchResult_struct> &Results);
+
+#endif
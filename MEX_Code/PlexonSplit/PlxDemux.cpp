@@ -0,0 +1,703 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <algorithm>
+#include "PlxDemux.h"
+
+const unsigned int PLX_MAGIC_NUMBER = 0x58454c50;
+const size_t READ_CHUNK_SIZE = 16 << 20;
+const size_t SPOOL_BUFFER_SIZE = 1 << 20;
+const size_t COPY_CHUNK_SIZE = 4 << 20;
+const size_t SPIKE_RECORD_HEADER = 14;
+const size_t SPIKE_WRITE_CHUNK = 8192;	// spikes of one unit gathered before they are written
+const int MAX_HEADERS = 1 << 16;
+
+/*
+ Writes the KOFIKO raw header: a 13 character identifier followed by the header size
+ (which counts itself) and the header fields. The size is patched in when the header is complete.
+*/
+class RawHeaderWriter {
+public:
+	RawHeaderWriter(FILE *fp, const char *strIdentifier) : m_fp(fp), m_iCount(0), m_bOK(true) {
+		m_bOK = fwrite(strIdentifier, 1, 13, m_fp) == 13;
+		UInt64(0);
+	}
+	void UInt64(double fValue) {
+		unsigned long long iValue = fValue > 0 ? (unsigned long long)(fValue + 0.5) : 0;
+		Write(&iValue, 8);
+	}
+	void Double(double fValue) {
+		Write(&fValue, 8);
+	}
+	void String(const std::string &strValue) {
+		UInt64(double(strValue.size()));
+		if (!strValue.empty())
+			Write(strValue.c_str(), strValue.size());
+	}
+	// Patches the header size and moves back to the end of the header
+	bool Finish() {
+		long iEnd = ftell(m_fp);
+		m_bOK = m_bOK && fseek(m_fp, 13, SEEK_SET) == 0;
+		m_bOK = m_bOK && fwrite(&m_iCount, 8, 1, m_fp) == 1;
+		m_bOK = m_bOK && fseek(m_fp, iEnd, SEEK_SET) == 0;
+		return m_bOK;
+	}
+	void Write(const void *pData, size_t iNumBytes) {
+		m_bOK = m_bOK && fwrite(pData, 1, iNumBytes, m_fp) == iNumBytes;
+		m_iCount += iNumBytes;
+	}
+	bool OK() const { return m_bOK; }
+private:
+	FILE *m_fp;
+	unsigned long long m_iCount;
+	bool m_bOK;
+};
+
+static std::string TrimName(const char *strName, size_t iMaxLength)
+{
+	std::string strOut(strName, strnlen(strName, iMaxLength));
+	while (!strOut.empty() && (strOut[strOut.size()-1] == ' ' || strOut[strOut.size()-1] == '\t'))
+		strOut.erase(strOut.size()-1);
+	return strOut;
+}
+
+static bool StartsWithNoCase(const std::string &strValue, const char *strPrefix)
+{
+	size_t n = strlen(strPrefix);
+	if (strValue.size() < n)
+		return false;
+	for (size_t k=0;k<n;k++)
+		if (tolower((unsigned char)strValue[k]) != tolower((unsigned char)strPrefix[k]))
+			return false;
+	return true;
+}
+
+static bool SeekTo(FILE *fp, long long iOffset)
+{
+#ifdef _WIN32
+	return _fseeki64(fp, iOffset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)iOffset, SEEK_SET) == 0;
+#endif
+}
+
+/*
+ Reads a spool file back in large chunks (taking the io gate for each of them), whatever
+ the size of the records.
+*/
+class SpoolReader {
+public:
+	SpoolReader(FILE *fp, IOGate *pGate) : m_fp(fp), m_pGate(pGate), m_Buffer(COPY_CHUNK_SIZE), m_iPos(0), m_iEnd(0) {}
+	bool Read(void *pData, size_t iNumBytes) {
+		char *pOut = (char *)pData;
+		while (iNumBytes > 0) {
+			if (m_iPos == m_iEnd) {
+				IOGateLock Lock(m_pGate);
+				m_iEnd = fread(&m_Buffer[0], 1, m_Buffer.size(), m_fp);
+				m_iPos = 0;
+				if (m_iEnd == 0)
+					return false;
+			}
+			size_t iCopy = std::min(iNumBytes, m_iEnd - m_iPos);
+			memcpy(pOut, &m_Buffer[m_iPos], iCopy);
+			m_iPos += iCopy;
+			pOut += iCopy;
+			iNumBytes -= iCopy;
+		}
+		return true;
+	}
+private:
+	FILE *m_fp;
+	IOGate *m_pGate;
+	std::vector<char> m_Buffer;
+	size_t m_iPos, m_iEnd;
+};
+
+// Spools are buffered here rather than by stdio, so that the disk writes go through the io gate
+static FILE *OpenSpool(const std::string &strFileName, std::vector<char> &Buffer)
+{
+	FILE *fp = fopen(strFileName.c_str(), "wb");
+	if (fp != NULL) {
+		setvbuf(fp, NULL, _IONBF, 0);
+		Buffer.reserve(SPOOL_BUFFER_SIZE);
+	}
+	return fp;
+}
+
+static bool FlushSpool(FILE *fp, std::vector<char> &Buffer, IOGate *pGate)
+{
+	if (Buffer.empty())
+		return true;
+	IOGateLock Lock(pGate);
+	bool bOK = fwrite(&Buffer[0], 1, Buffer.size(), fp) == Buffer.size();
+	Buffer.clear();
+	return bOK;
+}
+
+static bool WriteSpool(FILE *fp, std::vector<char> &Buffer, IOGate *pGate, const void *pData, size_t iNumBytes)
+{
+	if (Buffer.size() + iNumBytes > SPOOL_BUFFER_SIZE && !FlushSpool(fp, Buffer, pGate))
+		return false;
+	if (iNumBytes >= SPOOL_BUFFER_SIZE) {
+		IOGateLock Lock(pGate);
+		return fwrite(pData, 1, iNumBytes, fp) == iNumBytes;
+	}
+	Buffer.insert(Buffer.end(), (const char *)pData, (const char *)pData + iNumBytes);
+	return true;
+}
+
+void PlxDefaultOptions(PlxDemuxOptions_struct &Options)
+{
+	Options.m_bAnalog = true;
+	Options.m_bStrobe = true;
+	Options.m_bSpikes = true;
+	Options.m_bInt16Waveforms = false;
+	Options.m_fSpikeIndexBinSec = 10;
+	Options.m_strOutputFolder.clear();
+	Options.m_pIOGate = NULL;
+}
+
+std::string PlxOutputPrefix(const std::string &strPlxFile, const std::string &strOutputFolder)
+{
+	size_t iSlash = strPlxFile.find_last_of("/\\");
+	std::string strInputFolder = (iSlash == std::string::npos) ? std::string() : strPlxFile.substr(0, iSlash + 1);
+	std::string strName = (iSlash == std::string::npos) ? strPlxFile : strPlxFile.substr(iSlash + 1);
+	size_t iDot = strName.find_last_of('.');
+	std::string strSession = (iDot == std::string::npos) ? strName : strName.substr(0, iDot);
+	std::string strFolder = strOutputFolder.empty() ? strInputFolder : strOutputFolder;
+	if (!strFolder.empty() && strFolder[strFolder.size()-1] != '/' && strFolder[strFolder.size()-1] != '\\')
+		strFolder += (iSlash != std::string::npos) ? strPlxFile[iSlash] : '/';
+	return strFolder + strSession + "-";
+}
+
+PlxDemultiplexer::PlxDemultiplexer(const PlxDemuxOptions_struct &Options) : m_Options(Options)
+{
+	memset(&m_FileHeader, 0, sizeof(m_FileHeader));
+}
+
+PlxDemultiplexer::~PlxDemultiplexer()
+{
+	Cleanup();
+}
+
+bool PlxDemultiplexer::Fail(const std::string &strMessage)
+{
+	m_strError = strMessage;
+	Cleanup();
+	return false;
+}
+
+// Closes and removes all spool files that are still open (after an error)
+void PlxDemultiplexer::Cleanup()
+{
+	for (std::map<int, AnalogWriter_struct>::iterator it=m_AnalogWriters.begin();it!=m_AnalogWriters.end();it++) {
+		if (it->second.m_Spool != NULL) {
+			fclose(it->second.m_Spool);
+			remove((it->second.m_strFileName + ".part").c_str());
+		}
+	}
+	for (std::map<int, SpikeWriter_struct>::iterator it=m_SpikeWriters.begin();it!=m_SpikeWriters.end();it++) {
+		if (it->second.m_Spool != NULL) {
+			fclose(it->second.m_Spool);
+			remove((it->second.m_strFileName + ".part").c_str());
+		}
+	}
+	m_AnalogWriters.clear();
+	m_SpikeWriters.clear();
+}
+
+std::string PlxDemultiplexer::OutputFileName(const std::string &strSuffix) const
+{
+	return m_strPrefix + strSuffix + ".raw";
+}
+
+const PL_ChanHeader *PlxDemultiplexer::FindDSPHeader(int iChannel) const
+{
+	for (size_t k=0;k<m_DSPHeaders.size();k++)
+		if (m_DSPHeaders[k].Channel == iChannel)
+			return &m_DSPHeaders[k];
+	return NULL;
+}
+
+const PL_SlowChannelHeader *PlxDemultiplexer::FindSlowHeader(int iChannel) const
+{
+	for (size_t k=0;k<m_SlowHeaders.size();k++)
+		if (m_SlowHeaders[k].Channel == iChannel)
+			return &m_SlowHeaders[k];
+	return NULL;
+}
+
+// a/d value -> millivolts, same as plx_waves_v
+double PlxDemultiplexer::SpikeScale(const PL_ChanHeader *pHeader) const
+{
+	double fGain = (pHeader != NULL && pHeader->Gain > 0) ? pHeader->Gain : 1;
+	const PL_FileHeader &fh = m_FileHeader;
+	if (fh.Version < 103)
+		return 3000.0 / (2048.0 * fGain * 1000.0);
+	double fMaxMV = fh.SpikeMaxMagnitudeMV > 0 ? fh.SpikeMaxMagnitudeMV : 3000;
+	double fHalfRange = 0.5 * pow(2.0, fh.BitsPerSpikeSample > 0 ? fh.BitsPerSpikeSample : 12);
+	double fPreAmpGain = (fh.Version >= 105 && fh.SpikePreAmpGain > 0) ? fh.SpikePreAmpGain : 1000;
+	return fMaxMV / (fHalfRange * fGain * fPreAmpGain);
+}
+
+double PlxDemultiplexer::SpikeIndexBin() const
+{
+	return m_Options.m_fSpikeIndexBinSec > 0 ? m_Options.m_fSpikeIndexBinSec : 10;
+}
+
+// a/d value -> millivolts, same as plx_ad_v
+double PlxDemultiplexer::SlowScale(const PL_SlowChannelHeader *pHeader) const
+{
+	double fGain = pHeader->Gain > 0 ? pHeader->Gain : 1;
+	const PL_FileHeader &fh = m_FileHeader;
+	if (fh.Version <= 102)
+		return 5000.0 / (2048.0 * fGain * 1000.0);
+	double fMaxMV = fh.SlowMaxMagnitudeMV > 0 ? fh.SlowMaxMagnitudeMV : 5000;
+	double fHalfRange = 0.5 * pow(2.0, fh.BitsPerSlowSample > 0 ? fh.BitsPerSlowSample : 12);
+	double fPreAmpGain = (fh.Version >= 104 && pHeader->PreAmpGain > 0) ? pHeader->PreAmpGain : 1000;
+	return fMaxMV / (fHalfRange * fGain * fPreAmpGain);
+}
+
+bool PlxDemultiplexer::ReadHeaders(FILE *fp)
+{
+	if (fread(&m_FileHeader, sizeof(m_FileHeader), 1, fp) != 1 || m_FileHeader.MagicNumber != PLX_MAGIC_NUMBER)
+		return Fail("Not a plx file: " + m_strPlxFile);
+
+	if (m_FileHeader.NumDSPChannels < 0 || m_FileHeader.NumDSPChannels > MAX_HEADERS ||
+		m_FileHeader.NumEventChannels < 0 || m_FileHeader.NumEventChannels > MAX_HEADERS ||
+		m_FileHeader.NumSlowChannels < 0 || m_FileHeader.NumSlowChannels > MAX_HEADERS ||
+		m_FileHeader.ADFrequency <= 0)
+		return Fail("Corrupted plx file header: " + m_strPlxFile);
+
+	m_DSPHeaders.resize(m_FileHeader.NumDSPChannels);
+	m_EventHeaders.resize(m_FileHeader.NumEventChannels);
+	m_SlowHeaders.resize(m_FileHeader.NumSlowChannels);
+	if ((!m_DSPHeaders.empty() && fread(&m_DSPHeaders[0], sizeof(PL_ChanHeader), m_DSPHeaders.size(), fp) != m_DSPHeaders.size()) ||
+		(!m_EventHeaders.empty() && fread(&m_EventHeaders[0], sizeof(PL_EventHeader), m_EventHeaders.size(), fp) != m_EventHeaders.size()) ||
+		(!m_SlowHeaders.empty() && fread(&m_SlowHeaders[0], sizeof(PL_SlowChannelHeader), m_SlowHeaders.size(), fp) != m_SlowHeaders.size()))
+		return Fail("Truncated plx channel headers: " + m_strPlxFile);
+	return true;
+}
+
+bool PlxDemultiplexer::AnalogBlock(const PL_DataBlockHeader &db, unsigned long long iTimestamp, const short *aiWords)
+{
+	// a channel that never has samples gets no file
+	int iNumSamples = db.NumberOfWaveforms * db.NumberOfWordsInWaveform;
+	if (iNumSamples == 0)
+		return true;
+
+	std::map<int, AnalogWriter_struct>::iterator it = m_AnalogWriters.find(db.Channel);
+	if (it == m_AnalogWriters.end()) {
+		const PL_SlowChannelHeader *pHeader = FindSlowHeader(db.Channel);
+		if (pHeader == NULL || pHeader->ADFreq <= 0)
+			return true; // no way to place these samples in time
+		AnalogWriter_struct W;
+		W.m_iChannel = db.Channel;
+		W.m_strName = TrimName(pHeader->Name, sizeof(pHeader->Name));
+		W.m_strFileName = OutputFileName(W.m_strName);
+		W.m_iSamplingFreq = pHeader->ADFreq;
+		W.m_iTicksPerSample = m_FileHeader.ADFrequency / pHeader->ADFreq;
+		// fnConvertPLXtoFastDataAccess uses plx_ad_v (millivolts) for these channels and plx_ad (a/d values) for the rest
+		bool bVoltage = StartsWithNoCase(W.m_strName, "LFP") || StartsWithNoCase(W.m_strName, "AD") || StartsWithNoCase(W.m_strName, "RAW");
+		W.m_fScale = bVoltage ? SlowScale(pHeader) : 1.0;
+		W.m_iNextTimestamp = 0;
+		W.m_Spool = OpenSpool(W.m_strFileName + ".part", W.m_SpoolBuffer);
+		if (W.m_Spool == NULL)
+			return Fail("Cannot create " + W.m_strFileName + ".part");
+		it = m_AnalogWriters.insert(std::make_pair(int(db.Channel), W)).first;
+	}
+	AnalogWriter_struct &W = it->second;
+
+	// A gap in the timestamps starts a new frame (same rule as the plexon SDK)
+	if (W.m_afStartTS.empty() || iTimestamp != W.m_iNextTimestamp) {
+		W.m_afStartTS.push_back(double(iTimestamp) / m_FileHeader.ADFrequency);
+		W.m_aiNumSamplesPerFrame.push_back(0);
+	}
+	W.m_aiNumSamplesPerFrame.back() += iNumSamples;
+	W.m_iNextTimestamp = iTimestamp + (unsigned long long)iNumSamples * W.m_iTicksPerSample;
+
+	if (int(m_afConvertBuffer.size()) < iNumSamples)
+		m_afConvertBuffer.resize(iNumSamples);
+	for (int k=0;k<iNumSamples;k++)
+		m_afConvertBuffer[k] = float(aiWords[k] * W.m_fScale);
+	if (!WriteSpool(W.m_Spool, W.m_SpoolBuffer, m_Options.m_pIOGate, &m_afConvertBuffer[0], sizeof(float) * iNumSamples))
+		return Fail("Cannot write " + W.m_strFileName + ".part");
+	return true;
+}
+
+/*
+ Spike spool record: 8 byte timestamp (ticks), 2 byte unit, 4 byte number of words, waveform
+ (a/d values). The waveform length of the channel is the one of the first block that has words.
+ The counts, the time span and the time index of every unit are kept up to date here, so that
+ FinishSpikes can write the header first and then stream the spool into place.
+*/
+bool PlxDemultiplexer::SpikeBlock(const PL_DataBlockHeader &db, unsigned long long iTimestamp, const short *aiWords)
+{
+	std::map<int, SpikeWriter_struct>::iterator it = m_SpikeWriters.find(db.Channel);
+	if (it == m_SpikeWriters.end()) {
+		SpikeWriter_struct W;
+		char strSuffix[64];
+		sprintf(strSuffix, "spikes_ch%d", int(db.Channel));
+		W.m_iChannel = db.Channel;
+		W.m_strFileName = OutputFileName(strSuffix);
+		W.m_iWaveFormLength = 0;
+		W.m_iNumSpikes = 0;
+		W.m_Spool = OpenSpool(W.m_strFileName + ".part", W.m_SpoolBuffer);
+		if (W.m_Spool == NULL)
+			return Fail("Cannot create " + W.m_strFileName + ".part");
+		it = m_SpikeWriters.insert(std::make_pair(int(db.Channel), W)).first;
+	}
+	SpikeWriter_struct &W = it->second;
+
+	int iNumWords = db.NumberOfWaveforms * db.NumberOfWordsInWaveform;
+	if (W.m_iWaveFormLength == 0)
+		W.m_iWaveFormLength = iNumWords;
+	size_t iRecordSize = SPIKE_RECORD_HEADER + 2 * (size_t)iNumWords;
+	if (m_acSpikeRecord.size() < iRecordSize)
+		m_acSpikeRecord.resize(iRecordSize);
+	char *pRecord = &m_acSpikeRecord[0];
+	short iUnit = db.Unit;
+	memcpy(pRecord, &iTimestamp, 8);
+	memcpy(pRecord + 8, &iUnit, 2);
+	memcpy(pRecord + 10, &iNumWords, 4);
+	if (iNumWords > 0)
+		memcpy(pRecord + SPIKE_RECORD_HEADER, aiWords, 2 * (size_t)iNumWords);
+
+	if (!WriteSpool(W.m_Spool, W.m_SpoolBuffer, m_Options.m_pIOGate, pRecord, iRecordSize))
+		return Fail("Cannot write " + W.m_strFileName + ".part");
+	W.m_iNumSpikes++;
+
+	std::map<int, SpikeUnit_struct>::iterator itUnit = W.m_Units.find(iUnit);
+	if (itUnit == W.m_Units.end()) {
+		SpikeUnit_struct U;
+		U.m_iNumSpikes = 0;
+		U.m_iFirstTick = U.m_iLastTick = iTimestamp;
+		U.m_bSorted = true;
+		U.m_fIndexStart = floor(double(iTimestamp) / m_FileHeader.ADFrequency / SpikeIndexBin()) * SpikeIndexBin();
+		itUnit = W.m_Units.insert(std::make_pair(int(iUnit), U)).first;
+	}
+	SpikeUnit_struct &U = itUnit->second;
+	if (iTimestamp < U.m_iLastTick)
+		U.m_bSorted = false;
+	// every bin that starts at or before this spike gets the number of spikes before it
+	double fTime = double(iTimestamp) / m_FileHeader.ADFrequency;
+	while (U.m_fIndexStart + U.m_aiIndex.size() * SpikeIndexBin() <= fTime)
+		U.m_aiIndex.push_back(U.m_iNumSpikes);
+	U.m_iLastTick = iTimestamp;
+	U.m_iNumSpikes++;
+	return true;
+}
+
+bool PlxDemultiplexer::ParseBlocks(FILE *fp)
+{
+	std::vector<char> Buffer(READ_CHUNK_SIZE);
+	size_t iPos = 0, iEnd = 0;
+	bool bEOF = false;
+	PL_DataBlockHeader db;
+
+	while (true) {
+		// Make sure the block header and its waveform words are in the buffer
+		size_t iNeeded = sizeof(db);
+		for (int iStage=0;iStage<2;iStage++) {
+			if (iEnd - iPos < iNeeded && !bEOF) {
+				memmove(&Buffer[0], &Buffer[iPos], iEnd - iPos);
+				iEnd -= iPos;
+				iPos = 0;
+				if (Buffer.size() < iNeeded)
+					Buffer.resize(iNeeded);
+				size_t iRead;
+				{
+					IOGateLock Lock(m_Options.m_pIOGate);
+					iRead = fread(&Buffer[iEnd], 1, Buffer.size() - iEnd, fp);
+				}
+				iEnd += iRead;
+				bEOF = iRead == 0 || feof(fp) != 0;
+			}
+			if (iEnd - iPos < iNeeded)
+				return true; // end of file (a truncated last block is dropped)
+			if (iStage == 0) {
+				memcpy(&db, &Buffer[iPos], sizeof(db));
+				if (db.NumberOfWaveforms < 0 || db.NumberOfWordsInWaveform < 0)
+					return Fail("Corrupted data block in " + m_strPlxFile);
+				iNeeded = sizeof(db) + 2 * (size_t)db.NumberOfWaveforms * db.NumberOfWordsInWaveform;
+			}
+		}
+
+		const short *aiWords = (const short *)&Buffer[iPos + sizeof(db)];
+		unsigned long long iTimestamp = ((unsigned long long)(db.UpperByteOf5ByteTimestamp & 0xFF) << 32) | db.TimeStamp;
+		iPos += iNeeded;
+
+		switch (db.Type) {
+			case PL_SingleWFType:
+				if (m_Options.m_bSpikes && !SpikeBlock(db, iTimestamp, aiWords))
+					return false;
+				break;
+			case PL_ExtEventType:
+				if (m_Options.m_bStrobe && db.Channel == PL_StrobedExtChannel) {
+					// same as fnConvertPLXtoFastDataAccess: words are stored with an offset of 32768
+					m_afStrobeWords.push_back(double(db.Unit) + 32768);
+					m_afStrobeTimestamps.push_back(double(iTimestamp) / m_FileHeader.ADFrequency);
+				}
+				break;
+			case PL_ADDataType:
+				if (m_Options.m_bAnalog && !AnalogBlock(db, iTimestamp, aiWords))
+					return false;
+				break;
+		}
+	}
+}
+
+// KOFIKO_v1.00A, see fnDumpChannel.m
+bool PlxDemultiplexer::FinishAnalog(AnalogWriter_struct &W)
+{
+	std::string strSpoolFile = W.m_strFileName + ".part";
+	bool bOK = FlushSpool(W.m_Spool, W.m_SpoolBuffer, m_Options.m_pIOGate);
+	bOK = (fclose(W.m_Spool) == 0) && bOK;
+	W.m_Spool = NULL;
+	std::vector<char>().swap(W.m_SpoolBuffer);
+	FILE *fpIn = fopen(strSpoolFile.c_str(), "rb");
+	FILE *fpOut = fopen(W.m_strFileName.c_str(), "wb+");
+	if (!bOK || fpIn == NULL || fpOut == NULL) {
+		if (fpIn) fclose(fpIn);
+		if (fpOut) fclose(fpOut);
+		remove(strSpoolFile.c_str());
+		return Fail("Cannot create " + W.m_strFileName);
+	}
+
+	RawHeaderWriter H(fpOut, "KOFIKO_v1.00A");
+	H.UInt64(W.m_iChannel + 1);
+	H.UInt64(W.m_iSamplingFreq);
+	H.String(W.m_strName);
+	H.UInt64(double(W.m_aiNumSamplesPerFrame.size()));
+	for (size_t k=0;k<W.m_aiNumSamplesPerFrame.size();k++)
+		H.Write(&W.m_aiNumSamplesPerFrame[k], 8);
+	for (size_t k=0;k<W.m_afStartTS.size();k++)
+		H.Double(W.m_afStartTS[k]);
+	bOK = H.Finish();
+
+	IOGateLock Lock(m_Options.m_pIOGate);
+	std::vector<char> Chunk(COPY_CHUNK_SIZE);
+	size_t iRead;
+	while (bOK && (iRead = fread(&Chunk[0], 1, Chunk.size(), fpIn)) > 0)
+		bOK = fwrite(&Chunk[0], 1, iRead, fpOut) == iRead;
+	fclose(fpIn);
+	bOK = (fclose(fpOut) == 0) && bOK;
+	remove(strSpoolFile.c_str());
+	if (!bOK)
+		return Fail("Cannot write " + W.m_strFileName);
+	m_acOutputFiles.push_back(W.m_strFileName);
+	return true;
+}
+
+// KOFIKO_v1.03S, see fnDumpChannelSpikes.m
+// The header comes from what SpikeBlock collected. The spool is then read once and the spikes of every
+// unit are gathered SPIKE_WRITE_CHUNK at a time and written in place, so memory does not grow with the
+// number of spikes.
+bool PlxDemultiplexer::FinishSpikes(SpikeWriter_struct &W)
+{
+	std::string strSpoolFile = W.m_strFileName + ".part";
+	bool bOK = FlushSpool(W.m_Spool, W.m_SpoolBuffer, m_Options.m_pIOGate);
+	bOK = (fclose(W.m_Spool) == 0) && bOK;
+	W.m_Spool = NULL;
+	std::vector<char>().swap(W.m_SpoolBuffer);
+	std::map<int, SpikeUnit_struct>::iterator it;
+	for (it=W.m_Units.begin();bOK && it!=W.m_Units.end();it++) {
+		if (!it->second.m_bSorted) {
+			remove(strSpoolFile.c_str());
+			return Fail("Spikes are not in time order in " + m_strPlxFile);
+		}
+	}
+	FILE *fpIn = bOK ? fopen(strSpoolFile.c_str(), "rb") : NULL;
+	FILE *fpOut = fpIn != NULL ? fopen(W.m_strFileName.c_str(), "wb+") : NULL;
+	if (fpOut == NULL) {
+		if (fpIn) fclose(fpIn);
+		remove(strSpoolFile.c_str());
+		return Fail("Cannot create " + W.m_strFileName);
+	}
+	setvbuf(fpOut, NULL, _IOFBF, SPOOL_BUFFER_SIZE);
+
+	// No block had waveform words: zero waveforms of the length in the file header
+	int L = W.m_iWaveFormLength > 0 ? W.m_iWaveFormLength : std::max(m_FileHeader.NumPointsWave, 0);
+	const PL_ChanHeader *pHeader = FindDSPHeader(W.m_iChannel);
+	double fScale = SpikeScale(pHeader);
+	bool bInt16 = m_Options.m_bInt16Waveforms;
+
+	RawHeaderWriter H(fpOut, "KOFIKO_v1.03S");
+	H.String(m_strPlxFile);
+	H.String(pHeader != NULL ? TrimName(pHeader->Name, sizeof(pHeader->Name)) : std::string());
+	H.UInt64(W.m_iChannel);
+	H.Double(pHeader != NULL ? pHeader->Gain : 0);
+	H.Double(pHeader != NULL ? pHeader->Threshold : 0);
+	H.UInt64(pHeader != NULL ? pHeader->Filter : 0);
+	H.UInt64(0); // not sorted
+	H.UInt64(double(W.m_Units.size()));
+	H.UInt64(L);
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		H.UInt64(it->first);
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		H.UInt64(double(it->second.m_iNumSpikes));
+	// Intervals are stored as a NumUnits x 2 matrix (column major)
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		H.Double(double(it->second.m_iFirstTick) / m_FileHeader.ADFrequency);
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		H.Double(double(it->second.m_iLastTick) / m_FileHeader.ADFrequency);
+
+	// Waveform storage and the time index: for every IndexBin seconds from IndexStart, the
+	// number of spikes of the unit that come before it
+	H.UInt64(bInt16 ? 1 : 0);
+	H.Double(bInt16 ? fScale : 1);
+	H.Double(SpikeIndexBin());
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		H.Double(it->second.m_fIndexStart);
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		H.UInt64(double(it->second.m_aiIndex.size()));
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++)
+		if (!it->second.m_aiIndex.empty())
+			H.Write(&it->second.m_aiIndex[0], 8 * it->second.m_aiIndex.size());
+	bOK = H.Finish();
+	long long iDataStart = (long long)ftell(fpOut);
+
+	// Timestamps of all units, then the NumSpikes x WaveFormLength waveform matrix of every unit (column major)
+	typedef struct {
+		long long m_iTimestampOffset;
+		long long m_iWaveformOffset;
+		unsigned long long m_iNumSpikes;
+		unsigned long long m_iWritten;
+		std::vector<double> m_afTimestamps;
+		std::vector<short> m_aiWaveforms;	// sample major: sample s of the j-th spike of the chunk at s * SPIKE_WRITE_CHUNK + j
+	} UnitOutput_struct;
+	long long iElementSize = bInt16 ? 2 : 4;
+	std::map<int, UnitOutput_struct> Outputs;
+	unsigned long long iSpikesBefore = 0;
+	for (it=W.m_Units.begin();it!=W.m_Units.end();it++) {
+		UnitOutput_struct &O = Outputs[it->first];
+		O.m_iTimestampOffset = iDataStart + 8 * (long long)iSpikesBefore;
+		O.m_iWaveformOffset = iDataStart + 8 * (long long)W.m_iNumSpikes + iElementSize * L * (long long)iSpikesBefore;
+		O.m_iNumSpikes = it->second.m_iNumSpikes;
+		O.m_iWritten = 0;
+		iSpikesBefore += it->second.m_iNumSpikes;
+	}
+
+	std::vector<float> afConverted;
+	auto Flush = [&](UnitOutput_struct &O) -> bool {
+		size_t n = O.m_afTimestamps.size();
+		if (n == 0)
+			return true;
+		if (!bInt16) {
+			afConverted.resize((size_t)L * n + 1);
+			for (int s=0;s<L;s++)
+				for (size_t j=0;j<n;j++)
+					afConverted[s * n + j] = float(O.m_aiWaveforms[s * SPIKE_WRITE_CHUNK + j] * fScale);
+		}
+		IOGateLock Lock(m_Options.m_pIOGate);
+		bool bWritten = SeekTo(fpOut, O.m_iTimestampOffset + 8 * (long long)O.m_iWritten) &&
+			fwrite(&O.m_afTimestamps[0], sizeof(double), n, fpOut) == n;
+		for (int s=0;bWritten && s<L;s++) {
+			bWritten = SeekTo(fpOut, O.m_iWaveformOffset + iElementSize * ((long long)s * O.m_iNumSpikes + O.m_iWritten));
+			if (bInt16)
+				bWritten = bWritten && fwrite(&O.m_aiWaveforms[s * SPIKE_WRITE_CHUNK], sizeof(short), n, fpOut) == n;
+			else
+				bWritten = bWritten && fwrite(&afConverted[s * n], sizeof(float), n, fpOut) == n;
+		}
+		O.m_iWritten += n;
+		O.m_afTimestamps.clear();
+		return bWritten;
+	};
+
+	SpoolReader Spool(fpIn, m_Options.m_pIOGate);
+	std::vector<short> aiWords;
+	for (unsigned long long i=0;bOK && i<W.m_iNumSpikes;i++) {
+		char acRecord[SPIKE_RECORD_HEADER];
+		unsigned long long iTicks;
+		short iUnit;
+		int iNumWords;
+		bOK = Spool.Read(acRecord, SPIKE_RECORD_HEADER);
+		memcpy(&iTicks, acRecord, 8);
+		memcpy(&iUnit, acRecord + 8, 2);
+		memcpy(&iNumWords, acRecord + 10, 4);
+		if (!bOK || iNumWords < 0 || Outputs.find(iUnit) == Outputs.end()) {
+			bOK = false;
+			break;
+		}
+		aiWords.resize(iNumWords + 1);
+		bOK = iNumWords == 0 || Spool.Read(&aiWords[0], 2 * (size_t)iNumWords);
+
+		UnitOutput_struct &O = Outputs[iUnit];
+		if (O.m_aiWaveforms.empty())
+			O.m_aiWaveforms.resize((size_t)L * SPIKE_WRITE_CHUNK + 1);
+		size_t j = O.m_afTimestamps.size();
+		O.m_afTimestamps.push_back(double(iTicks) / m_FileHeader.ADFrequency);
+		for (int s=0;s<L;s++)
+			O.m_aiWaveforms[s * SPIKE_WRITE_CHUNK + j] = s < iNumWords ? aiWords[s] : 0;
+		if (O.m_afTimestamps.size() == SPIKE_WRITE_CHUNK)
+			bOK = bOK && Flush(O);
+	}
+	for (std::map<int, UnitOutput_struct>::iterator itOut=Outputs.begin();bOK && itOut!=Outputs.end();itOut++)
+		bOK = Flush(itOut->second) && itOut->second.m_iWritten == itOut->second.m_iNumSpikes;
+	fclose(fpIn);
+	remove(strSpoolFile.c_str());
+	bOK = (fclose(fpOut) == 0) && bOK;
+	if (!bOK)
+		return Fail("Cannot write " + W.m_strFileName);
+	m_acOutputFiles.push_back(W.m_strFileName);
+	return true;
+}
+
+// KOFIKO_v1.00E, see fnDumpStrobeWords.m
+bool PlxDemultiplexer::FinishStrobe()
+{
+	std::string strFileName = OutputFileName("strobe");
+	FILE *fpOut = fopen(strFileName.c_str(), "wb+");
+	if (fpOut == NULL)
+		return Fail("Cannot create " + strFileName);
+	RawHeaderWriter H(fpOut, "KOFIKO_v1.00E");
+	H.UInt64(double(m_afStrobeWords.size()));
+	for (size_t k=0;k<m_afStrobeWords.size();k++)
+		H.UInt64(m_afStrobeWords[k]);
+	for (size_t k=0;k<m_afStrobeTimestamps.size();k++)
+		H.Double(m_afStrobeTimestamps[k]);
+	bool bOK = H.Finish();
+	bOK = (fclose(fpOut) == 0) && bOK;
+	if (!bOK)
+		return Fail("Cannot write " + strFileName);
+	m_acOutputFiles.push_back(strFileName);
+	return true;
+}
+
+bool PlxDemultiplexer::Run(const std::string &strPlxFile)
+{
+	Cleanup();
+	m_strError.clear();
+	m_acOutputFiles.clear();
+	m_afStrobeWords.clear();
+	m_afStrobeTimestamps.clear();
+	m_strPlxFile = strPlxFile;
+
+	m_strPrefix = PlxOutputPrefix(strPlxFile, m_Options.m_strOutputFolder);
+
+	FILE *fp = fopen(strPlxFile.c_str(), "rb");
+	if (fp == NULL)
+		return Fail("Cannot open " + strPlxFile);
+	bool bOK = ReadHeaders(fp) && ParseBlocks(fp);
+	fclose(fp);
+	if (!bOK)
+		return false;
+
+	for (std::map<int, AnalogWriter_struct>::iterator it=m_AnalogWriters.begin();it!=m_AnalogWriters.end();it++)
+		if (!FinishAnalog(it->second))
+			return false;
+	if (m_Options.m_bStrobe && !FinishStrobe())
+		return false;
+	for (std::map<int, SpikeWriter_struct>::iterator it=m_SpikeWriters.begin();it!=m_SpikeWriters.end();it++)
+		if (!FinishSpikes(it->second))
+			return false;
+	m_AnalogWriters.clear();
+	m_SpikeWriters.clear();
+	return true;
+}
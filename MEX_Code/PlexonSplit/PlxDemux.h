@@ -0,0 +1,171 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef PLX_DEMUX_H
+#define PLX_DEMUX_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include "Plexon.h"
+
+/*
+ Single pass PLX -> KOFIKO raw file converter.
+
+ The PLX file is read once, sequentially, in large chunks. Every data block is handed to
+ the writer of its channel:
+   continuous (A/D) channels -> <Session>-<ChannelName>.raw    (KOFIKO_v1.00A)
+   strobe words (event 257)  -> <Session>-strobe.raw           (KOFIKO_v1.00E)
+   spike channels            -> <Session>-spikes_ch<N>.raw     (KOFIKO_v1.03S)
+
+ The files are identical to the ones written by fnDumpChannel, fnDumpStrobeWords and
+ fnDumpChannelSpikes in fnConvertPLXtoFastDataAccess.m (plx_ad_v / plx_waves_v voltage scaling),
+ and as there, continuous channels without samples get no file.
+ With m_bInt16Waveforms set, spike waveforms are kept as int16 a/d values with the voltage scale
+ in the header instead (what fnDumpChannelSpikes writes with the same option).
+ Since the raw formats keep their header (frame list, spike counts) before the data,
+ analog samples and spikes are spooled to a <file>.part file while the PLX file is parsed
+ and the final file is assembled when the pass is over.
+
+ The converter does not depend on matlab: plxsplit.cpp wraps it both as a mex file and,
+ compiled with PLXSPLIT_STANDALONE, as a command line tool.
+*/
+
+/*
+ Counting semaphore that bounds the number of converters touching the disk at the same
+ time (see PlxBatch.h). Parsing and sample conversion run outside of it.
+*/
+class IOGate {
+public:
+	IOGate(int iMaxConcurrent) : m_iFree(iMaxConcurrent) {}
+	void Enter() {
+		std::unique_lock<std::mutex> Lock(m_Mutex);
+		while (m_iFree <= 0)
+			m_Released.wait(Lock);
+		m_iFree--;
+	}
+	void Leave() {
+		std::lock_guard<std::mutex> Lock(m_Mutex);
+		m_iFree++;
+		m_Released.notify_one();
+	}
+private:
+	std::mutex m_Mutex;
+	std::condition_variable m_Released;
+	int m_iFree;
+};
+
+// Holds the gate (if any) for the lifetime of the object
+class IOGateLock {
+public:
+	IOGateLock(IOGate *pGate) : m_pGate(pGate) { if (m_pGate) m_pGate->Enter(); }
+	~IOGateLock() { if (m_pGate) m_pGate->Leave(); }
+private:
+	IOGate *m_pGate;
+};
+
+typedef struct {
+	bool m_bAnalog;
+	bool m_bStrobe;
+	bool m_bSpikes;
+	bool m_bInt16Waveforms;			// a/d values with the plx_waves_v scale: half the size of single, and exact
+	double m_fSpikeIndexBinSec;		// resolution of the per unit time index
+	std::string m_strOutputFolder; // empty: next to the plx file
+	IOGate *m_pIOGate;				// NULL: unrestricted
+} PlxDemuxOptions_struct;
+
+void PlxDefaultOptions(PlxDemuxOptions_struct &Options);
+
+// <output folder><session>- : the prefix shared by all the files written for strPlxFile
+std::string PlxOutputPrefix(const std::string &strPlxFile, const std::string &strOutputFolder);
+
+class PlxDemultiplexer {
+public:
+	PlxDemultiplexer(const PlxDemuxOptions_struct &Options);
+	~PlxDemultiplexer();
+
+	// Converts one file. Returns false (see GetError) if the file could not be read or written.
+	bool Run(const std::string &strPlxFile);
+
+	const std::vector<std::string> &GetOutputFiles() const { return m_acOutputFiles; }
+	const std::string &GetError() const { return m_strError; }
+	const PL_FileHeader &GetFileHeader() const { return m_FileHeader; }
+
+private:
+	typedef struct {
+		std::string m_strFileName;
+		std::string m_strName;
+		int m_iChannel;			// 0-based plexon channel
+		int m_iSamplingFreq;
+		int m_iTicksPerSample;
+		double m_fScale;		// a/d value -> written value
+		FILE *m_Spool;
+		std::vector<char> m_SpoolBuffer;
+		std::vector<unsigned long long> m_aiNumSamplesPerFrame;
+		std::vector<double> m_afStartTS;
+		unsigned long long m_iNextTimestamp;
+	} AnalogWriter_struct;
+
+	// Everything the spike file header needs, collected while spooling
+	typedef struct {
+		unsigned long long m_iNumSpikes;
+		unsigned long long m_iFirstTick;
+		unsigned long long m_iLastTick;
+		bool m_bSorted;
+		double m_fIndexStart;
+		std::vector<unsigned long long> m_aiIndex;	// spikes before m_fIndexStart + k * index bin
+	} SpikeUnit_struct;
+
+	typedef struct {
+		std::string m_strFileName;
+		int m_iChannel;			// 1-based DSP channel
+		int m_iWaveFormLength;	// 0 until a block with waveform words comes
+		FILE *m_Spool;
+		std::vector<char> m_SpoolBuffer;
+		unsigned long long m_iNumSpikes;
+		std::map<int, SpikeUnit_struct> m_Units;
+	} SpikeWriter_struct;
+
+	bool ReadHeaders(FILE *fp);
+	bool ParseBlocks(FILE *fp);
+	bool AnalogBlock(const PL_DataBlockHeader &db, unsigned long long iTimestamp, const short *aiWords);
+	bool SpikeBlock(const PL_DataBlockHeader &db, unsigned long long iTimestamp, const short *aiWords);
+	bool FinishAnalog(AnalogWriter_struct &W);
+	bool FinishSpikes(SpikeWriter_struct &W);
+	bool FinishStrobe();
+	void Cleanup();
+	bool Fail(const std::string &strMessage);
+
+	std::string OutputFileName(const std::string &strSuffix) const;
+	double SpikeScale(const PL_ChanHeader *pHeader) const;
+	double SpikeIndexBin() const;
+	double SlowScale(const PL_SlowChannelHeader *pHeader) const;
+	const PL_ChanHeader *FindDSPHeader(int iChannel) const;
+	const PL_SlowChannelHeader *FindSlowHeader(int iChannel) const;
+
+	PlxDemuxOptions_struct m_Options;
+	std::string m_strPlxFile;
+	std::string m_strPrefix;
+	std::string m_strError;
+	std::vector<std::string> m_acOutputFiles;
+
+	PL_FileHeader m_FileHeader;
+	std::vector<PL_ChanHeader> m_DSPHeaders;
+	std::vector<PL_EventHeader> m_EventHeaders;
+	std::vector<PL_SlowChannelHeader> m_SlowHeaders;
+
+	std::map<int, AnalogWriter_struct> m_AnalogWriters;
+	std::map<int, SpikeWriter_struct> m_SpikeWriters;
+	std::vector<double> m_afStrobeWords;
+	std::vector<double> m_afStrobeTimestamps;
+	std::vector<float> m_afConvertBuffer;
+	std::vector<char> m_acSpikeRecord;
+};
+
+#endif
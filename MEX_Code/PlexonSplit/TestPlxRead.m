@@ -1,2 +1,4 @@
 addpath('..\..\MEX\win32'); 
-plxsplit('Y:\3ch_multframes.plx');
+strctOptions.m_bVerbose = true;
+acFiles = plxsplit('Y:\3ch_multframes.plx', strctOptions)
+strctAnalog = fnReadDumpAnalogFile(acFiles{1},'ReadHeaderOnly')
@@ -1,220 +1,205 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
 #include <stdio.h>
-#include "mex.h"
+#include <string.h>
+#include <stdlib.h>
 #include <string>
-#include <math.h>
-#include "Plexon.h"
+#include "PlxDemux.h"
+#include "PlxBatch.h"
+#ifndef PLXSPLIT_STANDALONE
+#include "mex.h"
+#endif
 
+/*
+ Splits a PLX file into KOFIKO raw files (analog channels, strobe words, spikes) in a single pass.
+ See PlxDemux.h for the file formats.
 
+ Matlab:
+   acOutputFiles = plxsplit(strPlxFile, [strctOptions])
+   [acOutputFiles, acErrors, abSkipped] = plxsplit(acPlxFiles, [strctOptions])
+   strctOptions may have the fields m_bAnalog, m_bStrobe, m_bSpikes (all default to true),
+   m_strOutputFolder (default: the folder of the plx file), m_bVerbose (print the file header),
+   m_bInt16Waveforms (default false: single waveforms, true stores int16 a/d values) and m_fSpikeIndexBinSec (default 10).
+   A cell array of files is converted as a batch (see PlxBatch.h), with the extra fields
+   m_iNumThreads (default: number of cores), m_iMaxConcurrentIO (default 2) and m_bResume.
+   Failures are then reported in acErrors (one entry per file, empty on success) instead of
+   stopping the batch.
 
-#define MAX(a,b)( (a)<(b)?(b):(a))
-#define MIN(a,b)( (a)<(b)?(a):(b))
+ Command line (compile plxsplit.cpp, PlxDemux.cpp and PlxBatch.cpp with PLXSPLIT_STANDALONE defined):
+   plxsplit [-noanalog] [-nostrobe] [-nospikes] [-int16waves] [-out folder] [-j threads] [-io streams] [-resume] file1.plx [file2.plx ...]
+*/
 
-void printheaderinfo(PL_FileHeader& fh);
+void printheaderinfo(const PL_FileHeader& fh);
 
+#ifdef PLXSPLIT_STANDALONE
 
-/* Entry Points */
-void mexFunction( int nlhs, mxArray *plhs[], 
-				 int nrhs, const mxArray *prhs[] ) 
+static const char *USAGE = "Usage: plxsplit [-noanalog] [-nostrobe] [-nospikes] [-int16waves] [-out folder] [-j threads] [-io streams] [-resume] file1.plx [file2.plx ...]\n";
+
+int main(int argc, char *argv[])
+{
+	PlxDemuxOptions_struct Options;
+	PlxDefaultOptions(Options);
+	PlxBatchOptions_struct BatchOptions;
+	PlxDefaultBatchOptions(BatchOptions);
+	std::vector<std::string> acFiles;
+
+	for (int k=1;k<argc;k++) {
+		if (strcmp(argv[k], "-noanalog") == 0)
+			Options.m_bAnalog = false;
+		else if (strcmp(argv[k], "-nostrobe") == 0)
+			Options.m_bStrobe = false;
+		else if (strcmp(argv[k], "-nospikes") == 0)
+			Options.m_bSpikes = false;
+		else if (strcmp(argv[k], "-int16waves") == 0)
+			Options.m_bInt16Waveforms = true;
+		else if (strcmp(argv[k], "-resume") == 0)
+			BatchOptions.m_bResume = true;
+		else if (strcmp(argv[k], "-out") == 0 && k+1 < argc)
+			Options.m_strOutputFolder = argv[++k];
+		else if (strcmp(argv[k], "-j") == 0 && k+1 < argc)
+			BatchOptions.m_iNumThreads = atoi(argv[++k]);
+		else if (strcmp(argv[k], "-io") == 0 && k+1 < argc)
+			BatchOptions.m_iMaxConcurrentIO = atoi(argv[++k]);
+		else if (argv[k][0] == '-') {
+			fprintf(stderr, "Unknown option %s\n%s", argv[k], USAGE);
+			return 2;
+		} else
+			acFiles.push_back(argv[k]);
+	}
+	if (acFiles.empty()) {
+		fprintf(stderr, "%s", USAGE);
+		return 2;
+	}
+
+	std::vector<PlxBatchResult_struct> Results;
+	PlxBatchConvert(acFiles, Options, BatchOptions, Results);
+
+	int iNumFailed = 0;
+	for (size_t k=0;k<Results.size();k++) {
+		if (!Results[k].m_bOK) {
+			fprintf(stderr, "%s: %s\n", Results[k].m_strPlxFile.c_str(), Results[k].m_strError.c_str());
+			iNumFailed++;
+			continue;
+		}
+		printf("%s%s\n", Results[k].m_strPlxFile.c_str(), Results[k].m_bSkipped ? " (already converted)" : "");
+		for (size_t j=0;j<Results[k].m_acOutputFiles.size();j++)
+			printf("  %s\n", Results[k].m_acOutputFiles[j].c_str());
+	}
+	return iNumFailed > 0 ? 1 : 0;
+}
+
+#else
+
+static bool GetBoolField(const mxArray *strctOptions, const char *strField, bool bDefault)
+{
+	mxArray *pField = mxGetField(strctOptions, 0, strField);
+	if (pField == NULL || mxGetNumberOfElements(pField) == 0)
+		return bDefault;
+	return mxGetScalar(pField) != 0;
+}
+
+static std::string GetString(const mxArray *A)
 {
 	static char buff[900+1];
 	buff[0]=0;
-	mxGetString(prhs[0],buff,900);
+	mxGetString(A,buff,900);
+	return buff;
+}
 
+static mxArray *CreateCellOfStrings(const std::vector<std::string> &acStrings)
+{
+	mxArray *C = mxCreateCellMatrix(1, int(acStrings.size()));
+	for (size_t k=0;k<acStrings.size();k++)
+		mxSetCell(C, int(k), mxCreateString(acStrings[k].c_str()));
+	return C;
+}
 
-	FILE* fp = fopen(buff, "rb");
-	if(fp == 0){
-		printf("Cannot open %s",buff);
-		exit(1);
-	}
-	PL_FileHeader fh;
-	// first, read file header
-	fread(&fh, sizeof(fh), 1, fp);
-
-	// print file header information
-	printheaderinfo(fh);
-
-	// read channel headers
-	PL_ChanHeader channels[128];
-	PL_EventHeader evheaders[512];
-	PL_SlowChannelHeader slowheaders[64];
-
-	memset(channels, 0, 128*sizeof(PL_ChanHeader));
-	memset(evheaders, 0, 512*sizeof(PL_EventHeader));
-	memset(slowheaders, 0, 64*sizeof(PL_SlowChannelHeader));
-
-	if(fh.NumDSPChannels > 0)
-		fread(channels, fh.NumDSPChannels*sizeof(PL_ChanHeader), 1, fp);
-	if(fh.NumEventChannels> 0)
-		fread(evheaders, fh.NumEventChannels*sizeof(PL_EventHeader), 1, fp);
-	if(fh.NumSlowChannels)
-		fread(slowheaders, fh.NumSlowChannels*sizeof(PL_SlowChannelHeader), 1, fp);
-	
-	PL_DataBlockHeader db;
-	short buf[256];
-	// where the data starts
-	int datastart = sizeof(fh) + fh.NumDSPChannels*sizeof(PL_ChanHeader)
-						+ fh.NumEventChannels*sizeof(PL_EventHeader)
-						+ fh.NumSlowChannels*sizeof(PL_SlowChannelHeader);
-
-	int nbuf;
-
-	// SAMPLE 1:
-	// read the timestamps for a spike channel
-	//
-
-	int channel_to_extract = 1; // dsp channel numbers are 1-based
-	int unit_to_extract = 1;
-	int count = 1;
-	printf("\nTimestamps for channel %d, unit %d\n", 
-		channel_to_extract, unit_to_extract);
-
-	while(feof(fp) == 0 && fread(&db, sizeof(db), 1, fp) == 1){ // read the block
-		nbuf = 0;
-		if(db.NumberOfWaveforms > 0){ // read the waveform after the block
-			nbuf = db.NumberOfWaveforms*db.NumberOfWordsInWaveform;
-			fread(buf, nbuf*2, 1, fp);
-		}
-		if(db.Type == PL_SingleWFType){ // both timestamps and waveforms have this type
-			if(db.Channel == channel_to_extract && db.Unit == unit_to_extract){ 
-				printf("spike: %d ticks: %d seconds: %.6f\n", count, db.TimeStamp,
-						db.TimeStamp/(double)fh.ADFrequency);
-				count++;
-			}
-		}
+/* Entry Points */
+void mexFunction( int nlhs, mxArray *plhs[], 
+				 int nrhs, const mxArray *prhs[] ) 
+{
+	if (nrhs < 1 || !(mxIsChar(prhs[0]) || mxIsCell(prhs[0])) || (nrhs > 1 && !mxIsStruct(prhs[1]))) {
+		mexErrMsgTxt("Usage: acOutputFiles = plxsplit(strPlxFile, [strctOptions])\n"
+					 "       [acOutputFiles, acErrors, abSkipped] = plxsplit(acPlxFiles, [strctOptions])");
+		return;
 	}
 
-	// SAMPLE 2:
-	//  read the waveforms for a spike channel
-	//
-
-	channel_to_extract = 1;
-	unit_to_extract = 1;
-	count = 1;
-	printf("\nWaveforms for channel %d, unit %d\n", 
-		channel_to_extract, unit_to_extract);
-
-	// rewind file to the data start!!!
-	fseek(fp, datastart, SEEK_SET);
-	int i;
-	while(feof(fp) == 0 && fread(&db, sizeof(db), 1, fp) == 1){ // read the block
-		nbuf = 0;
-		if(db.NumberOfWaveforms > 0){ // read the waveform after the block
-			nbuf = db.NumberOfWaveforms*db.NumberOfWordsInWaveform;
-			fread(buf, nbuf*2, 1, fp);
-		}
-		if(db.Type == PL_SingleWFType && nbuf > 0){ 
-			if(db.Channel == channel_to_extract && db.Unit == unit_to_extract){ 
-				printf("spike: %d ticks: %d seconds: %.6f\n", count, db.TimeStamp,
-						db.TimeStamp/(double)fh.ADFrequency);
-				printf("waveform:");
-				for(i=0; i<db.NumberOfWordsInWaveform; i++){
-					printf(" %d,", buf[i]);
-				}
-				printf("\n");
-				count++;
-			}
-		}
+	PlxDemuxOptions_struct Options;
+	PlxDefaultOptions(Options);
+	PlxBatchOptions_struct BatchOptions;
+	PlxDefaultBatchOptions(BatchOptions);
+	bool bVerbose = false;
+	if (nrhs > 1) {
+		Options.m_bAnalog = GetBoolField(prhs[1], "m_bAnalog", true);
+		Options.m_bStrobe = GetBoolField(prhs[1], "m_bStrobe", true);
+		Options.m_bSpikes = GetBoolField(prhs[1], "m_bSpikes", true);
+		Options.m_bInt16Waveforms = GetBoolField(prhs[1], "m_bInt16Waveforms", false);
+		bVerbose = GetBoolField(prhs[1], "m_bVerbose", false);
+		mxArray *pBin = mxGetField(prhs[1], 0, "m_fSpikeIndexBinSec");
+		if (pBin != NULL && mxGetNumberOfElements(pBin) > 0)
+			Options.m_fSpikeIndexBinSec = mxGetScalar(pBin);
+		mxArray *pFolder = mxGetField(prhs[1], 0, "m_strOutputFolder");
+		if (pFolder != NULL && mxIsChar(pFolder))
+			Options.m_strOutputFolder = GetString(pFolder);
+		mxArray *pThreads = mxGetField(prhs[1], 0, "m_iNumThreads");
+		if (pThreads != NULL && mxGetNumberOfElements(pThreads) > 0)
+			BatchOptions.m_iNumThreads = int(mxGetScalar(pThreads));
+		mxArray *pIO = mxGetField(prhs[1], 0, "m_iMaxConcurrentIO");
+		if (pIO != NULL && mxGetNumberOfElements(pIO) > 0)
+			BatchOptions.m_iMaxConcurrentIO = int(mxGetScalar(pIO));
+		BatchOptions.m_bResume = GetBoolField(prhs[1], "m_bResume", false);
 	}
 
-	
-	// SAMPLE 3
-	//   read the timestamps for an external event channel
-	//
-	int event_to_extract = 1;
-	count = 1;
-	printf("\nTimestamps for event %d\n", 
-		event_to_extract);
-	
-	// rewind file to the data start!!!
-	fseek(fp, datastart, SEEK_SET);
-
-	while(feof(fp) == 0 && fread(&db, sizeof(db), 1, fp) == 1){ // read the block
-		nbuf = 0;
-		if(db.NumberOfWaveforms > 0){ // read the waveform after the block
-			nbuf = db.NumberOfWaveforms*db.NumberOfWordsInWaveform;
-			fread(buf, nbuf*2, 1, fp);
-		}
-		if(db.Type == PL_ExtEventType){ 
-			if(db.Channel == event_to_extract){ 
-				printf("event: %d ticks: %d seconds: %.6f\n", count, db.TimeStamp,
-					db.TimeStamp/(double)fh.ADFrequency);
-				count++;
-			}
+	if (mxIsChar(prhs[0])) {
+		PlxDemultiplexer Demux(Options);
+		if (!Demux.Run(GetString(prhs[0]))) {
+			mexErrMsgTxt(Demux.GetError().c_str());
+			return;
 		}
+		if (bVerbose)
+			printheaderinfo(Demux.GetFileHeader());
+		plhs[0] = CreateCellOfStrings(Demux.GetOutputFiles());
+		return;
 	}
 
-	// SAMPLE 4
-	//  read continuous data for one channel
-	//   please note that a/d data does not start
-	//      at time 0!!!
-	//   the timestamps for the a/d data points need to be
-	//      calculated
-	//    converting to voltage: 5V corresponds to the a/d value of 2048 
-
-	channel_to_extract = 0; // a/d channel numbers are zero-based!!!
-	count = 1;
-	printf("\nContinuous data for channel %d\n", 
-		channel_to_extract);
-	
-	// rewind file to the data start!!!
-	fseek(fp, datastart, SEEK_SET);
-
-	// find the header for this a/d channel
-	int header_num = -1;
-	for(i=0; i<fh.NumSlowChannels; i++){
-		if(slowheaders[i].Channel == channel_to_extract){
-			header_num = i;
-			break;
+	int iNumFiles = int(mxGetNumberOfElements(prhs[0]));
+	std::vector<std::string> acPlxFiles(iNumFiles);
+	for (int k=0;k<iNumFiles;k++) {
+		mxArray *pFile = mxGetCell(prhs[0], k);
+		if (pFile == NULL || !mxIsChar(pFile)) {
+			mexErrMsgTxt("acPlxFiles must be a cell array of file names.");
+			return;
 		}
-	}
-	if(header_num == -1){
-		printf("No header for the specified A/D channel!\n");
-		fclose(fp);
-		exit(1);
+		acPlxFiles[k] = GetString(pFile);
 	}
 
-	int gain = slowheaders[header_num].Gain;
-	int adfreq = slowheaders[header_num].ADFreq;
+	// The workers never call the mex API, all matlab arrays are built here
+	std::vector<PlxBatchResult_struct> Results;
+	PlxBatchConvert(acPlxFiles, Options, BatchOptions, Results);
 
-	if(adfreq == 0 || gain == 0){
-		printf("No A/D frequency or gain!\n");
-		fclose(fp);
-		exit(1);
+	std::vector<std::string> acOutputFiles, acErrors;
+	for (int k=0;k<iNumFiles;k++) {
+		acOutputFiles.insert(acOutputFiles.end(), Results[k].m_acOutputFiles.begin(), Results[k].m_acOutputFiles.end());
+		acErrors.push_back(Results[k].m_strError);
 	}
-	int ticks_in_adcycle = fh.ADFrequency/adfreq;
-
-	int first_timestamp = -1;
-	int ts;
-	while(feof(fp) == 0 && fread(&db, sizeof(db), 1, fp) == 1){ // read the block
-		nbuf = 0;
-		if(db.NumberOfWaveforms > 0){ // read the waveform after the block
-			nbuf = db.NumberOfWaveforms*db.NumberOfWordsInWaveform;
-			fread(buf, nbuf*2, 1, fp);
-		}
-		if(db.Type == PL_ADDataType){ 
-			if(db.Channel == channel_to_extract){
-				if(first_timestamp == -1){
-					printf("first data point at: %d ticks: %d seconds: %.6f\n", count, db.TimeStamp,
-						db.TimeStamp/(double)fh.ADFrequency);
-				first_timestamp = db.TimeStamp;
-				}
-				for(i=0; i<db.NumberOfWordsInWaveform; i++){
-					ts = db.TimeStamp + i*ticks_in_adcycle;
-					// voltage: 5V corresponds to the a/d value of 2048 
-					double v = (buf[i]*5./2048.)/(double)gain;
-
-					printf("a/d value %5d (%6.3f V) at %d ticks or %.6f seconds\n", 
-						buf[i], v, ts, ts/(double)fh.ADFrequency);
-				}
-				count++;
-			}
-		}
+	plhs[0] = CreateCellOfStrings(acOutputFiles);
+	if (nlhs > 1)
+		plhs[1] = CreateCellOfStrings(acErrors);
+	if (nlhs > 2) {
+		plhs[2] = mxCreateLogicalMatrix(1, iNumFiles);
+		mxLogical *abSkipped = (mxLogical*)mxGetData(plhs[2]);
+		for (int k=0;k<iNumFiles;k++)
+			abSkipped[k] = Results[k].m_bSkipped;
 	}
-
-	fclose(fp);
 }
 
-void printheaderinfo(PL_FileHeader& fh)
+#endif
+
+void printheaderinfo(const PL_FileHeader& fh)
 {
 	printf("File Version: %d\n", fh.Version);
 	printf("File Comment: %s\n", fh.Comment);
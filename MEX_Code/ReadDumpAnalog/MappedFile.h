@@ -0,0 +1,105 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ Read only memory mapping of a whole file. Only the pages that are actually touched are
+ read from the disk, which is what makes random access into large dump files cheap.
+*/
+class MappedFile {
+public:
+	MappedFile() : m_pData(NULL), m_iSize(0) {
+#ifdef _WIN32
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+#endif
+	}
+	~MappedFile() { Close(); }
+
+	bool Open(const char *strFileName) {
+		Close();
+#ifdef _WIN32
+		m_hFile = CreateFileA(strFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER Size;
+		if (!GetFileSizeEx(m_hFile, &Size) || Size.QuadPart == 0) {
+			Close();
+			return false;
+		}
+		m_iSize = (size_t)Size.QuadPart;
+		m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping == NULL) {
+			Close();
+			return false;
+		}
+		m_pData = (const unsigned char *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		int fd = open(strFileName, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		m_iSize = (size_t)st.st_size;
+		void *p = mmap(NULL, m_iSize, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		m_pData = (p == MAP_FAILED) ? NULL : (const unsigned char *)p;
+#endif
+		if (m_pData == NULL) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close() {
+#ifdef _WIN32
+		if (m_pData != NULL)
+			UnmapViewOfFile(m_pData);
+		if (m_hMapping != NULL)
+			CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+		m_hMapping = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		if (m_pData != NULL)
+			munmap((void *)m_pData, m_iSize);
+#endif
+		m_pData = NULL;
+		m_iSize = 0;
+	}
+
+	const unsigned char *Data() const { return m_pData; }
+	size_t Size() const { return m_iSize; }
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const unsigned char *m_pData;
+	size_t m_iSize;
+#ifdef _WIN32
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+#endif
+};
+
+#endif
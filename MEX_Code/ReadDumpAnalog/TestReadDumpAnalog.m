@@ -0,0 +1,52 @@
+% Write a dump with two frames and compare against fnReadDumpAnalogFile
+strctAnalog.m_iChannel = 3;
+strctAnalog.m_strChannelName = 'LFP03';
+strctAnalog.m_fSamplingFreq = 1000;
+strctAnalog.m_aiNumSamplesPerFrame = [5000 3000];
+strctAnalog.m_afStartTS = [10 16];
+strctAnalog.m_afData = single(randn(8000,1));
+strFile = fullfile(tempdir,'TestReadDumpAnalog.raw');
+fnDumpChannel(strctAnalog, strFile);
+
+strctHeader = fnReadDumpAnalog(strFile);
+assert(isequal(strctHeader.m_afStartTS(:)', strctAnalog.m_afStartTS));
+
+afAllTime = [10+(0:4999)/1000, 16+(0:2999)/1000];
+[afData, afTime, a2fSegments] = fnReadDumpAnalog(strFile, 'Interval', [11 12]);
+aiInside = find(afAllTime >= 11-1e-9 & afAllTime <= 12+1e-9);
+assert(isequal(afData, strctAnalog.m_afData(aiInside)) && max(abs(afTime(:)' - afAllTime(aiInside))) < 1e-9);
+% fnReadDumpAnalogFile goes through the mex for intervals too, and keeps the legacy time axis:
+% ceil((end-start)*Fs) samples from the sample before the start, NaN in the gaps
+[strctFile, afFileTime] = fnReadDumpAnalogFile(strFile, 'Interval', [11.0004 12.0004]);
+assert(length(afFileTime) == 1000 && abs(afFileTime(1) - 11) < 1e-9 && isequal(size(strctFile.m_afData), [1000 1]));
+assert(max(abs(strctFile.m_afData - double(strctAnalog.m_afData(1001:2000)))) < 1e-5);
+strctFile = fnReadDumpAnalogFile(strFile, 'Interval', [14.5 16.5]);
+assert(length(strctFile.m_afData) == 2000 && all(isnan(strctFile.m_afData(501:1500))) && ~any(isnan(strctFile.m_afData([1:500 1502:2000]))));
+
+% Interval that spans the gap between the frames: two segments
+[afData, afTime, a2fSegments] = fnReadDumpAnalog(strFile, 'Interval', [14.5 16.5]);
+assert(size(a2fSegments,1) == 2 && length(afData) == 1001);
+
+% Trial aligned resampling of many trials in one call
+afOnsets = 10 + rand(2000,1)*8;
+a2fTimes = bsxfun(@plus, afOnsets, -0.2:0.001:0.5);
+tic; a2fLFP = fnReadDumpAnalog(strFile, 'Resample', a2fTimes); toc
+a2fRef = reshape(interp1(afAllTime, double(strctAnalog.m_afData), a2fTimes(:)), size(a2fTimes));
+a2fRef(a2fTimes > 14.999 & a2fTimes < 16) = NaN;
+abValid = ~isnan(a2fRef);
+assert(isequal(abValid, ~isnan(a2fLFP)));
+assert(max(abs(a2fLFP(abValid) - a2fRef(abValid))) < 1e-5);
+
+% A header size close to 2^64 must not wrap around the size check
+hFile = fopen(strFile, 'r+');
+fseek(hFile, 13, 'bof');
+fwrite(hFile, intmax('uint64') - 5, 'uint64');
+fclose(hFile);
+bFailed = false;
+try
+    fnReadDumpAnalog(strFile, 'Interval', [11 12]);
+catch
+    bFailed = true;
+end
+assert(bFailed);
+delete(strFile);
@@ -0,0 +1,344 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "mex.h"
+#include "MappedFile.h"
+
+/*
+ Random access reader for KOFIKO_v1.00A analog dump files (see fnDumpChannel.m / fnReadDumpAnalogFile.m).
+
+ strctAnalog = fnReadDumpAnalog(strFile)
+	Header only: m_iChannel, m_fSamplingFreq, m_strChannelName, m_aiNumSamplesPerFrame, m_afStartTS, m_afEndTS.
+
+ [afData, afTime, a2fSegments] = fnReadDumpAnalog(strFile, 'Interval', a2fIntervals)
+	a2fIntervals is N x 2 ([start,end] in seconds). Returns the stored samples that fall inside every
+	interval, as single. For more than one interval the outputs are 1 x N cell arrays.
+	afTime is only computed if it is requested. a2fSegments describes the time axis without
+	expanding it: one row per frame piece, [first sample index (1-based), time of that sample, number of samples].
+
+ afData = fnReadDumpAnalog(strFile, 'Resample', a2fSampleTimes)
+	Linear interpolation at the given times (any shape, or a cell array of arrays). Times that fall
+	outside the recorded frames (before, after, or in a gap between frames) are NaN.
+	Output is single, with the shape of a2fSampleTimes.
+
+ The file is memory mapped and the frame table is binary searched, so only the pages holding the
+ requested samples are read. Samples are copied straight from the mapping into the single
+ precision output without any intermediate conversion.
+*/
+
+typedef struct {
+	int Channel;
+	double SamplingFreq;
+	std::string Name;
+	std::vector<double> StartTS;
+	std::vector<double> NumSamples;
+	std::vector<unsigned long long> FrameOffset; // first sample of every frame, NumFrames+1 entries
+	const unsigned char *Data;
+} AnalogDump_struct;
+
+class HeaderParser {
+public:
+	HeaderParser(const MappedFile &F) : m_F(F), m_iPos(0), m_bOK(true) {}
+	unsigned long long UInt64() { unsigned long long v = 0; Read(&v, 8); return v; }
+	double Double() { double v = 0; Read(&v, 8); return v; }
+	void Read(void *pOut, size_t n) {
+		if (!m_bOK || m_iPos + n > m_F.Size()) {
+			m_bOK = false;
+			return;
+		}
+		memcpy(pOut, m_F.Data() + m_iPos, n);
+		m_iPos += n;
+	}
+	bool OK() const { return m_bOK; }
+private:
+	const MappedFile &m_F;
+	size_t m_iPos;
+	bool m_bOK;
+};
+
+bool ParseHeader(const MappedFile &F, AnalogDump_struct &A)
+{
+	HeaderParser P(F);
+	char strIdentifier[13];
+	P.Read(strIdentifier, 13);
+	if (!P.OK() || memcmp(strIdentifier, "KOFIKO_v1.00A", 13) != 0)
+		return false;
+	unsigned long long iHeaderSize = P.UInt64();
+	A.Channel = int(P.UInt64());
+	A.SamplingFreq = double(P.UInt64());
+	unsigned long long iNameLength = P.UInt64();
+	if (!P.OK() || iNameLength > F.Size())
+		return false;
+	A.Name.resize(size_t(iNameLength));
+	if (iNameLength > 0)
+		P.Read(&A.Name[0], size_t(iNameLength));
+	unsigned long long iNumFrames = P.UInt64();
+	if (!P.OK() || iNumFrames > F.Size() / 16)
+		return false;
+	A.NumSamples.resize(size_t(iNumFrames));
+	A.StartTS.resize(size_t(iNumFrames));
+	A.FrameOffset.resize(size_t(iNumFrames) + 1);
+	A.FrameOffset[0] = 0;
+	for (size_t f=0;f<iNumFrames;f++) {
+		unsigned long long n = P.UInt64();
+		if (n > F.Size() / 4 - A.FrameOffset[f]) // more samples than the file can hold (and no wrap around)
+			return false;
+		A.NumSamples[f] = double(n);
+		A.FrameOffset[f+1] = A.FrameOffset[f] + n;
+	}
+	for (size_t f=0;f<iNumFrames;f++)
+		A.StartTS[f] = P.Double();
+	// iHeaderSize comes from the file: compared against what is left so that it cannot wrap around
+	if (!P.OK() || A.SamplingFreq <= 0 || F.Size() < 13 || iHeaderSize > F.Size() - 13 ||
+		(F.Size() - 13 - iHeaderSize) / 4 < A.FrameOffset[iNumFrames])
+		return false;
+	A.Data = F.Data() + 13 + iHeaderSize;
+	return true;
+}
+
+inline float SampleAt(const AnalogDump_struct &A, unsigned long long iSample)
+{
+	float v;
+	memcpy(&v, A.Data + 4 * iSample, 4); // the data start is not necessarily 4 byte aligned
+	return v;
+}
+
+// Last frame that starts at or before t (-1 if none)
+inline int FindFrame(const AnalogDump_struct &A, double t)
+{
+	return int(std::upper_bound(A.StartTS.begin(), A.StartTS.end(), t) - A.StartTS.begin()) - 1;
+}
+
+mxArray *CreateHeaderStruct(const AnalogDump_struct &A)
+{
+	const char *astrFields[] = {"m_iChannel", "m_fSamplingFreq", "m_strChannelName", "m_aiNumSamplesPerFrame", "m_afStartTS", "m_afEndTS"};
+	mxArray *S = mxCreateStructMatrix(1, 1, 6, astrFields);
+	int iNumFrames = int(A.StartTS.size());
+	mxArray *NumSamples = mxCreateDoubleMatrix(iNumFrames, 1, mxREAL);
+	mxArray *StartTS = mxCreateDoubleMatrix(iNumFrames, 1, mxREAL);
+	mxArray *EndTS = mxCreateDoubleMatrix(iNumFrames, 1, mxREAL);
+	for (int f=0;f<iNumFrames;f++) {
+		mxGetPr(NumSamples)[f] = A.NumSamples[f];
+		mxGetPr(StartTS)[f] = A.StartTS[f];
+		mxGetPr(EndTS)[f] = A.StartTS[f] + A.NumSamples[f] / A.SamplingFreq;
+	}
+	mxSetField(S, 0, "m_iChannel", mxCreateDoubleScalar(A.Channel));
+	mxSetField(S, 0, "m_fSamplingFreq", mxCreateDoubleScalar(A.SamplingFreq));
+	mxSetField(S, 0, "m_strChannelName", mxCreateString(A.Name.c_str()));
+	mxSetField(S, 0, "m_aiNumSamplesPerFrame", NumSamples);
+	mxSetField(S, 0, "m_afStartTS", StartTS);
+	mxSetField(S, 0, "m_afEndTS", EndTS);
+	return S;
+}
+
+typedef struct {
+	unsigned long long FirstSample; // in the file
+	double StartTime;
+	unsigned long long NumSamples;
+} Segment_struct;
+
+// Frame pieces that fall inside [fStart, fEnd]
+void FindSegments(const AnalogDump_struct &A, double fStart, double fEnd, std::vector<Segment_struct> &Segments)
+{
+	const double EPS = 1e-9;
+	Segments.clear();
+	int iNumFrames = int(A.StartTS.size());
+	int f = FindFrame(A, fStart);
+	if (f < 0)
+		f = 0;
+	for (;f<iNumFrames && A.StartTS[f] <= fEnd;f++) {
+		double fFirst = ceil((fStart - A.StartTS[f]) * A.SamplingFreq - EPS);
+		double fLast = floor((fEnd - A.StartTS[f]) * A.SamplingFreq + EPS);
+		if (fFirst < 0)
+			fFirst = 0;
+		if (fLast > A.NumSamples[f] - 1)
+			fLast = A.NumSamples[f] - 1;
+		if (fLast < fFirst)
+			continue;
+		Segment_struct S;
+		S.FirstSample = A.FrameOffset[f] + (unsigned long long)fFirst;
+		S.StartTime = A.StartTS[f] + fFirst / A.SamplingFreq;
+		S.NumSamples = (unsigned long long)(fLast - fFirst) + 1;
+		Segments.push_back(S);
+	}
+}
+
+void ReadInterval(const AnalogDump_struct &A, double fStart, double fEnd, bool bTime, bool bSegments,
+				  mxArray **pData, mxArray **pTime, mxArray **pSegments)
+{
+	std::vector<Segment_struct> Segments;
+	FindSegments(A, fStart, fEnd, Segments);
+	size_t iTotal = 0;
+	for (size_t k=0;k<Segments.size();k++)
+		iTotal += size_t(Segments[k].NumSamples);
+
+	*pData = mxCreateNumericMatrix(iTotal, 1, mxSINGLE_CLASS, mxREAL);
+	unsigned char *pOut = (unsigned char *)mxGetData(*pData);
+	double *Time = NULL, *Seg = NULL;
+	if (bTime) {
+		*pTime = mxCreateDoubleMatrix(iTotal, 1, mxREAL);
+		Time = mxGetPr(*pTime);
+	}
+	if (bSegments) {
+		*pSegments = mxCreateDoubleMatrix(Segments.size(), 3, mxREAL);
+		Seg = mxGetPr(*pSegments);
+	}
+
+	size_t iOut = 0;
+	for (size_t k=0;k<Segments.size();k++) {
+		const Segment_struct &S = Segments[k];
+		memcpy(pOut + 4 * iOut, A.Data + 4 * S.FirstSample, 4 * size_t(S.NumSamples));
+		if (Time != NULL)
+			for (size_t i=0;i<S.NumSamples;i++)
+				Time[iOut + i] = S.StartTime + double(i) / A.SamplingFreq;
+		if (Seg != NULL) {
+			Seg[k] = double(iOut + 1);
+			Seg[k + Segments.size()] = S.StartTime;
+			Seg[k + 2 * Segments.size()] = double(S.NumSamples);
+		}
+		iOut += size_t(S.NumSamples);
+	}
+}
+
+/*
+ Linear interpolation inside frames. Consecutive sample times are usually close to each other
+ (trials, sorted time axes), so the frame of the previous point is tried before searching.
+*/
+void Resample(const AnalogDump_struct &A, const double *afTimes, size_t iNumTimes, float *afOut)
+{
+	const float NaN = std::numeric_limits<float>::quiet_NaN();
+	int iNumFrames = int(A.StartTS.size());
+	int f = -1;
+	for (size_t k=0;k<iNumTimes;k++) {
+		double t = afTimes[k];
+		if (t != t || iNumFrames == 0) {
+			afOut[k] = NaN;
+			continue;
+		}
+		if (f < 0 || t < A.StartTS[f] || (f+1 < iNumFrames && t >= A.StartTS[f+1]))
+			f = FindFrame(A, t);
+		if (f < 0) {
+			afOut[k] = NaN;
+			continue;
+		}
+		double p = (t - A.StartTS[f]) * A.SamplingFreq;
+		double fLast = A.NumSamples[f] - 1;
+		if (p > fLast) {
+			// allow for rounding on the last sample of the frame
+			if (p - fLast < 1e-6 && fLast >= 0)
+				p = fLast;
+			else {
+				afOut[k] = NaN;
+				continue;
+			}
+		}
+		unsigned long long i0 = (unsigned long long)p;
+		double fAlpha = p - double(i0);
+		unsigned long long iSample = A.FrameOffset[f] + i0;
+		float v0 = SampleAt(A, iSample);
+		if (fAlpha == 0 || double(i0) >= fLast)
+			afOut[k] = v0;
+		else
+			afOut[k] = float(v0 + fAlpha * (SampleAt(A, iSample + 1) - v0));
+	}
+}
+
+mxArray *ResampleArray(const AnalogDump_struct &A, const mxArray *Times)
+{
+	if (!mxIsDouble(Times))
+		mexErrMsgTxt("Sample times must be double.");
+	mxArray *Out = mxCreateNumericArray(mxGetNumberOfDimensions(Times), mxGetDimensions(Times), mxSINGLE_CLASS, mxREAL);
+	Resample(A, mxGetPr(Times), mxGetNumberOfElements(Times), (float *)mxGetData(Out));
+	return Out;
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 1 || !mxIsChar(prhs[0]) || nrhs == 2 || (nrhs > 2 && !mxIsChar(prhs[1]))) {
+		mexErrMsgTxt("Usage: strctAnalog = fnReadDumpAnalog(strFile)\n"
+					 "       [afData, afTime, a2fSegments] = fnReadDumpAnalog(strFile, 'Interval', a2fIntervals)\n"
+					 "       afData = fnReadDumpAnalog(strFile, 'Resample', a2fSampleTimes)");
+		return;
+	}
+
+	char strFile[1024];
+	mxGetString(prhs[0], strFile, sizeof(strFile));
+	MappedFile F;
+	if (!F.Open(strFile)) {
+		mexErrMsgTxt("Cannot open file.");
+		return;
+	}
+	AnalogDump_struct A;
+	if (!ParseHeader(F, A)) {
+		mexErrMsgTxt("Not a KOFIKO_v1.00A analog file (or file is truncated).");
+		return;
+	}
+
+	if (nrhs == 1) {
+		plhs[0] = CreateHeaderStruct(A);
+		return;
+	}
+
+	char strMode[64];
+	mxGetString(prhs[1], strMode, sizeof(strMode));
+	for (char *p=strMode;*p;p++)
+		*p = char(tolower(*p));
+
+	if (strcmp(strMode, "resample") == 0) {
+		if (mxIsCell(prhs[2])) {
+			int iNumCells = int(mxGetNumberOfElements(prhs[2]));
+			plhs[0] = mxCreateCellArray(mxGetNumberOfDimensions(prhs[2]), mxGetDimensions(prhs[2]));
+			for (int k=0;k<iNumCells;k++) {
+				const mxArray *Times = mxGetCell(prhs[2], k);
+				if (Times != NULL)
+					mxSetCell(plhs[0], k, ResampleArray(A, Times));
+			}
+		} else
+			plhs[0] = ResampleArray(A, prhs[2]);
+		return;
+	}
+
+	if (strcmp(strMode, "interval") == 0) {
+		const mxArray *Intervals = prhs[2];
+		if (!mxIsDouble(Intervals) || mxGetNumberOfDimensions(Intervals) != 2 || mxGetN(Intervals) != 2) {
+			mexErrMsgTxt("Intervals must be a N x 2 double matrix.");
+			return;
+		}
+		int iNumIntervals = int(mxGetM(Intervals));
+		const double *afIntervals = mxGetPr(Intervals);
+		bool bTime = nlhs > 1, bSegments = nlhs > 2;
+		if (iNumIntervals == 1) {
+			ReadInterval(A, afIntervals[0], afIntervals[1], bTime, bSegments, &plhs[0], &plhs[1], &plhs[2]);
+			return;
+		}
+		plhs[0] = mxCreateCellMatrix(1, iNumIntervals);
+		if (bTime)
+			plhs[1] = mxCreateCellMatrix(1, iNumIntervals);
+		if (bSegments)
+			plhs[2] = mxCreateCellMatrix(1, iNumIntervals);
+		for (int k=0;k<iNumIntervals;k++) {
+			mxArray *Data = NULL, *Time = NULL, *Segments = NULL;
+			ReadInterval(A, afIntervals[k], afIntervals[k + iNumIntervals], bTime, bSegments, &Data, &Time, &Segments);
+			mxSetCell(plhs[0], k, Data);
+			if (bTime)
+				mxSetCell(plhs[1], k, Time);
+			if (bSegments)
+				mxSetCell(plhs[2], k, Segments);
+		}
+		return;
+	}
+
+	mexErrMsgTxt("Unknown mode. Use 'Interval' or 'Resample'.");
+}
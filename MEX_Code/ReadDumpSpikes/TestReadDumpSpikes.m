@@ -0,0 +1,39 @@
+% Write a v1.03S dump (single and int16 waveforms) and compare against fnReadDumpSpikeFile
+strctChannelInfo.m_strPlxFile = 'Test.plx';
+strctChannelInfo.m_strChannelName = 'sig001';
+strctChannelInfo.m_iChannelID = 1;
+strctChannelInfo.m_fGain = 20;
+strctChannelInfo.m_fThreshold = -300;
+strctChannelInfo.m_bFiltersActive = 1;
+strctChannelInfo.m_bSorted = 1;
+for k=1:3
+    astrctSpikes(k).m_iUnitIndex = k-1;
+    astrctSpikes(k).m_afTimestamps = sort(rand(20000,1)*3600);
+    astrctSpikes(k).m_afInterval = astrctSpikes(k).m_afTimestamps([1 end])';
+    astrctSpikes(k).m_a2fWaveforms = single(randn(20000,32)*0.05);
+end
+strFile = fullfile(tempdir,'TestReadDumpSpikes.raw');
+fnDumpChannelSpikes(strctChannelInfo, astrctSpikes, strFile);
+
+[astrctUnits, strctInfo] = fnReadDumpSpikes(strFile);
+assert(strcmp(strctInfo.m_strChannelName, 'sig001') && length(astrctUnits) == 3);
+assert(isequal(astrctUnits(2).m_afTimestamps, astrctSpikes(2).m_afTimestamps));
+assert(isequal(astrctUnits(2).m_a2fWaveforms, astrctSpikes(2).m_a2fWaveforms));
+
+% One unit in a one minute interval, timestamps only
+afInterval = [1000 1060];
+tic; astrctUnit = fnReadDumpSpikes(strFile, 'Units', 1, 'Interval', afInterval, 'Waveforms', false); toc
+abInside = astrctSpikes(2).m_afTimestamps >= afInterval(1) & astrctSpikes(2).m_afTimestamps <= afInterval(2);
+assert(isequal(astrctUnit.m_afTimestamps, astrctSpikes(2).m_afTimestamps(abInside)) && isempty(astrctUnit.m_a2fWaveforms));
+
+% Same query through fnReadDumpSpikeFile (mex and matlab paths)
+strctUnit = fnReadDumpSpikeFile(strFile, 'SingleUnit', [1 1], 'Interval', afInterval);
+assert(isequal(strctUnit.m_a2fWaveforms, double(astrctSpikes(2).m_a2fWaveforms(abInside,:))));
+
+% int16 waveforms with one scale per channel
+strctOptions.m_bInt16Waveforms = true;
+fnDumpChannelSpikes(strctChannelInfo, astrctSpikes, strFile, strctOptions);
+astrctUnit = fnReadDumpSpikes(strFile, 'Units', 1, 'Interval', afInterval);
+fScale = max(cellfun(@(x) max(abs(double(x(:)))), {astrctSpikes.m_a2fWaveforms})) / 32767;
+assert(max(max(abs(double(astrctUnit.m_a2fWaveforms) - double(astrctSpikes(2).m_a2fWaveforms(abInside,:))))) <= fScale);
+delete(strFile);
@@ -0,0 +1,446 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "mex.h"
+#include "../ReadDumpAnalog/MappedFile.h"
+
+/*
+ Random access reader for KOFIKO spike dump files (v1.01S, v1.02S and v1.03S, see fnDumpChannelSpikes.m).
+
+ [astrctUnits, strctChannelInfo] = fnReadDumpSpikes(strFile, ...)
+	'HeaderOnly'         - units without timestamps and waveforms
+	'Units', aiUnits     - unit indices to read, in this order
+	'Channel', iChannel  - v1.01S files hold several channels: only units of this channel are read
+	'Interval', [t0 t1]  - only spikes with t0 <= timestamp <= t1
+	'Waveforms', bRead   - false: m_a2fWaveforms is left empty and the waveform pages are never touched
+
+ astrctUnits has the fields of fnReadDumpSpikeFile (m_iChannel for v1.01S, m_iUnitIndex, m_afTimestamps,
+ m_a2fWaveforms, m_afInterval). Waveforms are returned as single; int16 waveforms of v1.03S files are
+ scaled by the channel scale. strctChannelInfo is empty for v1.01S files.
+
+ The file is memory mapped. In v1.03S files the timestamps of a unit are contiguous and a coarse time
+ index gives the spike range of every IndexBin seconds, so an interval query reads a few index entries,
+ a few pages of timestamps, and (only if asked) the matching rows of the waveform block.
+ Older files keep timestamps and waveforms interleaved per unit; there the timestamps of the unit are
+ scanned (they are not guaranteed to be sorted), but waveforms are still only read for the selected spikes.
+*/
+
+typedef struct {
+	int Version; // 1, 2 or 3
+	std::string PlxFile;
+	std::string ChannelName;
+	double ChannelID;
+	double Gain;
+	double Threshold;
+	double FiltersActive;
+	double Sorted;
+
+	size_t NumUnits;
+	size_t WaveFormLength;
+	std::vector<double> Channels; // v1.01S only
+	std::vector<double> UnitIndices;
+	std::vector<unsigned long long> NumSpikes;
+	std::vector<double> Intervals; // NumUnits x 2
+
+	bool Int16Waveforms;
+	double WaveFormScale;
+	double IndexBin;
+	std::vector<double> IndexStart;
+	std::vector<unsigned long long> IndexLength;
+	std::vector<const unsigned char *> Index;
+
+	std::vector<const unsigned char *> Timestamps;
+	std::vector<const unsigned char *> Waveforms;
+} SpikeDump_struct;
+
+class HeaderParser {
+public:
+	HeaderParser(const MappedFile &F) : m_F(F), m_iPos(0), m_bOK(true) {}
+	unsigned long long UInt64() { unsigned long long v = 0; Read(&v, 8); return v; }
+	double Double() { double v = 0; Read(&v, 8); return v; }
+	std::string String() {
+		unsigned long long n = UInt64();
+		if (!m_bOK || n > m_F.Size() - m_iPos) {
+			m_bOK = false;
+			return std::string();
+		}
+		std::string s((const char *)m_F.Data() + m_iPos, size_t(n));
+		m_iPos += size_t(n);
+		return s;
+	}
+	// Skips n bytes and returns where they start
+	const unsigned char *Skip(unsigned long long n) {
+		if (!m_bOK || n > m_F.Size() - m_iPos) {
+			m_bOK = false;
+			return NULL;
+		}
+		const unsigned char *p = m_F.Data() + m_iPos;
+		m_iPos += size_t(n);
+		return p;
+	}
+	void Read(void *pOut, size_t n) {
+		const unsigned char *p = Skip(n);
+		if (p != NULL)
+			memcpy(pOut, p, n);
+	}
+	bool OK() const { return m_bOK; }
+private:
+	const MappedFile &m_F;
+	size_t m_iPos;
+	bool m_bOK;
+};
+
+inline double TimestampAt(const unsigned char *pTimestamps, size_t i)
+{
+	double t;
+	memcpy(&t, pTimestamps + 8 * i, 8); // the data blocks are not necessarily 8 byte aligned
+	return t;
+}
+
+inline unsigned long long IndexAt(const unsigned char *pIndex, size_t i)
+{
+	unsigned long long v;
+	memcpy(&v, pIndex + 8 * i, 8);
+	return v;
+}
+
+bool ParseHeader(const MappedFile &F, SpikeDump_struct &S)
+{
+	HeaderParser P(F);
+	char strIdentifier[13];
+	P.Read(strIdentifier, 13);
+	if (!P.OK())
+		return false;
+	if (memcmp(strIdentifier, "KOFIKO_v1.01S", 13) == 0)
+		S.Version = 1;
+	else if (memcmp(strIdentifier, "KOFIKO_v1.02S", 13) == 0)
+		S.Version = 2;
+	else if (memcmp(strIdentifier, "KOFIKO_v1.03S", 13) == 0)
+		S.Version = 3;
+	else
+		return false;
+	unsigned long long iHeaderSize = P.UInt64();
+
+	S.ChannelID = S.Gain = S.Threshold = S.FiltersActive = S.Sorted = 0;
+	if (S.Version >= 2) {
+		S.PlxFile = P.String();
+		S.ChannelName = P.String();
+		S.ChannelID = double(P.UInt64());
+		S.Gain = P.Double();
+		S.Threshold = P.Double();
+		S.FiltersActive = double(P.UInt64());
+		S.Sorted = double(P.UInt64());
+	}
+	unsigned long long iNumUnits = P.UInt64();
+	unsigned long long iWaveFormLength = P.UInt64();
+	if (!P.OK() || iNumUnits > F.Size() / 32 || iWaveFormLength > F.Size())
+		return false;
+	S.NumUnits = size_t(iNumUnits);
+	S.WaveFormLength = size_t(iWaveFormLength);
+	if (S.Version == 1) {
+		S.Channels.resize(S.NumUnits);
+		for (size_t k=0;k<S.NumUnits;k++)
+			S.Channels[k] = double(P.UInt64());
+	}
+	S.UnitIndices.resize(S.NumUnits);
+	S.NumSpikes.resize(S.NumUnits);
+	S.Intervals.resize(2 * S.NumUnits);
+	for (size_t k=0;k<S.NumUnits;k++)
+		S.UnitIndices[k] = double(P.UInt64());
+	for (size_t k=0;k<S.NumUnits;k++)
+		S.NumSpikes[k] = P.UInt64();
+	for (size_t k=0;k<2*S.NumUnits;k++)
+		S.Intervals[k] = P.Double();
+
+	S.Int16Waveforms = false;
+	S.WaveFormScale = 1;
+	S.IndexBin = 0;
+	if (S.Version == 3) {
+		unsigned long long iClass = P.UInt64();
+		if (iClass > 1)
+			return false;
+		S.Int16Waveforms = iClass == 1;
+		S.WaveFormScale = P.Double();
+		S.IndexBin = P.Double();
+		S.IndexStart.resize(S.NumUnits);
+		S.IndexLength.resize(S.NumUnits);
+		S.Index.resize(S.NumUnits);
+		for (size_t k=0;k<S.NumUnits;k++)
+			S.IndexStart[k] = P.Double();
+		for (size_t k=0;k<S.NumUnits;k++)
+			S.IndexLength[k] = P.UInt64();
+		for (size_t k=0;k<S.NumUnits;k++) {
+			if (S.IndexLength[k] > F.Size() / 8)
+				return false;
+			S.Index[k] = P.Skip(8 * S.IndexLength[k]);
+		}
+		if (S.IndexBin <= 0)
+			return false;
+	}
+	if (!P.OK() || 13 + iHeaderSize > F.Size())
+		return false;
+
+	// Locate the timestamps and waveforms of every unit, making sure they are inside the file
+	const unsigned char *pData = F.Data() + 13 + iHeaderSize;
+	unsigned long long iAvailable = F.Size() - 13 - iHeaderSize;
+	unsigned long long iSampleSize = S.Int16Waveforms ? 2 : 4;
+	unsigned long long iTotalSpikes = 0;
+	for (size_t k=0;k<S.NumUnits;k++) {
+		if (S.NumSpikes[k] > iAvailable / 8)
+			return false;
+		iTotalSpikes += S.NumSpikes[k];
+	}
+	if (iTotalSpikes > iAvailable / (8 + iSampleSize * S.WaveFormLength))
+		return false;
+	S.Timestamps.resize(S.NumUnits);
+	S.Waveforms.resize(S.NumUnits);
+	unsigned long long iBefore = 0;
+	for (size_t k=0;k<S.NumUnits;k++) {
+		if (S.Version == 3) {
+			S.Timestamps[k] = pData + 8 * iBefore;
+			S.Waveforms[k] = pData + 8 * iTotalSpikes + iSampleSize * S.WaveFormLength * iBefore;
+		} else {
+			S.Timestamps[k] = pData + (8 + iSampleSize * S.WaveFormLength) * iBefore;
+			S.Waveforms[k] = S.Timestamps[k] + 8 * S.NumSpikes[k];
+		}
+		iBefore += S.NumSpikes[k];
+	}
+	return true;
+}
+
+// First spike of unit k with timestamp >= t (bUpper: > t), using the time index to narrow the search
+size_t IndexedBound(const SpikeDump_struct &S, size_t k, double t, bool bUpper)
+{
+	size_t n = size_t(S.NumSpikes[k]);
+	size_t iLow = 0, iHigh = n;
+	long long m = (long long)S.IndexLength[k];
+	if (m > 0 && t == t) {
+		double fBin = floor((t - S.IndexStart[k]) / S.IndexBin);
+		// one bin of slack on each side absorbs rounding at the bin edges
+		long long j0 = fBin < -1 ? -1 : (fBin > double(m) ? m : (long long)fBin);
+		j0 -= 1;
+		long long j1 = j0 + 3;
+		if (j0 >= 0 && j0 < m)
+			iLow = size_t(IndexAt(S.Index[k], size_t(j0)));
+		if (j1 >= 0 && j1 < m)
+			iHigh = size_t(IndexAt(S.Index[k], size_t(j1)));
+		if (iHigh > n) iHigh = n;
+		if (iLow > iHigh) iLow = iHigh;
+	}
+	while (iLow < iHigh) {
+		size_t iMid = iLow + (iHigh - iLow) / 2;
+		double v = TimestampAt(S.Timestamps[k], iMid);
+		if (bUpper ? v <= t : v < t)
+			iLow = iMid + 1;
+		else
+			iHigh = iMid;
+	}
+	return iLow;
+}
+
+// Spikes of unit k to return
+void SelectSpikes(const SpikeDump_struct &S, size_t k, bool bInterval, double fStart, double fEnd, std::vector<size_t> &aiSpikes)
+{
+	aiSpikes.clear();
+	size_t n = size_t(S.NumSpikes[k]);
+	if (!bInterval) {
+		aiSpikes.resize(n);
+		for (size_t i=0;i<n;i++)
+			aiSpikes[i] = i;
+		return;
+	}
+	if (S.Version == 3) {
+		size_t iFirst = IndexedBound(S, k, fStart, false);
+		size_t iLast = IndexedBound(S, k, fEnd, true);
+		for (size_t i=iFirst;i<iLast;i++)
+			aiSpikes.push_back(i);
+		return;
+	}
+	for (size_t i=0;i<n;i++) {
+		double t = TimestampAt(S.Timestamps[k], i);
+		if (t >= fStart && t <= fEnd)
+			aiSpikes.push_back(i);
+	}
+}
+
+// Selected rows of the NumSpikes x WaveFormLength matrix of unit k, as single
+mxArray *ReadWaveforms(const SpikeDump_struct &S, size_t k, const std::vector<size_t> &aiSpikes)
+{
+	size_t n = size_t(S.NumSpikes[k]), m = aiSpikes.size(), L = S.WaveFormLength;
+	mxArray *Out = mxCreateNumericMatrix(m, L, mxSINGLE_CLASS, mxREAL);
+	float *afOut = (float *)mxGetData(Out);
+	if (m == 0)
+		return Out;
+	bool bContiguous = aiSpikes.back() - aiSpikes.front() + 1 == m;
+	const unsigned char *pWaveforms = S.Waveforms[k];
+	for (size_t s=0;s<L;s++) {
+		if (S.Int16Waveforms) {
+			const unsigned char *pColumn = pWaveforms + 2 * (s * n);
+			for (size_t i=0;i<m;i++) {
+				short v;
+				memcpy(&v, pColumn + 2 * aiSpikes[i], 2);
+				afOut[s * m + i] = float(v * S.WaveFormScale);
+			}
+		} else {
+			const unsigned char *pColumn = pWaveforms + 4 * (s * n);
+			if (bContiguous)
+				memcpy(afOut + s * m, pColumn + 4 * aiSpikes[0], 4 * m);
+			else
+				for (size_t i=0;i<m;i++)
+					memcpy(afOut + s * m + i, pColumn + 4 * aiSpikes[i], 4);
+		}
+	}
+	return Out;
+}
+
+mxArray *CreateChannelInfo(const SpikeDump_struct &S)
+{
+	if (S.Version == 1)
+		return mxCreateDoubleMatrix(0, 0, mxREAL);
+	const char *astrFields[] = {"m_strPlxFile", "m_strChannelName", "m_iChannelID", "m_fGain", "m_fThreshold", "m_bFiltersActive", "m_bSorted"};
+	mxArray *C = mxCreateStructMatrix(1, 1, 7, astrFields);
+	mxSetField(C, 0, "m_strPlxFile", mxCreateString(S.PlxFile.c_str()));
+	mxSetField(C, 0, "m_strChannelName", mxCreateString(S.ChannelName.c_str()));
+	mxSetField(C, 0, "m_iChannelID", mxCreateDoubleScalar(S.ChannelID));
+	mxSetField(C, 0, "m_fGain", mxCreateDoubleScalar(S.Gain));
+	mxSetField(C, 0, "m_fThreshold", mxCreateDoubleScalar(S.Threshold));
+	mxSetField(C, 0, "m_bFiltersActive", mxCreateDoubleScalar(S.FiltersActive));
+	mxSetField(C, 0, "m_bSorted", mxCreateDoubleScalar(S.Sorted));
+	return C;
+}
+
+// Does entry k hold the requested unit (NULL: any unit) of the requested channel (v1.01S)
+bool MatchUnit(const SpikeDump_struct &S, size_t k, const double *pUnit, const double *pChannel)
+{
+	return (pUnit == NULL || S.UnitIndices[k] == *pUnit) && (pChannel == NULL || S.Version != 1 || S.Channels[k] == *pChannel);
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 1 || !mxIsChar(prhs[0])) {
+		mexErrMsgTxt("Usage: [astrctUnits, strctChannelInfo] = fnReadDumpSpikes(strFile, ['HeaderOnly'], ['Units', aiUnits], ['Channel', iChannel], ['Interval', [t0 t1]], ['Waveforms', bRead])");
+		return;
+	}
+
+	bool bHeaderOnly = false, bInterval = false, bWaveforms = true;
+	double fStart = 0, fEnd = 0, fChannel = 0;
+	const mxArray *Units = NULL;
+	bool bChannel = false;
+	for (int a=1;a<nrhs;a++) {
+		if (!mxIsChar(prhs[a])) {
+			mexErrMsgTxt("Expected an option name.");
+			return;
+		}
+		char strOption[64];
+		mxGetString(prhs[a], strOption, sizeof(strOption));
+		for (char *p=strOption;*p;p++)
+			*p = char(tolower(*p));
+		if (strcmp(strOption, "headeronly") == 0) {
+			bHeaderOnly = true;
+			continue;
+		}
+		if (a + 1 >= nrhs) {
+			mexErrMsgTxt("Missing option value.");
+			return;
+		}
+		const mxArray *Value = prhs[++a];
+		if (strcmp(strOption, "units") == 0) {
+			if (!mxIsDouble(Value)) {
+				mexErrMsgTxt("Units must be a vector of unit indices.");
+				return;
+			}
+			Units = Value;
+		} else if (strcmp(strOption, "channel") == 0) {
+			fChannel = mxGetScalar(Value);
+			bChannel = true;
+		} else if (strcmp(strOption, "interval") == 0) {
+			if (!mxIsDouble(Value) || mxGetNumberOfElements(Value) != 2) {
+				mexErrMsgTxt("Interval must be [start end].");
+				return;
+			}
+			fStart = mxGetPr(Value)[0];
+			fEnd = mxGetPr(Value)[1];
+			bInterval = true;
+		} else if (strcmp(strOption, "waveforms") == 0) {
+			bWaveforms = mxGetScalar(Value) != 0;
+		} else {
+			mexErrMsgTxt("Unknown option. Use 'HeaderOnly', 'Units', 'Channel', 'Interval' or 'Waveforms'.");
+			return;
+		}
+	}
+
+	char strFile[1024];
+	mxGetString(prhs[0], strFile, sizeof(strFile));
+	MappedFile F;
+	if (!F.Open(strFile)) {
+		mexErrMsgTxt("Cannot open file.");
+		return;
+	}
+	SpikeDump_struct S;
+	if (!ParseHeader(F, S)) {
+		mexErrMsgTxt("Not a KOFIKO spike file (v1.01S, v1.02S, v1.03S) or file is truncated.");
+		return;
+	}
+
+	std::vector<int> aiEntries;
+	const double *pChannel = bChannel ? &fChannel : NULL;
+	if (Units == NULL) {
+		for (size_t k=0;k<S.NumUnits;k++)
+			if (MatchUnit(S, k, NULL, pChannel))
+				aiEntries.push_back(int(k));
+	} else {
+		const double *afUnits = mxGetPr(Units);
+		for (size_t r=0;r<mxGetNumberOfElements(Units);r++) {
+			size_t k = 0;
+			while (k < S.NumUnits && !MatchUnit(S, k, &afUnits[r], pChannel))
+				k++;
+			if (k == S.NumUnits) {
+				mexErrMsgTxt("Unit not found in file.");
+				return;
+			}
+			aiEntries.push_back(int(k));
+		}
+	}
+
+	const char *astrFields[] = {"m_iChannel", "m_iUnitIndex", "m_afTimestamps", "m_a2fWaveforms", "m_afInterval"};
+	int iFirstField = S.Version == 1 ? 0 : 1;
+	plhs[0] = mxCreateStructMatrix(1, int(aiEntries.size()), 5 - iFirstField, astrFields + iFirstField);
+	std::vector<size_t> aiSpikes;
+	for (size_t u=0;u<aiEntries.size();u++) {
+		size_t k = size_t(aiEntries[u]);
+		if (S.Version == 1)
+			mxSetField(plhs[0], int(u), "m_iChannel", mxCreateDoubleScalar(S.Channels[k]));
+		mxSetField(plhs[0], int(u), "m_iUnitIndex", mxCreateDoubleScalar(S.UnitIndices[k]));
+		mxArray *Interval = mxCreateDoubleMatrix(1, 2, mxREAL);
+		mxGetPr(Interval)[0] = S.Intervals[k];
+		mxGetPr(Interval)[1] = S.Intervals[k + S.NumUnits];
+		mxSetField(plhs[0], int(u), "m_afInterval", Interval);
+		if (bHeaderOnly) {
+			mxSetField(plhs[0], int(u), "m_afTimestamps", mxCreateDoubleMatrix(0, 0, mxREAL));
+			mxSetField(plhs[0], int(u), "m_a2fWaveforms", mxCreateDoubleMatrix(0, 0, mxREAL));
+			continue;
+		}
+
+		SelectSpikes(S, k, bInterval, fStart, fEnd, aiSpikes);
+		mxArray *Timestamps = mxCreateDoubleMatrix(aiSpikes.size(), 1, mxREAL);
+		double *afTimestamps = mxGetPr(Timestamps);
+		for (size_t i=0;i<aiSpikes.size();i++)
+			afTimestamps[i] = TimestampAt(S.Timestamps[k], aiSpikes[i]);
+		mxSetField(plhs[0], int(u), "m_afTimestamps", Timestamps);
+		mxSetField(plhs[0], int(u), "m_a2fWaveforms", bWaveforms ? ReadWaveforms(S, k, aiSpikes) : mxCreateNumericMatrix(0, 0, mxSINGLE_CLASS, mxREAL));
+	}
+
+	if (nlhs > 1)
+		plhs[1] = CreateChannelInfo(S);
+}
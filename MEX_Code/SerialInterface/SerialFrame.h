@@ -0,0 +1,110 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef SERIAL_FRAME_H
+#define SERIAL_FRAME_H
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ Framed binary protocol on the serial line to the stimulators.
+
+ Frame: 0xA5 0x5A, type, seq, payload length (uint16, little endian), payload, CRC (uint16, little endian)
+ The CRC is CRC-16/CCITT (polynomial 0x1021, initial 0xFFFF) of type, seq, length and payload.
+
+ The host sends commands (type < 0x80) with a sequence number of its own, 1..255. The device answers
+ every command with one response of the same type and seq. Types with FRAME_EVENT set are sent by the
+ device on its own (trigger counts, ...); their seq counts the events of the device modulo 256.
+ A frame with a bad CRC is dropped and the parser resynchronizes on the next 0xA5 0x5A.
+*/
+
+const unsigned char FRAME_SYNC0 = 0xA5;
+const unsigned char FRAME_SYNC1 = 0x5A;
+const unsigned char FRAME_EVENT = 0x80;
+const int FRAME_HEADER_BYTES = 6;
+const int FRAME_CRC_BYTES = 2;
+const int FRAME_MAX_PAYLOAD = 256;	// what the stimulator accepts (STIM_MAX_PAYLOAD in StimProtocol.h)
+
+typedef struct {
+	unsigned char m_iType;
+	unsigned char m_iSeq;
+	std::vector<unsigned char> m_Payload;
+} Frame;
+
+inline unsigned short FrameCrc16(const unsigned char *pData, size_t iBytes, unsigned short iCrc = 0xFFFF)
+{
+	for (size_t k = 0; k < iBytes; k++) {
+		iCrc ^= (unsigned short)(pData[k] << 8);
+		for (int iBit = 0; iBit < 8; iBit++)
+			iCrc = (iCrc & 0x8000) ? (unsigned short)((iCrc << 1) ^ 0x1021) : (unsigned short)(iCrc << 1);
+	}
+	return iCrc;
+}
+
+// Appends the encoded frame to Out
+inline void FrameEncode(const Frame &F, std::vector<unsigned char> &Out)
+{
+	size_t iStart = Out.size();
+	size_t iLength = F.m_Payload.size();
+	Out.push_back(FRAME_SYNC0);
+	Out.push_back(FRAME_SYNC1);
+	Out.push_back(F.m_iType);
+	Out.push_back(F.m_iSeq);
+	Out.push_back((unsigned char)(iLength & 0xFF));
+	Out.push_back((unsigned char)(iLength >> 8));
+	Out.insert(Out.end(), F.m_Payload.begin(), F.m_Payload.end());
+	unsigned short iCrc = FrameCrc16(&Out[iStart + 2], FRAME_HEADER_BYTES - 2 + iLength);
+	Out.push_back((unsigned char)(iCrc & 0xFF));
+	Out.push_back((unsigned char)(iCrc >> 8));
+}
+
+class FrameParser {
+public:
+	FrameParser() : m_iStart(0), m_iCrcErrors(0) {}
+
+	// Appends every complete frame found in the bytes received so far to Frames
+	void Feed(const unsigned char *pData, size_t iBytes, std::vector<Frame> &Frames) {
+		m_Buffer.insert(m_Buffer.end(), pData, pData + iBytes);
+		while (true) {
+			while (m_iStart + 1 < m_Buffer.size() && !(m_Buffer[m_iStart] == FRAME_SYNC0 && m_Buffer[m_iStart + 1] == FRAME_SYNC1))
+				m_iStart++;
+			if (m_iStart + FRAME_HEADER_BYTES > m_Buffer.size())
+				break;
+			const unsigned char *pFrame = &m_Buffer[m_iStart];
+			size_t iLength = pFrame[4] | (pFrame[5] << 8);
+			if (iLength > FRAME_MAX_PAYLOAD) {
+				m_iCrcErrors++;
+				m_iStart++;
+				continue;
+			}
+			size_t iFrameBytes = FRAME_HEADER_BYTES + iLength + FRAME_CRC_BYTES;
+			if (m_iStart + iFrameBytes > m_Buffer.size())
+				break;
+			unsigned short iCrc = pFrame[iFrameBytes - 2] | (pFrame[iFrameBytes - 1] << 8);
+			if (FrameCrc16(pFrame + 2, FRAME_HEADER_BYTES - 2 + iLength) != iCrc) {
+				m_iCrcErrors++;
+				m_iStart++;
+				continue;
+			}
+			Frame F;
+			F.m_iType = pFrame[2];
+			F.m_iSeq = pFrame[3];
+			F.m_Payload.assign(pFrame + FRAME_HEADER_BYTES, pFrame + FRAME_HEADER_BYTES + iLength);
+			Frames.push_back(F);
+			m_iStart += iFrameBytes;
+		}
+		m_Buffer.erase(m_Buffer.begin(), m_Buffer.begin() + m_iStart);
+		m_iStart = 0;
+	}
+	long long CrcErrors() const { return m_iCrcErrors; }
+private:
+	std::vector<unsigned char> m_Buffer;
+	size_t m_iStart;
+	long long m_iCrcErrors;
+};
+
+#endif
@@ -1,10 +1,38 @@
 #define ARDUINO_WAIT_TIME 2000
 
-#include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mex.h>
+#include <set>
 #include <string>
+#include <vector>
+#include "SerialLink.h"
+#include "SerialLoopback.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+
+/*
+ Text commands (Windows only, as before):
+   hPort = fndllSerialInterface('Open', strPort), fndllSerialInterface('Send', hPort, strLine), fndllSerialInterface('Close', hPort)
+
+ Framed link (SerialLink.h):
+   hLink = fndllSerialInterface('OpenFramed', strPort, [iBaud = 115200], [fSettleSec = 2])
+	fSettleSec: the arduino resets when the port opens
+   [acResponses, aiTypes] = fndllSerialInterface('Transact', hLink, aiTypes, acPayloads, [fTimeoutSec = 0.1], [iRetries = 2])
+	all the commands go out at once. acResponses{k} (uint8) answers command k; aiTypes(k) is 0 if it never did.
+   [aiTypes, acPayloads, afTimes] = fndllSerialInterface('GetEvents', hLink)	events since the last call, afTimes on the GetSecs clock
+   strctStats = fndllSerialInterface('GetLinkStats', hLink)
+   fndllSerialInterface('CloseFramed', hLink)
+
+ Loopback device on a pseudo terminal, to test without hardware (not on Windows, see SerialLoopback.h):
+   strPort = fndllSerialInterface('StartLoopback', [fEventSec = 0], [iDropEvery = 0], [strDevice = 'echo'])
+	strDevice: 'echo', or 'nanostimulator' for the firmware command parser (StimProtocol) on a simulated stimulator
+   fndllSerialInterface('StopLoopback')
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+
 class Serial
 {
     private:
@@ -181,40 +209,218 @@ bool Serial::IsConnected()
 
 
 
-void mexFunction(int nlhs, mxArray *plhs[],
-								int nrhs, const mxArray *prhs[])
+#endif
+
+static std::set<SerialLink *> g_Links;
+static bool g_bExitRegistered = false;
+#ifndef _WIN32
+static SerialLoopback *g_pLoopback = NULL;
+#endif
+
+static void fnExit()
 {
+	for (std::set<SerialLink *>::iterator it = g_Links.begin(); it != g_Links.end(); it++)
+		delete *it;
+	g_Links.clear();
+#ifndef _WIN32
+	delete g_pLoopback;
+	g_pLoopback = NULL;
+#endif
+}
 
-  
-	if (nrhs < 2) {
-		return;
-	}
+static std::string GetString(const mxArray *pArray)
+{
+	char *pString = mxArrayToString(pArray);
+	if (pString == NULL)
+		mexErrMsgTxt("Expecting a string.");
+	std::string str(pString);
+	mxFree(pString);
+	return str;
+}
 
-	char *Command = mxArrayToString(prhs[0]);
+static double GetScalar(int nrhs, const mxArray *prhs[], int iArg, double fDefault)
+{
+	if (nrhs <= iArg || mxIsEmpty(prhs[iArg]))
+		return fDefault;
+	return mxGetScalar(prhs[iArg]);
+}
 
-	if   (strcmp(Command, "Open") == 0)  {
-			char *comport = mxArrayToString(prhs[1]);
-            Serial *S = new Serial(comport);
-			
-	        plhs[0] = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);
-			double* Tmp= (double*)mxGetPr(plhs[0]);
-			memcpy(Tmp, &S, 8);
-    }
+static SerialLink *GetLink(const mxArray *pHandle)
+{
+	SerialLink *pLink = NULL;
+	if (!mxIsDouble(pHandle) || mxGetNumberOfElements(pHandle) != 1)
+		mexErrMsgTxt("Expecting a link handle.");
+	memcpy(&pLink, mxGetPr(pHandle), sizeof(pLink));
+	if (g_Links.find(pLink) == g_Links.end())
+		mexErrMsgTxt("No such link (closed already?).");
+	return pLink;
+}
 
-  if   (strcmp(Command, "Send") == 0)  {
-		double* Tmp= (double*)mxGetPr(prhs[1]);
-		Serial* S;
-        memcpy(&S, Tmp, 8);
-		char *s= mxArrayToString(prhs[2]);
-		std::string std_s(s);
-		S->WriteData(std_s.c_str(),std_s.length());
-	}
+static mxArray *PayloadArray(const std::vector<unsigned char> &Payload)
+{
+	mxArray *pArray = mxCreateNumericMatrix(1, Payload.size(), mxUINT8_CLASS, mxREAL);
+	if (!Payload.empty())
+		memcpy(mxGetData(pArray), &Payload[0], Payload.size());
+	return pArray;
+}
 
-  if   (strcmp(Command, "Close") == 0)  {
-		double* Tmp= (double*)mxGetPr(prhs[1]);
-		Serial* S;
-        memcpy(&S, Tmp, 8);
-		delete S;
+static std::vector<unsigned char> GetPayload(const mxArray *pArray)
+{
+	size_t iBytes = mxGetNumberOfElements(pArray);
+	if (iBytes > size_t(FRAME_MAX_PAYLOAD))
+		mexErrMsgTxt("Payload too long.");
+	std::vector<unsigned char> Payload(iBytes);
+	if (mxIsUint8(pArray) || mxIsInt8(pArray)) {
+		if (iBytes > 0)
+			memcpy(&Payload[0], mxGetData(pArray), iBytes);
+	} else if (mxIsDouble(pArray)) {
+		const double *afBytes = mxGetPr(pArray);
+		for (size_t k = 0; k < iBytes; k++) {
+			if (afBytes[k] < 0 || afBytes[k] > 255)
+				mexErrMsgTxt("Payload bytes must be 0..255.");
+			Payload[k] = (unsigned char)afBytes[k];
+		}
+	} else
+		mexErrMsgTxt("Payloads must be uint8 or double.");
+	return Payload;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+								int nrhs, const mxArray *prhs[])
+{
+	if (!g_bExitRegistered) {
+		mexAtExit(fnExit);
+		g_bExitRegistered = true;
 	}
+	if (nrhs < 1)
+		mexErrMsgTxt("Usage: fndllSerialInterface(strCommand, ...)");
+	std::string strCommand = GetString(prhs[0]);
+
+	if (strCommand == "OpenFramed") {
+		if (nrhs < 2)
+			mexErrMsgTxt("Usage: hLink = fndllSerialInterface('OpenFramed', strPort, [iBaud], [fSettleSec])");
+		std::string strError;
+		SerialLink *pLink = new SerialLink();
+		if (!pLink->Open(GetString(prhs[1]), int(GetScalar(nrhs, prhs, 2, 115200)), strError)) {
+			delete pLink;
+			mexErrMsgTxt(strError.c_str());
+		}
+		g_Links.insert(pLink);
+		ClockSleepSecs(GetScalar(nrhs, prhs, 3, ARDUINO_WAIT_TIME / 1000.0));
+		plhs[0] = mxCreateNumericMatrix(1, 1, mxDOUBLE_CLASS, mxREAL);
+		memcpy(mxGetPr(plhs[0]), &pLink, sizeof(pLink));
+	} else if (strCommand == "Transact") {
+		if (nrhs < 4 || !mxIsCell(prhs[3]) || mxGetNumberOfElements(prhs[2]) != mxGetNumberOfElements(prhs[3]))
+			mexErrMsgTxt("Usage: [acResponses, aiTypes] = fndllSerialInterface('Transact', hLink, aiTypes, acPayloads, [fTimeoutSec], [iRetries])");
+		SerialLink *pLink = GetLink(prhs[1]);
+		size_t iNumCommands = mxGetNumberOfElements(prhs[2]);
+		if (iNumCommands > 0 && !mxIsDouble(prhs[2]))
+			mexErrMsgTxt("Types must be double.");
+		std::vector<Frame> Commands(iNumCommands);
+		for (size_t k = 0; k < iNumCommands; k++) {
+			double fType = mxGetPr(prhs[2])[k];
+			if (fType < 1 || fType >= FRAME_EVENT)
+				mexErrMsgTxt("Command types must be 1..127.");
+			Commands[k].m_iType = (unsigned char)fType;
+			Commands[k].m_iSeq = 0;
+			const mxArray *pPayload = mxGetCell(prhs[3], k);
+			if (pPayload != NULL)
+				Commands[k].m_Payload = GetPayload(pPayload);
+		}
+		std::vector<Frame> Responses;
+		pLink->Transact(Commands, Responses, GetScalar(nrhs, prhs, 4, 0.1), int(GetScalar(nrhs, prhs, 5, 2)));
+
+		plhs[0] = mxCreateCellMatrix(1, iNumCommands);
+		mxArray *Types = mxCreateDoubleMatrix(1, iNumCommands, mxREAL);
+		for (size_t k = 0; k < iNumCommands; k++) {
+			mxSetCell(plhs[0], k, PayloadArray(Responses[k].m_Payload));
+			mxGetPr(Types)[k] = Responses[k].m_iType;
+		}
+		if (nlhs > 1)
+			plhs[1] = Types;
+		else
+			mxDestroyArray(Types);
+	} else if (strCommand == "GetEvents") {
+		if (nrhs < 2)
+			mexErrMsgTxt("Usage: [aiTypes, acPayloads, afTimes] = fndllSerialInterface('GetEvents', hLink)");
+		std::vector<LinkEvent> Events;
+		GetLink(prhs[1])->TakeEvents(Events);
+		plhs[0] = mxCreateDoubleMatrix(1, Events.size(), mxREAL);
+		mxArray *Payloads = mxCreateCellMatrix(1, Events.size());
+		mxArray *Times = mxCreateDoubleMatrix(1, Events.size(), mxREAL);
+		for (size_t k = 0; k < Events.size(); k++) {
+			mxGetPr(plhs[0])[k] = Events[k].m_Frame.m_iType;
+			mxSetCell(Payloads, k, PayloadArray(Events[k].m_Frame.m_Payload));
+			mxGetPr(Times)[k] = Events[k].m_fTime;
+		}
+		if (nlhs > 1) plhs[1] = Payloads; else mxDestroyArray(Payloads);
+		if (nlhs > 2) plhs[2] = Times; else mxDestroyArray(Times);
+	} else if (strCommand == "GetLinkStats") {
+		if (nrhs < 2)
+			mexErrMsgTxt("Usage: strctStats = fndllSerialInterface('GetLinkStats', hLink)");
+		LinkStats Stats = GetLink(prhs[1])->Stats();
+		const char *acFields[] = {"m_iSent", "m_iReceived", "m_iCrcErrors", "m_iResent", "m_iTimeouts", "m_iUnexpected", "m_iEventsDropped", "m_iReadErrors", "m_iWriteErrors"};
+		const long long aiValues[] = {Stats.m_iSent, Stats.m_iReceived, Stats.m_iCrcErrors, Stats.m_iResent, Stats.m_iTimeouts, Stats.m_iUnexpected, Stats.m_iEventsDropped, Stats.m_iReadErrors, Stats.m_iWriteErrors};
+		plhs[0] = mxCreateStructMatrix(1, 1, 9, acFields);
+		for (int k = 0; k < 9; k++)
+			mxSetField(plhs[0], 0, acFields[k], mxCreateDoubleScalar(double(aiValues[k])));
+	} else if (strCommand == "CloseFramed") {
+		if (nrhs < 2)
+			mexErrMsgTxt("Usage: fndllSerialInterface('CloseFramed', hLink)");
+		SerialLink *pLink = GetLink(prhs[1]);
+		g_Links.erase(pLink);
+		delete pLink;
+	} else if (strCommand == "StartLoopback") {
+#ifdef _WIN32
+		mexErrMsgTxt("The loopback needs a pseudo terminal: use a null modem pair (com0com) on Windows.");
+#else
+		if (g_pLoopback == NULL)
+			g_pLoopback = new SerialLoopback();
+		std::string strSlave, strError, strDevice = nrhs > 3 ? GetString(prhs[3]) : "echo";
+		if (strDevice != "echo" && strDevice != "nanostimulator")
+			mexErrMsgTxt("Unknown loopback device.");
+		if (!g_pLoopback->Start(GetScalar(nrhs, prhs, 1, 0), int(GetScalar(nrhs, prhs, 2, 0)), strDevice == "nanostimulator", strSlave, strError))
+			mexErrMsgTxt(strError.c_str());
+		plhs[0] = mxCreateString(strSlave.c_str());
+#endif
+	} else if (strCommand == "StopLoopback") {
+#ifndef _WIN32
+		if (g_pLoopback != NULL)
+			g_pLoopback->Stop();
+#endif
+	}
+#ifdef _WIN32
+	else {
+		if (nrhs < 2) {
+			return;
+		}
+
+		char *Command = mxArrayToString(prhs[0]);
 
-}
\ No newline at end of file
+		if   (strcmp(Command, "Open") == 0)  {
+				char *comport = mxArrayToString(prhs[1]);
+	            Serial *S = new Serial(comport);
+			
+		        plhs[0] = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);
+				double* Tmp= (double*)mxGetPr(plhs[0]);
+				memcpy(Tmp, &S, 8);
+	    }
+
+	  if   (strcmp(Command, "Send") == 0)  {
+			double* Tmp= (double*)mxGetPr(prhs[1]);
+			Serial* S;
+	        memcpy(&S, Tmp, 8);
+			char *s= mxArrayToString(prhs[2]);
+			std::string std_s(s);
+			S->WriteData(std_s.c_str(),std_s.length());
+		}
+
+	  if   (strcmp(Command, "Close") == 0)  {
+			double* Tmp= (double*)mxGetPr(prhs[1]);
+			Serial* S;
+	        memcpy(&S, Tmp, 8);
+			delete S;
+		}
+	}
+#endif
+}
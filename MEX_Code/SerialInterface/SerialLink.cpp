@@ -0,0 +1,216 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+#include "SerialLink.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+
+SerialLink::SerialLink() : m_bStop(false), m_iNumPending(0), m_pResponses(NULL), m_iSeq(0)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	for (int k = 0; k < 256; k++)
+		m_aiPending[k] = m_aiPendingType[k] = -1;
+}
+
+bool SerialLink::Open(const std::string &strPort, int iBaud, std::string &strError)
+{
+	Close();
+	if (!m_Port.Open(strPort, iBaud, strError))
+		return false;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_Events.clear();
+	m_Parser = FrameParser();
+	m_bStop = false;
+	try {
+		m_Thread = std::thread(&SerialLink::Loop, this);
+	} catch (const std::system_error &) {
+		m_Port.Close();
+		strError = "Unable to start the reader thread.";
+		return false;
+	}
+	return true;
+}
+
+void SerialLink::Close()
+{
+	if (m_Thread.joinable()) {
+		m_bStop = true;
+		m_Thread.join();
+	}
+	m_Port.Close();
+}
+
+unsigned char SerialLink::NextSeq()
+{
+	m_iSeq = (unsigned char)(m_iSeq == 255 ? 1 : m_iSeq + 1);
+	return m_iSeq;
+}
+
+bool SerialLink::WriteFrames(const std::vector<Frame> &Commands, const std::vector<int> &aiIndices)
+{
+	std::vector<unsigned char> Bytes;
+	for (size_t k = 0; k < aiIndices.size(); k++)
+		FrameEncode(Commands[aiIndices[k]], Bytes);
+	std::lock_guard<std::mutex> Guard(m_WriteLock);
+	bool bOK = Bytes.empty() || m_Port.Write(&Bytes[0], int(Bytes.size()));
+	std::lock_guard<std::mutex> StatsGuard(m_Lock);
+	if (bOK)
+		m_Stats.m_iSent += aiIndices.size();
+	else
+		m_Stats.m_iWriteErrors++;
+	return bOK;
+}
+
+static bool PayloadsFit(const std::vector<Frame> &Commands)
+{
+	for (size_t k = 0; k < Commands.size(); k++)
+		if (Commands[k].m_Payload.size() > size_t(FRAME_MAX_PAYLOAD))
+			return false;
+	return true;
+}
+
+bool SerialLink::Send(const Frame &Command)
+{
+	std::vector<Frame> Commands(1, Command);
+	if (!PayloadsFit(Commands))
+		return false;
+	{
+		std::lock_guard<std::mutex> Guard(m_Lock);
+		Commands[0].m_iSeq = NextSeq();
+	}
+	return WriteFrames(Commands, std::vector<int>(1, 0));
+}
+
+bool SerialLink::Transact(const std::vector<Frame> &Commands, std::vector<Frame> &Responses, double fTimeoutSec, int iRetries)
+{
+	Responses.assign(Commands.size(), Frame());
+	for (size_t k = 0; k < Responses.size(); k++)
+		Responses[k].m_iType = 0;	// never a command type: no response
+	if (!PayloadsFit(Commands))
+		return false;
+	bool bAllAnswered = true;
+
+	for (size_t iFirst = 0; iFirst < Commands.size(); iFirst += LINK_MAX_IN_FLIGHT) {
+		size_t iLast = std::min(Commands.size(), iFirst + LINK_MAX_IN_FLIGHT);
+		std::vector<Frame> Window(Commands.begin() + iFirst, Commands.begin() + iLast);
+		std::vector<Frame> WindowResponses(Window.size());
+		std::vector<int> aiMissing;
+		{
+			std::lock_guard<std::mutex> Guard(m_Lock);
+			for (size_t k = 0; k < Window.size(); k++) {
+				Window[k].m_iSeq = NextSeq();
+				m_aiPending[Window[k].m_iSeq] = int(k);
+				m_aiPendingType[Window[k].m_iSeq] = Window[k].m_iType;
+				WindowResponses[k].m_iType = 0;
+				aiMissing.push_back(int(k));
+			}
+			m_iNumPending = int(Window.size());
+			m_pResponses = &WindowResponses;
+		}
+
+		bool bWritten = true;
+		for (int iTry = 0; iTry <= iRetries && !aiMissing.empty(); iTry++) {
+			if (iTry > 0) {
+				std::lock_guard<std::mutex> Guard(m_Lock);
+				m_Stats.m_iResent += aiMissing.size();
+			}
+			bWritten = WriteFrames(Window, aiMissing);
+			if (!bWritten)
+				break;
+
+			std::unique_lock<std::mutex> Lock(m_Lock);
+			m_Arrived.wait_for(Lock, std::chrono::duration<double>(fTimeoutSec), [this]() { return m_iNumPending == 0; });
+			aiMissing.clear();
+			for (size_t k = 0; k < Window.size(); k++)
+				if (m_aiPending[Window[k].m_iSeq] == int(k))
+					aiMissing.push_back(int(k));
+		}
+
+		{
+			std::lock_guard<std::mutex> Guard(m_Lock);
+			for (size_t k = 0; k < aiMissing.size(); k++)
+				m_aiPending[Window[aiMissing[k]].m_iSeq] = -1;
+			if (bWritten)
+				m_Stats.m_iTimeouts += aiMissing.size();
+			m_iNumPending = 0;
+			m_pResponses = NULL;
+		}
+		if (!aiMissing.empty())
+			bAllAnswered = false;
+		std::copy(WindowResponses.begin(), WindowResponses.end(), Responses.begin() + iFirst);
+		if (!bWritten)
+			break;
+	}
+	return bAllAnswered;
+}
+
+void SerialLink::TakeEvents(std::vector<LinkEvent> &Events)
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	Events.insert(Events.end(), m_Events.begin(), m_Events.end());
+	m_Events.clear();
+}
+
+LinkStats SerialLink::Stats()
+{
+	std::lock_guard<std::mutex> Guard(m_Lock);
+	return m_Stats;
+}
+
+void SerialLink::Loop()
+{
+	unsigned char aBuffer[4096];
+	std::vector<Frame> Frames;
+	while (!m_bStop) {
+		int iRead = m_Port.Read(aBuffer, sizeof(aBuffer));
+		if (iRead == 0)
+			continue;
+		if (iRead < 0) {
+			{
+				std::lock_guard<std::mutex> Guard(m_Lock);
+				m_Stats.m_iReadErrors++;
+			}
+			ClockSleepSecs(SERIAL_READ_TIMEOUT_MS * 1e-3);
+			continue;
+		}
+		double fNow = ClockGetSecs();
+		Frames.clear();
+		m_Parser.Feed(aBuffer, iRead, Frames);
+
+		std::lock_guard<std::mutex> Guard(m_Lock);
+		m_Stats.m_iCrcErrors = m_Parser.CrcErrors();
+		m_Stats.m_iReceived += Frames.size();
+		bool bAnswered = false;
+		for (size_t k = 0; k < Frames.size(); k++) {
+			const Frame &F = Frames[k];
+			if (F.m_iType & FRAME_EVENT) {
+				if (m_Events.size() >= LINK_MAX_EVENTS) {
+					m_Events.pop_front();
+					m_Stats.m_iEventsDropped++;
+				}
+				LinkEvent Event;
+				Event.m_fTime = fNow;
+				Event.m_Frame = F;
+				m_Events.push_back(Event);
+				continue;
+			}
+			int iIndex = m_aiPending[F.m_iSeq];
+			if (iIndex < 0 || m_pResponses == NULL || m_aiPendingType[F.m_iSeq] != F.m_iType) {
+				m_Stats.m_iUnexpected++;
+				continue;
+			}
+			(*m_pResponses)[iIndex] = F;
+			m_aiPending[F.m_iSeq] = -1;
+			m_iNumPending--;
+			bAnswered = true;
+		}
+		if (bAnswered)
+			m_Arrived.notify_all();
+	}
+}
@@ -0,0 +1,92 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef SERIAL_LINK_H
+#define SERIAL_LINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SerialFrame.h"
+#include "SerialPort.h"
+
+/*
+ Framed link (SerialFrame.h) over a serial port, with a reader thread of its own.
+
+ The thread parses everything the device sends: responses go to the command that waits for them
+ (matched by seq), events go to a queue (stamped on the GetSecs clock as they arrive) that the caller
+ drains whenever it likes. Transact pipelines: all the commands are written at once and the responses
+ are collected as they come back, so a batch costs one round trip. A command whose response did not
+ come back in time is sent again (with the same seq), up to iRetries times: the commands must be safe
+ to repeat (setters are).
+
+ At most LINK_MAX_IN_FLIGHT commands are pipelined, a quarter of the 255 sequence numbers: a seq
+ comes back only three windows after the one that used it, so a response that arrives after its
+ command timed out cannot be taken for the answer to a new command.
+ Commands with a payload longer than FRAME_MAX_PAYLOAD are refused before anything is written.
+*/
+
+typedef struct {
+	double m_fTime;
+	Frame m_Frame;
+} LinkEvent;
+
+typedef struct {
+	long long m_iSent;			// frames, resends included
+	long long m_iReceived;		// good frames
+	long long m_iCrcErrors;
+	long long m_iResent;
+	long long m_iTimeouts;		// commands that never got a response
+	long long m_iUnexpected;	// responses nobody was waiting for (late duplicates)
+	long long m_iEventsDropped;	// the event queue was full
+	long long m_iReadErrors;
+	long long m_iWriteErrors;	// the commands of a failed write are not waited for
+} LinkStats;
+
+const int LINK_MAX_EVENTS = 4096;
+const int LINK_MAX_IN_FLIGHT = 64;	// commands pipelined at once (seq is 8 bit)
+
+class SerialLink {
+public:
+	SerialLink();
+	~SerialLink() { Close(); }
+	bool Open(const std::string &strPort, int iBaud, std::string &strError);
+	void Close();
+
+	// Responses[k] answers Commands[k] (whose m_iSeq is ignored). False if some response never came back,
+	// if a payload is too long (then nothing is sent), or at once if the port cannot be written.
+	bool Transact(const std::vector<Frame> &Commands, std::vector<Frame> &Responses, double fTimeoutSec, int iRetries);
+	bool Send(const Frame &Command);	// does not wait: whatever comes back is counted as unexpected
+	void TakeEvents(std::vector<LinkEvent> &Events);
+	LinkStats Stats();
+
+private:
+	void Loop();
+	unsigned char NextSeq();
+	bool WriteFrames(const std::vector<Frame> &Commands, const std::vector<int> &aiIndices);
+
+	SerialPort m_Port;
+	std::thread m_Thread;
+	std::atomic<bool> m_bStop;
+	std::mutex m_WriteLock;
+
+	std::mutex m_Lock;						// everything below
+	std::condition_variable m_Arrived;
+	int m_aiPending[256];					// seq -> index of the command waiting for it, -1 if none
+	int m_aiPendingType[256];				// seq -> type of that command
+	int m_iNumPending;
+	std::vector<Frame> *m_pResponses;
+	std::deque<LinkEvent> m_Events;
+	LinkStats m_Stats;
+	unsigned char m_iSeq;
+	FrameParser m_Parser;					// reader thread only
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <system_error>
+#include <vector>
+#include "SerialLoopback.h"
+#include "SerialFrame.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+#include "../../Apps/ChipKitStimGUI/ChipKIT Sketch/StimProtocol/StimSimulated.h"
+
+SerialLoopback::SerialLoopback() : m_iMaster(-1), m_iSlave(-1), m_fEventSec(0), m_iDropEvery(0), m_bNanoStimulator(false), m_bStop(false)
+{
+}
+
+bool SerialLoopback::Start(double fEventSec, int iDropEvery, bool bNanoStimulator, std::string &strSlave, std::string &strError)
+{
+	Stop();
+	m_iMaster = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (m_iMaster < 0 || grantpt(m_iMaster) != 0 || unlockpt(m_iMaster) != 0 || ptsname(m_iMaster) == NULL) {
+		strError = "Unable to open a pseudo terminal.";
+		Stop();
+		return false;
+	}
+	strSlave = ptsname(m_iMaster);
+	// Raw from the start, or the line discipline echoes and translates the first bytes
+	m_iSlave = open(strSlave.c_str(), O_RDWR | O_NOCTTY);
+	struct termios Params;
+	if (m_iSlave < 0 || tcgetattr(m_iSlave, &Params) != 0) {
+		strError = "Unable to open the pseudo terminal slave.";
+		Stop();
+		return false;
+	}
+	cfmakeraw(&Params);
+	tcsetattr(m_iSlave, TCSANOW, &Params);
+
+	m_fEventSec = fEventSec;
+	m_iDropEvery = iDropEvery;
+	m_bNanoStimulator = bNanoStimulator;
+	m_bStop = false;
+	try {
+		m_Thread = std::thread(&SerialLoopback::Loop, this);
+	} catch (const std::system_error &) {
+		strError = "Unable to start the loopback thread.";
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+void SerialLoopback::Stop()
+{
+	if (m_Thread.joinable()) {
+		m_bStop = true;
+		m_Thread.join();
+	}
+	if (m_iSlave >= 0)
+		close(m_iSlave);
+	if (m_iMaster >= 0)
+		close(m_iMaster);
+	m_iMaster = m_iSlave = -1;
+}
+
+static void WriteAll(int iFile, const std::vector<unsigned char> &Bytes)
+{
+	size_t iDone = 0;
+	while (iDone < Bytes.size()) {
+		ssize_t iWritten = write(iFile, &Bytes[iDone], Bytes.size() - iDone);
+		if (iWritten > 0) {
+			iDone += iWritten;
+			continue;
+		}
+		if (iWritten < 0 && errno != EAGAIN && errno != EINTR)
+			return;
+		struct pollfd Poll = {iFile, POLLOUT, 0};
+		if (poll(&Poll, 1, 100) <= 0)
+			return;
+	}
+}
+
+void SerialLoopback::Loop()
+{
+	FrameParser Parser;
+	StimSimulatedDevice Stimulator;
+	StimProtocol Firmware(Stimulator);
+	std::vector<Frame> Commands;
+	std::vector<unsigned char> Out;
+	unsigned char aBuffer[4096];
+	long long iNumCommands = 0;
+	unsigned int iNumEvents = 0;
+	double fNextEvent = ClockGetSecs() + m_fEventSec;
+
+	while (!m_bStop) {
+		int iWaitMS = 20;
+		if (m_fEventSec > 0 && !m_bNanoStimulator)
+			iWaitMS = std::max(0, std::min(iWaitMS, int((fNextEvent - ClockGetSecs()) * 1e3)));
+		struct pollfd Poll = {m_iMaster, POLLIN, 0};
+		Out.clear();
+		if (poll(&Poll, 1, iWaitMS) > 0) {
+			ssize_t iRead = read(m_iMaster, aBuffer, sizeof(aBuffer));
+			if (m_bNanoStimulator) {
+				Stimulator.m_Output.clear();
+				Stimulator.m_Text.clear();
+				unsigned long iNowMs = (unsigned long)(ClockGetSecs() * 1e3);
+				for (ssize_t k = 0; k < iRead; k++)
+					Firmware.Feed(aBuffer[k], iNowMs);
+				Firmware.ReportTriggers();
+				WriteAll(m_iMaster, Stimulator.m_Output);
+				continue;
+			}
+			Commands.clear();
+			if (iRead > 0)
+				Parser.Feed(aBuffer, size_t(iRead), Commands);
+			for (size_t k = 0; k < Commands.size(); k++) {
+				if (Commands[k].m_iType & FRAME_EVENT)
+					continue;
+				if (m_iDropEvery > 0 && ++iNumCommands % m_iDropEvery == 0)
+					continue;
+				FrameEncode(Commands[k], Out);
+			}
+		}
+		if (m_fEventSec > 0 && !m_bNanoStimulator && ClockGetSecs() >= fNextEvent) {
+			iNumEvents++;
+			Frame Event;
+			Event.m_iType = LOOPBACK_EVENT;
+			Event.m_iSeq = (unsigned char)iNumEvents;
+			for (int iByte = 0; iByte < 4; iByte++)
+				Event.m_Payload.push_back((unsigned char)(iNumEvents >> (8 * iByte)));
+			FrameEncode(Event, Out);
+			fNextEvent += m_fEventSec;
+		}
+		if (!Out.empty())
+			WriteAll(m_iMaster, Out);
+	}
+}
+
+#endif
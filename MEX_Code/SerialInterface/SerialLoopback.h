@@ -0,0 +1,47 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef SERIAL_LOOPBACK_H
+#define SERIAL_LOOPBACK_H
+
+#ifndef _WIN32
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+/*
+ A device at the other end of a pseudo terminal, to test the framed link without hardware.
+ Open the slave name it returns as the serial port. It answers every command with the same type,
+ seq and payload, leaves every iDropEvery-th command unanswered (0: none) so that retries happen,
+ and sends a trigger count event (type LOOPBACK_EVENT, uint32 little endian payload) every fEventSec
+ (0: never).
+ With bNanoStimulator, the bytes go to the NanoStimulator firmware parser instead (StimProtocol, with
+ the simulated device of StimSimulated.h), and fEventSec and iDropEvery do nothing.
+*/
+
+const unsigned char LOOPBACK_EVENT = 0x81;
+
+class SerialLoopback {
+public:
+	SerialLoopback();
+	~SerialLoopback() { Stop(); }
+	bool Start(double fEventSec, int iDropEvery, bool bNanoStimulator, std::string &strSlave, std::string &strError);
+	void Stop();
+private:
+	void Loop();
+	int m_iMaster;
+	int m_iSlave;		// kept open: the master reads EIO while no slave is open
+	double m_fEventSec;
+	int m_iDropEvery;
+	bool m_bNanoStimulator;
+	std::thread m_Thread;
+	std::atomic<bool> m_bStop;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,215 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+#include "SerialPort.h"
+
+#ifdef _WIN32
+
+SerialPort::SerialPort() : m_hPort(INVALID_HANDLE_VALUE), m_hReadEvent(NULL), m_hWriteEvent(NULL)
+{
+}
+
+bool SerialPort::Open(const std::string &strPort, int iBaud, std::string &strError)
+{
+	Close();
+	// COM10 and above only open through the device namespace
+	std::string strPath = strPort.compare(0, 4, "\\\\.\\") == 0 ? strPort : "\\\\.\\" + strPort;
+	m_hPort = CreateFileA(strPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	if (m_hPort == INVALID_HANDLE_VALUE) {
+		strError = strPort + " is not available.";
+		return false;
+	}
+
+	DCB Params = {0};
+	Params.DCBlength = sizeof(Params);
+	if (!GetCommState(m_hPort, &Params)) {
+		strError = "Failed to get the serial parameters.";
+		Close();
+		return false;
+	}
+	Params.BaudRate = iBaud;
+	Params.ByteSize = 8;
+	Params.StopBits = ONESTOPBIT;
+	Params.Parity = NOPARITY;
+	Params.fBinary = TRUE;
+	Params.fOutX = Params.fInX = FALSE;
+	Params.fDtrControl = DTR_CONTROL_ENABLE;
+	Params.fRtsControl = RTS_CONTROL_ENABLE;
+	if (!SetCommState(m_hPort, &Params)) {
+		strError = "Could not set the serial parameters.";
+		Close();
+		return false;
+	}
+
+	// A read returns as soon as a byte is there, or after SERIAL_READ_TIMEOUT_MS
+	COMMTIMEOUTS Timeouts = {0};
+	Timeouts.ReadIntervalTimeout = MAXDWORD;
+	Timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+	Timeouts.ReadTotalTimeoutConstant = SERIAL_READ_TIMEOUT_MS;
+	Timeouts.WriteTotalTimeoutConstant = 1000;
+	SetCommTimeouts(m_hPort, &Timeouts);
+	PurgeComm(m_hPort, PURGE_RXCLEAR | PURGE_TXCLEAR);
+
+	m_hReadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	m_hWriteEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	return true;
+}
+
+void SerialPort::Close()
+{
+	if (m_hPort != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hPort);
+	if (m_hReadEvent != NULL)
+		CloseHandle(m_hReadEvent);
+	if (m_hWriteEvent != NULL)
+		CloseHandle(m_hWriteEvent);
+	m_hPort = INVALID_HANDLE_VALUE;
+	m_hReadEvent = m_hWriteEvent = NULL;
+}
+
+bool SerialPort::IsOpen() const
+{
+	return m_hPort != INVALID_HANDLE_VALUE;
+}
+
+int SerialPort::Read(unsigned char *pBuffer, int iMaxBytes)
+{
+	OVERLAPPED Overlapped = {0};
+	Overlapped.hEvent = m_hReadEvent;
+	DWORD iRead = 0;
+	if (!ReadFile(m_hPort, pBuffer, iMaxBytes, &iRead, &Overlapped)) {
+		if (GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult(m_hPort, &Overlapped, &iRead, TRUE))
+			return -1;
+	}
+	return int(iRead);
+}
+
+bool SerialPort::Write(const unsigned char *pData, int iBytes)
+{
+	OVERLAPPED Overlapped = {0};
+	Overlapped.hEvent = m_hWriteEvent;
+	DWORD iWritten = 0;
+	if (!WriteFile(m_hPort, pData, iBytes, &iWritten, &Overlapped)) {
+		if (GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult(m_hPort, &Overlapped, &iWritten, TRUE))
+			return false;
+	}
+	return int(iWritten) == iBytes;
+}
+
+#else
+
+static speed_t BaudConstant(int iBaud)
+{
+	switch (iBaud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+		case 921600: return B921600;
+#endif
+		default: return B0;
+	}
+}
+
+SerialPort::SerialPort() : m_iFile(-1)
+{
+}
+
+bool SerialPort::Open(const std::string &strPort, int iBaud, std::string &strError)
+{
+	Close();
+	speed_t Speed = BaudConstant(iBaud);
+	if (Speed == B0) {
+		strError = "Unsupported baud rate.";
+		return false;
+	}
+	m_iFile = open(strPort.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (m_iFile < 0) {
+		strError = strPort + " is not available.";
+		return false;
+	}
+	struct termios Params;
+	if (tcgetattr(m_iFile, &Params) != 0) {
+		strError = "Failed to get the serial parameters.";
+		Close();
+		return false;
+	}
+	cfmakeraw(&Params);
+	Params.c_cflag |= CLOCAL | CREAD;
+	Params.c_cflag &= ~(CSTOPB | CRTSCTS);
+	Params.c_cc[VMIN] = 0;
+	Params.c_cc[VTIME] = 0;
+	cfsetispeed(&Params, Speed);
+	cfsetospeed(&Params, Speed);
+	if (tcsetattr(m_iFile, TCSANOW, &Params) != 0) {
+		strError = "Could not set the serial parameters.";
+		Close();
+		return false;
+	}
+	tcflush(m_iFile, TCIOFLUSH);
+	return true;
+}
+
+void SerialPort::Close()
+{
+	if (m_iFile >= 0)
+		close(m_iFile);
+	m_iFile = -1;
+}
+
+bool SerialPort::IsOpen() const
+{
+	return m_iFile >= 0;
+}
+
+int SerialPort::Read(unsigned char *pBuffer, int iMaxBytes)
+{
+	struct pollfd Poll = {m_iFile, POLLIN, 0};
+	int iReady = poll(&Poll, 1, SERIAL_READ_TIMEOUT_MS);
+	if (iReady == 0 || (iReady < 0 && errno == EINTR))
+		return 0;
+	if (iReady < 0)
+		return -1;
+	ssize_t iRead = read(m_iFile, pBuffer, iMaxBytes);
+	if (iRead < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	if (iRead == 0 && (Poll.revents & (POLLHUP | POLLERR)))
+		return -1;
+	return int(iRead);
+}
+
+bool SerialPort::Write(const unsigned char *pData, int iBytes)
+{
+	while (iBytes > 0) {
+		ssize_t iWritten = write(m_iFile, pData, iBytes);
+		if (iWritten < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return false;
+			struct pollfd Poll = {m_iFile, POLLOUT, 0};
+			if (poll(&Poll, 1, 1000) <= 0)
+				return false;
+			continue;
+		}
+		pData += iWritten;
+		iBytes -= int(iWritten);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <string>
+
+/*
+ Raw 8N1 serial port (COMx on Windows, /dev/tty* or a pseudo terminal elsewhere).
+ One thread may Read while another one Writes: the Windows handle is overlapped for that reason.
+*/
+
+const int SERIAL_READ_TIMEOUT_MS = 20;	// Read returns 0 when nothing arrived for this long
+
+class SerialPort {
+public:
+	SerialPort();
+	~SerialPort() { Close(); }
+	bool Open(const std::string &strPort, int iBaud, std::string &strError);
+	void Close();
+	bool IsOpen() const;
+	int Read(unsigned char *pBuffer, int iMaxBytes);		// bytes read, 0 on timeout, -1 on error
+	bool Write(const unsigned char *pData, int iBytes);	// all of it, or false
+private:
+#ifdef _WIN32
+	void *m_hPort;
+	void *m_hReadEvent;
+	void *m_hWriteEvent;
+#else
+	int m_iFile;
+#endif
+};
+
+#endif
@@ -0,0 +1,45 @@
+% Framed link against the loopback device (pseudo terminal, Linux/Mac): it echoes every command
+% and sends a trigger count event every 10 ms
+strPort = fndllSerialInterface('StartLoopback', 0.01);
+hLink = fndllSerialInterface('OpenFramed', strPort, 115200, 0);
+
+% A 16 channel train update in one round trip
+aiTypes = 1 + mod(0:15, 10);
+acPayloads = arrayfun(@(k) uint8([k, 0:k]), 0:15, 'UniformOutput', false);
+fStart = GetSecs();
+[acResponses, aiAnswered] = fndllSerialInterface('Transact', hLink, aiTypes, acPayloads);
+fprintf('16 commands in %.2f ms\n', (GetSecs()-fStart)*1e3);
+assert(isequal(aiAnswered, aiTypes) && isequal(acResponses, acPayloads));
+
+WaitSecs(0.2);
+[aiEventTypes, acEvents, afTimes] = fndllSerialInterface('GetEvents', hLink);
+aiCounts = cellfun(@(x) double(typecast(x, 'uint32')), acEvents);
+assert(length(aiCounts) >= 15 && all(aiEventTypes == 129) && all(diff(aiCounts) == 1) && all(diff(afTimes) >= 0));
+fndllSerialInterface('CloseFramed', hLink);
+
+% Every 5th command is lost: resent until it gets through
+strPort = fndllSerialInterface('StartLoopback', 0, 5);
+hLink = fndllSerialInterface('OpenFramed', strPort, 115200, 0);
+acPayloads = arrayfun(@(k) uint8(mod(k, 256)), 1:500, 'UniformOutput', false);
+[acResponses, aiAnswered] = fndllSerialInterface('Transact', hLink, ones(1,500), acPayloads, 0.05, 3);
+strctStats = fndllSerialInterface('GetLinkStats', hLink);
+assert(all(aiAnswered == 1) && isequal(acResponses, acPayloads));
+assert(strctStats.m_iResent > 0 && strctStats.m_iTimeouts == 0 && strctStats.m_iCrcErrors == 0);
+fndllSerialInterface('CloseFramed', hLink);
+
+% Nothing answers: aiAnswered is 0
+strPort = fndllSerialInterface('StartLoopback', 0, 1);
+hLink = fndllSerialInterface('OpenFramed', strPort, 115200, 0);
+[acResponses, aiAnswered] = fndllSerialInterface('Transact', hLink, [3 4], {uint8(1), []}, 0.02, 1);
+assert(all(aiAnswered == 0));
+
+% Payloads longer than what the stimulator takes are refused before anything is sent
+bFailed = false;
+try
+    fndllSerialInterface('Transact', hLink, [3 4], {uint8(1), zeros(1,257,'uint8')});
+catch
+    bFailed = true;
+end
+assert(bFailed);
+fndllSerialInterface('CloseFramed', hLink);
+fndllSerialInterface('StopLoopback');
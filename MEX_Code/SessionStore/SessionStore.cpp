@@ -0,0 +1,690 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "SessionStore.h"
+
+static const char *STORE_IDENTIFIER = "KOFIKO_v2.00C";
+const unsigned long long STORE_HEADER_SIZE = 13 + 8 + 8;
+const size_t CHUNK_ENTRY_SIZE = 64;
+const size_t WRITE_BATCH = 256;		// chunks compressed before they are written out
+const int MAX_STORE_THREADS = 64;
+
+enum {
+	JOB_FLOATS = 0,
+	JOB_TIMES,
+	JOB_WORDS,
+	JOB_WAVES_FLOAT,
+	JOB_WAVES_INT16
+};
+
+void StoreDefaultOptions(StoreOptions_struct &Options)
+{
+	Options.m_iAnalogChunk = 1 << 16;
+	Options.m_iSpikeChunk = 1 << 12;
+	Options.m_fTicksPerSec = 40000;
+	Options.m_iNumThreads = 0;
+	Options.m_bVerify = true;
+}
+
+void StoreInitMember(StoreMember_struct &M, int iType, const std::string &strName)
+{
+	M.m_iType = iType;
+	M.m_strName = strName;
+	M.m_iRawBytes = 0;
+	M.m_iChannel = 0;
+	M.m_fSamplingFreq = 0;
+	M.m_strChannelName.clear();
+	M.m_aiNumSamplesPerFrame.clear();
+	M.m_afStartTS.clear();
+	M.m_strPlxFile.clear();
+	M.m_fChannelID = M.m_fGain = M.m_fThreshold = M.m_fFiltersActive = M.m_fSorted = 0;
+	M.m_iWaveFormLength = 0;
+	M.m_afUnitIndices.clear();
+	M.m_aiNumSpikes.clear();
+	M.m_afIntervals.clear();
+	M.m_iNumStrobeWords = 0;
+	M.m_Chunks.clear();
+}
+
+void StoreParallelFor(size_t n, int iNumThreads, const std::function<void(size_t)> &Fn)
+{
+	if (iNumThreads <= 0)
+		iNumThreads = int(std::thread::hardware_concurrency());
+	if (iNumThreads > MAX_STORE_THREADS)
+		iNumThreads = MAX_STORE_THREADS;
+	if (size_t(iNumThreads) > n)
+		iNumThreads = int(n);
+	if (iNumThreads <= 1) {
+		for (size_t i=0;i<n;i++)
+			Fn(i);
+		return;
+	}
+	std::atomic<size_t> iNext(0);
+	auto Worker = [&]() {
+		size_t i;
+		while ((i = iNext++) < n)
+			Fn(i);
+	};
+	std::vector<std::thread> Workers;
+	for (int k=0;k<iNumThreads;k++)
+		Workers.push_back(std::thread(Worker));
+	for (size_t k=0;k<Workers.size();k++)
+		Workers[k].join();
+}
+
+inline double DoubleAt(const unsigned char *p, size_t i)
+{
+	double v;
+	memcpy(&v, p + 8 * i, 8);
+	return v;
+}
+
+// Earliest and latest of n timestamps (spike timestamps of old dumps are not always sorted)
+static void TimeRange(const unsigned char *pTimestamps, size_t iFirst, size_t n, StoreChunk_struct &C)
+{
+	C.m_fStart = C.m_fEnd = DoubleAt(pTimestamps, iFirst);
+	for (size_t i=1;i<n;i++) {
+		double t = DoubleAt(pTimestamps, iFirst + i);
+		C.m_fStart = std::min(C.m_fStart, t);
+		C.m_fEnd = std::max(C.m_fEnd, t);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// Directory serialization
+
+class ByteWriter {
+public:
+	ByteWriter(Bytes &Out) : m_Out(Out) {}
+	void UInt64(unsigned long long v) { Write(&v, 8); }
+	void Double(double v) { Write(&v, 8); }
+	void String(const std::string &s) {
+		UInt64(s.size());
+		Write(s.c_str(), s.size());
+	}
+	void Write(const void *p, size_t n) {
+		m_Out.insert(m_Out.end(), (const unsigned char *)p, (const unsigned char *)p + n);
+	}
+private:
+	Bytes &m_Out;
+};
+
+class ByteReader {
+public:
+	ByteReader(const unsigned char *p, size_t n) : m_p(p), m_iSize(n), m_iPos(0), m_bOK(true) {}
+	unsigned long long UInt64() { unsigned long long v = 0; Read(&v, 8); return v; }
+	double Double() { double v = 0; Read(&v, 8); return v; }
+	std::string String() {
+		unsigned long long n = UInt64();
+		if (!m_bOK || n > m_iSize - m_iPos) {
+			m_bOK = false;
+			return std::string();
+		}
+		std::string s((const char *)m_p + m_iPos, size_t(n));
+		m_iPos += size_t(n);
+		return s;
+	}
+	void Read(void *pOut, size_t n) {
+		if (!m_bOK || n > m_iSize - m_iPos) {
+			m_bOK = false;
+			return;
+		}
+		memcpy(pOut, m_p + m_iPos, n);
+		m_iPos += n;
+	}
+	// Guards the vector sizes read from the file
+	bool Fits(unsigned long long iCount, size_t iItemSize) {
+		m_bOK = m_bOK && iCount <= (m_iSize - m_iPos) / iItemSize;
+		return m_bOK;
+	}
+	bool OK() const { return m_bOK; }
+private:
+	const unsigned char *m_p;
+	size_t m_iSize, m_iPos;
+	bool m_bOK;
+};
+
+static void WriteMember(ByteWriter &W, const StoreMember_struct &M)
+{
+	W.UInt64(M.m_iType);
+	W.String(M.m_strName);
+	W.UInt64(M.m_iRawBytes);
+	if (M.m_iType == MEMBER_ANALOG) {
+		W.UInt64(M.m_iChannel);
+		W.Double(M.m_fSamplingFreq);
+		W.String(M.m_strChannelName);
+		W.UInt64(M.m_aiNumSamplesPerFrame.size());
+		for (size_t k=0;k<M.m_aiNumSamplesPerFrame.size();k++)
+			W.UInt64(M.m_aiNumSamplesPerFrame[k]);
+		for (size_t k=0;k<M.m_afStartTS.size();k++)
+			W.Double(M.m_afStartTS[k]);
+	} else if (M.m_iType == MEMBER_SPIKES) {
+		W.String(M.m_strPlxFile);
+		W.String(M.m_strChannelName);
+		W.Double(M.m_fChannelID);
+		W.Double(M.m_fGain);
+		W.Double(M.m_fThreshold);
+		W.Double(M.m_fFiltersActive);
+		W.Double(M.m_fSorted);
+		W.UInt64(M.m_iWaveFormLength);
+		W.UInt64(M.m_afUnitIndices.size());
+		for (size_t k=0;k<M.m_afUnitIndices.size();k++)
+			W.Double(M.m_afUnitIndices[k]);
+		for (size_t k=0;k<M.m_aiNumSpikes.size();k++)
+			W.UInt64(M.m_aiNumSpikes[k]);
+		for (size_t k=0;k<M.m_afIntervals.size();k++)
+			W.Double(M.m_afIntervals[k]);
+	} else
+		W.UInt64(M.m_iNumStrobeWords);
+
+	W.UInt64(M.m_Chunks.size());
+	for (size_t k=0;k<M.m_Chunks.size();k++) {
+		const StoreChunk_struct &C = M.m_Chunks[k];
+		unsigned int aiIDs[2] = {(unsigned int)C.m_iColumn, (unsigned int)C.m_iCodec};
+		W.Write(aiIDs, 8);
+		W.UInt64(C.m_iOffset);
+		W.UInt64(C.m_iStoredSize);
+		W.UInt64(C.m_iFirstItem);
+		W.UInt64(C.m_iNumItems);
+		W.Double(C.m_fStart);
+		W.Double(C.m_fEnd);
+		W.Double(C.m_fParam);
+	}
+}
+
+static bool ReadMember(ByteReader &R, StoreMember_struct &M)
+{
+	int iType = int(R.UInt64());
+	StoreInitMember(M, iType, R.String());
+	M.m_iRawBytes = R.UInt64();
+	if (M.m_iType == MEMBER_ANALOG) {
+		M.m_iChannel = int(R.UInt64());
+		M.m_fSamplingFreq = R.Double();
+		M.m_strChannelName = R.String();
+		unsigned long long iNumFrames = R.UInt64();
+		if (!R.Fits(iNumFrames, 16))
+			return false;
+		M.m_aiNumSamplesPerFrame.resize(size_t(iNumFrames));
+		M.m_afStartTS.resize(size_t(iNumFrames));
+		for (size_t k=0;k<iNumFrames;k++)
+			M.m_aiNumSamplesPerFrame[k] = R.UInt64();
+		for (size_t k=0;k<iNumFrames;k++)
+			M.m_afStartTS[k] = R.Double();
+	} else if (M.m_iType == MEMBER_SPIKES) {
+		M.m_strPlxFile = R.String();
+		M.m_strChannelName = R.String();
+		M.m_fChannelID = R.Double();
+		M.m_fGain = R.Double();
+		M.m_fThreshold = R.Double();
+		M.m_fFiltersActive = R.Double();
+		M.m_fSorted = R.Double();
+		M.m_iWaveFormLength = R.UInt64();
+		unsigned long long iNumUnits = R.UInt64();
+		if (!R.Fits(iNumUnits, 32))
+			return false;
+		M.m_afUnitIndices.resize(size_t(iNumUnits));
+		M.m_aiNumSpikes.resize(size_t(iNumUnits));
+		M.m_afIntervals.resize(2 * size_t(iNumUnits));
+		for (size_t k=0;k<iNumUnits;k++)
+			M.m_afUnitIndices[k] = R.Double();
+		for (size_t k=0;k<iNumUnits;k++)
+			M.m_aiNumSpikes[k] = R.UInt64();
+		for (size_t k=0;k<2*iNumUnits;k++)
+			M.m_afIntervals[k] = R.Double();
+	} else if (M.m_iType == MEMBER_STROBE)
+		M.m_iNumStrobeWords = R.UInt64();
+	else
+		return false;
+
+	unsigned long long iNumChunks = R.UInt64();
+	if (!R.Fits(iNumChunks, CHUNK_ENTRY_SIZE))
+		return false;
+	M.m_Chunks.resize(size_t(iNumChunks));
+	for (size_t k=0;k<iNumChunks;k++) {
+		StoreChunk_struct &C = M.m_Chunks[k];
+		unsigned int aiIDs[2] = {0, 0};
+		R.Read(aiIDs, 8);
+		C.m_iColumn = int(aiIDs[0]);
+		C.m_iCodec = int(aiIDs[1]);
+		C.m_iOffset = R.UInt64();
+		C.m_iStoredSize = R.UInt64();
+		C.m_iFirstItem = R.UInt64();
+		C.m_iNumItems = R.UInt64();
+		C.m_fStart = R.Double();
+		C.m_fEnd = R.Double();
+		C.m_fParam = R.Double();
+	}
+	return R.OK();
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// Writer
+
+StoreWriter::StoreWriter(const StoreOptions_struct &Options) : m_Options(Options), m_fp(NULL), m_iPos(0)
+{
+	if (m_Options.m_iAnalogChunk == 0)
+		m_Options.m_iAnalogChunk = 1 << 16;
+	if (m_Options.m_iSpikeChunk == 0)
+		m_Options.m_iSpikeChunk = 1 << 12;
+}
+
+StoreWriter::~StoreWriter()
+{
+	// A store that was not closed has no directory: remove it rather than leave a broken file
+	if (m_fp != NULL) {
+		fclose(m_fp);
+		remove(m_strFileName.c_str());
+	}
+}
+
+bool StoreWriter::Fail(const std::string &strMessage)
+{
+	if (m_strError.empty())
+		m_strError = strMessage;
+	return false;
+}
+
+bool StoreWriter::Open(const std::string &strFileName)
+{
+	m_strFileName = strFileName;
+	m_fp = fopen(strFileName.c_str(), "wb");
+	if (m_fp == NULL)
+		return Fail("Cannot create " + strFileName);
+	unsigned long long aiPlaceholder[2] = {0, 0};
+	if (fwrite(STORE_IDENTIFIER, 1, 13, m_fp) != 13 || fwrite(aiPlaceholder, 8, 2, m_fp) != 2)
+		return Fail("Cannot write " + strFileName);
+	m_iPos = STORE_HEADER_SIZE;
+	return true;
+}
+
+void StoreWriter::EncodeJob(const ChunkJob_struct &Job, Bytes &Out, StoreChunk_struct &Chunk)
+{
+	size_t n = size_t(Chunk.m_iNumItems);
+	size_t iFirst = size_t(Chunk.m_iFirstItem);
+	switch (Job.m_iKind) {
+		case JOB_FLOATS: {
+			std::vector<float> afValues(n + 1);
+			memcpy(&afValues[0], Job.m_pSource + 4 * iFirst, 4 * n);
+			Chunk.m_iCodec = EncodeFloats(&afValues[0], n, Out, Chunk.m_fParam);
+			break;
+		}
+		case JOB_TIMES:
+		case JOB_WORDS: {
+			std::vector<double> afValues(n + 1);
+			if (Job.m_iKind == JOB_TIMES)
+				memcpy(&afValues[0], Job.m_pSource + 8 * iFirst, 8 * n);
+			else
+				for (size_t i=0;i<n;i++) {
+					unsigned long long iWord;
+					memcpy(&iWord, Job.m_pSource + 8 * (iFirst + i), 8);
+					afValues[i] = double(iWord);
+				}
+			if (Job.m_iKind == JOB_TIMES) {
+				Chunk.m_iCodec = EncodeTimestamps(&afValues[0], n, m_Options.m_fTicksPerSec, Out);
+				Chunk.m_fParam = m_Options.m_fTicksPerSec;
+			} else {
+				Chunk.m_iCodec = EncodeIntegers(&afValues[0], n, Out);
+				Chunk.m_fParam = 1;
+			}
+			break;
+		}
+		case JOB_WAVES_FLOAT:
+		case JOB_WAVES_INT16: {
+			// column major NumSpikes x L -> spike after spike
+			size_t L = Job.m_iItemWidth, iRows = Job.m_iSourceRows;
+			size_t iSampleSize = Job.m_iKind == JOB_WAVES_INT16 ? 2 : 4;
+			std::vector<unsigned char> Gathered(iSampleSize * n * L + 4);
+			for (size_t i=0;i<n;i++)
+				for (size_t s=0;s<L;s++)
+					memcpy(&Gathered[iSampleSize * (i * L + s)], Job.m_pSource + iSampleSize * (s * iRows + iFirst + i), iSampleSize);
+			if (Job.m_iKind == JOB_WAVES_INT16) {
+				Chunk.m_iCodec = EncodeScaledInt16((const short *)&Gathered[0], n * L, Out);
+				Chunk.m_fParam = Job.m_fScale;
+			} else
+				Chunk.m_iCodec = EncodeFloats((const float *)&Gathered[0], n * L, Out, Chunk.m_fParam);
+			break;
+		}
+	}
+	Chunk.m_iStoredSize = Out.size();
+}
+
+bool StoreWriter::WriteJobs(StoreMember_struct &M, std::vector<ChunkJob_struct> &Jobs)
+{
+	if (m_fp == NULL)
+		return Fail("Store is not open");
+	for (size_t b=0;b<Jobs.size();b+=WRITE_BATCH) {
+		size_t n = std::min(WRITE_BATCH, Jobs.size() - b);
+		std::vector<Bytes> Payloads(n);
+		StoreParallelFor(n, m_Options.m_iNumThreads, [&](size_t i) {
+			EncodeJob(Jobs[b + i], Payloads[i], Jobs[b + i].m_Chunk);
+		});
+		for (size_t i=0;i<n;i++) {
+			StoreChunk_struct &C = Jobs[b + i].m_Chunk;
+			C.m_iOffset = m_iPos;
+			if (!Payloads[i].empty() && fwrite(&Payloads[i][0], 1, Payloads[i].size(), m_fp) != Payloads[i].size())
+				return Fail("Cannot write " + m_strFileName);
+			m_iPos += Payloads[i].size();
+			M.m_Chunks.push_back(C);
+		}
+	}
+	m_Members.push_back(M);
+	return true;
+}
+
+static void InitJob(StoreChunk_struct &C, int iColumn, unsigned long long iFirst, unsigned long long iCount)
+{
+	memset(&C, 0, sizeof(C));
+	C.m_iColumn = iColumn;
+	C.m_iFirstItem = iFirst;
+	C.m_iNumItems = iCount;
+}
+
+bool StoreWriter::AddAnalog(StoreMember_struct &M, const unsigned char *pSamples)
+{
+	M.m_Chunks.clear();
+	std::vector<ChunkJob_struct> Jobs;
+	// Chunks are cut at frame boundaries so that every chunk covers a single time span
+	unsigned long long iFrameStart = 0;
+	for (size_t f=0;f<M.m_aiNumSamplesPerFrame.size();f++) {
+		unsigned long long iFrameSamples = M.m_aiNumSamplesPerFrame[f];
+		for (unsigned long long i=0;i<iFrameSamples;i+=m_Options.m_iAnalogChunk) {
+			ChunkJob_struct J;
+			unsigned long long n = std::min((unsigned long long)m_Options.m_iAnalogChunk, iFrameSamples - i);
+			InitJob(J.m_Chunk, COLUMN_SAMPLES, iFrameStart + i, n);
+			J.m_Chunk.m_fStart = M.m_afStartTS[f] + double(i) / M.m_fSamplingFreq;
+			J.m_Chunk.m_fEnd = M.m_afStartTS[f] + double(i + n - 1) / M.m_fSamplingFreq;
+			J.m_pSource = pSamples;
+			J.m_iKind = JOB_FLOATS;
+			J.m_iItemWidth = 1;
+			J.m_iSourceRows = 0;
+			J.m_fScale = 1;
+			Jobs.push_back(J);
+		}
+		iFrameStart += iFrameSamples;
+	}
+	return WriteJobs(M, Jobs);
+}
+
+bool StoreWriter::AddStrobe(StoreMember_struct &M, const unsigned char *pWords, const unsigned char *pTimestamps)
+{
+	M.m_Chunks.clear();
+	std::vector<ChunkJob_struct> Jobs;
+	for (int iColumn=COLUMN_WORDS;iColumn<=COLUMN_STROBE_TIMES;iColumn++) {
+		for (unsigned long long i=0;i<M.m_iNumStrobeWords;i+=m_Options.m_iAnalogChunk) {
+			ChunkJob_struct J;
+			unsigned long long n = std::min((unsigned long long)m_Options.m_iAnalogChunk, M.m_iNumStrobeWords - i);
+			InitJob(J.m_Chunk, iColumn, i, n);
+			TimeRange(pTimestamps, size_t(i), size_t(n), J.m_Chunk);
+			J.m_pSource = iColumn == COLUMN_WORDS ? pWords : pTimestamps;
+			J.m_iKind = iColumn == COLUMN_WORDS ? JOB_WORDS : JOB_TIMES;
+			J.m_iItemWidth = 1;
+			J.m_iSourceRows = 0;
+			J.m_fScale = 1;
+			Jobs.push_back(J);
+		}
+	}
+	return WriteJobs(M, Jobs);
+}
+
+bool StoreWriter::AddSpikes(StoreMember_struct &M, const std::vector<const unsigned char *> &Timestamps,
+							const std::vector<const unsigned char *> &Waveforms, bool bInt16, double fWaveFormScale)
+{
+	M.m_Chunks.clear();
+	std::vector<ChunkJob_struct> Jobs;
+	for (size_t u=0;u<M.m_aiNumSpikes.size();u++) {
+		unsigned long long iNumSpikes = M.m_aiNumSpikes[u];
+		for (int iWaves=0;iWaves<2;iWaves++) {
+			for (unsigned long long i=0;i<iNumSpikes;i+=m_Options.m_iSpikeChunk) {
+				ChunkJob_struct J;
+				unsigned long long n = std::min((unsigned long long)m_Options.m_iSpikeChunk, iNumSpikes - i);
+				InitJob(J.m_Chunk, iWaves ? SpikeWavesColumn(int(u)) : SpikeTimesColumn(int(u)), i, n);
+				TimeRange(Timestamps[u], size_t(i), size_t(n), J.m_Chunk);
+				J.m_pSource = iWaves ? Waveforms[u] : Timestamps[u];
+				J.m_iKind = iWaves ? (bInt16 ? JOB_WAVES_INT16 : JOB_WAVES_FLOAT) : JOB_TIMES;
+				J.m_iItemWidth = size_t(M.m_iWaveFormLength);
+				J.m_iSourceRows = size_t(iNumSpikes);
+				J.m_fScale = fWaveFormScale;
+				Jobs.push_back(J);
+			}
+		}
+	}
+	return WriteJobs(M, Jobs);
+}
+
+bool StoreWriter::Close()
+{
+	if (m_fp == NULL)
+		return Fail("Store is not open");
+	Bytes Directory;
+	ByteWriter W(Directory);
+	W.UInt64(m_Members.size());
+	for (size_t k=0;k<m_Members.size();k++)
+		WriteMember(W, m_Members[k]);
+	unsigned long long aiDirectory[2] = {m_iPos, Directory.size()};
+	bool bOK = fwrite(&Directory[0], 1, Directory.size(), m_fp) == Directory.size();
+	bOK = bOK && fseek(m_fp, 13, SEEK_SET) == 0 && fwrite(aiDirectory, 8, 2, m_fp) == 2;
+	bOK = (fclose(m_fp) == 0) && bOK;
+	m_fp = NULL;
+	if (!bOK) {
+		remove(m_strFileName.c_str());
+		return Fail("Cannot write " + m_strFileName);
+	}
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// Reader
+
+StoreReader::StoreReader(int iNumThreads) : m_iNumThreads(iNumThreads)
+{
+}
+
+bool StoreReader::Open(const std::string &strFileName)
+{
+	m_Members.clear();
+	if (!m_File.Open(strFileName.c_str())) {
+		m_strError = "Cannot open " + strFileName;
+		return false;
+	}
+	unsigned long long aiDirectory[2];
+	if (m_File.Size() < STORE_HEADER_SIZE || memcmp(m_File.Data(), STORE_IDENTIFIER, 13) != 0) {
+		m_strError = "Not a session store: " + strFileName;
+		return false;
+	}
+	memcpy(aiDirectory, m_File.Data() + 13, 16);
+	if (aiDirectory[0] < STORE_HEADER_SIZE || aiDirectory[0] > m_File.Size() || aiDirectory[1] > m_File.Size() - aiDirectory[0] ||
+		!ParseDirectory(m_File.Data() + aiDirectory[0], size_t(aiDirectory[1]))) {
+		m_strError = "Session store is truncated or was not closed: " + strFileName;
+		return false;
+	}
+	// Every chunk must lie between the header and the directory, and must not claim more values than
+	// its payload can hold (every codec spends at least one byte per 128 values)
+	for (size_t m=0;m<m_Members.size();m++) {
+		const StoreMember_struct &M = m_Members[m];
+		for (size_t k=0;k<M.m_Chunks.size();k++) {
+			const StoreChunk_struct &C = M.m_Chunks[k];
+			unsigned long long iItemWidth = M.m_iType == MEMBER_SPIKES && (C.m_iColumn & 1) ? std::max(M.m_iWaveFormLength, 1ULL) : 1;
+			if (C.m_iOffset < STORE_HEADER_SIZE || C.m_iOffset > aiDirectory[0] || C.m_iStoredSize > aiDirectory[0] - C.m_iOffset ||
+				C.m_iNumItems > 128 * (C.m_iStoredSize + 1) / iItemWidth) {
+				m_strError = "Corrupted chunk table in " + strFileName;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool StoreReader::ParseDirectory(const unsigned char *pDirectory, size_t iSize)
+{
+	ByteReader R(pDirectory, iSize);
+	unsigned long long iNumMembers = R.UInt64();
+	if (!R.Fits(iNumMembers, 24))
+		return false;
+	m_Members.resize(size_t(iNumMembers));
+	for (size_t k=0;k<iNumMembers;k++)
+		if (!ReadMember(R, m_Members[k]))
+			return false;
+	return R.OK();
+}
+
+const StoreMember_struct *StoreReader::FindMember(const std::string &strName) const
+{
+	for (size_t k=0;k<m_Members.size();k++)
+		if (m_Members[k].m_strName == strName)
+			return &m_Members[k];
+	return NULL;
+}
+
+unsigned long long StoreReader::StoredBytes(const StoreMember_struct &M) const
+{
+	unsigned long long iBytes = 0;
+	for (size_t k=0;k<M.m_Chunks.size();k++)
+		iBytes += M.m_Chunks[k].m_iStoredSize;
+	return iBytes;
+}
+
+void StoreReader::ColumnChunks(const StoreMember_struct &M, int iColumn, std::vector<size_t> &aiChunks) const
+{
+	aiChunks.clear();
+	for (size_t k=0;k<M.m_Chunks.size();k++)
+		if (M.m_Chunks[k].m_iColumn == iColumn)
+			aiChunks.push_back(k);
+}
+
+int StoreReader::ChunkOfItem(const StoreMember_struct &M, const std::vector<size_t> &aiColumnChunks, unsigned long long iItem) const
+{
+	size_t iLow = 0, iHigh = aiColumnChunks.size();
+	while (iLow < iHigh) {
+		size_t iMid = (iLow + iHigh) / 2;
+		if (M.m_Chunks[aiColumnChunks[iMid]].m_iFirstItem <= iItem)
+			iLow = iMid + 1;
+		else
+			iHigh = iMid;
+	}
+	if (iLow == 0)
+		return -1;
+	const StoreChunk_struct &C = M.m_Chunks[aiColumnChunks[iLow - 1]];
+	return iItem < C.m_iFirstItem + C.m_iNumItems ? int(aiColumnChunks[iLow - 1]) : -1;
+}
+
+bool StoreReader::DecodeFloatChunks(const StoreMember_struct &M, const std::vector<size_t> &aiChunks, size_t iItemWidth,
+									std::vector<std::vector<float> > &Out)
+{
+	Out.resize(aiChunks.size());
+	std::atomic<bool> bOK(true);
+	StoreParallelFor(aiChunks.size(), m_iNumThreads, [&](size_t k) {
+		const StoreChunk_struct &C = M.m_Chunks[aiChunks[k]];
+		size_t n = size_t(C.m_iNumItems) * iItemWidth;
+		Out[k].resize(n);
+		if (!DecodeFloats(C.m_iCodec, C.m_fParam, m_File.Data() + C.m_iOffset, size_t(C.m_iStoredSize), n, n > 0 ? &Out[k][0] : NULL))
+			bOK = false;
+	});
+	if (!bOK)
+		m_strError = "Corrupted chunk in member " + M.m_strName;
+	return bOK;
+}
+
+bool StoreReader::DecodeDoubleChunks(const StoreMember_struct &M, const std::vector<size_t> &aiChunks, std::vector<std::vector<double> > &Out)
+{
+	Out.resize(aiChunks.size());
+	std::atomic<bool> bOK(true);
+	StoreParallelFor(aiChunks.size(), m_iNumThreads, [&](size_t k) {
+		const StoreChunk_struct &C = M.m_Chunks[aiChunks[k]];
+		size_t n = size_t(C.m_iNumItems);
+		Out[k].resize(n);
+		if (!DecodeDoubles(C.m_iCodec, C.m_fParam, m_File.Data() + C.m_iOffset, size_t(C.m_iStoredSize), n, n > 0 ? &Out[k][0] : NULL))
+			bOK = false;
+	});
+	if (!bOK)
+		m_strError = "Corrupted chunk in member " + M.m_strName;
+	return bOK;
+}
+
+// Chunks of iColumn that overlap items [iFirst, iFirst + iCount)
+static void OverlappingChunks(const StoreMember_struct &M, int iColumn, unsigned long long iFirst, unsigned long long iCount,
+							  std::vector<size_t> &aiChunks)
+{
+	aiChunks.clear();
+	for (size_t k=0;k<M.m_Chunks.size();k++) {
+		const StoreChunk_struct &C = M.m_Chunks[k];
+		if (C.m_iColumn == iColumn && C.m_iFirstItem < iFirst + iCount && C.m_iFirstItem + C.m_iNumItems > iFirst)
+			aiChunks.push_back(k);
+	}
+}
+
+bool StoreReader::ReadFloats(const StoreMember_struct &M, int iColumn, unsigned long long iFirst, unsigned long long iCount,
+							 size_t iItemWidth, float *afOut)
+{
+	std::vector<size_t> aiChunks;
+	OverlappingChunks(M, iColumn, iFirst, iCount, aiChunks);
+	unsigned long long iCovered = 0;
+	for (size_t k=0;k<aiChunks.size();k++) {
+		const StoreChunk_struct &C = M.m_Chunks[aiChunks[k]];
+		iCovered += std::min(C.m_iFirstItem + C.m_iNumItems, iFirst + iCount) - std::max(C.m_iFirstItem, iFirst);
+	}
+	if (iCovered != iCount) {
+		m_strError = "Items out of range in member " + M.m_strName;
+		return false;
+	}
+	// Each chunk is decoded and copied by one thread; the output ranges do not overlap
+	std::atomic<bool> bOK(true);
+	StoreParallelFor(aiChunks.size(), m_iNumThreads, [&](size_t k) {
+		const StoreChunk_struct &C = M.m_Chunks[aiChunks[k]];
+		size_t n = size_t(C.m_iNumItems) * iItemWidth;
+		std::vector<float> afChunk(n + 1);
+		if (!DecodeFloats(C.m_iCodec, C.m_fParam, m_File.Data() + C.m_iOffset, size_t(C.m_iStoredSize), n, &afChunk[0])) {
+			bOK = false;
+			return;
+		}
+		unsigned long long iStart = std::max(C.m_iFirstItem, iFirst);
+		unsigned long long iEnd = std::min(C.m_iFirstItem + C.m_iNumItems, iFirst + iCount);
+		size_t iSrc = size_t(iStart - C.m_iFirstItem), iDst = size_t(iStart - iFirst), m = size_t(iEnd - iStart);
+		if (iItemWidth == 1)
+			memcpy(afOut + iDst, &afChunk[iSrc], 4 * m);
+		else
+			for (size_t i=0;i<m;i++)
+				for (size_t s=0;s<iItemWidth;s++)
+					afOut[s * size_t(iCount) + iDst + i] = afChunk[(iSrc + i) * iItemWidth + s];
+	});
+	if (!bOK)
+		m_strError = "Corrupted chunk in member " + M.m_strName;
+	return bOK;
+}
+
+bool StoreReader::ReadDoubles(const StoreMember_struct &M, int iColumn, unsigned long long iFirst, unsigned long long iCount, double *afOut)
+{
+	std::vector<size_t> aiChunks;
+	OverlappingChunks(M, iColumn, iFirst, iCount, aiChunks);
+	unsigned long long iCovered = 0;
+	for (size_t k=0;k<aiChunks.size();k++) {
+		const StoreChunk_struct &C = M.m_Chunks[aiChunks[k]];
+		iCovered += std::min(C.m_iFirstItem + C.m_iNumItems, iFirst + iCount) - std::max(C.m_iFirstItem, iFirst);
+	}
+	if (iCovered != iCount) {
+		m_strError = "Items out of range in member " + M.m_strName;
+		return false;
+	}
+	std::atomic<bool> bOK(true);
+	StoreParallelFor(aiChunks.size(), m_iNumThreads, [&](size_t k) {
+		const StoreChunk_struct &C = M.m_Chunks[aiChunks[k]];
+		size_t n = size_t(C.m_iNumItems);
+		std::vector<double> afChunk(n + 1);
+		if (!DecodeDoubles(C.m_iCodec, C.m_fParam, m_File.Data() + C.m_iOffset, size_t(C.m_iStoredSize), n, &afChunk[0])) {
+			bOK = false;
+			return;
+		}
+		unsigned long long iStart = std::max(C.m_iFirstItem, iFirst);
+		unsigned long long iEnd = std::min(C.m_iFirstItem + C.m_iNumItems, iFirst + iCount);
+		memcpy(afOut + (iStart - iFirst), &afChunk[size_t(iStart - C.m_iFirstItem)], 8 * size_t(iEnd - iStart));
+	});
+	if (!bOK)
+		m_strError = "Corrupted chunk in member " + M.m_strName;
+	return bOK;
+}
@@ -0,0 +1,196 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "StoreCodec.h"
+#include "../ReadDumpAnalog/MappedFile.h"
+
+/*
+ Single file columnar store for the raw files of a session (<Session>.kst).
+
+ Every raw file (<Session>-<Name>.raw) becomes a member called <Name> that keeps the header of the
+ raw file and splits its data into columns:
+   analog channel (KOFIKO_v1.00A)    column 0: samples
+   strobe words (KOFIKO_v1.00E)      column 0: words, column 1: timestamps
+   spike channel (v1.02S / v1.03S)   column 2u: timestamps of unit u, column 2u+1: its waveforms
+                                     (one item per spike, stored spike after spike)
+ Columns are cut into chunks (m_iAnalogChunk samples, m_iSpikeChunk spikes) that are compressed
+ on their own (see StoreCodec.h), so a reader only decodes the chunks it needs, and decodes them
+ in parallel. Every chunk records the earliest and latest time of its items: that is the time index.
+
+ File layout:
+   "KOFIKO_v2.00C", uint64 directory offset, uint64 directory size
+   chunk payloads
+   directory: uint64 NumMembers, then per member its header fields and chunk table
+ The directory is written last, so a file that was not closed properly has no directory and is
+ rejected by the reader.
+*/
+
+enum {
+	MEMBER_ANALOG = 0,
+	MEMBER_STROBE = 1,
+	MEMBER_SPIKES = 2
+};
+
+enum {
+	COLUMN_SAMPLES = 0,
+	COLUMN_WORDS = 0,
+	COLUMN_STROBE_TIMES = 1
+};
+
+inline int SpikeTimesColumn(int iUnit) { return 2 * iUnit; }
+inline int SpikeWavesColumn(int iUnit) { return 2 * iUnit + 1; }
+
+typedef struct {
+	int m_iColumn;
+	int m_iCodec;
+	unsigned long long m_iOffset;
+	unsigned long long m_iStoredSize;
+	unsigned long long m_iFirstItem;
+	unsigned long long m_iNumItems;
+	double m_fStart;	// earliest and latest time of the items
+	double m_fEnd;
+	double m_fParam;	// codec parameter (scale, ticks per second)
+} StoreChunk_struct;
+
+typedef struct {
+	int m_iType;
+	std::string m_strName;
+	unsigned long long m_iRawBytes;		// size of the raw file the member came from
+
+	// MEMBER_ANALOG
+	int m_iChannel;
+	double m_fSamplingFreq;
+	std::string m_strChannelName;
+	std::vector<unsigned long long> m_aiNumSamplesPerFrame;
+	std::vector<double> m_afStartTS;
+
+	// MEMBER_SPIKES (m_strChannelName is shared with the analog members)
+	std::string m_strPlxFile;
+	double m_fChannelID;
+	double m_fGain;
+	double m_fThreshold;
+	double m_fFiltersActive;
+	double m_fSorted;
+	unsigned long long m_iWaveFormLength;
+	std::vector<double> m_afUnitIndices;
+	std::vector<unsigned long long> m_aiNumSpikes;
+	std::vector<double> m_afIntervals;	// NumUnits x 2, column major
+
+	// MEMBER_STROBE
+	unsigned long long m_iNumStrobeWords;
+
+	std::vector<StoreChunk_struct> m_Chunks;	// ordered by column, then by first item
+} StoreMember_struct;
+
+typedef struct {
+	size_t m_iAnalogChunk;		// samples per chunk
+	size_t m_iSpikeChunk;		// spikes per chunk
+	double m_fTicksPerSec;		// clock of the timestamps (plexon: 40 kHz)
+	int m_iNumThreads;			// 0: number of cores
+	bool m_bVerify;				// decode every member after packing and compare it with its raw file
+} StoreOptions_struct;
+
+void StoreDefaultOptions(StoreOptions_struct &Options);
+void StoreInitMember(StoreMember_struct &M, int iType, const std::string &strName);
+
+class StoreWriter {
+public:
+	StoreWriter(const StoreOptions_struct &Options);
+	~StoreWriter();
+
+	bool Open(const std::string &strFileName);
+	// M holds the header fields of the member; its chunk table is filled in
+	bool AddAnalog(StoreMember_struct &M, const unsigned char *pSamples);
+	// Strobe words are uint64 in the raw file and are kept as doubles (as fnReadDumpStrobeFile returns them)
+	bool AddStrobe(StoreMember_struct &M, const unsigned char *pWords, const unsigned char *pTimestamps);
+	// Per unit: timestamps (double) and the NumSpikes x WaveFormLength waveform matrix (column major),
+	// either float32 or int16 (value = int16 * fWaveFormScale). Pointers need not be aligned.
+	bool AddSpikes(StoreMember_struct &M, const std::vector<const unsigned char *> &Timestamps,
+				   const std::vector<const unsigned char *> &Waveforms, bool bInt16, double fWaveFormScale);
+	// Writes the directory
+	bool Close();
+
+	const std::string &GetError() const { return m_strError; }
+
+private:
+	typedef struct {
+		StoreChunk_struct m_Chunk;
+		const unsigned char *m_pSource;
+		int m_iKind;
+		size_t m_iItemWidth;	// waveform length
+		size_t m_iSourceRows;	// rows of the column major waveform matrix
+		double m_fScale;
+	} ChunkJob_struct;
+
+	bool WriteJobs(StoreMember_struct &M, std::vector<ChunkJob_struct> &Jobs);
+	void EncodeJob(const ChunkJob_struct &Job, Bytes &Out, StoreChunk_struct &Chunk);
+	bool Fail(const std::string &strMessage);
+
+	StoreOptions_struct m_Options;
+	FILE *m_fp;
+	std::string m_strFileName;
+	unsigned long long m_iPos;
+	std::vector<StoreMember_struct> m_Members;
+	std::string m_strError;
+};
+
+class StoreReader {
+public:
+	StoreReader(int iNumThreads = 0);
+
+	bool Open(const std::string &strFileName);
+	const std::vector<StoreMember_struct> &GetMembers() const { return m_Members; }
+	const StoreMember_struct *FindMember(const std::string &strName) const;
+	unsigned long long StoredBytes(const StoreMember_struct &M) const;
+
+	// Items [iFirst, iFirst + iCount) of a float column. Items of iItemWidth values (waveforms) are
+	// returned as the iCount x iItemWidth column major matrix.
+	bool ReadFloats(const StoreMember_struct &M, int iColumn, unsigned long long iFirst, unsigned long long iCount,
+					size_t iItemWidth, float *afOut);
+	bool ReadDoubles(const StoreMember_struct &M, int iColumn, unsigned long long iFirst, unsigned long long iCount, double *afOut);
+
+	// Chunks of a column (indices into M.m_Chunks), and the chunk that holds an item (-1 if none)
+	void ColumnChunks(const StoreMember_struct &M, int iColumn, std::vector<size_t> &aiChunks) const;
+	int ChunkOfItem(const StoreMember_struct &M, const std::vector<size_t> &aiColumnChunks, unsigned long long iItem) const;
+	// Decodes whole chunks in parallel (Out[k] holds chunk aiChunks[k], iItemWidth values per item)
+	bool DecodeFloatChunks(const StoreMember_struct &M, const std::vector<size_t> &aiChunks, size_t iItemWidth,
+						   std::vector<std::vector<float> > &Out);
+	bool DecodeDoubleChunks(const StoreMember_struct &M, const std::vector<size_t> &aiChunks, std::vector<std::vector<double> > &Out);
+
+	const std::string &GetError() const { return m_strError; }
+
+private:
+	bool ParseDirectory(const unsigned char *pDirectory, size_t iSize);
+
+	MappedFile m_File;
+	int m_iNumThreads;
+	std::vector<StoreMember_struct> m_Members;
+	std::string m_strError;
+};
+
+// Runs Fn(0..n-1) on iNumThreads threads (0: number of cores)
+void StoreParallelFor(size_t n, int iNumThreads, const std::function<void(size_t)> &Fn);
+
+/*
+ Raw file import (StoreImport.cpp). Supported: KOFIKO_v1.00A, KOFIKO_v1.00E, KOFIKO_v1.02S and KOFIKO_v1.03S.
+ v1.01S files (several channels in one file) are left out.
+*/
+
+// <Session>-<Name>.raw -> <Name> (the whole file name without .raw if it does not start with <Session>-)
+std::string StoreMemberName(const std::string &strStoreFile, const std::string &strRawFile);
+bool StoreAddRawFile(StoreWriter &Writer, const std::string &strRawFile, const std::string &strName, std::string &strError);
+bool StoreVerifyRawFile(StoreReader &Reader, const std::string &strRawFile, const std::string &strName, std::string &strError);
+bool StorePackRawFiles(const std::string &strStoreFile, const std::vector<std::string> &acRawFiles,
+					   const StoreOptions_struct &Options, std::string &strError);
+
+#endif
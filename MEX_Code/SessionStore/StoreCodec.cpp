@@ -0,0 +1,381 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#include <math.h>
+#include "StoreCodec.h"
+
+const size_t PACK_BLOCK = 128;
+const int MAX_SCALE_DIVISOR = 4;
+
+inline unsigned long long LowBits(int w)
+{
+	return w >= 64 ? ~0ULL : ((1ULL << w) - 1);
+}
+
+inline unsigned long long ZigZag(long long v)
+{
+	return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+inline long long UnZigZag(unsigned long long u)
+{
+	return (long long)(u >> 1) ^ -(long long)(u & 1);
+}
+
+class BitPacker {
+public:
+	BitPacker(Bytes &Out) : m_Out(Out), m_iAcc(0), m_iBits(0) {}
+	void Put(unsigned long long v, int w) {
+		while (w > 0) {
+			int k = w > 32 ? 32 : w;
+			m_iAcc |= (v & LowBits(k)) << m_iBits;
+			m_iBits += k;
+			v = k < 64 ? v >> k : 0;
+			w -= k;
+			while (m_iBits >= 8) {
+				m_Out.push_back((unsigned char)(m_iAcc & 0xFF));
+				m_iAcc >>= 8;
+				m_iBits -= 8;
+			}
+		}
+	}
+	void Flush() {
+		if (m_iBits > 0)
+			m_Out.push_back((unsigned char)(m_iAcc & 0xFF));
+		m_iAcc = 0;
+		m_iBits = 0;
+	}
+private:
+	Bytes &m_Out;
+	unsigned long long m_iAcc;
+	int m_iBits;
+};
+
+class BitUnpacker {
+public:
+	BitUnpacker(const unsigned char *pIn, size_t iSize) : m_pIn(pIn), m_iSize(iSize), m_iPos(0), m_iAcc(0), m_iBits(0), m_bOK(true) {}
+	unsigned long long Get(int w) {
+		unsigned long long v = 0;
+		int iGot = 0;
+		while (iGot < w) {
+			int k = (w - iGot) > 32 ? 32 : (w - iGot);
+			while (m_iBits < k) {
+				if (m_iPos >= m_iSize) {
+					m_bOK = false;
+					return 0;
+				}
+				m_iAcc |= (unsigned long long)m_pIn[m_iPos++] << m_iBits;
+				m_iBits += 8;
+			}
+			v |= (m_iAcc & LowBits(k)) << iGot;
+			m_iAcc >>= k;
+			m_iBits -= k;
+			iGot += k;
+		}
+		return v;
+	}
+	int Byte() {
+		Align();
+		if (m_iPos >= m_iSize) {
+			m_bOK = false;
+			return 0;
+		}
+		return m_pIn[m_iPos++];
+	}
+	void Align() {
+		m_iAcc = 0;
+		m_iBits = 0;
+	}
+	bool OK() const { return m_bOK; }
+private:
+	const unsigned char *m_pIn;
+	size_t m_iSize, m_iPos;
+	unsigned long long m_iAcc;
+	int m_iBits;
+	bool m_bOK;
+};
+
+static void PackBlocks(const unsigned long long *aiValues, size_t n, Bytes &Out)
+{
+	BitPacker Packer(Out);
+	for (size_t b=0;b<n;b+=PACK_BLOCK) {
+		size_t m = (n - b) < PACK_BLOCK ? (n - b) : PACK_BLOCK;
+		unsigned long long iAll = 0;
+		for (size_t i=0;i<m;i++)
+			iAll |= aiValues[b + i];
+		int w = 0;
+		while (w < 64 && (iAll >> w) != 0)
+			w++;
+		Out.push_back((unsigned char)w);
+		for (size_t i=0;i<m;i++)
+			Packer.Put(aiValues[b + i], w);
+		Packer.Flush();
+	}
+}
+
+static bool UnpackBlocks(const unsigned char *pIn, size_t iSize, size_t n, unsigned long long *aiValues)
+{
+	BitUnpacker Unpacker(pIn, iSize);
+	for (size_t b=0;b<n;b+=PACK_BLOCK) {
+		size_t m = (n - b) < PACK_BLOCK ? (n - b) : PACK_BLOCK;
+		int w = Unpacker.Byte();
+		if (w > 64)
+			return false;
+		for (size_t i=0;i<m;i++)
+			aiValues[b + i] = Unpacker.Get(w);
+		Unpacker.Align();
+		if (!Unpacker.OK())
+			return false;
+	}
+	return true;
+}
+
+static void Append(Bytes &Out, const void *pData, size_t iNumBytes)
+{
+	const unsigned char *p = (const unsigned char *)pData;
+	Out.insert(Out.end(), p, p + iNumBytes);
+}
+
+// First value, then the zigzag deltas
+static void EncodeInt64(const long long *aiValues, size_t n, Bytes &Out)
+{
+	if (n == 0)
+		return;
+	Append(Out, &aiValues[0], 8);
+	std::vector<unsigned long long> aiDeltas(n - 1);
+	for (size_t i=1;i<n;i++)
+		aiDeltas[i-1] = ZigZag(aiValues[i] - aiValues[i-1]);
+	PackBlocks(aiDeltas.empty() ? NULL : &aiDeltas[0], n - 1, Out);
+}
+
+static bool DecodeInt64(const unsigned char *pIn, size_t iSize, size_t n, long long *aiValues)
+{
+	if (n == 0)
+		return true;
+	if (iSize < 8)
+		return false;
+	memcpy(&aiValues[0], pIn, 8);
+	std::vector<unsigned long long> aiDeltas(n - 1);
+	if (n > 1 && !UnpackBlocks(pIn + 8, iSize - 8, n - 1, &aiDeltas[0]))
+		return false;
+	for (size_t i=1;i<n;i++)
+		aiValues[i] = aiValues[i-1] + UnZigZag(aiDeltas[i-1]);
+	return true;
+}
+
+// Ticks must stay far from the int64 range so that the deltas never overflow
+const double MAX_TICK = 4.0e18;
+
+int EncodeTimestamps(const double *afValues, size_t n, double fTicksPerSec, Bytes &Out)
+{
+	Out.clear();
+	std::vector<long long> aiTicks(n);
+	bool bTicks = fTicksPerSec > 0;
+	for (size_t i=0;bTicks && i<n;i++) {
+		double fTick = floor(afValues[i] * fTicksPerSec + 0.5);
+		bTicks = fabs(fTick) < MAX_TICK && fTick / fTicksPerSec == afValues[i];
+		aiTicks[i] = (long long)fTick;
+	}
+	if (!bTicks) {
+		Append(Out, afValues, 8 * n);
+		return CODEC_RAW;
+	}
+	EncodeInt64(n > 0 ? &aiTicks[0] : NULL, n, Out);
+	return CODEC_TICKS;
+}
+
+int EncodeIntegers(const double *afValues, size_t n, Bytes &Out)
+{
+	int iCodec = EncodeTimestamps(afValues, n, 1.0, Out);
+	return iCodec == CODEC_TICKS ? CODEC_DELTA : iCodec;
+}
+
+static void EncodeInt16Stream(const std::vector<int> &aiValues, Bytes &Out)
+{
+	std::vector<unsigned long long> aiDeltas(aiValues.size());
+	int iPrev = 0;
+	for (size_t i=0;i<aiValues.size();i++) {
+		aiDeltas[i] = ZigZag(aiValues[i] - iPrev);
+		iPrev = aiValues[i];
+	}
+	PackBlocks(aiDeltas.empty() ? NULL : &aiDeltas[0], aiDeltas.size(), Out);
+}
+
+inline bool SameBits(float a, float b)
+{
+	return memcmp(&a, &b, 4) == 0;
+}
+
+typedef struct {
+	unsigned long long m_iIndex;
+	float m_fValue;
+} Exception_struct;
+
+// Quantizes with fScale; returns the number of values that do not come back bit exact
+static size_t Quantize(const float *afValues, size_t n, double fScale, std::vector<int> &aiValues, std::vector<Exception_struct> *pExceptions)
+{
+	size_t iNumExceptions = 0;
+	int iPrev = 0;
+	for (size_t i=0;i<n;i++) {
+		double q = floor(afValues[i] / fScale + 0.5);
+		bool bOK = q == q && fabs(q) <= 32767;
+		int iValue = bOK ? int(q) : iPrev;
+		if (!bOK || !SameBits(float(iValue * fScale), afValues[i])) {
+			iNumExceptions++;
+			if (pExceptions != NULL) {
+				Exception_struct E;
+				E.m_iIndex = i;
+				E.m_fValue = afValues[i];
+				pExceptions->push_back(E);
+			}
+		}
+		aiValues[i] = iValue;
+		iPrev = iValue;
+	}
+	return iNumExceptions;
+}
+
+/*
+ The scale is not stored in the raw files, so it is estimated: the smallest non zero magnitude, or
+ the smallest step between neighbouring samples (for chunks that never come near zero), is usually
+ one a/d step or a small multiple of it. The estimate is refined by least squares, first on the
+ differences between neighbours (small multiples of the scale, so their rounding to the lattice is
+ reliable) and then on the values themselves, which brings the scale close enough for
+ float(q * scale) to reproduce the stored values bit for bit.
+*/
+static double FitScale(const float *afValues, size_t n, double s, bool bDifferences, double fTolerance)
+{
+	double fNum = 0, fDen = 0;
+	for (size_t i=bDifferences ? 1 : 0;i<n;i++) {
+		double v = bDifferences ? double(afValues[i]) - double(afValues[i-1]) : double(afValues[i]);
+		double q = floor(v / s + 0.5);
+		// values that are off the lattice (outliers, NaN) are left out of the fit
+		if (q == q && q != 0 && fabs(q) <= 32767 && fabs(v / s - q) < fTolerance) {
+			fNum += q * v;
+			fDen += q * q;
+		}
+	}
+	return fDen > 0 ? fNum / fDen : s;
+}
+
+static bool FindScale(const float *afValues, size_t n, double &fScale)
+{
+	double afBase[2] = {0, 0};
+	for (size_t i=0;i<n;i++) {
+		double a = fabs(double(afValues[i]));
+		if (a > 0 && a < 3.0e38 && (afBase[0] == 0 || a < afBase[0]))
+			afBase[0] = a;
+		double d = i > 0 ? fabs(double(afValues[i]) - double(afValues[i-1])) : 0;
+		if (d > 0 && d < 3.0e38 && (afBase[1] == 0 || d < afBase[1]))
+			afBase[1] = d;
+	}
+	if (afBase[0] == 0) {
+		fScale = 1;
+		return true;
+	}
+	std::vector<int> aiValues(n);
+	for (int b=0;b<2;b++) {
+		if (afBase[b] == 0)
+			continue;
+		for (int k=1;k<=MAX_SCALE_DIVISOR;k++) {
+			double s = afBase[b] / k;
+			for (int iIter=0;iIter<2;iIter++)
+				s = FitScale(afValues, n, s, true, 0.1);
+			for (int iIter=0;iIter<2;iIter++)
+				s = FitScale(afValues, n, s, false, 0.01);
+			if (Quantize(afValues, n, s, aiValues, NULL) <= n / 32) {
+				fScale = s;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static int EncodeQuantized(const std::vector<int> &aiValues, const std::vector<Exception_struct> &Exceptions, Bytes &Out)
+{
+	unsigned long long iNumExceptions = Exceptions.size();
+	Append(Out, &iNumExceptions, 8);
+	for (size_t k=0;k<Exceptions.size();k++) {
+		Append(Out, &Exceptions[k].m_iIndex, 8);
+		Append(Out, &Exceptions[k].m_fValue, 4);
+	}
+	EncodeInt16Stream(aiValues, Out);
+	return CODEC_SCALED_INT16;
+}
+
+int EncodeFloats(const float *afValues, size_t n, Bytes &Out, double &fScale)
+{
+	Out.clear();
+	fScale = 1;
+	if (n == 0 || !FindScale(afValues, n, fScale)) {
+		Append(Out, afValues, 4 * n);
+		return CODEC_RAW;
+	}
+	std::vector<int> aiValues(n);
+	std::vector<Exception_struct> Exceptions;
+	Quantize(afValues, n, fScale, aiValues, &Exceptions);
+	return EncodeQuantized(aiValues, Exceptions, Out);
+}
+
+int EncodeScaledInt16(const short *aiValues, size_t n, Bytes &Out)
+{
+	Out.clear();
+	std::vector<int> aiInts(aiValues, aiValues + n);
+	return EncodeQuantized(aiInts, std::vector<Exception_struct>(), Out);
+}
+
+bool DecodeDoubles(int iCodec, double fParam, const unsigned char *pIn, size_t iSize, size_t n, double *afOut)
+{
+	if (iCodec == CODEC_RAW) {
+		if (iSize != 8 * n)
+			return false;
+		memcpy(afOut, pIn, 8 * n);
+		return true;
+	}
+	if (iCodec != CODEC_TICKS && iCodec != CODEC_DELTA)
+		return false;
+	std::vector<long long> aiTicks(n);
+	if (n > 0 && !DecodeInt64(pIn, iSize, n, &aiTicks[0]))
+		return false;
+	for (size_t i=0;i<n;i++)
+		afOut[i] = iCodec == CODEC_TICKS ? double(aiTicks[i]) / fParam : double(aiTicks[i]);
+	return true;
+}
+
+bool DecodeFloats(int iCodec, double fParam, const unsigned char *pIn, size_t iSize, size_t n, float *afOut)
+{
+	if (iCodec == CODEC_RAW) {
+		if (iSize != 4 * n)
+			return false;
+		memcpy(afOut, pIn, 4 * n);
+		return true;
+	}
+	if (iCodec != CODEC_SCALED_INT16 || iSize < 8)
+		return false;
+	unsigned long long iNumExceptions;
+	memcpy(&iNumExceptions, pIn, 8);
+	if (iNumExceptions > (iSize - 8) / 12)
+		return false;
+	size_t iStream = 8 + 12 * size_t(iNumExceptions);
+	std::vector<unsigned long long> aiDeltas(n);
+	if (n > 0 && !UnpackBlocks(pIn + iStream, iSize - iStream, n, &aiDeltas[0]))
+		return false;
+	long long iValue = 0;
+	for (size_t i=0;i<n;i++) {
+		iValue += UnZigZag(aiDeltas[i]);
+		afOut[i] = float(iValue * fParam);
+	}
+	for (size_t k=0;k<iNumExceptions;k++) {
+		unsigned long long iIndex;
+		memcpy(&iIndex, pIn + 8 + 12 * k, 8);
+		if (iIndex >= n)
+			return false;
+		memcpy(&afOut[iIndex], pIn + 8 + 12 * k + 8, 4);
+	}
+	return true;
+}
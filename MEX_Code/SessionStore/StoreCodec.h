@@ -0,0 +1,56 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef STORE_CODEC_H
+#define STORE_CODEC_H
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ Chunk codecs of the session store (see SessionStore.h).
+
+ All integer streams are packed the same way: blocks of 128 values, each block starts with one
+ byte holding the bit width of its largest value, followed by the values packed LSB first.
+
+ CODEC_RAW           the values as they are (float32 or double)
+ CODEC_TICKS         timestamps that are whole ticks of a clock (Param = ticks per second):
+                     first tick as int64, then the zigzag deltas between ticks
+ CODEC_DELTA         integer values kept as doubles (strobe words): same packing as CODEC_TICKS
+ CODEC_SCALED_INT16  float32 values that are int16 * Param (a/d values in volts):
+                     number of exceptions, exceptions (uint64 index, float32 value), then the
+                     zigzag deltas of the int16 values. Values that the scale does not reproduce
+                     exactly are stored as exceptions, so the codec is lossless.
+*/
+
+enum {
+	CODEC_RAW = 0,
+	CODEC_TICKS = 1,
+	CODEC_DELTA = 2,
+	CODEC_SCALED_INT16 = 3
+};
+
+typedef std::vector<unsigned char> Bytes;
+
+// Timestamps: CODEC_TICKS if every value is a whole tick at fTicksPerSec, otherwise CODEC_RAW
+int EncodeTimestamps(const double *afValues, size_t n, double fTicksPerSec, Bytes &Out);
+
+// Integer valued doubles: CODEC_DELTA, or CODEC_RAW if some value is not an integer
+int EncodeIntegers(const double *afValues, size_t n, Bytes &Out);
+
+// Float32 samples: CODEC_SCALED_INT16 if an int16 scale reproduces (almost) all values, otherwise CODEC_RAW.
+// fScale returns the scale that was used.
+int EncodeFloats(const float *afValues, size_t n, Bytes &Out, double &fScale);
+
+// Values that are known to be int16 * scale (the float32 values are float(q * scale)). The scale
+// is not part of the encoding: the caller stores it as the chunk parameter.
+int EncodeScaledInt16(const short *aiValues, size_t n, Bytes &Out);
+
+// Decoders return false if the chunk is corrupted
+bool DecodeDoubles(int iCodec, double fParam, const unsigned char *pIn, size_t iSize, size_t n, double *afOut);
+bool DecodeFloats(int iCodec, double fParam, const unsigned char *pIn, size_t iSize, size_t n, float *afOut);
+
+#endif
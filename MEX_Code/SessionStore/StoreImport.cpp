@@ -0,0 +1,370 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#include <algorithm>
+#include "SessionStore.h"
+
+/*
+ Parsing of the KOFIKO raw files that go into a session store, and the check that a stored member
+ decodes back to exactly the data of its raw file.
+*/
+
+typedef struct {
+	StoreMember_struct Member;
+	const unsigned char *Samples;		// analog
+	const unsigned char *Words;			// strobe
+	const unsigned char *StrobeTimes;
+	std::vector<const unsigned char *> Timestamps;	// spikes, per unit
+	std::vector<const unsigned char *> Waveforms;
+	bool Int16Waveforms;
+	double WaveFormScale;
+} RawFile_struct;
+
+class RawParser {
+public:
+	RawParser(const MappedFile &F) : m_F(F), m_iPos(0), m_bOK(true) {}
+	unsigned long long UInt64() { unsigned long long v = 0; Read(&v, 8); return v; }
+	double Double() { double v = 0; Read(&v, 8); return v; }
+	std::string String() {
+		unsigned long long n = UInt64();
+		const unsigned char *p = Skip(n);
+		return p != NULL ? std::string((const char *)p, size_t(n)) : std::string();
+	}
+	const unsigned char *Skip(unsigned long long n) {
+		if (!m_bOK || n > m_F.Size() - m_iPos) {
+			m_bOK = false;
+			return NULL;
+		}
+		const unsigned char *p = m_F.Data() + m_iPos;
+		m_iPos += size_t(n);
+		return p;
+	}
+	void Read(void *pOut, size_t n) {
+		const unsigned char *p = Skip(n);
+		if (p != NULL)
+			memcpy(pOut, p, n);
+	}
+	bool Count(unsigned long long n, size_t iItemSize) {
+		m_bOK = m_bOK && n <= m_F.Size() / iItemSize;
+		return m_bOK;
+	}
+	bool OK() const { return m_bOK; }
+private:
+	const MappedFile &m_F;
+	size_t m_iPos;
+	bool m_bOK;
+};
+
+static bool ParseAnalog(const MappedFile &F, RawParser &P, unsigned long long iHeaderSize, RawFile_struct &R)
+{
+	StoreMember_struct &M = R.Member;
+	M.m_iChannel = int(P.UInt64());
+	M.m_fSamplingFreq = double(P.UInt64());
+	M.m_strChannelName = P.String();
+	unsigned long long iNumFrames = P.UInt64();
+	if (!P.Count(iNumFrames, 16))
+		return false;
+	M.m_aiNumSamplesPerFrame.resize(size_t(iNumFrames));
+	M.m_afStartTS.resize(size_t(iNumFrames));
+	unsigned long long iNumSamples = 0;
+	for (size_t f=0;f<iNumFrames;f++) {
+		M.m_aiNumSamplesPerFrame[f] = P.UInt64();
+		if (M.m_aiNumSamplesPerFrame[f] > F.Size() / 4 - iNumSamples)
+			return false;
+		iNumSamples += M.m_aiNumSamplesPerFrame[f];
+	}
+	for (size_t f=0;f<iNumFrames;f++)
+		M.m_afStartTS[f] = P.Double();
+	if (!P.OK() || M.m_fSamplingFreq <= 0 || F.Size() < 13 || iHeaderSize > F.Size() - 13 || (F.Size() - 13 - iHeaderSize) / 4 < iNumSamples)
+		return false;
+	R.Samples = F.Data() + 13 + iHeaderSize;
+	return true;
+}
+
+static bool ParseStrobe(RawParser &P, RawFile_struct &R)
+{
+	R.Member.m_iNumStrobeWords = P.UInt64();
+	if (!P.Count(R.Member.m_iNumStrobeWords, 16))
+		return false;
+	R.Words = P.Skip(8 * R.Member.m_iNumStrobeWords);
+	R.StrobeTimes = P.Skip(8 * R.Member.m_iNumStrobeWords);
+	return P.OK();
+}
+
+static bool ParseSpikes(const MappedFile &F, RawParser &P, unsigned long long iHeaderSize, bool bIndexed, RawFile_struct &R)
+{
+	StoreMember_struct &M = R.Member;
+	M.m_strPlxFile = P.String();
+	M.m_strChannelName = P.String();
+	M.m_fChannelID = double(P.UInt64());
+	M.m_fGain = P.Double();
+	M.m_fThreshold = P.Double();
+	M.m_fFiltersActive = double(P.UInt64());
+	M.m_fSorted = double(P.UInt64());
+	unsigned long long iNumUnits = P.UInt64();
+	M.m_iWaveFormLength = P.UInt64();
+	if (!P.Count(iNumUnits, 32) || M.m_iWaveFormLength > F.Size())
+		return false;
+	size_t N = size_t(iNumUnits);
+	M.m_afUnitIndices.resize(N);
+	M.m_aiNumSpikes.resize(N);
+	M.m_afIntervals.resize(2 * N);
+	for (size_t k=0;k<N;k++)
+		M.m_afUnitIndices[k] = double(P.UInt64());
+	for (size_t k=0;k<N;k++)
+		M.m_aiNumSpikes[k] = P.UInt64();
+	for (size_t k=0;k<2*N;k++)
+		M.m_afIntervals[k] = P.Double();
+	// The time index of v1.03S files is not needed: the chunk table replaces it
+	if (bIndexed) {
+		unsigned long long iClass = P.UInt64();
+		if (iClass > 1)
+			return false;
+		R.Int16Waveforms = iClass == 1;
+		R.WaveFormScale = P.Double();
+	}
+	if (!P.OK() || F.Size() < 13 || iHeaderSize > F.Size() - 13)
+		return false;
+
+	const unsigned char *pData = F.Data() + 13 + iHeaderSize;
+	unsigned long long iAvailable = F.Size() - 13 - iHeaderSize;
+	unsigned long long iSampleSize = R.Int16Waveforms ? 2 : 4;
+	unsigned long long iTotalSpikes = 0;
+	for (size_t k=0;k<N;k++) {
+		if (M.m_aiNumSpikes[k] > iAvailable / 8 - iTotalSpikes)
+			return false;
+		iTotalSpikes += M.m_aiNumSpikes[k];
+	}
+	if (iTotalSpikes > iAvailable / (8 + iSampleSize * M.m_iWaveFormLength))
+		return false;
+	R.Timestamps.resize(N);
+	R.Waveforms.resize(N);
+	unsigned long long iBefore = 0;
+	for (size_t k=0;k<N;k++) {
+		if (bIndexed) {
+			R.Timestamps[k] = pData + 8 * iBefore;
+			R.Waveforms[k] = pData + 8 * iTotalSpikes + iSampleSize * M.m_iWaveFormLength * iBefore;
+		} else {
+			R.Timestamps[k] = pData + (8 + iSampleSize * M.m_iWaveFormLength) * iBefore;
+			R.Waveforms[k] = R.Timestamps[k] + 8 * M.m_aiNumSpikes[k];
+		}
+		iBefore += M.m_aiNumSpikes[k];
+	}
+	return true;
+}
+
+static bool ParseRawFile(const MappedFile &F, const std::string &strName, RawFile_struct &R, std::string &strError)
+{
+	RawParser P(F);
+	char strIdentifier[13];
+	P.Read(strIdentifier, 13);
+	unsigned long long iHeaderSize = P.UInt64();
+	R.Samples = R.Words = R.StrobeTimes = NULL;
+	R.Int16Waveforms = false;
+	R.WaveFormScale = 1;
+	bool bOK;
+	if (!P.OK())
+		bOK = false;
+	else if (memcmp(strIdentifier, "KOFIKO_v1.00A", 13) == 0) {
+		StoreInitMember(R.Member, MEMBER_ANALOG, strName);
+		bOK = ParseAnalog(F, P, iHeaderSize, R);
+	} else if (memcmp(strIdentifier, "KOFIKO_v1.00E", 13) == 0) {
+		StoreInitMember(R.Member, MEMBER_STROBE, strName);
+		bOK = ParseStrobe(P, R);
+	} else if (memcmp(strIdentifier, "KOFIKO_v1.02S", 13) == 0 || memcmp(strIdentifier, "KOFIKO_v1.03S", 13) == 0) {
+		StoreInitMember(R.Member, MEMBER_SPIKES, strName);
+		bOK = ParseSpikes(F, P, iHeaderSize, strIdentifier[11] == '3', R);
+	} else {
+		strError = "Unsupported raw file format: " + strName;
+		return false;
+	}
+	if (!bOK)
+		strError = "Truncated or corrupted raw file: " + strName;
+	R.Member.m_iRawBytes = F.Size();
+	return bOK;
+}
+
+std::string StoreMemberName(const std::string &strStoreFile, const std::string &strRawFile)
+{
+	size_t iSlash = strRawFile.find_last_of("/\\");
+	std::string strName = iSlash == std::string::npos ? strRawFile : strRawFile.substr(iSlash + 1);
+	if (strName.size() > 4 && strName.compare(strName.size() - 4, 4, ".raw") == 0)
+		strName.resize(strName.size() - 4);
+
+	iSlash = strStoreFile.find_last_of("/\\");
+	std::string strSession = iSlash == std::string::npos ? strStoreFile : strStoreFile.substr(iSlash + 1);
+	size_t iDot = strSession.find_last_of('.');
+	if (iDot != std::string::npos)
+		strSession.resize(iDot);
+	strSession += "-";
+	if (strName.size() > strSession.size() && strName.compare(0, strSession.size(), strSession) == 0)
+		strName = strName.substr(strSession.size());
+	return strName;
+}
+
+bool StoreAddRawFile(StoreWriter &Writer, const std::string &strRawFile, const std::string &strName, std::string &strError)
+{
+	MappedFile F;
+	if (!F.Open(strRawFile.c_str())) {
+		strError = "Cannot open " + strRawFile;
+		return false;
+	}
+	RawFile_struct R;
+	if (!ParseRawFile(F, strRawFile, R, strError))
+		return false;
+	R.Member.m_strName = strName;
+	bool bOK;
+	if (R.Member.m_iType == MEMBER_ANALOG)
+		bOK = Writer.AddAnalog(R.Member, R.Samples);
+	else if (R.Member.m_iType == MEMBER_STROBE)
+		bOK = Writer.AddStrobe(R.Member, R.Words, R.StrobeTimes);
+	else
+		bOK = Writer.AddSpikes(R.Member, R.Timestamps, R.Waveforms, R.Int16Waveforms, R.WaveFormScale);
+	if (!bOK)
+		strError = Writer.GetError();
+	return bOK;
+}
+
+static bool SameHeader(const StoreMember_struct &A, const StoreMember_struct &B)
+{
+	return A.m_iType == B.m_iType && A.m_iRawBytes == B.m_iRawBytes && A.m_iChannel == B.m_iChannel &&
+		A.m_fSamplingFreq == B.m_fSamplingFreq && A.m_strChannelName == B.m_strChannelName &&
+		A.m_aiNumSamplesPerFrame == B.m_aiNumSamplesPerFrame && A.m_afStartTS == B.m_afStartTS &&
+		A.m_strPlxFile == B.m_strPlxFile && A.m_fChannelID == B.m_fChannelID && A.m_fGain == B.m_fGain &&
+		A.m_fThreshold == B.m_fThreshold && A.m_fFiltersActive == B.m_fFiltersActive && A.m_fSorted == B.m_fSorted &&
+		A.m_iWaveFormLength == B.m_iWaveFormLength && A.m_afUnitIndices == B.m_afUnitIndices &&
+		A.m_aiNumSpikes == B.m_aiNumSpikes && A.m_afIntervals == B.m_afIntervals && A.m_iNumStrobeWords == B.m_iNumStrobeWords;
+}
+
+// Decoded values must be bitwise identical to the raw file (int16 sources: to float(q * scale))
+static bool SameFloats(const float *afDecoded, const unsigned char *pRaw, size_t n)
+{
+	return n == 0 || memcmp(afDecoded, pRaw, 4 * n) == 0;
+}
+
+static bool SameScaledInt16(const float *afDecoded, const unsigned char *pRaw, size_t n, double fScale)
+{
+	for (size_t i=0;i<n;i++) {
+		short q;
+		memcpy(&q, pRaw + 2 * i, 2);
+		float v = float(q * fScale);
+		if (memcmp(&v, &afDecoded[i], 4) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool SameDoubles(const double *afDecoded, const unsigned char *pRaw, size_t n)
+{
+	return n == 0 || memcmp(afDecoded, pRaw, 8 * n) == 0;
+}
+
+static bool SameWords(const double *afDecoded, const unsigned char *pRaw, size_t n)
+{
+	for (size_t i=0;i<n;i++) {
+		unsigned long long iWord;
+		memcpy(&iWord, pRaw + 8 * i, 8);
+		if (afDecoded[i] != double(iWord))
+			return false;
+	}
+	return true;
+}
+
+bool StoreVerifyRawFile(StoreReader &Reader, const std::string &strRawFile, const std::string &strName, std::string &strError)
+{
+	const StoreMember_struct *pMember = Reader.FindMember(strName);
+	MappedFile F;
+	RawFile_struct R;
+	if (pMember == NULL || !F.Open(strRawFile.c_str()) || !ParseRawFile(F, strRawFile, R, strError)) {
+		strError = "Cannot verify " + strRawFile;
+		return false;
+	}
+	R.Member.m_strName = strName;
+	const StoreMember_struct &M = *pMember;
+	bool bOK = SameHeader(M, R.Member);
+	if (bOK && M.m_iType == MEMBER_ANALOG) {
+		unsigned long long n = 0;
+		for (size_t f=0;f<M.m_aiNumSamplesPerFrame.size();f++)
+			n += M.m_aiNumSamplesPerFrame[f];
+		std::vector<float> afData(size_t(n) + 1);
+		bOK = Reader.ReadFloats(M, COLUMN_SAMPLES, 0, n, 1, &afData[0]) && SameFloats(&afData[0], R.Samples, size_t(n));
+	} else if (bOK && M.m_iType == MEMBER_STROBE) {
+		size_t n = size_t(M.m_iNumStrobeWords);
+		std::vector<double> afData(n + 1);
+		bOK = Reader.ReadDoubles(M, COLUMN_WORDS, 0, n, &afData[0]) && SameWords(&afData[0], R.Words, n) &&
+			Reader.ReadDoubles(M, COLUMN_STROBE_TIMES, 0, n, &afData[0]) && SameDoubles(&afData[0], R.StrobeTimes, n);
+	} else if (bOK) {
+		size_t L = size_t(M.m_iWaveFormLength);
+		for (size_t u=0;bOK && u<M.m_aiNumSpikes.size();u++) {
+			size_t n = size_t(M.m_aiNumSpikes[u]);
+			std::vector<double> afTimes(n + 1);
+			std::vector<float> afWaves(n * L + 1);
+			bOK = Reader.ReadDoubles(M, SpikeTimesColumn(int(u)), 0, n, &afTimes[0]) && SameDoubles(&afTimes[0], R.Timestamps[u], n) &&
+				Reader.ReadFloats(M, SpikeWavesColumn(int(u)), 0, n, L, &afWaves[0]);
+			if (bOK)
+				bOK = R.Int16Waveforms ? SameScaledInt16(&afWaves[0], R.Waveforms[u], n * L, R.WaveFormScale) :
+					SameFloats(&afWaves[0], R.Waveforms[u], n * L);
+		}
+	}
+	if (!bOK)
+		strError = "Verification failed: " + strName + " does not match " + strRawFile;
+	return bOK;
+}
+
+bool StorePackRawFiles(const std::string &strStoreFile, const std::vector<std::string> &acRawFiles,
+					   const StoreOptions_struct &Options, std::string &strError)
+{
+	std::vector<std::string> acNames(acRawFiles.size());
+	for (size_t k=0;k<acRawFiles.size();k++) {
+		acNames[k] = StoreMemberName(strStoreFile, acRawFiles[k]);
+		for (size_t j=0;j<k;j++)
+			if (acNames[j] == acNames[k]) {
+				strError = "Two raw files map to the member " + acNames[k];
+				return false;
+			}
+	}
+	// Never over an existing store, and never a broken one under its name: the store is written next
+	// to it and renamed once it is complete and verified
+	FILE *fp = fopen(strStoreFile.c_str(), "rb");
+	if (fp != NULL) {
+		fclose(fp);
+		strError = strStoreFile + " already exists";
+		return false;
+	}
+	std::string strTempFile = strStoreFile + ".part";
+	{
+		StoreWriter Writer(Options);
+		if (!Writer.Open(strTempFile)) {
+			strError = Writer.GetError();
+			return false;
+		}
+		// One file at a time: the chunks of a file are compressed in parallel
+		for (size_t k=0;k<acRawFiles.size();k++)
+			if (!StoreAddRawFile(Writer, acRawFiles[k], acNames[k], strError))
+				return false;
+		if (!Writer.Close()) {
+			strError = Writer.GetError();
+			return false;
+		}
+	}
+	bool bOK = true;
+	if (Options.m_bVerify) {
+		StoreReader Reader(Options.m_iNumThreads);
+		bOK = Reader.Open(strTempFile);
+		if (!bOK)
+			strError = Reader.GetError();
+		for (size_t k=0;bOK && k<acRawFiles.size();k++)
+			bOK = StoreVerifyRawFile(Reader, acRawFiles[k], acNames[k], strError);
+	}
+	if (bOK && rename(strTempFile.c_str(), strStoreFile.c_str()) != 0) {
+		strError = "Cannot rename " + strTempFile + " to " + strStoreFile;
+		bOK = false;
+	}
+	if (!bOK)
+		remove(strTempFile.c_str());
+	return bOK;
+}
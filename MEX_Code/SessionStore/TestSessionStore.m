@@ -0,0 +1,56 @@
+% Pack an analog channel and a spike channel into a session store and read them back
+strFolder = tempdir;
+strAnalogFile = fullfile(strFolder,'TestStore-LFP1.raw');
+strSpikeFile = fullfile(strFolder,'TestStore-spikes_ch1.raw');
+strStoreFile = fullfile(strFolder,'TestStore.kst');
+
+% int16 a/d values saved as single, as fnDumpChannel does
+fScale = 10/32768;
+afData = single(round(filter(1, [1 -0.999], randn(3600*1000,1)*20)) * fScale);
+strctAnalog.m_iChannel = 1;
+strctAnalog.m_fSamplingFreq = 1000;
+strctAnalog.m_strChannelName = 'LFP1';
+strctAnalog.m_aiNumSamplesPerFrame = [2000*1000; 1600*1000];
+strctAnalog.m_afStartTS = [10; 2100];
+strctAnalog.m_afData = afData;
+fnDumpChannel(strctAnalog, strAnalogFile);
+
+strctChannelInfo.m_strPlxFile = 'Test.plx';
+strctChannelInfo.m_strChannelName = 'sig001';
+strctChannelInfo.m_iChannelID = 1;
+strctChannelInfo.m_fGain = 20;
+strctChannelInfo.m_fThreshold = -300;
+strctChannelInfo.m_bFiltersActive = 1;
+strctChannelInfo.m_bSorted = 1;
+for k=1:3
+    astrctSpikes(k).m_iUnitIndex = k-1;
+    astrctSpikes(k).m_afTimestamps = sort(round(rand(20000,1)*3600*40000))/40000;
+    astrctSpikes(k).m_afInterval = astrctSpikes(k).m_afTimestamps([1 end])';
+    astrctSpikes(k).m_a2fWaveforms = single(randn(20000,32)*0.05);
+end
+fnDumpChannelSpikes(strctChannelInfo, astrctSpikes, strSpikeFile);
+
+tic; fnSessionStore('Pack', strStoreFile, {strAnalogFile, strSpikeFile}); toc
+astrctMembers = fnSessionStore('List', strStoreFile);
+fprintf('%s: %d -> %d bytes\n', astrctMembers(1).m_strName, astrctMembers(1).m_iRawBytes, astrctMembers(1).m_iStoredBytes);
+assert(astrctMembers(1).m_iStoredBytes < astrctMembers(1).m_iRawBytes / 2);
+
+% Lossless
+strctStored = fnSessionStore('Analog', strStoreFile, 'LFP1');
+assert(isequal(strctStored.m_afData, afData));
+astrctUnits = fnSessionStore('Spikes', strStoreFile, 'spikes_ch1');
+assert(isequal(astrctUnits(2).m_afTimestamps, astrctSpikes(2).m_afTimestamps));
+assert(isequal(astrctUnits(2).m_a2fWaveforms, astrctSpikes(2).m_a2fWaveforms));
+
+% The fnReadDump* entry points fall back to the store once the raw files are gone
+afSampleTimes = 100 + rand(100,50)*3000;
+strctRaw = fnReadDumpAnalogFile(strAnalogFile, 'Resample', afSampleTimes);
+strctUnitRaw = fnReadDumpSpikeFile(strSpikeFile, 'SingleUnit', [1 1], 'Interval', [1000 1060]);
+delete(strAnalogFile);
+delete(strSpikeFile);
+tic; strctFromStore = fnReadDumpAnalogFile(strAnalogFile, 'Resample', afSampleTimes); toc
+assert(isequalwithequalnans(strctFromStore.m_afData, strctRaw.m_afData));
+strctUnitFromStore = fnReadDumpSpikeFile(strSpikeFile, 'SingleUnit', [1 1], 'Interval', [1000 1060]);
+assert(isequal(strctUnitFromStore.m_afTimestamps, strctUnitRaw.m_afTimestamps));
+assert(isequal(strctUnitFromStore.m_a2fWaveforms, strctUnitRaw.m_a2fWaveforms));
+delete(strStoreFile);
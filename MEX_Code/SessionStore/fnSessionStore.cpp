@@ -0,0 +1,582 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "SessionStore.h"
+#ifndef SESSIONSTORE_STANDALONE
+#include "mex.h"
+#endif
+
+/*
+ Session store: all raw files of a session in one compressed file (see SessionStore.h).
+
+ Matlab:
+   fnSessionStore('Pack', strStoreFile, acRawFiles, [strctOptions])
+	strctOptions may have the fields m_iNumThreads (default: number of cores), m_bVerify (default true:
+	the store is read back and compared with every raw file) and m_fTicksPerSec (default 40000).
+	An existing strStoreFile is not replaced; the store only gets its name once it is complete and verified.
+   astrctMembers = fnSessionStore('List', strStoreFile)
+	m_strName, m_strType ('Analog', 'Strobe' or 'Spikes'), m_iRawBytes, m_iStoredBytes.
+   [strctAnalog, afTime] = fnSessionStore('Analog', strStoreFile, strMember, ...)
+	the header fields of fnReadDumpAnalog and m_afData (single):
+	no option               - all samples
+	'HeaderOnly'            - no samples
+	'Interval', [t0 t1]     - the stored samples with t0 <= time <= t1, and their times
+	'Resample', afTimes     - linear interpolation at afTimes (any shape, or a cell array), NaN outside the frames
+   [astrctUnits, strctChannelInfo] = fnSessionStore('Spikes', strStoreFile, strMember, ...)
+	same options and outputs as fnReadDumpSpikes ('HeaderOnly', 'Units', 'Interval', 'Waveforms';
+	'Channel' is accepted and ignored, a member holds a single channel)
+   strctStrobe = fnSessionStore('Strobe', strStoreFile, strMember)
+	m_aiWords and m_afTimestamp, as fnReadDumpStrobeFile.
+
+ Only the chunks that hold the requested samples or spikes are decompressed, on all cores.
+
+ Command line (compile fnSessionStore.cpp, SessionStore.cpp, StoreImport.cpp and StoreCodec.cpp with
+ SESSIONSTORE_STANDALONE defined):
+   kofikostore pack [-j threads] [-noverify] session.kst file1.raw [file2.raw ...]
+   kofikostore list session.kst
+*/
+
+static const char *MEMBER_TYPE_NAMES[] = {"Analog", "Strobe", "Spikes"};
+
+#ifdef SESSIONSTORE_STANDALONE
+
+static const char *USAGE = "Usage: kofikostore pack [-j threads] [-noverify] session.kst file1.raw [file2.raw ...]\n"
+						   "       kofikostore list session.kst\n";
+
+int main(int argc, char *argv[])
+{
+	if (argc >= 3 && strcmp(argv[1], "list") == 0) {
+		StoreReader Reader;
+		if (!Reader.Open(argv[2])) {
+			fprintf(stderr, "%s\n", Reader.GetError().c_str());
+			return 1;
+		}
+		const std::vector<StoreMember_struct> &Members = Reader.GetMembers();
+		unsigned long long iRaw = 0, iStored = 0;
+		for (size_t k=0;k<Members.size();k++) {
+			unsigned long long iBytes = Reader.StoredBytes(Members[k]);
+			printf("%-24s %-7s %14llu -> %14llu (%.1f%%)\n", Members[k].m_strName.c_str(), MEMBER_TYPE_NAMES[Members[k].m_iType],
+				   Members[k].m_iRawBytes, iBytes, Members[k].m_iRawBytes > 0 ? 100.0 * iBytes / Members[k].m_iRawBytes : 0.0);
+			iRaw += Members[k].m_iRawBytes;
+			iStored += iBytes;
+		}
+		printf("%-24s %-7s %14llu -> %14llu\n", "total", "", iRaw, iStored);
+		return 0;
+	}
+	if (argc < 3 || strcmp(argv[1], "pack") != 0) {
+		fprintf(stderr, "%s", USAGE);
+		return 2;
+	}
+	StoreOptions_struct Options;
+	StoreDefaultOptions(Options);
+	std::string strStoreFile;
+	std::vector<std::string> acRawFiles;
+	for (int k=2;k<argc;k++) {
+		if (strcmp(argv[k], "-j") == 0 && k+1 < argc)
+			Options.m_iNumThreads = atoi(argv[++k]);
+		else if (strcmp(argv[k], "-noverify") == 0)
+			Options.m_bVerify = false;
+		else if (argv[k][0] == '-') {
+			fprintf(stderr, "Unknown option %s\n%s", argv[k], USAGE);
+			return 2;
+		} else if (strStoreFile.empty())
+			strStoreFile = argv[k];
+		else
+			acRawFiles.push_back(argv[k]);
+	}
+	if (strStoreFile.empty() || acRawFiles.empty()) {
+		fprintf(stderr, "%s", USAGE);
+		return 2;
+	}
+	std::string strError;
+	if (!StorePackRawFiles(strStoreFile, acRawFiles, Options, strError)) {
+		fprintf(stderr, "%s\n", strError.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+#else
+
+static std::string GetString(const mxArray *A)
+{
+	if (A == NULL || !mxIsChar(A))
+		return std::string();
+	char *str = mxArrayToString(A);
+	std::string s(str);
+	mxFree(str);
+	return s;
+}
+
+static double GetScalarField(const mxArray *strctOptions, const char *strField, double fDefault)
+{
+	mxArray *pField = strctOptions != NULL ? mxGetField(strctOptions, 0, strField) : NULL;
+	if (pField == NULL || mxGetNumberOfElements(pField) == 0)
+		return fDefault;
+	return mxGetScalar(pField);
+}
+
+static std::string LowerCase(const mxArray *A)
+{
+	std::string s = GetString(A);
+	for (size_t k=0;k<s.size();k++)
+		s[k] = char(tolower(s[k]));
+	return s;
+}
+
+static mxArray *CreateColumn(const std::vector<double> &afValues)
+{
+	mxArray *A = mxCreateDoubleMatrix(afValues.size(), 1, mxREAL);
+	if (!afValues.empty())
+		memcpy(mxGetPr(A), &afValues[0], 8 * afValues.size());
+	return A;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// Analog members
+
+class AnalogView {
+public:
+	AnalogView(StoreReader &Reader, const StoreMember_struct &M) : m_Reader(Reader), m_M(M) {
+		m_aiFrameOffset.push_back(0);
+		for (size_t f=0;f<M.m_aiNumSamplesPerFrame.size();f++)
+			m_aiFrameOffset.push_back(m_aiFrameOffset.back() + M.m_aiNumSamplesPerFrame[f]);
+		m_Reader.ColumnChunks(M, COLUMN_SAMPLES, m_aiColumn);
+	}
+
+	unsigned long long NumSamples() const { return m_aiFrameOffset.back(); }
+
+	// Sample index and interpolation weight of time t (false if t is outside the frames)
+	bool Locate(double t, unsigned long long &iSample, double &fAlpha, bool &bNext) const {
+		const std::vector<double> &afStart = m_M.m_afStartTS;
+		if (t != t || afStart.empty())
+			return false;
+		int f = int(std::upper_bound(afStart.begin(), afStart.end(), t) - afStart.begin()) - 1;
+		if (f < 0)
+			return false;
+		double p = (t - afStart[f]) * m_M.m_fSamplingFreq;
+		double fLast = double(m_M.m_aiNumSamplesPerFrame[f]) - 1;
+		if (p > fLast) {
+			// allow for rounding on the last sample of the frame
+			if (p - fLast < 1e-6 && fLast >= 0)
+				p = fLast;
+			else
+				return false;
+		}
+		unsigned long long i0 = (unsigned long long)p;
+		fAlpha = p - double(i0);
+		bNext = fAlpha != 0 && double(i0) < fLast;
+		iSample = m_aiFrameOffset[f] + i0;
+		return true;
+	}
+
+	void Need(unsigned long long iSample) {
+		int iChunk = m_Reader.ChunkOfItem(m_M, m_aiColumn, iSample);
+		if (iChunk >= 0)
+			m_aiNeeded.push_back(size_t(iChunk));
+	}
+
+	// Decodes every chunk that was asked for with Need()
+	void Decode() {
+		std::sort(m_aiNeeded.begin(), m_aiNeeded.end());
+		m_aiNeeded.erase(std::unique(m_aiNeeded.begin(), m_aiNeeded.end()), m_aiNeeded.end());
+		if (!m_Reader.DecodeFloatChunks(m_M, m_aiNeeded, 1, m_Decoded))
+			mexErrMsgTxt(m_Reader.GetError().c_str());
+	}
+
+	float Sample(unsigned long long iSample) const {
+		int iChunk = m_Reader.ChunkOfItem(m_M, m_aiColumn, iSample);
+		if (iChunk < 0)
+			return std::numeric_limits<float>::quiet_NaN();
+		size_t iSlot = std::lower_bound(m_aiNeeded.begin(), m_aiNeeded.end(), size_t(iChunk)) - m_aiNeeded.begin();
+		return m_Decoded[iSlot][size_t(iSample - m_M.m_Chunks[iChunk].m_iFirstItem)];
+	}
+
+	const std::vector<unsigned long long> &FrameOffset() const { return m_aiFrameOffset; }
+
+private:
+	StoreReader &m_Reader;
+	const StoreMember_struct &m_M;
+	std::vector<unsigned long long> m_aiFrameOffset;
+	std::vector<size_t> m_aiColumn;
+	std::vector<size_t> m_aiNeeded;
+	std::vector<std::vector<float> > m_Decoded;
+};
+
+static mxArray *Resample(AnalogView &View, const mxArray *Times)
+{
+	if (!mxIsDouble(Times))
+		mexErrMsgTxt("Sample times must be double.");
+	mxArray *Out = mxCreateNumericArray(mxGetNumberOfDimensions(Times), mxGetDimensions(Times), mxSINGLE_CLASS, mxREAL);
+	const double *afTimes = mxGetPr(Times);
+	float *afOut = (float *)mxGetData(Out);
+	size_t n = mxGetNumberOfElements(Times);
+	unsigned long long iSample;
+	double fAlpha;
+	bool bNext;
+	for (size_t k=0;k<n;k++)
+		if (View.Locate(afTimes[k], iSample, fAlpha, bNext)) {
+			View.Need(iSample);
+			if (bNext)
+				View.Need(iSample + 1);
+		}
+	View.Decode();
+	for (size_t k=0;k<n;k++) {
+		if (!View.Locate(afTimes[k], iSample, fAlpha, bNext)) {
+			afOut[k] = std::numeric_limits<float>::quiet_NaN();
+			continue;
+		}
+		float v0 = View.Sample(iSample);
+		afOut[k] = bNext ? float(v0 + fAlpha * (View.Sample(iSample + 1) - v0)) : v0;
+	}
+	return Out;
+}
+
+static mxArray *CreateAnalogHeader(const StoreMember_struct &M)
+{
+	const char *astrFields[] = {"m_iChannel", "m_fSamplingFreq", "m_strChannelName", "m_aiNumSamplesPerFrame", "m_afStartTS", "m_afEndTS", "m_afData"};
+	mxArray *S = mxCreateStructMatrix(1, 1, 7, astrFields);
+	size_t iNumFrames = M.m_afStartTS.size();
+	std::vector<double> afNumSamples(iNumFrames), afEndTS(iNumFrames);
+	for (size_t f=0;f<iNumFrames;f++) {
+		afNumSamples[f] = double(M.m_aiNumSamplesPerFrame[f]);
+		afEndTS[f] = M.m_afStartTS[f] + afNumSamples[f] / M.m_fSamplingFreq;
+	}
+	mxSetField(S, 0, "m_iChannel", mxCreateDoubleScalar(M.m_iChannel));
+	mxSetField(S, 0, "m_fSamplingFreq", mxCreateDoubleScalar(M.m_fSamplingFreq));
+	mxSetField(S, 0, "m_strChannelName", mxCreateString(M.m_strChannelName.c_str()));
+	mxSetField(S, 0, "m_aiNumSamplesPerFrame", CreateColumn(afNumSamples));
+	mxSetField(S, 0, "m_afStartTS", CreateColumn(M.m_afStartTS));
+	mxSetField(S, 0, "m_afEndTS", CreateColumn(afEndTS));
+	return S;
+}
+
+static void ReadAnalog(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], StoreReader &Reader, const StoreMember_struct &M)
+{
+	std::string strMode = nrhs > 3 ? LowerCase(prhs[3]) : std::string();
+	plhs[0] = CreateAnalogHeader(M);
+	AnalogView View(Reader, M);
+	if (strMode == "headeronly")
+		return;
+	if (strMode.empty()) {
+		unsigned long long n = View.NumSamples();
+		mxArray *Data = mxCreateNumericMatrix(size_t(n), 1, mxSINGLE_CLASS, mxREAL);
+		if (n > 0 && !Reader.ReadFloats(M, COLUMN_SAMPLES, 0, n, 1, (float *)mxGetData(Data)))
+			mexErrMsgTxt(Reader.GetError().c_str());
+		mxSetField(plhs[0], 0, "m_afData", Data);
+		if (nlhs > 1) {
+			plhs[1] = mxCreateDoubleMatrix(1, size_t(n), mxREAL);
+			double *afTime = mxGetPr(plhs[1]);
+			for (size_t f=0;f<M.m_afStartTS.size();f++)
+				for (unsigned long long i=0;i<M.m_aiNumSamplesPerFrame[f];i++)
+					afTime[View.FrameOffset()[f] + i] = M.m_afStartTS[f] + double(i) / M.m_fSamplingFreq;
+		}
+		return;
+	}
+	if (nrhs < 5)
+		mexErrMsgTxt("Missing option value.");
+	if (strMode == "resample") {
+		if (mxIsCell(prhs[4])) {
+			size_t iNumCells = mxGetNumberOfElements(prhs[4]);
+			mxArray *Cells = mxCreateCellArray(mxGetNumberOfDimensions(prhs[4]), mxGetDimensions(prhs[4]));
+			for (size_t k=0;k<iNumCells;k++) {
+				const mxArray *Times = mxGetCell(prhs[4], k);
+				if (Times != NULL) {
+					AnalogView CellView(Reader, M);
+					mxSetCell(Cells, k, Resample(CellView, Times));
+				}
+			}
+			mxSetField(plhs[0], 0, "m_afData", Cells);
+		} else
+			mxSetField(plhs[0], 0, "m_afData", Resample(View, prhs[4]));
+		return;
+	}
+	if (strMode != "interval")
+		mexErrMsgTxt("Unknown option. Use 'HeaderOnly', 'Interval' or 'Resample'.");
+	if (!mxIsDouble(prhs[4]) || mxGetNumberOfElements(prhs[4]) != 2)
+		mexErrMsgTxt("Interval must be [start end].");
+	double fStart = mxGetPr(prhs[4])[0], fEnd = mxGetPr(prhs[4])[1];
+
+	// Sample range of every frame that falls in the interval (as fnReadDumpAnalog)
+	const double EPS = 1e-9;
+	std::vector<unsigned long long> aiFirst, aiCount;
+	std::vector<size_t> aiFrame;
+	unsigned long long iTotal = 0;
+	for (size_t f=0;f<M.m_afStartTS.size();f++) {
+		double fFirst = ceil((fStart - M.m_afStartTS[f]) * M.m_fSamplingFreq - EPS);
+		double fLast = floor((fEnd - M.m_afStartTS[f]) * M.m_fSamplingFreq + EPS);
+		fFirst = std::max(fFirst, 0.0);
+		fLast = std::min(fLast, double(M.m_aiNumSamplesPerFrame[f]) - 1);
+		if (fLast < fFirst)
+			continue;
+		aiFrame.push_back(f);
+		aiFirst.push_back((unsigned long long)fFirst);
+		aiCount.push_back((unsigned long long)(fLast - fFirst) + 1);
+		iTotal += aiCount.back();
+	}
+	mxArray *Data = mxCreateNumericMatrix(size_t(iTotal), 1, mxSINGLE_CLASS, mxREAL);
+	float *afData = (float *)mxGetData(Data);
+	double *afTime = NULL;
+	if (nlhs > 1) {
+		plhs[1] = mxCreateDoubleMatrix(size_t(iTotal), 1, mxREAL);
+		afTime = mxGetPr(plhs[1]);
+	}
+	for (size_t r=0;r<aiFrame.size();r++) {
+		size_t f = aiFrame[r];
+		if (!Reader.ReadFloats(M, COLUMN_SAMPLES, View.FrameOffset()[f] + aiFirst[r], aiCount[r], 1, afData))
+			mexErrMsgTxt(Reader.GetError().c_str());
+		afData += aiCount[r];
+		if (afTime != NULL) {
+			double fFirstTime = M.m_afStartTS[f] + double(aiFirst[r]) / M.m_fSamplingFreq;
+			for (unsigned long long i=0;i<aiCount[r];i++)
+				*afTime++ = fFirstTime + double(i) / M.m_fSamplingFreq;
+		}
+	}
+	mxSetField(plhs[0], 0, "m_afData", Data);
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// Spike members
+
+static mxArray *CreateChannelInfo(const StoreMember_struct &M)
+{
+	const char *astrFields[] = {"m_strPlxFile", "m_strChannelName", "m_iChannelID", "m_fGain", "m_fThreshold", "m_bFiltersActive", "m_bSorted"};
+	mxArray *C = mxCreateStructMatrix(1, 1, 7, astrFields);
+	mxSetField(C, 0, "m_strPlxFile", mxCreateString(M.m_strPlxFile.c_str()));
+	mxSetField(C, 0, "m_strChannelName", mxCreateString(M.m_strChannelName.c_str()));
+	mxSetField(C, 0, "m_iChannelID", mxCreateDoubleScalar(M.m_fChannelID));
+	mxSetField(C, 0, "m_fGain", mxCreateDoubleScalar(M.m_fGain));
+	mxSetField(C, 0, "m_fThreshold", mxCreateDoubleScalar(M.m_fThreshold));
+	mxSetField(C, 0, "m_bFiltersActive", mxCreateDoubleScalar(M.m_fFiltersActive));
+	mxSetField(C, 0, "m_bSorted", mxCreateDoubleScalar(M.m_fSorted));
+	return C;
+}
+
+// Spikes of unit u inside [fStart, fEnd]: only chunks whose time range overlaps the interval are decoded
+static void ReadUnitInterval(StoreReader &Reader, const StoreMember_struct &M, int u, double fStart, double fEnd, bool bWaveforms,
+							 mxArray *&Timestamps, mxArray *&Waveforms)
+{
+	size_t L = size_t(M.m_iWaveFormLength);
+	std::vector<size_t> aiTimes, aiWaves, aiTimeChunks, aiWaveChunks;
+	Reader.ColumnChunks(M, SpikeTimesColumn(u), aiTimes);
+	Reader.ColumnChunks(M, SpikeWavesColumn(u), aiWaves);
+	for (size_t k=0;k<aiTimes.size();k++) {
+		const StoreChunk_struct &C = M.m_Chunks[aiTimes[k]];
+		if (C.m_fEnd >= fStart && C.m_fStart <= fEnd) {
+			aiTimeChunks.push_back(aiTimes[k]);
+			if (k < aiWaves.size())
+				aiWaveChunks.push_back(aiWaves[k]);
+		}
+	}
+	std::vector<std::vector<double> > DecodedTimes;
+	if (!Reader.DecodeDoubleChunks(M, aiTimeChunks, DecodedTimes))
+		mexErrMsgTxt(Reader.GetError().c_str());
+	// (chunk, spike in chunk) of every selected spike
+	std::vector<std::pair<size_t, size_t> > aiSelected;
+	for (size_t k=0;k<DecodedTimes.size();k++)
+		for (size_t i=0;i<DecodedTimes[k].size();i++)
+			if (DecodedTimes[k][i] >= fStart && DecodedTimes[k][i] <= fEnd)
+				aiSelected.push_back(std::make_pair(k, i));
+	size_t m = aiSelected.size();
+	Timestamps = mxCreateDoubleMatrix(m, 1, mxREAL);
+	for (size_t i=0;i<m;i++)
+		mxGetPr(Timestamps)[i] = DecodedTimes[aiSelected[i].first][aiSelected[i].second];
+	if (!bWaveforms) {
+		Waveforms = mxCreateNumericMatrix(0, 0, mxSINGLE_CLASS, mxREAL);
+		return;
+	}
+	std::vector<std::vector<float> > DecodedWaves;
+	if (aiWaveChunks.size() != aiTimeChunks.size() || !Reader.DecodeFloatChunks(M, aiWaveChunks, L, DecodedWaves))
+		mexErrMsgTxt(("Corrupted chunk in member " + M.m_strName).c_str());
+	Waveforms = mxCreateNumericMatrix(m, L, mxSINGLE_CLASS, mxREAL);
+	float *afOut = (float *)mxGetData(Waveforms);
+	for (size_t i=0;i<m;i++) {
+		const float *afWave = &DecodedWaves[aiSelected[i].first][aiSelected[i].second * L];
+		for (size_t s=0;s<L;s++)
+			afOut[s * m + i] = afWave[s];
+	}
+}
+
+static void ReadSpikes(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], StoreReader &Reader, const StoreMember_struct &M)
+{
+	bool bHeaderOnly = false, bInterval = false, bWaveforms = true;
+	double fStart = 0, fEnd = 0;
+	const mxArray *Units = NULL;
+	for (int a=3;a<nrhs;a++) {
+		std::string strOption = LowerCase(prhs[a]);
+		if (strOption == "headeronly") {
+			bHeaderOnly = true;
+			continue;
+		}
+		if (a + 1 >= nrhs)
+			mexErrMsgTxt("Missing option value.");
+		const mxArray *Value = prhs[++a];
+		if (strOption == "units") {
+			if (!mxIsDouble(Value))
+				mexErrMsgTxt("Units must be a vector of unit indices.");
+			Units = Value;
+		} else if (strOption == "interval") {
+			if (!mxIsDouble(Value) || mxGetNumberOfElements(Value) != 2)
+				mexErrMsgTxt("Interval must be [start end].");
+			fStart = mxGetPr(Value)[0];
+			fEnd = mxGetPr(Value)[1];
+			bInterval = true;
+		} else if (strOption == "waveforms")
+			bWaveforms = mxGetScalar(Value) != 0;
+		else if (strOption != "channel") // members hold one channel
+			mexErrMsgTxt("Unknown option. Use 'HeaderOnly', 'Units', 'Interval' or 'Waveforms'.");
+	}
+
+	size_t iNumUnits = M.m_afUnitIndices.size();
+	std::vector<size_t> aiUnits;
+	if (Units == NULL) {
+		for (size_t k=0;k<iNumUnits;k++)
+			aiUnits.push_back(k);
+	} else {
+		for (size_t r=0;r<mxGetNumberOfElements(Units);r++) {
+			size_t k = std::find(M.m_afUnitIndices.begin(), M.m_afUnitIndices.end(), mxGetPr(Units)[r]) - M.m_afUnitIndices.begin();
+			if (k == iNumUnits)
+				mexErrMsgTxt("Unit not found in file.");
+			aiUnits.push_back(k);
+		}
+	}
+
+	const char *astrFields[] = {"m_iUnitIndex", "m_afTimestamps", "m_a2fWaveforms", "m_afInterval"};
+	plhs[0] = mxCreateStructMatrix(1, aiUnits.size(), 4, astrFields);
+	size_t L = size_t(M.m_iWaveFormLength);
+	for (size_t r=0;r<aiUnits.size();r++) {
+		size_t k = aiUnits[r];
+		mxSetField(plhs[0], r, "m_iUnitIndex", mxCreateDoubleScalar(M.m_afUnitIndices[k]));
+		mxArray *Interval = mxCreateDoubleMatrix(1, 2, mxREAL);
+		mxGetPr(Interval)[0] = M.m_afIntervals[k];
+		mxGetPr(Interval)[1] = M.m_afIntervals[k + iNumUnits];
+		mxSetField(plhs[0], r, "m_afInterval", Interval);
+		if (bHeaderOnly) {
+			mxSetField(plhs[0], r, "m_afTimestamps", mxCreateDoubleMatrix(0, 0, mxREAL));
+			mxSetField(plhs[0], r, "m_a2fWaveforms", mxCreateDoubleMatrix(0, 0, mxREAL));
+			continue;
+		}
+		mxArray *Timestamps, *Waveforms;
+		if (bInterval)
+			ReadUnitInterval(Reader, M, int(k), fStart, fEnd, bWaveforms, Timestamps, Waveforms);
+		else {
+			size_t n = size_t(M.m_aiNumSpikes[k]);
+			Timestamps = mxCreateDoubleMatrix(n, 1, mxREAL);
+			Waveforms = mxCreateNumericMatrix(bWaveforms ? n : 0, bWaveforms ? L : 0, mxSINGLE_CLASS, mxREAL);
+			if ((n > 0 && !Reader.ReadDoubles(M, SpikeTimesColumn(int(k)), 0, n, mxGetPr(Timestamps))) ||
+				(bWaveforms && n * L > 0 && !Reader.ReadFloats(M, SpikeWavesColumn(int(k)), 0, n, L, (float *)mxGetData(Waveforms))))
+				mexErrMsgTxt(Reader.GetError().c_str());
+		}
+		mxSetField(plhs[0], r, "m_afTimestamps", Timestamps);
+		mxSetField(plhs[0], r, "m_a2fWaveforms", Waveforms);
+	}
+	if (nlhs > 1)
+		plhs[1] = CreateChannelInfo(M);
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
+static void ReadStrobe(mxArray *plhs[], StoreReader &Reader, const StoreMember_struct &M)
+{
+	size_t n = size_t(M.m_iNumStrobeWords);
+	const char *astrFields[] = {"m_aiWords", "m_afTimestamp"};
+	plhs[0] = mxCreateStructMatrix(1, 1, 2, astrFields);
+	mxArray *Words = mxCreateDoubleMatrix(n, 1, mxREAL);
+	mxArray *Timestamps = mxCreateDoubleMatrix(n, 1, mxREAL);
+	if (n > 0 && (!Reader.ReadDoubles(M, COLUMN_WORDS, 0, n, mxGetPr(Words)) ||
+				  !Reader.ReadDoubles(M, COLUMN_STROBE_TIMES, 0, n, mxGetPr(Timestamps))))
+		mexErrMsgTxt(Reader.GetError().c_str());
+	mxSetField(plhs[0], 0, "m_aiWords", Words);
+	mxSetField(plhs[0], 0, "m_afTimestamp", Timestamps);
+}
+
+static void Pack(int nrhs, const mxArray *prhs[])
+{
+	if (nrhs < 3 || !mxIsCell(prhs[2]))
+		mexErrMsgTxt("Usage: fnSessionStore('Pack', strStoreFile, acRawFiles, [strctOptions])");
+	StoreOptions_struct Options;
+	StoreDefaultOptions(Options);
+	const mxArray *strctOptions = nrhs > 3 && mxIsStruct(prhs[3]) ? prhs[3] : NULL;
+	Options.m_iNumThreads = int(GetScalarField(strctOptions, "m_iNumThreads", Options.m_iNumThreads));
+	Options.m_bVerify = GetScalarField(strctOptions, "m_bVerify", Options.m_bVerify) != 0;
+	Options.m_fTicksPerSec = GetScalarField(strctOptions, "m_fTicksPerSec", Options.m_fTicksPerSec);
+	std::vector<std::string> acRawFiles;
+	for (size_t k=0;k<mxGetNumberOfElements(prhs[2]);k++) {
+		acRawFiles.push_back(GetString(mxGetCell(prhs[2], k)));
+		if (acRawFiles.back().empty())
+			mexErrMsgTxt("acRawFiles must be a cell array of file names.");
+	}
+	std::string strError;
+	if (!StorePackRawFiles(GetString(prhs[1]), acRawFiles, Options, strError))
+		mexErrMsgTxt(strError.c_str());
+}
+
+static void List(mxArray *plhs[], StoreReader &Reader)
+{
+	const std::vector<StoreMember_struct> &Members = Reader.GetMembers();
+	const char *astrFields[] = {"m_strName", "m_strType", "m_iRawBytes", "m_iStoredBytes"};
+	plhs[0] = mxCreateStructMatrix(1, Members.size(), 4, astrFields);
+	for (size_t k=0;k<Members.size();k++) {
+		mxSetField(plhs[0], k, "m_strName", mxCreateString(Members[k].m_strName.c_str()));
+		mxSetField(plhs[0], k, "m_strType", mxCreateString(MEMBER_TYPE_NAMES[Members[k].m_iType]));
+		mxSetField(plhs[0], k, "m_iRawBytes", mxCreateDoubleScalar(double(Members[k].m_iRawBytes)));
+		mxSetField(plhs[0], k, "m_iStoredBytes", mxCreateDoubleScalar(double(Reader.StoredBytes(Members[k]))));
+	}
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 2 || !mxIsChar(prhs[0]) || !mxIsChar(prhs[1])) {
+		mexErrMsgTxt("Usage: fnSessionStore('Pack', strStoreFile, acRawFiles, [strctOptions])\n"
+					 "       astrctMembers = fnSessionStore('List', strStoreFile)\n"
+					 "       [strctAnalog, afTime] = fnSessionStore('Analog', strStoreFile, strMember, ['HeaderOnly' | 'Interval', [t0 t1] | 'Resample', afTimes])\n"
+					 "       [astrctUnits, strctChannelInfo] = fnSessionStore('Spikes', strStoreFile, strMember, ...)\n"
+					 "       strctStrobe = fnSessionStore('Strobe', strStoreFile, strMember)");
+		return;
+	}
+	std::string strCommand = LowerCase(prhs[0]);
+	if (strCommand == "pack") {
+		Pack(nrhs, prhs);
+		return;
+	}
+
+	StoreReader Reader;
+	if (!Reader.Open(GetString(prhs[1])))
+		mexErrMsgTxt(Reader.GetError().c_str());
+	if (strCommand == "list") {
+		List(plhs, Reader);
+		return;
+	}
+	if (nrhs < 3 || !mxIsChar(prhs[2]))
+		mexErrMsgTxt("Missing member name.");
+	const StoreMember_struct *pMember = Reader.FindMember(GetString(prhs[2]));
+	if (pMember == NULL)
+		mexErrMsgTxt("Member not found in session store.");
+	int iExpectedType = strCommand == "analog" ? MEMBER_ANALOG : (strCommand == "spikes" ? MEMBER_SPIKES :
+		(strCommand == "strobe" ? MEMBER_STROBE : -1));
+	if (iExpectedType < 0)
+		mexErrMsgTxt("Unknown command. Use 'Pack', 'List', 'Analog', 'Spikes' or 'Strobe'.");
+	if (pMember->m_iType != iExpectedType)
+		mexErrMsgTxt("Member has a different type.");
+	if (iExpectedType == MEMBER_ANALOG)
+		ReadAnalog(nlhs, plhs, nrhs, prhs, Reader, *pMember);
+	else if (iExpectedType == MEMBER_SPIKES)
+		ReadSpikes(nlhs, plhs, nrhs, prhs, Reader, *pMember);
+	else
+		ReadStrobe(plhs, Reader, *pMember);
+}
+
+#endif
@@ -0,0 +1,49 @@
+% Native timestamped variable log against fnTsAddVar / fnTsSetVar
+fnTsLog('Clear');
+strLogFile = [tempdir, 'TestTsLog.tslog'];
+fnTsLog('Open', strLogFile);
+
+iFix = fnTsLog('AddVar', 'm_strctStimulusParams.FixationSpotPix', [512 384], 16);
+fnTsLog('AddVar', 'ImageList', 'Faces.txt');
+tstrct = fnTsAddVar(struct(), 'FixationSpotPix', [512 384], 16);
+
+iNumSets = 1000;
+for k=1:iNumSets
+    pt2fSpot = [512 384] + k;
+    fnTsLog('Set', iFix, pt2fSpot);
+    tstrct = fnTsSetVar(tstrct, 'FixationSpotPix', pt2fSpot);
+    if mod(k,100) == 0
+        fnTsLog('Set', 'ImageList', sprintf('List%d.txt', k));
+        fnTsLog('Flush');
+    end
+end
+fnTsLog('Set', 'm_iTrial', int32(7));
+fnTsLog('Set', 'm_iTrial', 8.4);	% converted to int32
+
+assert(isequal(fnTsLog('Get', 'm_strctStimulusParams.FixationSpotPix'), fnTsGetVar(tstrct, 'FixationSpotPix')));
+assert(strcmp(fnTsLog('Get', 'ImageList'), 'List1000.txt'));
+assert(fnTsLog('Get', 'm_iTrial') == int32(8));
+
+[a3fBuffer, afTimeStamp] = fnTsLog('GetAll', iFix);
+assert(isequal(size(a3fBuffer), [1 2 iNumSets+1]) && all(diff(afTimeStamp) >= 0));
+assert(isequal(a3fBuffer(:,:,1:tstrct.FixationSpotPix.BufferIdx), tstrct.FixationSpotPix.Buffer(:,:,1:tstrct.FixationSpotPix.BufferIdx)));
+
+% Same layout as fnTsAddVar, dotted names nested
+strctLog = fnTsLog('Export');
+assert(strctLog.m_strctStimulusParams.FixationSpotPix.BufferIdx == iNumSets+1);
+assert(iscell(strctLog.ImageList.Buffer) && length(strctLog.ImageList.Buffer) == 11);
+
+% The file has everything once the log is closed
+fnTsLog('Close');
+strctFile = fnTsLog('Read', strLogFile);
+assert(isequal(strctFile, strctLog));
+[acNames, aiCounts] = fnTsLog('List');
+fprintf('%d variables, %d values\n', length(acNames), sum(aiCounts));
+
+% Cost of one logged value
+iNumTimed = 100000;
+tic; for k=1:iNumTimed, fnTsLog('Set', iFix, [k k]); end; fMEX = toc;
+tic; for k=1:1000, tstrct = fnTsSetVar(tstrct, 'FixationSpotPix', [k k]); end; fEval = toc;
+fprintf('fnTsLog %.2f us per value, fnTsSetVar %.2f us per value\n', fMEX/iNumTimed*1e6, fEval/1000*1e6);
+fnTsLog('Clear');
+delete(strLogFile);
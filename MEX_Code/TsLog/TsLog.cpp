@@ -0,0 +1,362 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+#include "TsLog.h"
+
+static const char TSLOG_MAGIC[16] = "KOFIKO_TSLOG_v1";
+
+int TsLog::Find(const std::string &strName) const
+{
+	std::map<std::string, int>::const_iterator it = m_Names.find(strName);
+	return it == m_Names.end() ? -1 : it->second;
+}
+
+int TsLog::Add(const TsVariable &Var)
+{
+	int iVar = int(m_aVariables.size());
+	m_aVariables.push_back(Var);
+	m_Names[Var.m_strName] = iVar;
+	return iVar;
+}
+
+int TsLog::AddNumeric(const std::string &strName, int iClass, int iElementBytes, const std::vector<int> &aiDims, int iChunkItems)
+{
+	TsVariable Var;
+	Var.m_strName = strName;
+	Var.m_iKind = TSLOG_NUMERIC;
+	Var.m_iClass = iClass;
+	Var.m_iElementBytes = iElementBytes;
+	Var.m_aiDims = aiDims;
+	Var.m_iValueBytes = size_t(iElementBytes);
+	for (size_t k = 0; k < aiDims.size(); k++)
+		Var.m_iValueBytes *= size_t(aiDims[k]);
+	Var.m_iChunkItems = iChunkItems > 0 ? iChunkItems : TSLOG_DEFAULT_CHUNK;
+	Var.m_iCount = 0;
+	Var.m_iFlushed = 0;
+	Var.m_bDefinitionFlushed = false;
+	return Add(Var);
+}
+
+int TsLog::AddString(const std::string &strName, int iChunkItems)
+{
+	std::vector<int> aiDims(2, 1);
+	int iVar = AddNumeric(strName, 0, 1, aiDims, iChunkItems);
+	m_aVariables[iVar].m_iKind = TSLOG_STRING;
+	m_aVariables[iVar].m_iValueBytes = 0;
+	return iVar;
+}
+
+// Opens a new chunk when the last one is full, and stamps the item
+void TsLog::StartItem(TsVariable &Var, double fTime)
+{
+	if (Var.m_iCount % Var.m_iChunkItems == 0) {
+		Var.m_aTimeChunks.push_back(std::vector<double>());
+		Var.m_aTimeChunks.back().reserve(Var.m_iChunkItems);
+		if (Var.m_iKind == TSLOG_STRING) {
+			Var.m_aStringChunks.push_back(std::vector<std::string>());
+			Var.m_aStringChunks.back().reserve(Var.m_iChunkItems);
+		} else {
+			Var.m_aValueChunks.push_back(std::vector<unsigned char>());
+			Var.m_aValueChunks.back().reserve(Var.m_iChunkItems * Var.m_iValueBytes);
+		}
+	}
+	Var.m_aTimeChunks.back().push_back(fTime);
+	Var.m_iCount++;
+}
+
+void TsLog::Append(int iVar, const void *pValue, double fTime)
+{
+	TsVariable &Var = m_aVariables[iVar];
+	StartItem(Var, fTime);
+	const unsigned char *pBytes = (const unsigned char *)pValue;
+	Var.m_aValueChunks.back().insert(Var.m_aValueChunks.back().end(), pBytes, pBytes + Var.m_iValueBytes);
+}
+
+void TsLog::AppendString(int iVar, const std::string &strValue, double fTime)
+{
+	TsVariable &Var = m_aVariables[iVar];
+	StartItem(Var, fTime);
+	Var.m_aStringChunks.back().push_back(strValue);
+}
+
+double TsLog::Time(int iVar, long long iItem) const
+{
+	const TsVariable &Var = m_aVariables[iVar];
+	return Var.m_aTimeChunks[size_t(iItem / Var.m_iChunkItems)][size_t(iItem % Var.m_iChunkItems)];
+}
+
+const unsigned char *TsLog::Value(int iVar, long long iItem) const
+{
+	const TsVariable &Var = m_aVariables[iVar];
+	return &Var.m_aValueChunks[size_t(iItem / Var.m_iChunkItems)][size_t(iItem % Var.m_iChunkItems) * Var.m_iValueBytes];
+}
+
+const std::string &TsLog::String(int iVar, long long iItem) const
+{
+	const TsVariable &Var = m_aVariables[iVar];
+	return Var.m_aStringChunks[size_t(iItem / Var.m_iChunkItems)][size_t(iItem % Var.m_iChunkItems)];
+}
+
+/* File */
+
+static bool WriteUInt32(FILE *fp, unsigned int iValue)
+{
+	return fwrite(&iValue, sizeof(iValue), 1, fp) == 1;
+}
+
+static long long Tell(FILE *fp)
+{
+#ifdef _WIN32
+	return _ftelli64(fp);
+#else
+	return (long long)ftello(fp);
+#endif
+}
+
+static bool Truncate(const std::string &strFile, long long iBytes)
+{
+#ifdef _WIN32
+	int fd;
+	if (_sopen_s(&fd, strFile.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+		return false;
+	bool bOK = _chsize_s(fd, iBytes) == 0;
+	_close(fd);
+	return bOK;
+#else
+	return truncate(strFile.c_str(), (off_t)iBytes) == 0;
+#endif
+}
+
+bool TsLog::Open(const std::string &strFile)
+{
+	Close();
+	m_pFile = fopen(strFile.c_str(), "wb");
+	if (m_pFile == NULL) {
+		m_strError = "Could not open " + strFile + " for writing.";
+		return false;
+	}
+	m_strFile = strFile;
+	m_iGoodBytes = 0;
+	m_bFailed = false;
+	for (size_t k = 0; k < m_aVariables.size(); k++) {
+		m_aVariables[k].m_iFlushed = 0;
+		m_aVariables[k].m_bDefinitionFlushed = false;
+	}
+	if (fwrite(TSLOG_MAGIC, sizeof(TSLOG_MAGIC), 1, m_pFile) != 1) {
+		m_strError = "Could not write to " + strFile + ".";
+		Close();
+		return false;
+	}
+	m_iGoodBytes = sizeof(TSLOG_MAGIC);
+	return Flush();
+}
+
+bool TsLog::WriteDefinition(const TsVariable &Var, int iVar)
+{
+	bool bOK = WriteUInt32(m_pFile, TSLOG_RECORD_VARIABLE) && WriteUInt32(m_pFile, iVar) &&
+		WriteUInt32(m_pFile, unsigned(Var.m_strName.size())) &&
+		fwrite(Var.m_strName.data(), 1, Var.m_strName.size(), m_pFile) == Var.m_strName.size() &&
+		WriteUInt32(m_pFile, Var.m_iKind) && WriteUInt32(m_pFile, Var.m_iClass) &&
+		WriteUInt32(m_pFile, Var.m_iElementBytes) && WriteUInt32(m_pFile, unsigned(Var.m_aiDims.size()));
+	for (size_t k = 0; bOK && k < Var.m_aiDims.size(); k++)
+		bOK = WriteUInt32(m_pFile, Var.m_aiDims[k]);
+	return bOK;
+}
+
+// Values m_iFlushed..m_iCount-1, chunk by chunk
+bool TsLog::WriteValues(const TsVariable &Var, int iVar)
+{
+	long long iCount = Var.m_iCount - Var.m_iFlushed;
+	if (!WriteUInt32(m_pFile, TSLOG_RECORD_VALUES) || !WriteUInt32(m_pFile, iVar) || !WriteUInt32(m_pFile, unsigned(iCount)))
+		return false;
+	for (long long iItem = Var.m_iFlushed; iItem < Var.m_iCount; ) {
+		size_t iChunk = size_t(iItem / Var.m_iChunkItems), iFirst = size_t(iItem % Var.m_iChunkItems);
+		size_t N = Var.m_aTimeChunks[iChunk].size() - iFirst;
+		if (fwrite(&Var.m_aTimeChunks[iChunk][iFirst], sizeof(double), N, m_pFile) != N)
+			return false;
+		iItem += N;
+	}
+	for (long long iItem = Var.m_iFlushed; iItem < Var.m_iCount; ) {
+		size_t iChunk = size_t(iItem / Var.m_iChunkItems), iFirst = size_t(iItem % Var.m_iChunkItems);
+		size_t N = Var.m_aTimeChunks[iChunk].size() - iFirst;
+		if (Var.m_iKind == TSLOG_STRING) {
+			for (size_t k = iFirst; k < iFirst + N; k++) {
+				const std::string &str = Var.m_aStringChunks[iChunk][k];
+				if (!WriteUInt32(m_pFile, unsigned(str.size())) || fwrite(str.data(), 1, str.size(), m_pFile) != str.size())
+					return false;
+			}
+		} else if (N * Var.m_iValueBytes > 0 &&
+				   fwrite(&Var.m_aValueChunks[iChunk][iFirst * Var.m_iValueBytes], Var.m_iValueBytes, N, m_pFile) != N)
+			return false;
+		iItem += N;
+	}
+	return true;
+}
+
+// Drops the file at the end of the last good Flush: whatever the failed write left behind is cut off
+void TsLog::Fail()
+{
+	fclose(m_pFile);
+	m_pFile = NULL;
+	m_bFailed = true;
+	Truncate(m_strFile, m_iGoodBytes);
+	m_strError = "Could not write to " + m_strFile + ". The file keeps what was flushed before, nothing more is written to it.";
+}
+
+bool TsLog::Flush()
+{
+	if (m_bFailed)
+		return false;
+	if (m_pFile == NULL)
+		return true;
+	bool bOK = true;
+	for (size_t k = 0; bOK && k < m_aVariables.size(); k++) {
+		TsVariable &Var = m_aVariables[k];
+		if (!Var.m_bDefinitionFlushed) {
+			bOK = WriteDefinition(Var, int(k));
+			Var.m_bDefinitionFlushed = bOK;
+		}
+		if (bOK && Var.m_iCount > Var.m_iFlushed) {
+			bOK = WriteValues(Var, int(k));
+			if (bOK)
+				Var.m_iFlushed = Var.m_iCount;
+		}
+	}
+	if (!bOK || ferror(m_pFile) || fflush(m_pFile) != 0) {
+		Fail();
+		return false;
+	}
+	m_iGoodBytes = Tell(m_pFile);
+	return true;
+}
+
+void TsLog::Close()
+{
+	if (m_pFile != NULL) {
+		Flush();
+		if (m_pFile != NULL)
+			fclose(m_pFile);
+		m_pFile = NULL;
+	}
+}
+
+void TsLog::Clear()
+{
+	Close();
+	m_bFailed = false;
+	m_aVariables.clear();
+	m_Names.clear();
+}
+
+static bool ReadUInt32(FILE *fp, unsigned int *piValue)
+{
+	return fread(piValue, sizeof(*piValue), 1, fp) == 1;
+}
+
+bool TsLog::Read(const std::string &strFile)
+{
+	Clear();
+	FILE *fp = fopen(strFile.c_str(), "rb");
+	if (fp == NULL) {
+		m_strError = "Could not open " + strFile + ".";
+		return false;
+	}
+	char Magic[sizeof(TSLOG_MAGIC)];
+	if (fread(Magic, sizeof(Magic), 1, fp) != 1 || memcmp(Magic, TSLOG_MAGIC, sizeof(Magic)) != 0) {
+		fclose(fp);
+		m_strError = strFile + " is not a variable log.";
+		return false;
+	}
+
+	// counts and sizes are checked against what is left of the file before anything is allocated
+	fseek(fp, 0, SEEK_END);
+	unsigned long long iFileSize = (unsigned long long)Tell(fp);
+	fseek(fp, sizeof(TSLOG_MAGIC), SEEK_SET);
+
+	std::vector<int> aiLocal;	// file id -> variable
+	std::vector<double> afTimes;
+	unsigned int iType, iId;
+	while (ReadUInt32(fp, &iType) && ReadUInt32(fp, &iId)) {
+		unsigned long long iLeft = iFileSize - (unsigned long long)Tell(fp);
+		if (iType == TSLOG_RECORD_VARIABLE) {
+			unsigned int iNameLength, iKind, iClass, iElementBytes, iNumDims;
+			if (!ReadUInt32(fp, &iNameLength) || iNameLength > 65536)
+				break;
+			std::string strName(iNameLength, ' ');
+			if ((iNameLength > 0 && fread(&strName[0], 1, iNameLength, fp) != iNameLength) ||
+				!ReadUInt32(fp, &iKind) || !ReadUInt32(fp, &iClass) || !ReadUInt32(fp, &iElementBytes) ||
+				!ReadUInt32(fp, &iNumDims) || iNumDims > 32)
+				break;
+			std::vector<int> aiDims(iNumDims);
+			unsigned long long iValueBytes = iElementBytes;
+			bool bOK = iElementBytes > 0 && iElementBytes <= iLeft;
+			for (unsigned int k = 0; bOK && k < iNumDims; k++) {
+				unsigned int iDim;
+				// one value of the variable has to fit in the file
+				bOK = ReadUInt32(fp, &iDim) && (iDim == 0 || iValueBytes <= iLeft / iDim);
+				iValueBytes *= iDim;
+				aiDims[k] = int(iDim);
+			}
+			if (!bOK)
+				break;
+			if (aiLocal.size() <= iId)
+				aiLocal.resize(iId + 1, -1);
+			aiLocal[iId] = iKind == TSLOG_STRING ? AddString(strName, TSLOG_DEFAULT_CHUNK) :
+				AddNumeric(strName, int(iClass), int(iElementBytes), aiDims, TSLOG_DEFAULT_CHUNK);
+		} else if (iType == TSLOG_RECORD_VALUES) {
+			unsigned int N;
+			if (iId >= aiLocal.size() || aiLocal[iId] < 0 || !ReadUInt32(fp, &N))
+				break;
+			int iVar = aiLocal[iId];
+			const TsVariable &Var = m_aVariables[iVar];
+			iLeft = iFileSize - (unsigned long long)Tell(fp);
+			unsigned long long iItemBytes = sizeof(double) + (Var.m_iKind == TSLOG_STRING ? 4 : Var.m_iValueBytes);
+			if (N > iLeft / iItemBytes)
+				break;
+			afTimes.resize(N);
+			if (N > 0 && fread(&afTimes[0], sizeof(double), N, fp) != N)
+				break;
+			// a record is only added once it was read completely
+			std::vector<std::string> aStrings;
+			std::vector<unsigned char> Values;
+			bool bOK = true;
+			if (Var.m_iKind == TSLOG_STRING) {
+				aStrings.resize(N);
+				for (unsigned int k = 0; bOK && k < N; k++) {
+					unsigned int iLength;
+					bOK = ReadUInt32(fp, &iLength) && iLength <= iFileSize - (unsigned long long)Tell(fp);
+					if (bOK) {
+						aStrings[k].resize(iLength);
+						bOK = iLength == 0 || fread(&aStrings[k][0], 1, iLength, fp) == iLength;
+					}
+				}
+			} else {
+				Values.resize(size_t(N) * Var.m_iValueBytes);
+				bOK = Values.empty() || fread(&Values[0], 1, Values.size(), fp) == Values.size();
+			}
+			if (!bOK)
+				break;
+			for (unsigned int k = 0; k < N; k++) {
+				if (Var.m_iKind == TSLOG_STRING)
+					AppendString(iVar, aStrings[k], afTimes[k]);
+				else
+					Append(iVar, Values.empty() ? NULL : &Values[k * Var.m_iValueBytes], afTimes[k]);
+			}
+		} else
+			break;
+	}
+	fclose(fp);
+	return true;
+}
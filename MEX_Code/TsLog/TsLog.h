@@ -0,0 +1,110 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#ifndef TS_LOG_H
+#define TS_LOG_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+
+/*
+ Append only log of timestamped variables: the native version of the Buffer / TimeStamp /
+ BufferIdx structures of fnTsAddVar and fnTsSetVar.
+
+ Every variable has a fixed kind (numeric or string), a fixed numeric class and a fixed value size,
+ all taken from its first value. Values go into chunks of m_iChunkItems items: a full chunk is never
+ copied, the next value starts a new chunk, so an append costs the same at item 10 and 10 million.
+
+ The log can stream to a file (Open): Flush appends whatever was logged since the previous Flush,
+ so the file grows during the session instead of being written all at once at the end.
+
+ File layout (native byte order):
+   "KOFIKO_TSLOG_v1" + '\0'
+   records, each starting with a uint32 type:
+   TSLOG_RECORD_VARIABLE: uint32 id, uint32 name length, name, int32 kind, int32 class,
+                          uint32 element bytes, uint32 number of dims, uint32 dims[]
+   TSLOG_RECORD_VALUES:   uint32 id, uint32 N, double times[N], then N values: element bytes *
+                          number of elements each for numeric variables, uint32 length + chars for strings
+ A record cut short by a crash is ignored when the file is read back. A failed write cuts the file
+ back to the end of the previous Flush and stops the streaming, so the file never holds half a record
+ with more records after it.
+*/
+
+enum {
+	TSLOG_NUMERIC = 0,
+	TSLOG_STRING = 1
+};
+
+enum {
+	TSLOG_RECORD_VARIABLE = 1,
+	TSLOG_RECORD_VALUES = 2
+};
+
+const int TSLOG_DEFAULT_CHUNK = 1024;
+
+typedef struct {
+	std::string m_strName;
+	int m_iKind;
+	int m_iClass;				// mxClassID of numeric variables
+	int m_iElementBytes;
+	std::vector<int> m_aiDims;	// of one value
+	size_t m_iValueBytes;		// element bytes * number of elements
+	int m_iChunkItems;
+
+	std::vector<std::vector<unsigned char> > m_aValueChunks;
+	std::vector<std::vector<std::string> > m_aStringChunks;
+	std::vector<std::vector<double> > m_aTimeChunks;
+	long long m_iCount;
+	long long m_iFlushed;		// values already in the file
+	bool m_bDefinitionFlushed;
+} TsVariable;
+
+class TsLog {
+public:
+	TsLog() : m_pFile(NULL), m_iGoodBytes(0), m_bFailed(false) {}
+	~TsLog() { Close(); }
+
+	int Find(const std::string &strName) const;	// -1 if not logged
+	int AddNumeric(const std::string &strName, int iClass, int iElementBytes, const std::vector<int> &aiDims, int iChunkItems);
+	int AddString(const std::string &strName, int iChunkItems);
+
+	void Append(int iVar, const void *pValue, double fTime);			// numeric, m_iValueBytes bytes
+	void AppendString(int iVar, const std::string &strValue, double fTime);
+
+	int NumVariables() const { return int(m_aVariables.size()); }
+	const TsVariable &Variable(int iVar) const { return m_aVariables[iVar]; }
+	double Time(int iVar, long long iItem) const;
+	const unsigned char *Value(int iVar, long long iItem) const;
+	const std::string &String(int iVar, long long iItem) const;
+
+	bool Open(const std::string &strFile);	// starts streaming everything logged so far, and what follows
+	bool Flush();								// false, and nothing more is written, once a write failed
+	void Close();
+	bool IsOpen() const { return m_pFile != NULL; }
+	bool Read(const std::string &strFile);	// replaces the log with the content of a file
+	void Clear();
+
+	const std::string &GetError() const { return m_strError; }
+
+private:
+	int Add(const TsVariable &Var);
+	void StartItem(TsVariable &Var, double fTime);
+	bool WriteDefinition(const TsVariable &Var, int iVar);
+	bool WriteValues(const TsVariable &Var, int iVar);
+	void Fail();
+
+	std::vector<TsVariable> m_aVariables;
+	std::map<std::string, int> m_Names;
+	FILE *m_pFile;
+	std::string m_strFile;
+	long long m_iGoodBytes;		// end of the records of the last successful Flush
+	bool m_bFailed;
+	std::string m_strError;
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "mex.h"
+#include "TsLog.h"
+#include "../GetSecs_x64/PrecisionClock.h"
+
+/*
+ Timestamped variable log (see TsLog.h). Values are stamped on the GetSecs clock.
+
+ Matlab:
+   iVar = fnTsLog('AddVar', strName, InitValue, [iChunkItems])
+	as fnTsAddVar: logs InitValue now. The name may have dots ('m_strctStimulusParams.FixationSpotPix').
+	Numeric, logical and char values; the class and size of InitValue are those of every later value.
+   fnTsLog('Set', strName or iVar, Value, [fTime])
+	as fnTsSetVar. Unknown names are added. Values of another class are converted.
+   Value = fnTsLog('Get', strName or iVar)                    the last value
+   [Buffer, afTimeStamp] = fnTsLog('GetAll', strName or iVar)
+   strct = fnTsLog('Export')
+	every variable as fnTsAddVar builds it (Buffer, TimeStamp, BufferIdx, BufferSize), dotted names nested.
+   fnTsLog('Open', strFile)	streams the log to strFile (what was logged so far, and then every Flush)
+   fnTsLog('Flush'), fnTsLog('Close'), fnTsLog('Clear')
+   strct = fnTsLog('Read', strFile)	a log file, as 'Export' (the live log is not touched)
+   [acNames, aiCounts] = fnTsLog('List')
+*/
+
+static TsLog g_Log;
+static bool g_bAtExit = false;
+
+static void fnExit()
+{
+	g_Log.Close();
+}
+
+static std::string GetString(const mxArray *pArray)
+{
+	char *pString = mxArrayToString(pArray);
+	if (pString == NULL)
+		mexErrMsgTxt("Expecting a string.");
+	std::string str(pString);
+	mxFree(pString);
+	return str;
+}
+
+static bool IsNumeric(const mxArray *Value)
+{
+	return (mxIsNumeric(Value) || mxIsLogical(Value)) && !mxIsComplex(Value) && !mxIsSparse(Value);
+}
+
+static int AddVariable(const std::string &strName, const mxArray *Value, int iChunkItems)
+{
+	if (mxIsChar(Value))
+		return g_Log.AddString(strName, iChunkItems);
+	if (!IsNumeric(Value))
+		mexErrMsgTxt("Only real numeric, logical and char values can be logged.");
+	const mwSize *Dims = mxGetDimensions(Value);
+	std::vector<int> aiDims(Dims, Dims + mxGetNumberOfDimensions(Value));
+	return g_Log.AddNumeric(strName, int(mxGetClassID(Value)), int(mxGetElementSize(Value)), aiDims, iChunkItems);
+}
+
+static int GetVariable(const mxArray *Var, const mxArray *Value, bool bAdd)
+{
+	if (mxIsChar(Var)) {
+		std::string strName = GetString(Var);
+		int iVar = g_Log.Find(strName);
+		if (iVar < 0 && bAdd)
+			iVar = AddVariable(strName, Value, TSLOG_DEFAULT_CHUNK);
+		if (iVar < 0)
+			mexErrMsgTxt("Variable is not logged.");
+		return iVar;
+	}
+	int iVar = int(mxGetScalar(Var)) - 1;
+	if (iVar < 0 || iVar >= g_Log.NumVariables())
+		mexErrMsgTxt("Variable is not logged.");
+	return iVar;
+}
+
+static mxArray *CreateArray(int iClass, mwSize iNumDims, const mwSize *Dims)
+{
+	if (iClass == mxLOGICAL_CLASS)
+		return mxCreateLogicalArray(iNumDims, Dims);
+	return mxCreateNumericArray(iNumDims, Dims, mxClassID(iClass), mxREAL);
+}
+
+static void Append(int iVar, const mxArray *Value, double fTime)
+{
+	const TsVariable &Var = g_Log.Variable(iVar);
+	if (Var.m_iKind == TSLOG_STRING) {
+		if (!mxIsChar(Value))
+			mexErrMsgTxt("This variable holds strings.");
+		g_Log.AppendString(iVar, GetString(Value), fTime);
+		return;
+	}
+	if (!IsNumeric(Value))
+		mexErrMsgTxt("This variable holds numeric values.");
+	if (mxGetNumberOfElements(Value) * size_t(Var.m_iElementBytes) != Var.m_iValueBytes)
+		mexErrMsgTxt("The value does not have the size of the first value of this variable.");
+
+	if (int(mxGetClassID(Value)) == Var.m_iClass) {
+		g_Log.Append(iVar, mxGetData(Value), fTime);
+		return;
+	}
+	// convert the way Matlab does (rounding, saturation)
+	mxArray *Empty = Var.m_iClass == mxLOGICAL_CLASS ? mxCreateLogicalMatrix(0, 0) :
+		mxCreateNumericMatrix(0, 0, mxClassID(Var.m_iClass), mxREAL);
+	mxArray *Converted = NULL;
+	mxArray *In = const_cast<mxArray *>(Value);
+	mexCallMATLAB(1, &Converted, 1, &In, mxGetClassName(Empty));
+	g_Log.Append(iVar, mxGetData(Converted), fTime);
+	mxDestroyArray(Converted);
+	mxDestroyArray(Empty);
+}
+
+static mxArray *LastValue(const TsLog &Log, int iVar)
+{
+	const TsVariable &Var = Log.Variable(iVar);
+	if (Var.m_iKind == TSLOG_STRING)
+		return mxCreateString(Log.String(iVar, Var.m_iCount - 1).c_str());
+	std::vector<mwSize> Dims(Var.m_aiDims.begin(), Var.m_aiDims.end());
+	mxArray *Out = CreateArray(Var.m_iClass, mwSize(Dims.size()), &Dims[0]);
+	if (Var.m_iValueBytes > 0)
+		memcpy(mxGetData(Out), Log.Value(iVar, Var.m_iCount - 1), Var.m_iValueBytes);
+	return Out;
+}
+
+// Buffer and TimeStamp as fnTsAddVar keeps them: values stacked along one more dimension, or a cell array
+static void AllValues(const TsLog &Log, int iVar, mxArray **pBuffer, mxArray **pTimeStamp)
+{
+	const TsVariable &Var = Log.Variable(iVar);
+	mwSize N = mwSize(Var.m_iCount);
+	if (Var.m_iKind == TSLOG_STRING) {
+		*pBuffer = mxCreateCellMatrix(1, N);
+		for (mwSize k = 0; k < N; k++)
+			mxSetCell(*pBuffer, k, mxCreateString(Log.String(iVar, k).c_str()));
+	} else {
+		std::vector<mwSize> Dims(Var.m_aiDims.begin(), Var.m_aiDims.end());
+		Dims.push_back(N);
+		*pBuffer = CreateArray(Var.m_iClass, mwSize(Dims.size()), &Dims[0]);
+		unsigned char *pOut = (unsigned char *)mxGetData(*pBuffer);
+		for (long long iItem = 0; iItem < Var.m_iCount; iItem += Var.m_iChunkItems) {
+			const std::vector<unsigned char> &Chunk = Var.m_aValueChunks[size_t(iItem / Var.m_iChunkItems)];
+			if (!Chunk.empty())
+				memcpy(pOut + size_t(iItem) * Var.m_iValueBytes, &Chunk[0], Chunk.size());
+		}
+	}
+	*pTimeStamp = mxCreateDoubleMatrix(1, N, mxREAL);
+	double *afTimes = mxGetPr(*pTimeStamp);
+	for (long long iItem = 0; iItem < Var.m_iCount; iItem += Var.m_iChunkItems) {
+		const std::vector<double> &Chunk = Var.m_aTimeChunks[size_t(iItem / Var.m_iChunkItems)];
+		memcpy(afTimes + iItem, &Chunk[0], Chunk.size() * sizeof(double));
+	}
+}
+
+static mxArray *Export(const TsLog &Log)
+{
+	mxArray *Root = mxCreateStructMatrix(1, 1, 0, NULL);
+	for (int iVar = 0; iVar < Log.NumVariables(); iVar++) {
+		const TsVariable &Var = Log.Variable(iVar);
+		// walk down the dotted name, creating the structures on the way
+		mxArray *Parent = Root;
+		std::string strName = Var.m_strName;
+		size_t iDot;
+		while ((iDot = strName.find('.')) != std::string::npos) {
+			std::string strField = strName.substr(0, iDot);
+			strName = strName.substr(iDot + 1);
+			mxArray *Child = mxGetField(Parent, 0, strField.c_str());
+			if (Child == NULL || !mxIsStruct(Child)) {
+				if (mxGetFieldNumber(Parent, strField.c_str()) < 0)
+					mxAddField(Parent, strField.c_str());
+				if (Child != NULL)
+					mxDestroyArray(Child);
+				Child = mxCreateStructMatrix(1, 1, 0, NULL);
+				mxSetField(Parent, 0, strField.c_str(), Child);
+			}
+			Parent = Child;
+		}
+
+		const char *astrFields[] = {"Buffer", "TimeStamp", "BufferIdx", "BufferSize"};
+		mxArray *Entry = mxCreateStructMatrix(1, 1, 4, astrFields);
+		mxArray *Buffer, *TimeStamp;
+		AllValues(Log, iVar, &Buffer, &TimeStamp);
+		mxSetField(Entry, 0, "Buffer", Buffer);
+		mxSetField(Entry, 0, "TimeStamp", TimeStamp);
+		mxSetField(Entry, 0, "BufferIdx", mxCreateDoubleScalar(double(Var.m_iCount)));
+		mxSetField(Entry, 0, "BufferSize", mxCreateDoubleScalar(double(Var.m_iCount)));
+		if (mxGetFieldNumber(Parent, strName.c_str()) < 0)
+			mxAddField(Parent, strName.c_str());
+		mxArray *Old = mxGetField(Parent, 0, strName.c_str());
+		if (Old != NULL)
+			mxDestroyArray(Old);
+		mxSetField(Parent, 0, strName.c_str(), Entry);
+	}
+	return Root;
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 1 || !mxIsChar(prhs[0])) {
+		mexErrMsgTxt("Usage: iVar = fnTsLog('AddVar', strName, InitValue, [iChunkItems])\n"
+					 "       fnTsLog('Set', strName or iVar, Value, [fTime]), Value = fnTsLog('Get', strName or iVar)\n"
+					 "       [Buffer, afTimeStamp] = fnTsLog('GetAll', strName or iVar), strct = fnTsLog('Export')\n"
+					 "       fnTsLog('Open', strFile), fnTsLog('Flush'), fnTsLog('Close'), fnTsLog('Clear')\n"
+					 "       strct = fnTsLog('Read', strFile), [acNames, aiCounts] = fnTsLog('List')");
+		return;
+	}
+	if (!g_bAtExit) {
+		mexAtExit(fnExit);
+		g_bAtExit = true;
+	}
+	std::string strCommand = GetString(prhs[0]);
+
+	if (strCommand == "Set") {
+		if (nrhs < 3)
+			mexErrMsgTxt("Set: variable and value expected.");
+		int iVar = GetVariable(prhs[1], prhs[2], true);
+		Append(iVar, prhs[2], nrhs > 3 ? mxGetScalar(prhs[3]) : ClockGetSecs());
+	} else if (strCommand == "AddVar") {
+		if (nrhs < 3 || !mxIsChar(prhs[1]))
+			mexErrMsgTxt("AddVar: name and initial value expected.");
+		std::string strName = GetString(prhs[1]);
+		int iVar = g_Log.Find(strName);
+		if (iVar < 0)
+			iVar = AddVariable(strName, prhs[2], nrhs > 3 ? int(mxGetScalar(prhs[3])) : TSLOG_DEFAULT_CHUNK);
+		Append(iVar, prhs[2], ClockGetSecs());
+		plhs[0] = mxCreateDoubleScalar(iVar + 1);
+	} else if (strCommand == "Get") {
+		if (nrhs < 2)
+			mexErrMsgTxt("Get: variable expected.");
+		plhs[0] = LastValue(g_Log, GetVariable(prhs[1], NULL, false));
+	} else if (strCommand == "GetAll") {
+		if (nrhs < 2)
+			mexErrMsgTxt("GetAll: variable expected.");
+		mxArray *Buffer, *TimeStamp;
+		AllValues(g_Log, GetVariable(prhs[1], NULL, false), &Buffer, &TimeStamp);
+		plhs[0] = Buffer;
+		if (nlhs > 1)
+			plhs[1] = TimeStamp;
+		else
+			mxDestroyArray(TimeStamp);
+	} else if (strCommand == "Export") {
+		plhs[0] = Export(g_Log);
+	} else if (strCommand == "Open") {
+		if (nrhs < 2 || !mxIsChar(prhs[1]))
+			mexErrMsgTxt("Open: file name expected.");
+		if (!g_Log.Open(GetString(prhs[1])))
+			mexErrMsgTxt(g_Log.GetError().c_str());
+	} else if (strCommand == "Flush") {
+		if (!g_Log.Flush())
+			mexErrMsgTxt(g_Log.GetError().c_str());
+	} else if (strCommand == "Close") {
+		g_Log.Close();
+	} else if (strCommand == "Clear") {
+		g_Log.Clear();
+	} else if (strCommand == "Read") {
+		if (nrhs < 2 || !mxIsChar(prhs[1]))
+			mexErrMsgTxt("Read: file name expected.");
+		TsLog Log;
+		if (!Log.Read(GetString(prhs[1])))
+			mexErrMsgTxt(Log.GetError().c_str());
+		plhs[0] = Export(Log);
+	} else if (strCommand == "List") {
+		int N = g_Log.NumVariables();
+		plhs[0] = mxCreateCellMatrix(N, 1);
+		for (int k = 0; k < N; k++)
+			mxSetCell(plhs[0], k, mxCreateString(g_Log.Variable(k).m_strName.c_str()));
+		if (nlhs > 1) {
+			plhs[1] = mxCreateDoubleMatrix(N, 1, mxREAL);
+			for (int k = 0; k < N; k++)
+				mxGetPr(plhs[1])[k] = double(g_Log.Variable(k).m_iCount);
+		}
+	} else
+		mexErrMsgTxt("Unknown command.");
+}
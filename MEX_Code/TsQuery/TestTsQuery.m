@@ -0,0 +1,67 @@
+% Batched queries over timestamped variables against fnMyInterp1 and find
+strctLog = struct();
+strctLog = fnTsAddVar(strctLog, 'StimulusON', 0, 16);
+strctLog = fnTsAddVar(strctLog, 'FixationSpotPix', [512 384], 16);
+strctLog = fnTsAddVar(strctLog, 'ImageList', 'Faces.txt', 16);
+strctLog.m_strctStimulusParams = fnTsAddVar(struct(), 'm_fRotationAngle', 0, 16);
+for k=1:200
+    strctLog = fnTsSetVar(strctLog, 'StimulusON', mod(k,2));
+    strctLog = fnTsSetVar(strctLog, 'FixationSpotPix', [512 384] + k);
+    strctLog.m_strctStimulusParams = fnTsSetVar(strctLog.m_strctStimulusParams, 'm_fRotationAngle', k*10);
+    if mod(k,50) == 0
+        strctLog = fnTsSetVar(strctLog, 'ImageList', sprintf('List%d.txt', k));
+    end
+    WaitSecs(0.001);
+end
+acNames = {'StimulusON', 'FixationSpotPix', 'm_strctStimulusParams.m_fRotationAngle'};
+afTS = strctLog.StimulusON.TimeStamp(1:strctLog.StimulusON.BufferIdx);
+afTrialOnsets = sort(afTS(1) + rand(1,100) * (afTS(end) - afTS(1)));
+
+[a2fMatrix, aiFirstColumn, acColumns] = fnTsQuery('Join', strctLog, acNames, afTrialOnsets);
+assert(isequal(size(a2fMatrix), [100 4]) && isequal(aiFirstColumn, [1 2 4]) && strcmp(acColumns{3}, 'FixationSpotPix(2)'));
+afBuffer = squeeze(strctLog.StimulusON.Buffer(1,1,1:strctLog.StimulusON.BufferIdx));
+assert(isequal(a2fMatrix(:,1), fnMyInterp1(afTS, afBuffer, afTrialOnsets(:))));
+strctRot = strctLog.m_strctStimulusParams.m_fRotationAngle;
+afRotTS = strctRot.TimeStamp(1:strctRot.BufferIdx);
+afRot = squeeze(strctRot.Buffer(1,1,1:strctRot.BufferIdx));
+assert(max(abs(fnTsQuery('Join', strctLog, acNames{3}, afTrialOnsets, 'linear') - fnMyInterp1(afRotTS, afRot, afTrialOnsets(:), 'linear'))) < 1e-9);
+
+% As-of semantics: nothing before the first value, nothing older than fMaxAge
+assert(all(isnan(fnTsQuery('Join', strctLog, acNames, afTS(1) - 1))));
+assert(all(isnan(fnTsQuery('Join', strctLog, acNames, afTS(end) + 10, 'hold', 1))));
+
+% Index works for strings too
+aiIndex = fnTsQuery('Index', strctLog, 'ImageList', afTrialOnsets);
+acImage = strctLog.ImageList.Buffer(aiIndex);
+fprintf('Last trial used %s\n', acImage{end});
+
+% Intervals match find on the time stamps
+afStart = afTrialOnsets(1:end-1); afEnd = afTrialOnsets(2:end);
+[a2iFirst, a2iLast, a2iAtStart] = fnTsQuery('Interval', strctLog, acNames, afStart, afEnd);
+for k=1:length(afStart)
+    aiInside = find(afTS >= afStart(k) & afTS <= afEnd(k));
+    assert(isequal(a2iFirst(k,1):a2iLast(k,1), aiInside));
+    assert(a2iAtStart(k,1) == find(afTS <= afStart(k), 1, 'last'));
+end
+
+% Per-trial design matrix from 200 variables
+strctBig = struct();
+acBigNames = cell(1,200);
+for v=1:200
+    acBigNames{v} = sprintf('Var%d', v);
+    iNumValues = 20000;
+    strctBig.(acBigNames{v}) = struct('Buffer', reshape(rand(1,iNumValues), [1 1 iNumValues]), ...
+        'TimeStamp', cumsum(rand(1,iNumValues)*0.2), 'BufferIdx', iNumValues, 'BufferSize', iNumValues);
+end
+afTrials = 0:2:1999;
+tic; a2fDesign = fnTsQuery('Join', strctBig, acBigNames, afTrials); fMEX = toc;
+tic;
+a2fLoop = zeros(length(afTrials), 200);
+for v=1:200
+    strctVar = strctBig.(acBigNames{v});
+    a2fLoop(:,v) = fnMyInterp1(strctVar.TimeStamp, squeeze(strctVar.Buffer), afTrials(:));
+end
+fLoop = toc;
+a2fLoop(bsxfun(@lt, afTrials(:), cellfun(@(s) strctBig.(s).TimeStamp(1), acBigNames))) = NaN;
+assert(isequaln(a2fDesign, a2fLoop));
+fprintf('200 variables x %d trials: fnTsQuery %.2f ms, fnMyInterp1 loop %.2f ms\n', length(afTrials), fMEX*1e3, fLoop*1e3);
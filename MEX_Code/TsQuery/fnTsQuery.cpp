@@ -0,0 +1,429 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include "mex.h"
+#include "../MyInterp1/Resample1D.h"
+
+/*
+ Queries over logged timestamped variables (the Buffer / TimeStamp / BufferIdx structures of
+ fnTsAddVar, or fnTsLog('Export')), many variables and many query times in one call.
+
+ strctRoot holds the variables, acNames lists them (a string or a cell of strings, dots go down
+ nested structures: 'm_strctStimulusParams.FixationSpotPix'). Only the first BufferIdx entries are
+ used, and their TimeStamp must be non-decreasing (GetSecs order). Sorted query times are the fast
+ path: every lookup gallops from the answer of the previous one.
+
+ Matlab:
+   [a2fMatrix, aiFirstColumn, acColumns] = fnTsQuery('Join', strctRoot, acNames, afTimes, [strMode], [fMaxAge])
+	as-of join onto one timeline: row k holds every variable as it was at afTimes(k). A variable whose
+	values have E elements takes E columns, starting at aiFirstColumn(v). strMode is 'hold' (default,
+	the last value logged at or before the time), 'nearest' or 'linear'. NaN before a variable was
+	first logged, and where the value used is older than fMaxAge seconds. Numeric variables only.
+   a2iIndex = fnTsQuery('Index', strctRoot, acNames, afTimes, [fMaxAge])
+	BufferIdx entry (1-based) in effect at each time, 0 if none. Works for string variables as well.
+   [a2iFirst, a2iLast, a2iAtStart] = fnTsQuery('Interval', strctRoot, acNames, afStart, afEnd)
+	entries logged within [afStart(k), afEnd(k)]: a2iFirst(k,v):a2iLast(k,v), empty when Last < First.
+	a2iAtStart is the entry in effect at afStart(k) (0 if none).
+ Outputs have one row per query time (or interval) and one column per variable (per element for Join).
+*/
+
+// Variables are split across threads only above this many output elements
+const int TSQUERY_MIN_PARALLEL_WORK = 1 << 16;
+const int TSQUERY_MAX_THREADS = 16;
+
+typedef struct {
+	std::string m_strName;
+	const double *m_afTimeStamp;
+	int m_iNumItems;			// BufferIdx
+	const void *m_pValues;		// NULL for string variables
+	mxClassID m_Class;
+	int m_iNumElements;			// of one value
+	int m_iFirstColumn;			// 0-based, Join only
+} TsQueryVar;
+
+static std::string GetString(const mxArray *pArray)
+{
+	char *pString = mxArrayToString(pArray);
+	if (pString == NULL)
+		mexErrMsgTxt("Expecting a string.");
+	std::string str(pString);
+	mxFree(pString);
+	return str;
+}
+
+static std::vector<std::string> GetNames(const mxArray *Names)
+{
+	std::vector<std::string> astrNames;
+	if (mxIsChar(Names)) {
+		astrNames.push_back(GetString(Names));
+	} else if (mxIsCell(Names)) {
+		for (mwSize k = 0; k < mxGetNumberOfElements(Names); k++) {
+			const mxArray *Name = mxGetCell(Names, k);
+			if (Name == NULL || !mxIsChar(Name))
+				mexErrMsgTxt("Variable names must be strings.");
+			astrNames.push_back(GetString(Name));
+		}
+	} else
+		mexErrMsgTxt("Expecting a variable name or a cell array of names.");
+	return astrNames;
+}
+
+// All the pointers are taken here, so the workers never call the Matlab API
+static TsQueryVar ResolveVariable(const mxArray *Root, const std::string &strName)
+{
+	char strError[512];
+	const mxArray *Node = Root;
+	size_t iStart = 0;
+	while (Node != NULL) {
+		size_t iDot = strName.find('.', iStart);
+		std::string strField = strName.substr(iStart, iDot == std::string::npos ? std::string::npos : iDot - iStart);
+		Node = mxIsStruct(Node) ? mxGetField(Node, 0, strField.c_str()) : NULL;
+		if (iDot == std::string::npos)
+			break;
+		iStart = iDot + 1;
+	}
+	const mxArray *Buffer = Node != NULL && mxIsStruct(Node) ? mxGetField(Node, 0, "Buffer") : NULL;
+	const mxArray *TimeStamp = Node != NULL && mxIsStruct(Node) ? mxGetField(Node, 0, "TimeStamp") : NULL;
+	if (Buffer == NULL || TimeStamp == NULL || !mxIsDouble(TimeStamp)) {
+		sprintf(strError, "%.400s is not a timestamped variable (Buffer, TimeStamp).", strName.c_str());
+		mexErrMsgTxt(strError);
+	}
+
+	TsQueryVar Var;
+	Var.m_strName = strName;
+	Var.m_afTimeStamp = mxGetPr(TimeStamp);
+	int iAllocated = int(mxGetNumberOfElements(TimeStamp));
+	const mxArray *BufferIdx = mxGetField(Node, 0, "BufferIdx");
+	Var.m_iNumItems = BufferIdx != NULL && !mxIsEmpty(BufferIdx) ? int(mxGetScalar(BufferIdx)) : iAllocated;
+	if (Var.m_iNumItems > iAllocated) Var.m_iNumItems = iAllocated;
+	if (Var.m_iNumItems < 0) Var.m_iNumItems = 0;
+
+	Var.m_Class = mxGetClassID(Buffer);
+	Var.m_iFirstColumn = 0;
+	if (mxIsCell(Buffer)) {
+		Var.m_pValues = NULL;
+		Var.m_iNumElements = 1;
+	} else {
+		// Buffer is [size of one value, BufferSize] and TimeStamp has BufferSize entries
+		size_t iNumValues = mxGetNumberOfElements(Buffer);
+		if (mxIsComplex(Buffer) || mxIsSparse(Buffer) || iAllocated == 0 || iNumValues % iAllocated != 0) {
+			sprintf(strError, "%.400s: Buffer does not match TimeStamp.", strName.c_str());
+			mexErrMsgTxt(strError);
+		}
+		Var.m_pValues = mxGetData(Buffer);
+		Var.m_iNumElements = int(iNumValues / iAllocated);
+	}
+	return Var;
+}
+
+static std::vector<TsQueryVar> ResolveVariables(const mxArray *Root, const mxArray *Names)
+{
+	if (!mxIsStruct(Root))
+		mexErrMsgTxt("Expecting a structure of timestamped variables.");
+	std::vector<std::string> astrNames = GetNames(Names);
+	std::vector<TsQueryVar> aVars;
+	for (size_t k = 0; k < astrNames.size(); k++)
+		aVars.push_back(ResolveVariable(Root, astrNames[k]));
+	return aVars;
+}
+
+// Entry in effect at each time (-1 if none, or older than fMaxAge)
+static void IndexVariable(const TsQueryVar &Var, const double *afTimes, int iNumTimes, double fMaxAge, int *aiIndex)
+{
+	int iPos = 0;
+	for (int k = 0; k < iNumTimes; k++) {
+		double t = afTimes[k];
+		if (t != t || Var.m_iNumItems == 0) {
+			aiIndex[k] = -1;
+			continue;
+		}
+		iPos = FindLastLessOrEqual(Var.m_afTimeStamp, Var.m_iNumItems, t, iPos);
+		aiIndex[k] = (iPos >= 0 && t - Var.m_afTimeStamp[iPos] <= fMaxAge) ? iPos : -1;
+	}
+}
+
+template<class T> void JoinColumns(const TsQueryVar &Var, const T *Values, const double *afTimes, int iNumTimes,
+								   ResampleMode Mode, double fMaxAge, double *Out)
+{
+	const double fNaN = ResampleMissingValue<double>();
+	const double *TS = Var.m_afTimeStamp;
+	int N = Var.m_iNumItems, E = Var.m_iNumElements;
+	int iPos = 0;
+	for (int k = 0; k < iNumTimes; k++) {
+		double t = afTimes[k];
+		int i0 = -1, i1 = -1;
+		double fAlpha = 0;
+		if (t == t && N > 0) {
+			iPos = FindLastLessOrEqual(TS, N, t, iPos);
+			if (Mode == RESAMPLE_NEAREST) {
+				int iNext = iPos + 1 < N ? iPos + 1 : -1;
+				if (iPos < 0 || (iNext >= 0 && TS[iNext] - t < t - TS[iPos]))
+					i0 = iNext;
+				else
+					i0 = iPos;
+				if (fabs(t - TS[i0]) > fMaxAge)
+					i0 = -1;
+			} else if (iPos >= 0 && t - TS[iPos] <= fMaxAge) {
+				i0 = iPos;
+				if (Mode == RESAMPLE_LINEAR && iPos + 1 < N && TS[iPos + 1] > TS[iPos]) {
+					i1 = iPos + 1;
+					fAlpha = (t - TS[i0]) / (TS[i1] - TS[i0]);
+				}
+			}
+		}
+
+		if (i0 < 0) {
+			for (int e = 0; e < E; e++)
+				Out[(size_t)e * iNumTimes + k] = fNaN;
+		} else if (i1 < 0) {
+			const T *V0 = Values + (size_t)i0 * E;
+			for (int e = 0; e < E; e++)
+				Out[(size_t)e * iNumTimes + k] = double(V0[e]);
+		} else {
+			const T *V0 = Values + (size_t)i0 * E, *V1 = Values + (size_t)i1 * E;
+			for (int e = 0; e < E; e++)
+				Out[(size_t)e * iNumTimes + k] = double(V0[e]) + fAlpha * (double(V1[e]) - double(V0[e]));
+		}
+	}
+}
+
+static bool IsNumericClass(mxClassID Class)
+{
+	switch (Class) {
+		case mxDOUBLE_CLASS: case mxSINGLE_CLASS: case mxLOGICAL_CLASS:
+		case mxINT8_CLASS: case mxUINT8_CLASS: case mxINT16_CLASS: case mxUINT16_CLASS:
+		case mxINT32_CLASS: case mxUINT32_CLASS: case mxINT64_CLASS: case mxUINT64_CLASS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void JoinVariable(const TsQueryVar &Var, const double *afTimes, int iNumTimes, ResampleMode Mode, double fMaxAge, double *Out)
+{
+	const void *Values = Var.m_pValues;
+	switch (Var.m_Class) {
+		case mxDOUBLE_CLASS:  JoinColumns(Var, (const double*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxSINGLE_CLASS:  JoinColumns(Var, (const float*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxINT8_CLASS:    JoinColumns(Var, (const signed char*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxUINT8_CLASS:   JoinColumns(Var, (const unsigned char*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxLOGICAL_CLASS: JoinColumns(Var, (const mxLogical*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxINT16_CLASS:   JoinColumns(Var, (const short*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxUINT16_CLASS:  JoinColumns(Var, (const unsigned short*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxINT32_CLASS:   JoinColumns(Var, (const int*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxUINT32_CLASS:  JoinColumns(Var, (const unsigned int*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxINT64_CLASS:   JoinColumns(Var, (const long long*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		case mxUINT64_CLASS:  JoinColumns(Var, (const unsigned long long*)Values, afTimes, iNumTimes, Mode, fMaxAge, Out); break;
+		default: break; // rejected before the workers start
+	}
+}
+
+// Entries within [afStart(k), afEnd(k)], and the entry in effect at afStart(k)
+static void IntervalVariable(const TsQueryVar &Var, const double *afStart, const double *afEnd, int iNumIntervals,
+							 double *afFirst, double *afLast, double *afAtStart)
+{
+	int iPosBefore = 0, iPosStart = 0, iPosEnd = 0;
+	for (int k = 0; k < iNumIntervals; k++) {
+		double t0 = afStart[k], t1 = afEnd[k];
+		if (t0 != t0 || t1 != t1 || Var.m_iNumItems == 0) {
+			afFirst[k] = 1;
+			afLast[k] = 0;
+			afAtStart[k] = 0;
+			continue;
+		}
+		// the last entry before t0 is the last one <= the double just below t0
+		iPosBefore = FindLastLessOrEqual(Var.m_afTimeStamp, Var.m_iNumItems, nextafter(t0, -HUGE_VAL), iPosBefore);
+		iPosStart = FindLastLessOrEqual(Var.m_afTimeStamp, Var.m_iNumItems, t0, iPosStart);
+		iPosEnd = FindLastLessOrEqual(Var.m_afTimeStamp, Var.m_iNumItems, t1, iPosEnd);
+		afFirst[k] = iPosBefore + 2;
+		afLast[k] = iPosEnd + 1;
+		if (afLast[k] < afFirst[k] - 1)
+			afLast[k] = afFirst[k] - 1;
+		afAtStart[k] = iPosStart + 1;
+	}
+}
+
+/*
+ Runs Func(iVar) for every variable, the variables split into contiguous blocks across threads
+ when there is enough work (fWorkPerVariable output elements each, on average).
+*/
+template<class F> void ForEachVariable(int iNumVars, double fWorkPerVariable, const F &Func)
+{
+	int iNumThreads = 1;
+	if (fWorkPerVariable * iNumVars >= TSQUERY_MIN_PARALLEL_WORK) {
+		iNumThreads = int(std::thread::hardware_concurrency());
+		if (iNumThreads > TSQUERY_MAX_THREADS) iNumThreads = TSQUERY_MAX_THREADS;
+		if (iNumThreads > iNumVars) iNumThreads = iNumVars;
+		if (iNumThreads < 1) iNumThreads = 1;
+	}
+	if (iNumThreads == 1) {
+		for (int v = 0; v < iNumVars; v++)
+			Func(v);
+		return;
+	}
+
+	std::vector<std::thread> Workers;
+	int iBlock = (iNumVars + iNumThreads - 1) / iNumThreads;
+	for (int iThread = 0; iThread < iNumThreads; iThread++) {
+		int iFirst = iThread * iBlock;
+		int iLast = iFirst + iBlock < iNumVars ? iFirst + iBlock : iNumVars;
+		if (iFirst >= iLast)
+			break;
+		Workers.push_back(std::thread([&Func, iFirst, iLast]() {
+			for (int v = iFirst; v < iLast; v++)
+				Func(v);
+		}));
+	}
+	for (size_t k = 0; k < Workers.size(); k++)
+		Workers[k].join();
+}
+
+static ResampleMode GetMode(const mxArray *Mode)
+{
+	std::string strMode = GetString(Mode);
+	if (strMode == "hold")
+		return RESAMPLE_HOLD;
+	if (strMode == "nearest")
+		return RESAMPLE_NEAREST;
+	if (strMode == "linear")
+		return RESAMPLE_LINEAR;
+	mexErrMsgTxt("Unknown mode. Use 'hold', 'nearest' or 'linear'.");
+	return RESAMPLE_HOLD;
+}
+
+static double GetMaxAge(int nrhs, const mxArray *prhs[], int iArg)
+{
+	if (nrhs <= iArg || mxIsEmpty(prhs[iArg]))
+		return HUGE_VAL;
+	return mxGetScalar(prhs[iArg]);
+}
+
+static const double *GetTimes(const mxArray *Times, int *piNumTimes)
+{
+	if (!mxIsDouble(Times) || mxIsComplex(Times))
+		mexErrMsgTxt("Query times must be double.");
+	*piNumTimes = int(mxGetNumberOfElements(Times));
+	return mxGetPr(Times);
+}
+
+static void Join(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (nrhs < 4)
+		mexErrMsgTxt("Join: structure, names and times expected.");
+	std::vector<TsQueryVar> aVars = ResolveVariables(prhs[1], prhs[2]);
+	int iNumTimes;
+	const double *afTimes = GetTimes(prhs[3], &iNumTimes);
+	ResampleMode Mode = nrhs > 4 && !mxIsEmpty(prhs[4]) ? GetMode(prhs[4]) : RESAMPLE_HOLD;
+	double fMaxAge = GetMaxAge(nrhs, prhs, 5);
+
+	int iNumColumns = 0;
+	for (size_t v = 0; v < aVars.size(); v++) {
+		if (aVars[v].m_pValues == NULL || !IsNumericClass(aVars[v].m_Class)) {
+			char strError[512];
+			sprintf(strError, "Join: %.400s is not numeric (use 'Index').", aVars[v].m_strName.c_str());
+			mexErrMsgTxt(strError);
+		}
+		aVars[v].m_iFirstColumn = iNumColumns;
+		iNumColumns += aVars[v].m_iNumElements;
+	}
+
+	plhs[0] = mxCreateDoubleMatrix(iNumTimes, iNumColumns, mxREAL);
+	double *Out = mxGetPr(plhs[0]);
+	int iNumVars = int(aVars.size());
+	ForEachVariable(iNumVars, iNumVars > 0 ? double(iNumTimes) * iNumColumns / iNumVars : 0, [&](int v) {
+		JoinVariable(aVars[v], afTimes, iNumTimes, Mode, fMaxAge, Out + (size_t)aVars[v].m_iFirstColumn * iNumTimes);
+	});
+
+	if (nlhs > 1) {
+		plhs[1] = mxCreateDoubleMatrix(1, iNumVars, mxREAL);
+		for (int v = 0; v < iNumVars; v++)
+			mxGetPr(plhs[1])[v] = aVars[v].m_iFirstColumn + 1;
+	}
+	if (nlhs > 2) {
+		plhs[2] = mxCreateCellMatrix(1, iNumColumns);
+		for (int v = 0; v < iNumVars; v++) {
+			for (int e = 0; e < aVars[v].m_iNumElements; e++) {
+				char strElement[32];
+				sprintf(strElement, "(%d)", e + 1);
+				std::string strColumn = aVars[v].m_strName + (aVars[v].m_iNumElements > 1 ? strElement : "");
+				mxSetCell(plhs[2], aVars[v].m_iFirstColumn + e, mxCreateString(strColumn.c_str()));
+			}
+		}
+	}
+}
+
+static void Index(mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (nrhs < 4)
+		mexErrMsgTxt("Index: structure, names and times expected.");
+	std::vector<TsQueryVar> aVars = ResolveVariables(prhs[1], prhs[2]);
+	int iNumTimes;
+	const double *afTimes = GetTimes(prhs[3], &iNumTimes);
+	double fMaxAge = GetMaxAge(nrhs, prhs, 4);
+
+	int iNumVars = int(aVars.size());
+	plhs[0] = mxCreateDoubleMatrix(iNumTimes, iNumVars, mxREAL);
+	double *Out = mxGetPr(plhs[0]);
+	ForEachVariable(iNumVars, iNumTimes, [&](int v) {
+		std::vector<int> aiIndex(iNumTimes);
+		if (iNumTimes > 0)
+			IndexVariable(aVars[v], afTimes, iNumTimes, fMaxAge, &aiIndex[0]);
+		for (int k = 0; k < iNumTimes; k++)
+			Out[(size_t)v * iNumTimes + k] = aiIndex[k] + 1;
+	});
+}
+
+static void Interval(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	if (nrhs < 5)
+		mexErrMsgTxt("Interval: structure, names, start and end times expected.");
+	std::vector<TsQueryVar> aVars = ResolveVariables(prhs[1], prhs[2]);
+	int iNumIntervals, iNumEnds;
+	const double *afStart = GetTimes(prhs[3], &iNumIntervals);
+	const double *afEnd = GetTimes(prhs[4], &iNumEnds);
+	if (iNumEnds != iNumIntervals)
+		mexErrMsgTxt("Interval: start and end times must have the same length.");
+
+	int iNumVars = int(aVars.size());
+	for (int i = 0; i < 3; i++)
+		plhs[i] = mxCreateDoubleMatrix(iNumIntervals, iNumVars, mxREAL);
+	double *afFirst = mxGetPr(plhs[0]), *afLast = mxGetPr(plhs[1]), *afAtStart = mxGetPr(plhs[2]);
+	ForEachVariable(iNumVars, 3.0 * iNumIntervals, [&](int v) {
+		size_t iOffset = (size_t)v * iNumIntervals;
+		IntervalVariable(aVars[v], afStart, afEnd, iNumIntervals, afFirst + iOffset, afLast + iOffset, afAtStart + iOffset);
+	});
+	for (int i = nlhs > 1 ? nlhs : 1; i < 3; i++) {
+		mxDestroyArray(plhs[i]);
+		plhs[i] = NULL;
+	}
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
+{
+	if (nrhs < 1 || !mxIsChar(prhs[0])) {
+		mexErrMsgTxt("Usage: [a2fMatrix, aiFirstColumn, acColumns] = fnTsQuery('Join', strctRoot, acNames, afTimes, ['hold' | 'nearest' | 'linear'], [fMaxAge])\n"
+					 "       a2iIndex = fnTsQuery('Index', strctRoot, acNames, afTimes, [fMaxAge])\n"
+					 "       [a2iFirst, a2iLast, a2iAtStart] = fnTsQuery('Interval', strctRoot, acNames, afStart, afEnd)");
+		return;
+	}
+	std::string strCommand = GetString(prhs[0]);
+
+	if (strCommand == "Join")
+		Join(nlhs, plhs, nrhs, prhs);
+	else if (strCommand == "Index")
+		Index(plhs, nrhs, prhs);
+	else if (strCommand == "Interval")
+		Interval(nlhs, plhs, nrhs, prhs);
+	else
+		mexErrMsgTxt("Unknown command.");
+}
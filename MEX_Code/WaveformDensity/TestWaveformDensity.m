@@ -0,0 +1,26 @@
+% Compare against Bresenham and time the multi unit / anti-aliased modes
+a2fWaves = 0.7*sin(repmat((0:39)/3,20000,1)) + 0.1*randn(20000,40);
+aiUnits = ceil(rand(20000,1)*4);
+
+a2fOld = Bresenham(a2fWaves, [1 40], 200, [-1 1], 200);
+a2fNew = fnWaveformDensity(a2fWaves, [1 40], 200, [-1 1], 200);
+assert(isequal(a2fOld, a2fNew));
+
+tic; a3fUnits = fnWaveformDensity(a2fWaves, [1 40], 200, [-1 1], 200, aiUnits); toc
+assert(max(max(abs(sum(a3fUnits,3) - a2fNew))) < 1e-9);
+
+tic; a3fSmooth = fnWaveformDensity(a2fWaves, [1 40], 200, [-1 1], 200, aiUnits, true); toc
+figure;
+for k=1:4
+    subplot(2,2,k);
+    imagesc(sqrt(a3fSmooth(:,:,k)));
+end
+
+% A NaN sample breaks the line: both sides are drawn, the first pixel after the gap included
+afWave = zeros(1,40);
+afWave(20) = NaN;
+a2fGap = fnWaveformDensity(afWave, [1 40], 40, [-1 1], 200);
+assert(sum(a2fGap(:)) == 39 && isequal(find(sum(a2fGap,1)), [1:19, 21:40]));
+a2fGapSmooth = fnWaveformDensity(afWave, [1 40], 40, [-1 1], 200, [], true);
+afColumnSum = sum(a2fGapSmooth,1);
+assert(all(abs(afColumnSum([1:19, 21:40]) - 1) < 0.01) && afColumnSum(20) == 0);
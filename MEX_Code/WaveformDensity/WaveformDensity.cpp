@@ -0,0 +1,293 @@
+/*
+% Copyright (c) 2011 Shay Ohayon, California Institute of Technology.
+% This file is a part of a free software. you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation (see GPL.txt)
+*/
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include "mex.h"
+
+/*
+ Waveform density image (successor of Bresenham.cpp, same leading arguments).
+
+ Syntax:
+ a3fDensity = fnWaveformDensity(a2fWaves, afRangeX, NumPtsX, afRangeY, NumPtsY, [aiUnits], [bAntiAlias])
+
+ a2fWaves  : NumWaveForms x NumPtsInWave (double or single). Sample i is drawn at x = i.
+ afRangeX  : [x0 x1] data range mapped to image columns 0..NumPtsX-1
+ afRangeY  : [y0 y1] data range mapped to image rows 0..NumPtsY-1
+ aiUnits   : optional per waveform layer index (1..NumUnits). Waveforms with index <= 0 are skipped.
+			 The output then has one layer per unit (NumPtsY x NumPtsX x NumUnits).
+ bAntiAlias: optional, draws Wu anti-aliased lines instead of Bresenham lines.
+
+ Segments are clipped to the image instead of asserting. Waveforms are split across threads,
+ each thread accumulates into its own integer image, and the images are summed at the end.
+ Bresenham counts are exact; anti-aliased weights are accumulated in 1/256 units.
+*/
+
+const int WU_ONE = 256;
+const int MIN_WAVES_PER_THREAD = 2048;
+const int MAX_THREADS = 16;
+
+typedef struct {
+	int NumPtsX;
+	int NumPtsY;
+	int NumLayers;
+	double OffsetX, ScaleX;
+	double OffsetY, ScaleY;
+	bool AntiAlias;
+} Canvas_struct;
+
+// Liang-Barsky clipping of a segment against [0,MaxX] x [0,MaxY]. Returns false if nothing is left.
+bool ClipSegment(double &x0, double &y0, double &x1, double &y1, double MaxX, double MaxY, bool &bStartClipped)
+{
+	double t0 = 0, t1 = 1;
+	double dx = x1 - x0, dy = y1 - y0;
+	double p[4] = {-dx, dx, -dy, dy};
+	double q[4] = {x0, MaxX - x0, y0, MaxY - y0};
+	for (int k=0;k<4;k++) {
+		if (p[k] == 0) {
+			if (q[k] < 0)
+				return false;
+			continue;
+		}
+		double r = q[k] / p[k];
+		if (p[k] < 0) {
+			if (r > t1) return false;
+			if (r > t0) t0 = r;
+		} else {
+			if (r < t0) return false;
+			if (r < t1) t1 = r;
+		}
+	}
+	bStartClipped = t0 > 0;
+	double nx0 = x0 + t0*dx, ny0 = y0 + t0*dy;
+	double nx1 = x0 + t1*dx, ny1 = y0 + t1*dy;
+	x0 = nx0; y0 = ny0; x1 = nx1; y1 = ny1;
+	return true;
+}
+
+// Integer Bresenham. The first pixel is skipped for segments that continue the previous one,
+// so shared vertices are only counted once (same as Bresenham.cpp).
+void BresenhamLine(int x0, int y0, int x1, int y1, unsigned int *Image, int NumPtsY, bool bSkipFirst)
+{
+	int dx = abs(x1-x0), dy = abs(y1-y0);
+	int sx = (x0 < x1) ? 1 : -1;
+	int sy = (y0 < y1) ? 1 : -1;
+	int err = dx-dy;
+	while (1) {
+		if (bSkipFirst)
+			bSkipFirst = false;
+		else
+			Image[(size_t)x0*NumPtsY + y0]++;
+		if (x0 == x1 && y0 == y1)
+			break;
+		int e2 = 2*err;
+		if (e2 > -dy) {
+			err -= dy;
+			x0 += sx;
+		}
+		if (e2 < dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+inline void PlotWeight(unsigned int *Image, int NumPtsX, int NumPtsY, int x, int y, double w)
+{
+	if (x < 0 || x >= NumPtsX || y < 0 || y >= NumPtsY)
+		return;
+	Image[(size_t)x*NumPtsY + y] += (unsigned int)(w * WU_ONE + 0.5);
+}
+
+// Xiaolin Wu's anti-aliased line. The start pixel is skipped for continuing segments.
+void WuLine(double x0, double y0, double x1, double y1, unsigned int *Image, int NumPtsX, int NumPtsY, bool bSkipFirst)
+{
+	bool bSteep = fabs(y1-y0) > fabs(x1-x0);
+	if (bSteep) {
+		double t;
+		t = x0; x0 = y0; y0 = t;
+		t = x1; x1 = y1; y1 = t;
+	}
+	bool bReversed = x0 > x1;
+	if (bReversed) {
+		double t;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+	}
+	double dx = x1 - x0;
+	double fGradient = (dx == 0) ? 1 : (y1 - y0) / dx;
+
+	int xStart = int(floor(x0 + 0.5));
+	int xEnd = int(floor(x1 + 0.5));
+	// the pixel column of the segment start is skipped when continuing a waveform
+	int xSkip = bSkipFirst ? (bReversed ? xEnd : xStart) : -1;
+
+	double y = y0 + fGradient * (xStart - x0);
+	for (int x=xStart;x<=xEnd;x++, y+=fGradient) {
+		if (x == xSkip)
+			continue;
+		int yi = int(floor(y));
+		double f = y - yi;
+		if (bSteep) {
+			PlotWeight(Image, NumPtsX, NumPtsY, yi, x, 1-f);
+			PlotWeight(Image, NumPtsX, NumPtsY, yi+1, x, f);
+		} else {
+			PlotWeight(Image, NumPtsX, NumPtsY, x, yi, 1-f);
+			PlotWeight(Image, NumPtsX, NumPtsY, x, yi+1, f);
+		}
+	}
+}
+
+template<class T> void RenderWaveforms(const T *WaveForms, int NumWaveForms, int NumPtsInWave, const int *aiLayer,
+									   Canvas_struct C, int iFirst, int iLast, unsigned int *Accumulator)
+{
+	size_t LayerSize = (size_t)C.NumPtsX * C.NumPtsY;
+	double MaxX = C.NumPtsX - 1, MaxY = C.NumPtsY - 1;
+
+	for (int WaveIter=iFirst;WaveIter<iLast;WaveIter++) {
+		int iLayer = aiLayer ? aiLayer[WaveIter] : 0;
+		if (iLayer < 0)
+			continue;
+		unsigned int *Image = Accumulator + iLayer * LayerSize;
+
+		// the start pixel of a segment was already drawn only if the previous segment was drawn (a NaN
+		// sample ends the line, the next finite one starts a fresh one)
+		bool bPrevDrawn = false;
+		for (int pt=0;pt<NumPtsInWave-1;pt++) {
+			double Ay = double(WaveForms[(size_t)pt*NumWaveForms + WaveIter]);
+			double By = double(WaveForms[(size_t)(pt+1)*NumWaveForms + WaveIter]);
+			if (Ay != Ay || By != By) {
+				bPrevDrawn = false;
+				continue;
+			}
+
+			double Axt = (pt+1 - C.OffsetX) * C.ScaleX;
+			double Ayt = (Ay - C.OffsetY) * C.ScaleY;
+			double Bxt = (pt+2 - C.OffsetX) * C.ScaleX;
+			double Byt = (By - C.OffsetY) * C.ScaleY;
+
+			bool bStartClipped = false;
+			if (!ClipSegment(Axt, Ayt, Bxt, Byt, MaxX, MaxY, bStartClipped)) {
+				bPrevDrawn = false;
+				continue;
+			}
+			bool bSkipFirst = bPrevDrawn && !bStartClipped;
+			bPrevDrawn = true;
+
+			if (C.AntiAlias)
+				WuLine(Axt, Ayt, Bxt, Byt, Image, C.NumPtsX, C.NumPtsY, bSkipFirst);
+			else
+				BresenhamLine((int)Axt, (int)Ayt, (int)Bxt, (int)Byt, Image, C.NumPtsY, bSkipFirst);
+		}
+	}
+}
+
+template<class T> void RenderAll(const T *WaveForms, int NumWaveForms, int NumPtsInWave, const int *aiLayer,
+								 const Canvas_struct &C, double *Out)
+{
+	size_t ImageSize = (size_t)C.NumPtsX * C.NumPtsY * C.NumLayers;
+
+	int iNumThreads = NumWaveForms / MIN_WAVES_PER_THREAD;
+	int iNumCores = int(std::thread::hardware_concurrency());
+	if (iNumThreads > iNumCores) iNumThreads = iNumCores;
+	if (iNumThreads > MAX_THREADS) iNumThreads = MAX_THREADS;
+	if (iNumThreads < 1) iNumThreads = 1;
+
+	std::vector< std::vector<unsigned int> > Accumulators(iNumThreads);
+	for (int t=0;t<iNumThreads;t++)
+		Accumulators[t].assign(ImageSize, 0);
+
+	if (iNumThreads == 1) {
+		RenderWaveforms(WaveForms, NumWaveForms, NumPtsInWave, aiLayer, C, 0, NumWaveForms, &Accumulators[0][0]);
+	} else {
+		std::vector<std::thread> Workers;
+		int iPerThread = (NumWaveForms + iNumThreads - 1) / iNumThreads;
+		for (int t=0;t<iNumThreads;t++) {
+			int iFirst = t * iPerThread;
+			int iLast = (iFirst + iPerThread < NumWaveForms) ? iFirst + iPerThread : NumWaveForms;
+			Workers.push_back(std::thread(RenderWaveforms<T>, WaveForms, NumWaveForms, NumPtsInWave, aiLayer, C,
+										  iFirst, iLast, &Accumulators[t][0]));
+		}
+		for (size_t k=0;k<Workers.size();k++)
+			Workers[k].join();
+	}
+
+	double fScale = C.AntiAlias ? 1.0 / WU_ONE : 1.0;
+	for (size_t k=0;k<ImageSize;k++) {
+		double Sum = 0;
+		for (int t=0;t<iNumThreads;t++)
+			Sum += Accumulators[t][k];
+		Out[k] = Sum * fScale;
+	}
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] ) {
+	if (nrhs < 5) {
+		mexErrMsgTxt("Usage: a3fDensity = fnWaveformDensity(a2fWaves, afRangeX, NumPtsX, afRangeY, NumPtsY, [aiUnits], [bAntiAlias])");
+		return;
+	}
+
+	const mwSize *dim = mxGetDimensions(prhs[0]);
+	int NumWaveForms = int(dim[0]);
+	int NumPtsInWave = int(dim[1]);
+
+	double *afX = (double*)mxGetData(prhs[1]);
+	double *afY = (double*)mxGetData(prhs[3]);
+	if (mxGetNumberOfElements(prhs[1]) < 2 || mxGetNumberOfElements(prhs[3]) < 2) {
+		mexErrMsgTxt("Ranges must have two elements.");
+		return;
+	}
+
+	Canvas_struct C;
+	C.NumPtsX = (int) *(double*)mxGetData(prhs[2]);
+	C.NumPtsY = (int) *(double*)mxGetData(prhs[4]);
+	C.OffsetX = afX[0];
+	C.OffsetY = afY[0];
+	C.ScaleX = 1.0/ (afX[1]-afX[0]) * (C.NumPtsX-1);
+	C.ScaleY = 1.0/ (afY[1]-afY[0]) * (C.NumPtsY-1);
+	C.AntiAlias = nrhs > 6 && mxGetScalar(prhs[6]) != 0;
+	C.NumLayers = 1;
+	if (C.NumPtsX < 1 || C.NumPtsY < 1) {
+		mexErrMsgTxt("Image size must be positive.");
+		return;
+	}
+
+	// Waveform -> layer (0 based, -1 is skipped)
+	std::vector<int> aiLayer;
+	if (nrhs > 5 && !mxIsEmpty(prhs[5])) {
+		if (int(mxGetNumberOfElements(prhs[5])) != NumWaveForms || !mxIsDouble(prhs[5])) {
+			mexErrMsgTxt("aiUnits must be a double vector with one entry per waveform.");
+			return;
+		}
+		double *afUnits = (double*)mxGetData(prhs[5]);
+		aiLayer.resize(NumWaveForms);
+		int iMaxUnit = 0;
+		for (int k=0;k<NumWaveForms;k++) {
+			aiLayer[k] = (afUnits[k] >= 1) ? int(afUnits[k]) - 1 : -1;
+			if (aiLayer[k]+1 > iMaxUnit)
+				iMaxUnit = aiLayer[k]+1;
+		}
+		C.NumLayers = iMaxUnit > 0 ? iMaxUnit : 1;
+	}
+
+	mwSize dim1[3] = {(mwSize)C.NumPtsY, (mwSize)C.NumPtsX, (mwSize)C.NumLayers};
+	plhs[0] = mxCreateNumericArray(3, dim1, mxDOUBLE_CLASS, mxREAL);
+	double *Out = (double*)mxGetPr(plhs[0]);
+
+	if (NumWaveForms == 0 || NumPtsInWave < 2)
+		return;
+
+	const int *pLayer = aiLayer.empty() ? NULL : &aiLayer[0];
+	if (mxIsDouble(prhs[0]))
+		RenderAll((const double*)mxGetData(prhs[0]), NumWaveForms, NumPtsInWave, pLayer, C, Out);
+	else if (mxIsSingle(prhs[0]))
+		RenderAll((const float*)mxGetData(prhs[0]), NumWaveForms, NumPtsInWave, pLayer, C, Out);
+	else
+		mexErrMsgTxt("Waveforms must be double or single.");
+}
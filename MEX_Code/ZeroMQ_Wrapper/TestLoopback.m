@@ -0,0 +1,36 @@
+% Tests the ZeroMQ wrapper against its own in-process echo server.
+% Commands are pipelined (no reply is awaited before the next send) and
+% every one must come back, in order.
+addpath('..\..\MEX\win32');
+
+strURL = 'tcp://127.0.0.1:4102';
+hServer = fndllZeroMQ_Wrapper('StartEchoServer',strURL);
+handle = fndllZeroMQ_Wrapper('StartConnectThread',strURL);
+
+iNumCommands = 500;
+fTic = GetSecs();
+for k=1:iNumCommands
+    fndllZeroMQ_Wrapper('Send',handle,sprintf('event Inside %d',k));
+end
+fSendTime = GetSecs()-fTic;
+
+acReplies = {};
+iNumDropped = 0;
+while length(acReplies) < iNumCommands && GetSecs()-fTic < 5
+    [acNew, iDropped] = fndllZeroMQ_Wrapper('GetReplies',handle);
+    acReplies = [acReplies, acNew]; %#ok
+    iNumDropped = iNumDropped + iDropped;
+    WaitSecs(0.001);
+end
+fRoundTrip = GetSecs()-fTic;
+
+fndllZeroMQ_Wrapper('CloseThread',handle);
+fndllZeroMQ_Wrapper('StopEchoServer',hServer);
+
+assert(iNumDropped == 0, 'Replies were dropped');
+assert(length(acReplies) == iNumCommands, 'Only %d of %d replies arrived', length(acReplies), iNumCommands);
+for k=1:iNumCommands
+    assert(strcmp(acReplies{k}, sprintf('event Inside %d',k)), 'Reply %d out of order', k);
+end
+fprintf('%d commands queued in %.2f ms (%.1f us each), all echoed after %.1f ms\n', ...
+    iNumCommands, fSendTime*1e3, fSendTime/iNumCommands*1e6, fRoundTrip*1e3);
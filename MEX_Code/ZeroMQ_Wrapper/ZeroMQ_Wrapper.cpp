@@ -4,209 +4,524 @@
 % it under the terms of the GNU General Public License as published by
 % the Free Software Foundation (see GPL.txt)
 */
+// ZeroMQ client connections for MATLAB.
+//
+//   handle = fndllZeroMQ_Wrapper('StartConnectThread', url)
+//   fndllZeroMQ_Wrapper('Send', handle, command)
+//   [acReplies, iNumDropped] = fndllZeroMQ_Wrapper('GetReplies', handle)
+//   fndllZeroMQ_Wrapper('CloseThread', handle)
+//
+//   handle = fndllZeroMQ_Wrapper('StartEchoServer', url)
+//   fndllZeroMQ_Wrapper('StopEchoServer', handle)
+//
+// Every connection has its own worker thread and DEALER socket, so
+// commands are pipelined: a command is sent without waiting for the
+// reply to the previous one, and a slow peer only holds up its own
+// connection. The DEALER sends an empty delimiter frame before each
+// command, so REP and ROUTER servers both accept it.
+//
+// 'Send' pushes the command on the connection's lock-free queue (MPSC)
+// and wakes the worker through an inproc PAIR socket; the worker blocks
+// in zmq_poll on that socket and the DEALER. The command buffer is
+// handed to ZeroMQ with zmq_msg_init_data and freed by ZeroMQ once sent.
+//
+// Replies go into a ring that 'GetReplies' drains. When MATLAB does not
+// drain it, the newest replies are dropped and counted.
+//
+// The echo server (ROUTER) returns every message it receives; it lets
+// the wrapper be tested in process (see TestLoopback.m).
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "mex.h"
 #include "zmq.h"
-#include "zmq_utils.h"
-#include <windows.h>
-#include <tchar.h>
+#include <new>
 #include <string>
-#include <queue>
 #include <list>
+#include <deque>
+#include <thread>
+#include <atomic>
 
-typedef struct {
-    const char *connect_url;
-      DWORD   dwThread;
-	 bool thread_running;
-} ThreadData;
+#define REPLY_RING_SIZE 1024
+#define CLOSE_LINGER_MS 100
 
-DWORD WINAPI MyThreadFunction( LPVOID lpParam );
-#define MAX(x,y)(x>y)?(x):(y)
-#define MIN(x,y)(x<y)?(x):(y)
-std::queue<std::string> MyQueue;
+/////////////////////////////////////////////////////////////////////////
+// Commands and the MPSC queue (intrusive, after D. Vyukov)
 
-typedef std::list<ThreadData*> lst;
-lst MyHandleList;
-lst MyWatchDogList;
-
-bool initialized = false;
-void *context;
+struct QueuedCommand {
+	std::atomic<QueuedCommand*> next;
+	size_t length;
+	char data[1];
+};
 
-void CloseContext(void)
+static QueuedCommand *AllocateCommand(size_t length)
 {
- 
-	if (initialized) {
-
-		for (lst::iterator i= MyHandleList.begin(); i != MyHandleList.end(); i++) {
-			ThreadData* Tmp = *i;
-			Tmp->thread_running = false;
-				
-		}
-		Sleep(100);
-		zmq_ctx_destroy (context);
-		initialized = false;
-	}
+	QueuedCommand *cmd = (QueuedCommand*)malloc(sizeof(QueuedCommand) + length);
+	new (&cmd->next) std::atomic<QueuedCommand*>((QueuedCommand*)NULL);
+	cmd->length = length;
+	return cmd;
 }
 
-void initialize_zmq()
+// zmq_free_fn: the command is freed once ZeroMQ has sent it
+static void FreeCommand(void *data, void *hint)
 {
-	mexAtExit(CloseContext);
-	context = zmq_ctx_new ();
-	initialized = true;
+	free(hint);
 }
 
+class CommandQueue {
+public:
+	CommandQueue() : head(&stub), tail(&stub) { stub.next.store(NULL); }
 
+	// Any thread
+	void Push(QueuedCommand *cmd)
+	{
+		cmd->next.store(NULL, std::memory_order_relaxed);
+		QueuedCommand *prev = head.exchange(cmd, std::memory_order_acq_rel);
+		prev->next.store(cmd, std::memory_order_release);
+	}
 
-DWORD WINAPI MyThreadFunction( LPVOID lpParam )
-{
-	ThreadData *pData = (ThreadData*)lpParam ;
+	// Worker thread only. Returns NULL when empty (or when a push is
+	// half way through; the pusher then wakes the worker again).
+	QueuedCommand *Pop()
+	{
+		QueuedCommand *t = tail;
+		QueuedCommand *next = t->next.load(std::memory_order_acquire);
+		if (t == &stub) {
+			if (next == NULL)
+				return NULL;
+			tail = next;
+			t = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next != NULL) {
+			tail = next;
+			return t;
+		}
+		if (t != head.load(std::memory_order_acquire))
+			return NULL;
+		Push(&stub);
+		next = t->next.load(std::memory_order_acquire);
+		if (next != NULL) {
+			tail = next;
+			return t;
+		}
+		return NULL;
+	}
 
-   void *requester = zmq_socket (context, ZMQ_REQ);
-     zmq_connect (requester, pData->connect_url); // "tcp://localhost:5555"
-	 pData->thread_running = true;
-	 while (pData->thread_running)
-	 {
-		 if (!MyQueue.empty()) {
+private:
+	std::atomic<QueuedCommand*> head;
+	QueuedCommand *tail;
+	QueuedCommand stub;
+};
+
+/////////////////////////////////////////////////////////////////////////
+// Reply ring (SPSC: worker produces, MATLAB consumes)
+
+class ReplyRing {
+public:
+	ReplyRing() : dropped(0), read(0), write(0) {}
+
+	void Push(std::string *reply)
+	{
+		unsigned int w = write.load(std::memory_order_relaxed);
+		if (w - read.load(std::memory_order_acquire) == REPLY_RING_SIZE) {
+			delete reply;
+			dropped++;
+			return;
+		}
+		slots[w % REPLY_RING_SIZE] = reply;
+		write.store(w + 1, std::memory_order_release);
+	}
 
-			 std::string command = MyQueue.front();
-			 MyQueue.pop();
-			 
-		  zmq_msg_t request;
-		  zmq_msg_init_size (&request, command.length());
-		  memcpy (zmq_msg_data (&request), command.c_str() , command.length());
-          zmq_msg_send (&request, requester, 0);
-          zmq_msg_close (&request);
+	std::string *Pop()
+	{
+		unsigned int r = read.load(std::memory_order_relaxed);
+		if (r == write.load(std::memory_order_acquire))
+			return NULL;
+		std::string *reply = slots[r % REPLY_RING_SIZE];
+		read.store(r + 1, std::memory_order_release);
+		return reply;
+	}
+
+	std::atomic<unsigned int> dropped;
+
+private:
+	std::atomic<unsigned int> read, write;
+	std::string *slots[REPLY_RING_SIZE];
+};
+
+/////////////////////////////////////////////////////////////////////////
+
+struct Connection {
+	std::string url;
+	std::thread worker;
+	std::atomic<bool> thread_running;
+	std::atomic<bool> wake_pending;
+	void *wake_sender;		// MATLAB side of the wake pair
+	void *wake_receiver;	// worker side
+	CommandQueue commands;
+	ReplyRing replies;
+};
+
+struct EchoServer {
+	std::string url;
+	std::thread worker;
+	std::atomic<bool> thread_running;
+	void *wake_sender;
+	void *wake_receiver;
+	void *router;
+};
+
+typedef std::list<Connection*> lst;
+lst MyHandleList;
+std::list<EchoServer*> MyEchoList;
+
+bool initialized = false;
+void *context;
 
-         zmq_msg_t reply;
-           zmq_msg_init (&reply);
-          zmq_msg_recv (&reply, requester, 0);
-//          printf ("Received World %d\n", request_nbr);
-          zmq_msg_close (&reply);
-		 } else {
-			 // Be nice and sleep
-			 Sleep(1);
-		 }
-	 }
-	zmq_close (requester);
-	 return 0; 
+static void Wake(void *wake_sender)
+{
+	zmq_msg_t msg;
+	zmq_msg_init(&msg);
+	zmq_msg_send(&msg, wake_sender, ZMQ_DONTWAIT);
+	zmq_msg_close(&msg);
 }
 
+static void DrainWake(void *wake_receiver)
+{
+	zmq_msg_t msg;
+	zmq_msg_init(&msg);
+	while (zmq_msg_recv(&msg, wake_receiver, ZMQ_DONTWAIT) >= 0)
+		;
+	zmq_msg_close(&msg);
+}
 
-DWORD WINAPI MyWatchDogFunction(LPVOID lpParam )
+// Creates the inproc pair that wakes a worker. The worker end is bound
+// here, before the worker starts, as inproc needs bind before connect.
+static bool CreateWakePair(const void *owner, void **sender, void **receiver)
 {
+	char endpoint[64];
+	sprintf(endpoint, "inproc://zmq-wrapper-wake-%p", owner);
+	*receiver = zmq_socket(context, ZMQ_PAIR);
+	*sender = zmq_socket(context, ZMQ_PAIR);
+	if (zmq_bind(*receiver, endpoint) != 0 || zmq_connect(*sender, endpoint) != 0) {
+		zmq_close(*receiver);
+		zmq_close(*sender);
+		return false;
+	}
+	return true;
+}
 
-		ThreadData *pData = (ThreadData*)lpParam ;
+/////////////////////////////////////////////////////////////////////////
+// Client worker
 
-		return 0;
+// Sends the delimiter and the command without blocking. Returns false
+// if the DEALER cannot take it now (no peer yet, or high water mark).
+static bool SendCommand(void *dealer, QueuedCommand *cmd)
+{
+	zmq_msg_t delimiter;
+	zmq_msg_init(&delimiter);
+	int ret = zmq_msg_send(&delimiter, dealer, ZMQ_SNDMORE | ZMQ_DONTWAIT);
+	zmq_msg_close(&delimiter);
+	if (ret < 0)
+		return false;
+	// once the first frame is queued, the rest of the message is too
+	zmq_msg_t body;
+	zmq_msg_init_data(&body, cmd->data, cmd->length, FreeCommand, cmd);
+	if (zmq_msg_send(&body, dealer, 0) < 0)
+		zmq_msg_close(&body);
+	return true;
 }
 
-ThreadData* create_client_thread(const char *connect_url, int n)
+static void ReceiveReplies(void *dealer, ReplyRing &replies)
 {
+	zmq_msg_t frame;
+	zmq_msg_init(&frame);
+	while (zmq_msg_recv(&frame, dealer, ZMQ_DONTWAIT) >= 0) {
+		std::string *reply = new std::string;
+		bool first = true;
+		for (;;) {
+			// skip the empty delimiter added by REP/ROUTER peers
+			if (!(first && zmq_msg_size(&frame) == 0 && zmq_msg_more(&frame)))
+				reply->append((const char*)zmq_msg_data(&frame), zmq_msg_size(&frame));
+			first = false;
+			if (!zmq_msg_more(&frame) || zmq_msg_recv(&frame, dealer, 0) < 0)
+				break;
+		}
+		replies.Push(reply);
+	}
+	zmq_msg_close(&frame);
+}
 
-	ThreadData *pData = new ThreadData;
-	pData->connect_url = new char[n];
-	memcpy((char*)pData->connect_url,connect_url,n);
+static void ConnectionThread(Connection *pData)
+{
+	void *dealer = zmq_socket(context, ZMQ_DEALER);
+	int linger = CLOSE_LINGER_MS;
+	zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger));
+	zmq_connect(dealer, pData->url.c_str()); // "tcp://localhost:5555"
+
+	std::deque<QueuedCommand*> backlog;
+	zmq_pollitem_t items[2];
+	items[0].socket = pData->wake_receiver;
+	items[0].events = ZMQ_POLLIN;
+	items[1].socket = dealer;
+
+	while (pData->thread_running) {
+		items[1].events = ZMQ_POLLIN | (backlog.empty() ? 0 : ZMQ_POLLOUT);
+		if (zmq_poll(items, 2, -1) < 0 && zmq_errno() == ETERM)
+			break;
+
+		if (items[0].revents & ZMQ_POLLIN) {
+			DrainWake(pData->wake_receiver);
+			// later pushes must wake us again
+			pData->wake_pending = false;
+		}
+		for (QueuedCommand *cmd; (cmd = pData->commands.Pop()) != NULL; )
+			backlog.push_back(cmd);
+		while (!backlog.empty() && SendCommand(dealer, backlog.front()))
+			backlog.pop_front();
 
-        HANDLE retValue = CreateThread( 
-            NULL,                   // default security attributes
-            0,                      // use default stack size  
-            MyThreadFunction,       // thread function name
-            pData,          // argument to thread function 
-            0,                      // use default creation flags 
-            &pData->dwThread);   // returns the thread identifier 
+		if (items[1].revents & ZMQ_POLLIN)
+			ReceiveReplies(dealer, pData->replies);
+	}
 
-  return pData;
+	// unsent commands are dropped
+	for (QueuedCommand *cmd; (cmd = pData->commands.Pop()) != NULL; )
+		backlog.push_back(cmd);
+	for (size_t k = 0; k < backlog.size(); k++)
+		free(backlog[k]);
+	zmq_close(dealer);
+	zmq_close(pData->wake_receiver);
+}
 
-//     sleep (2);
-//     zmq_close (requester);
-//     zmq_ctx_destroy (context);
- 
+Connection* create_client_thread(const char *connect_url)
+{
+	Connection *pData = new Connection;
+	pData->url = connect_url;
+	pData->thread_running = true;
+	pData->wake_pending = false;
+	if (!CreateWakePair(pData, &pData->wake_sender, &pData->wake_receiver)) {
+		delete pData;
+		return NULL;
+	}
+	pData->worker = std::thread(ConnectionThread, pData);
+	return pData;
+}
 
+static void close_client_thread(Connection *pData)
+{
+	pData->thread_running = false;
+	Wake(pData->wake_sender);
+	pData->worker.join();
+	zmq_close(pData->wake_sender);
+	for (std::string *reply; (reply = pData->replies.Pop()) != NULL; )
+		delete reply;
+	delete pData;
 }
 
+/////////////////////////////////////////////////////////////////////////
+// Echo server
 
+static void EchoThread(EchoServer *pData)
+{
+	zmq_pollitem_t items[2];
+	items[0].socket = pData->wake_receiver;
+	items[0].events = ZMQ_POLLIN;
+	items[1].socket = pData->router;
+	items[1].events = ZMQ_POLLIN;
+	zmq_msg_t frame;
+	zmq_msg_init(&frame);
+	while (pData->thread_running) {
+		if (zmq_poll(items, 2, -1) < 0 && zmq_errno() == ETERM)
+			break;
+		if (items[0].revents & ZMQ_POLLIN)
+			DrainWake(pData->wake_receiver);
+		// identity, delimiter and body go back as they came
+		while (zmq_msg_recv(&frame, pData->router, ZMQ_DONTWAIT) >= 0) {
+			for (;;) {
+				bool more = zmq_msg_more(&frame) != 0;
+				zmq_msg_send(&frame, pData->router, more ? ZMQ_SNDMORE : 0);
+				if (!more || zmq_msg_recv(&frame, pData->router, 0) < 0)
+					break;
+			}
+		}
+	}
+	zmq_msg_close(&frame);
+	zmq_close(pData->router);
+	zmq_close(pData->wake_receiver);
+}
 
+EchoServer* create_echo_server(const char *bind_url)
+{
+	EchoServer *pData = new EchoServer;
+	pData->url = bind_url;
+	pData->thread_running = true;
+	pData->router = zmq_socket(context, ZMQ_ROUTER);
+	int linger = 0;
+	zmq_setsockopt(pData->router, ZMQ_LINGER, &linger, sizeof(linger));
+	if (zmq_bind(pData->router, bind_url) != 0) {
+		mexPrintf("Cannot bind %s: %s\n", bind_url, zmq_strerror(zmq_errno()));
+		zmq_close(pData->router);
+		delete pData;
+		return NULL;
+	}
+	if (!CreateWakePair(pData, &pData->wake_sender, &pData->wake_receiver)) {
+		zmq_close(pData->router);
+		delete pData;
+		return NULL;
+	}
+	pData->worker = std::thread(EchoThread, pData);
+	return pData;
+}
 
-ThreadData* create_watchdog_thread(ThreadData *thread_to_watch)
+static void stop_echo_server(EchoServer *pData)
 {
+	pData->thread_running = false;
+	Wake(pData->wake_sender);
+	pData->worker.join();
+	zmq_close(pData->wake_sender);
+	delete pData;
+}
 
-	ThreadData *pData = new ThreadData;
-	thread_to_watch->dwThread = thread_to_watch->dwThread;
-	
-    HANDLE retValue = CreateThread( 
-            NULL,                   // default security attributes
-            0,                      // use default stack size  
-            MyWatchDogFunction,       // thread function name
-            pData,          // argument to thread function 
-            0,                      // use default creation flags 
-            &pData->dwThread);   // returns the thread identifier 
+/////////////////////////////////////////////////////////////////////////
 
-  return pData;
+void CloseContext(void)
+{
+	if (initialized) {
+		for (lst::iterator i = MyHandleList.begin(); i != MyHandleList.end(); i++)
+			close_client_thread(*i);
+		MyHandleList.clear();
+		for (std::list<EchoServer*>::iterator i = MyEchoList.begin(); i != MyEchoList.end(); i++)
+			stop_echo_server(*i);
+		MyEchoList.clear();
+		zmq_ctx_destroy (context);
+		initialized = false;
+	}
+}
 
-//     sleep (2);
-//     zmq_close (requester);
-//     zmq_ctx_destroy (context);
- 
+void initialize_zmq()
+{
+	mexAtExit(CloseContext);
+	context = zmq_ctx_new ();
+	initialized = true;
+}
 
+static mxArray *HandleToDouble(void *p)
+{
+	mxArray *mx = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);
+	double* Tmp= (double*)mxGetPr(mx);
+	memcpy(Tmp, &p, sizeof(p));
+	return mx;
 }
 
-void mexFunction( int nlhs, mxArray *plhs[], 
-				 int nrhs, const mxArray *prhs[] ) 
+template <class T>
+static T* DoubleToHandle(const mxArray *mx, std::list<T*> &handles)
+{
+	if (mxGetClassID(mx) != mxDOUBLE_CLASS || mxGetNumberOfElements(mx) < 1)
+		return NULL;
+	T* sd;
+	memcpy(&sd, mxGetPr(mx), sizeof(sd));
+	for (typename std::list<T*>::iterator i = handles.begin(); i != handles.end(); i++)
+		if (*i == sd)
+			return sd;
+	return NULL;
+}
+
+void mexFunction( int nlhs, mxArray *plhs[],
+				 int nrhs, const mxArray *prhs[] )
 {
 
    if(!initialized) initialize_zmq();
-    
-	if (nrhs < 2) {
+
+	if (nrhs < 2 || !mxIsChar(prhs[0])) {
 		return;
 	}
 
+	char Command[32];
+	if (mxGetString(prhs[0], Command, sizeof(Command)) != 0) {
+		mexPrintf("Command is too long.\n");
+		return;
+	}
 
-	char *Command = mxArrayToString(prhs[0]);
+	if   (strcmp(Command, "StartConnectThread") == 0 || strcmp(Command, "StartEchoServer") == 0)  {
+		if (!mxIsChar(prhs[1])) {
+			mexPrintf("%s needs a url.\n", Command);
+			return;
+		}
+		char *url = mxArrayToString(prhs[1]);
+		void *handle;
+		if (Command[5] == 'C') {
+			Connection* sd = create_client_thread(url);
+			if (sd)
+				MyHandleList.push_back(sd);
+			handle = sd;
+		} else {
+			EchoServer* es = create_echo_server(url);
+			if (es)
+				MyEchoList.push_back(es);
+			handle = es;
+		}
+		mxFree(url);
+		plhs[0] = HandleToDouble(handle);
+		return;
+	}
 
-	if   (strcmp(Command, "StartConnectThread") == 0)  {
-        	int url_length = int(mxGetNumberOfElements(prhs[1])) + 1;
-			char *url = mxArrayToString(prhs[1]);
-            ThreadData* sd=  create_client_thread(url, url_length);
-			MyHandleList.push_back(sd);
+	if   (strcmp(Command, "StopEchoServer") == 0)  {
+		EchoServer* es = DoubleToHandle(prhs[1], MyEchoList);
+		if (es) {
+			MyEchoList.remove(es);
+			stop_echo_server(es);
+		}
+		return;
+	}
 
-			ThreadData* sd2=  create_watchdog_thread(sd);
-			MyWatchDogList.push_back(sd2);
-	        plhs[0] = mxCreateNumericMatrix(1,1,mxDOUBLE_CLASS,mxREAL);
-			double* Tmp= (double*)mxGetPr(plhs[0]);
-			memcpy(Tmp, &sd, 8);
-    }
-    
-    
-    if   (strcmp(Command, "Send") == 0)  {
-		double* Tmp= (double*)mxGetPr(prhs[1]);
-		ThreadData* sd;
-        memcpy(&sd, Tmp, 8);
+	Connection* sd = DoubleToHandle(prhs[1], MyHandleList);
+	if (!sd) {
+		// Thread was closed and now we try to use it again?
+		mexPrintf("Connection was closed. Cannot %s.\n", Command);
+		return;
+	}
 
-		if (!sd->thread_running) {
-			// Thread was killed and now we try to send things again?
-			mexPrintf("Connection was closed. Cannot send.\n");
+	if   (strcmp(Command, "Send") == 0)  {
+		if (nrhs < 3 || !mxIsChar(prhs[2])) {
+			mexPrintf("Send needs a string.\n");
 			return;
 		}
+		size_t length = mxGetNumberOfElements(prhs[2]);
+		QueuedCommand *cmd = AllocateCommand(length + 1);
+		mxGetString(prhs[2], cmd->data, (mwSize)(length + 1));
+		cmd->length = length;
+		sd->commands.Push(cmd);
+		if (!sd->wake_pending.exchange(true))
+			Wake(sd->wake_sender);
+		return;
+	}
 
-		char *s= mxArrayToString(prhs[2]);
-		std::string std_s(s);
-		MyQueue.push(std_s);
-
+	if   (strcmp(Command, "GetReplies") == 0)  {
+		std::deque<std::string*> replies;
+		for (std::string *reply; (reply = sd->replies.Pop()) != NULL; )
+			replies.push_back(reply);
+		plhs[0] = mxCreateCellMatrix(1, (mwSize)replies.size());
+		for (size_t k = 0; k < replies.size(); k++) {
+			mwSize dims[2] = {1, (mwSize)replies[k]->size()};
+			mxArray *str = mxCreateCharArray(2, dims);
+			mxChar *chars = (mxChar*)mxGetData(str);
+			for (size_t j = 0; j < replies[k]->size(); j++)
+				chars[j] = (mxChar)(unsigned char)(*replies[k])[j];
+			mxSetCell(plhs[0], k, str);
+			delete replies[k];
+		}
+		if (nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(sd->replies.dropped.exchange(0));
+		return;
 	}
-			
-    if   (strcmp(Command, "CloseThread") == 0)  {
-		double* Tmp= (double*)mxGetPr(prhs[1]);
-		ThreadData* sd;
-        memcpy(&sd, Tmp, 8);
-		sd->thread_running = false;
 
+	if   (strcmp(Command, "CloseThread") == 0)  {
 		// remove from active handle list
-		
 		MyHandleList.remove(sd);
-			
-		//MyHandleList.push_back(sd);
-
+		close_client_thread(sd);
+		return;
 	}
 
-
+	mexPrintf("Unknown command %s\n", Command);
 }
@@ -0,0 +1,46 @@
+% FUNCTION [acVars,aiSockets,aiLost] = mspump(strCommand,...)
+%
+% Description:
+%
+%    Message pump for several sockets.  One "Poll" call returns
+%    every complete message received on every registered socket,
+%    instead of one msrecv call (and one select) per socket.
+%
+%    mspump('Add',sock)     registers a socket created with
+%                           "msaccept" or "msconnect"
+%    mspump('Remove',sock)  unregisters it
+%
+%    [acVars,aiSockets,aiLost] = mspump('Poll',timeout)
+%       waits up to "timeout" seconds (default 0, < 0 waits
+%       indefinitely) for at least one message.  "acVars" is a
+%       cell array of the received variables and "aiSockets" the
+%       socket each one came from, in arrival order per socket.
+%       "aiLost" lists the sockets that were closed by the peer
+%       or sent a malformed message; they are removed from the
+%       pump and should be closed with "msclose".
+%       At most 16 MB per socket (or one larger message) is read
+%       ahead of "Poll"; a faster sender is held back by TCP.
+%
+%    ret = mspump('Send',sock,var,version)
+%       sends "var" like "mssend", without blocking: what the
+%       socket does not take right away is queued and sent by
+%       the next "Poll" or "Flush".  "version" is optional (default
+%       1, see "mssend").  "ret" < 0 indicates failure.
+%
+%    pending = mspump('Flush',timeout)
+%       sends queued data for up to "timeout" seconds and
+%       returns the number of bytes still queued.
+%
+%    Registered sockets are non-blocking, so they should not be
+%    used with "msrecv" or "mssend" until they are removed.
+%    Messages from "mssend" (either version) are accepted.
+%
+% Example:
+%
+% >> mspump('Add',iStatServerSocket);
+% >> mspump('Add',iStimulusServerSocket);
+% >> [acVars,aiSockets,aiLost] = mspump('Poll',0);
+% >> for k=1:length(acVars)
+% >>     fnHandle(aiSockets(k),acVars{k});
+% >> end
+%
@@ -20,6 +20,8 @@
 %
 %    "success" is an optional success messages.  "success" < 0
 %    indicates failure. "success" >= 0 indicates success.
+%    -3 means a malformed message was received; the connection
+%    should then be closed.
 %
 % Example:
 %    
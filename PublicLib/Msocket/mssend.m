@@ -1,4 +1,4 @@
-% FUNCTION success = mssend(sock,var)
+% FUNCTION success = mssend(sock,var,version)
 %
 % Author: 
 %   Steven Michael (smichael@ll.mit.edu)
@@ -13,6 +13,13 @@
 %    "var" is any MATLAB variable.  Currently, all variable
 %    types are supported except for function handles.
 %
+%    "version" is optional.  By default the variable is sent in the
+%    v1 format, which every msrecv understands.  Pass 2 to use the
+%    v2 format, in which numeric data goes straight from the
+%    variable to the socket, when the peer runs an msrecv (or
+%    mspump) that accepts it.  v2 payloads are limited to 4 GB
+%    (1 GB in 32 bit MATLAB).
+%
 %    "success" is a status indicator. "success" < 0 indicates failure.
 %    Any other number indicates success.
 %
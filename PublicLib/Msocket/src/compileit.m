@@ -19,10 +19,13 @@ end
 
 % Compile object code
 mex -I. -c matvar.cpp
+mex -I. -c matvar2.cpp
 mex -I. -c msrecv.cpp
 mex -I. -c mssend.cpp
-mex -cxx msrecv.o matvar.o
-mex -cxx mssend.o matvar.o
+mex -I. -c mspump.cpp
+mex -cxx msrecv.o matvar.o matvar2.o
+mex -cxx mssend.o matvar.o matvar2.o
+mex -cxx mspump.o matvar.o matvar2.o
 
 % This only works on x86_64 and x86 linux systems for now
 if strcmp(computer,'GLNXA64')
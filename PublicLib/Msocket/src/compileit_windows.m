@@ -14,6 +14,7 @@ files = {'udp_msconnect.c',...
   'udp_msclose.c',...
   'udp_mssendraw.c',...
   'udp_mssendraw_mod.cpp',...
+  'udp_mschannel.cpp',...
     'udp_msrecvraw_mod.c',...
   'udp_msrecvraw.c'  };
 
@@ -20,11 +20,13 @@ end
 
 % Compile object code
 mex -I. -DWIN32 -c matvar.cpp
+mex -I. -DWIN32 -c matvar2.cpp
 mex -I. -DWIN32 -c msrecv.cpp
 mex -I. -DWIN32 -c mssend.cpp
+mex -I. -DWIN32 -c mspump.cpp
 mex -I. -DWIN32 -c mscheckbuf.cpp
 
-cmd = sprintf('mex -I. -DWIN32 msrecv.obj matvar.obj ws2_32.lib -L"%s"',libdir);
+cmd = sprintf('mex -I. -DWIN32 msrecv.obj matvar.obj matvar2.obj ws2_32.lib -L"%s"',libdir);
 cmd
 eval(cmd);
 
@@ -33,7 +35,11 @@ cmd = sprintf('mex -I. -DWIN32 mscheckbuf.obj matvar.obj ws2_32.lib -L"%s"',libd
 cmd
 eval(cmd);
 
-cmd = sprintf('mex -I. -DWIN32 mssend.obj matvar.obj ws2_32.lib -L"%s"',libdir);
+cmd = sprintf('mex -I. -DWIN32 mssend.obj matvar.obj matvar2.obj ws2_32.lib -L"%s"',libdir);
+cmd
+eval(cmd);
+
+cmd = sprintf('mex -I. -DWIN32 mspump.obj matvar.obj matvar2.obj ws2_32.lib -L"%s"',libdir);
 cmd
 eval(cmd);
 
@@ -0,0 +1,546 @@
+////////////////////////////////////////////////////////////
+//
+// Name:   matvar2.cpp
+//
+// Description:
+//
+//    Version 2 of the mssend/msrecv wire format (see
+//    matvar2.h).  Numeric data goes from and into the
+//    mxArrays through scatter/gather socket calls.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+////////////////////////////////////////////////////////////
+
+#include <matvar2.h>
+
+#include <string.h>
+#include <errno.h>
+#include <map>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MSV2_MAX_DEPTH 64
+
+////////////////////////////////////////////////////////////
+// Arenas
+
+static std::map<int, MsArena *> arenas;
+
+static void msv2_free_arenas(void)
+{
+	for(std::map<int, MsArena *>::iterator it = arenas.begin(); it != arenas.end(); it++)
+		delete it->second;
+	arenas.clear();
+}
+
+MsArena *msv2_arena(int sock)
+{
+	if(arenas.empty())
+		mexAtExit(msv2_free_arenas);
+	MsArena *&arena = arenas[sock];
+	if(!arena)
+		arena = new MsArena;
+	return arena;
+}
+
+template <class T>
+static void release_if_large(std::vector<T> &v)
+{
+	if(v.capacity() * sizeof(T) > MSV2_ARENA_KEEP)
+		std::vector<T>().swap(v);
+	else
+		v.clear();
+}
+
+void MsArena::trim(void)
+{
+	release_if_large(buffer);
+	release_if_large(small);
+	release_if_large(iov);
+	release_if_large(segments);
+}
+
+////////////////////////////////////////////////////////////
+// Scatter/gather transfers
+
+// Sends or receives every byte of iov[0..n). The iovecs are consumed.
+static int msv2_transfer(int sock, MsIoVec *iov, size_t n, bool send)
+{
+	while(n > 0 && MSIOV_LEN(*iov) == 0) {
+		iov++;
+		n--;
+	}
+	while(n > 0) {
+		size_t batch = n < MSV2_MAX_IOV ? n : MSV2_MAX_IOV;
+		size_t done;
+#if defined(WIN32) || defined(_WIN32)
+		DWORD transferred = 0, flags = 0;
+		int ret = send ?
+			WSASend(sock, iov, (DWORD)batch, &transferred, 0, NULL, NULL) :
+			WSARecv(sock, iov, (DWORD)batch, &transferred, &flags, NULL, NULL);
+		if(ret != 0)
+			return -1;
+		done = transferred;
+#else
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = batch;
+		ssize_t ret = send ? sendmsg(sock, &msg, MSG_NOSIGNAL) : recvmsg(sock, &msg, MSG_WAITALL);
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		done = (size_t)ret;
+#endif
+		// connection closed
+		if(done == 0)
+			return -1;
+		while(n > 0 && done >= MSIOV_LEN(*iov)) {
+			done -= MSIOV_LEN(*iov);
+			iov++;
+			n--;
+		}
+		if(done > 0) {
+			MSIOV_BASE(*iov) = (char *)MSIOV_BASE(*iov) + done;
+			MSIOV_LEN(*iov) -= done;
+		}
+	}
+	return 0;
+}
+
+int msv2_recv_all(int sock, char *data, size_t len)
+{
+	MsIoVec iov;
+	MSIOV_BASE(iov) = data;
+	MSIOV_LEN(iov) = len;
+	return msv2_transfer(sock, &iov, 1, false);
+}
+
+// Turns the segments into iovecs, merging neighbours and splitting
+// segments that are too long for a single buffer
+static void msv2_build_iov(MsArena *arena)
+{
+	for(size_t i=0;i<arena->segments.size();i++) {
+		const MsArena::Segment &seg = arena->segments[i];
+		size_t len = seg.length;
+		if(len == 0)
+			continue;
+		char *base = seg.ext ? seg.ext : &arena->small[0] + seg.offset;
+		if(!arena->iov.empty()) {
+			MsIoVec &last = arena->iov.back();
+			if((char *)MSIOV_BASE(last) + MSIOV_LEN(last) == base &&
+				MSIOV_LEN(last) + len <= MSV2_MAX_CHUNK) {
+				MSIOV_LEN(last) += len;
+				continue;
+			}
+		}
+		while(len > 0) {
+			size_t chunk = len < MSV2_MAX_CHUNK ? len : MSV2_MAX_CHUNK;
+			MsIoVec v;
+			MSIOV_BASE(v) = base;
+			MSIOV_LEN(v) = chunk;
+			arena->iov.push_back(v);
+			base += chunk;
+			len -= chunk;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Descriptor
+
+static void put_int(std::vector<char> &buf, int value)
+{
+#ifdef _BIG_ENDIAN_
+	MatVar::swap4((unsigned char *)&value);
+#endif
+	const char *c = (const char *)&value;
+	buf.insert(buf.end(), c, c + sizeof(int));
+}
+
+static MatVarType msv2_type(mxClassID id)
+{
+	switch(id) {
+	case mxLOGICAL_CLASS: return MAT_LOGICAL;
+	case mxCHAR_CLASS: return MAT_CHAR;
+	case mxUINT8_CLASS: return MAT_UINT8;
+	case mxINT8_CLASS: return MAT_INT8;
+	case mxUINT16_CLASS: return MAT_UINT16;
+	case mxINT16_CLASS: return MAT_INT16;
+	case mxUINT32_CLASS: return MAT_UINT32;
+	case mxINT32_CLASS: return MAT_INT32;
+	case mxUINT64_CLASS: return MAT_UINT64;
+	case mxINT64_CLASS: return MAT_INT64;
+	case mxSINGLE_CLASS: return MAT_SINGLE;
+	case mxDOUBLE_CLASS: return MAT_DOUBLE;
+	case mxSTRUCT_CLASS: return MAT_STRUCT;
+	case mxCELL_CLASS: return MAT_CELL;
+	default: return MAT_VAREND;
+	}
+}
+
+static void add_segment(MsArena *arena, char *data, size_t len)
+{
+	MsArena::Segment seg;
+	seg.length = len;
+	if(len < MSV2_SMALL_LEAF) {
+		seg.ext = (char *)0;
+		seg.offset = arena->small.size();
+		arena->small.insert(arena->small.end(), data, data + len);
+	}
+	else {
+		seg.ext = data;
+		seg.offset = 0;
+	}
+	arena->segments.push_back(seg);
+}
+
+static void put_dims(std::vector<char> &buf, const mxArray *mx)
+{
+	mwSize ndim = mxGetNumberOfDimensions(mx);
+	const mwSize *dims = mxGetDimensions(mx);
+	put_int(buf, (int)ndim);
+	for(mwSize i=0;i<ndim;i++)
+		put_int(buf, (int)dims[i]);
+}
+
+static int describe(const mxArray *mx, MsArena *arena, int depth)
+{
+	std::vector<char> &buf = arena->buffer;
+	if(!mx) {
+		put_int(buf, MAT_EMPTY);
+		return 0;
+	}
+	MatVarType type = msv2_type(mxGetClassID(mx));
+	if(type == MAT_VAREND || mxIsSparse(mx) || depth > MSV2_MAX_DEPTH) {
+		mexPrintf("mssend: unsupported variable (class %s)\n", mxGetClassName(mx));
+		return -1;
+	}
+	size_t numel = mxGetNumberOfElements(mx);
+	put_int(buf, type);
+	if(type == MAT_CELL) {
+		put_dims(buf, mx);
+		for(size_t i=0;i<numel;i++)
+			if(describe(mxGetCell(mx, i), arena, depth + 1) < 0)
+				return -1;
+		return 0;
+	}
+	if(type == MAT_STRUCT) {
+		int nFields = mxGetNumberOfFields(mx);
+		put_dims(buf, mx);
+		put_int(buf, nFields);
+		for(int j=0;j<nFields;j++) {
+			const char *name = mxGetFieldNameByNumber(mx, j);
+			buf.insert(buf.end(), name, name + strlen(name) + 1);
+		}
+		for(size_t i=0;i<numel;i++)
+			for(int j=0;j<nFields;j++)
+				if(describe(mxGetFieldByNumber(mx, i, j), arena, depth + 1) < 0)
+					return -1;
+		return 0;
+	}
+	bool complex = mxIsComplex(mx) != 0;
+	put_int(buf, complex ? MAT_COMPLEX : MAT_REAL);
+	put_dims(buf, mx);
+	size_t len = numel * mxGetElementSize(mx);
+	add_segment(arena, (char *)mxGetData(mx), len);
+	if(complex)
+		add_segment(arena, (char *)mxGetImagData(mx), len);
+	return 0;
+}
+
+long long msv2_prepare(const mxArray *mx, MsArena *arena)
+{
+	arena->buffer.resize(MSV2_HEADER_SIZE);
+	arena->small.clear();
+	arena->segments.clear();
+	arena->iov.clear();
+
+	if(describe(mx, arena, 0) < 0)
+		return -1;
+	unsigned long long payload = 0;
+	for(size_t i=0;i<arena->segments.size();i++)
+		payload += arena->segments[i].length;
+	if(payload > MSV2_MAX_PAYLOAD) {
+		mexPrintf("mssend: the variable has more than %llu bytes of data\n", (unsigned long long)MSV2_MAX_PAYLOAD);
+		return -1;
+	}
+
+	MsV2Header hdr;
+	hdr.magic = MSV2_MAGIC;
+	hdr.descLength = (unsigned int)(arena->buffer.size() - MSV2_HEADER_SIZE);
+	hdr.payloadLength = payload;
+	memcpy(&arena->buffer[0], &hdr, MSV2_HEADER_SIZE);
+
+	MsIoVec v;
+	MSIOV_BASE(v) = &arena->buffer[0];
+	MSIOV_LEN(v) = arena->buffer.size();
+	arena->iov.push_back(v);
+	msv2_build_iov(arena);
+	return (long long)(arena->buffer.size() + payload);
+}
+
+long long msv2_send(int sock, const mxArray *mx, MsArena *arena)
+{
+	long long total = msv2_prepare(mx, arena);
+	if(total < 0) {
+		arena->trim();
+		return -1;
+	}
+	int ret = msv2_transfer(sock, &arena->iov[0], arena->iov.size(), true);
+	arena->trim();
+	return ret < 0 ? -1 : total;
+}
+
+////////////////////////////////////////////////////////////
+// Receiving
+
+class DescriptorReader {
+ public:
+	DescriptorReader(const char *data, size_t len) : p(data), end(data + len) {}
+
+	bool get_int(int &value) {
+		if(end - p < (ptrdiff_t)sizeof(int))
+			return false;
+		memcpy(&value, p, sizeof(int));
+#ifdef _BIG_ENDIAN_
+		MatVar::swap4((unsigned char *)&value);
+#endif
+		p += sizeof(int);
+		return true;
+	}
+
+	bool get_dims(mwSize &ndim, mwSize *dims, size_t &numel) {
+		int n;
+		if(!get_int(n) || n < 1 || n > MAX_DIMS)
+			return false;
+		ndim = (mwSize)n;
+		numel = 1;
+		for(int i=0;i<n;i++) {
+			int d;
+			if(!get_int(d) || d < 0)
+				return false;
+			dims[i] = (mwSize)d;
+			if(d > 0 && numel > ((size_t)-1) / (size_t)d)
+				return false;
+			numel *= (size_t)d;
+		}
+		if(ndim == 1) {
+			dims[1] = 1;
+			ndim = 2;
+		}
+		return true;
+	}
+
+	const char *get_name(void) {
+		const char *name = p;
+		const char *nul = (const char *)memchr(p, '\0', end - p);
+		if(!nul)
+			return (const char *)0;
+		p = nul + 1;
+		return name;
+	}
+
+	size_t remaining(void) const { return end - p; }
+
+ private:
+	const char *p, *end;
+};
+
+// Creates the variable described at the reader and queues its numeric
+// data in arena->segments.  Returns false on a malformed descriptor;
+// *out is NULL for MAT_EMPTY.
+static bool build(DescriptorReader &r, MsArena *arena, unsigned long long &payloadLeft,
+				  int depth, mxArray **out)
+{
+	*out = (mxArray *)0;
+	int type;
+	if(depth > MSV2_MAX_DEPTH || !r.get_int(type) || type < MAT_EMPTY || type >= MAT_VAREND)
+		return false;
+	if(type == MAT_EMPTY)
+		return true;
+
+	mwSize ndim;
+	mwSize dims[MAX_DIMS];
+	size_t numel;
+	if(type == MAT_CELL || type == MAT_STRUCT) {
+		if(!r.get_dims(ndim, dims, numel))
+			return false;
+		int nFields = 0;
+		std::vector<const char *> fieldNames;
+		if(type == MAT_STRUCT) {
+			if(!r.get_int(nFields) || nFields < 0 || (size_t)nFields > r.remaining())
+				return false;
+			fieldNames.resize(nFields);
+			for(int j=0;j<nFields;j++)
+				if(!(fieldNames[j] = r.get_name()))
+					return false;
+		}
+		// every child takes at least four bytes of descriptor
+		size_t nchildren = type == MAT_STRUCT ? numel * nFields : numel;
+		if((nFields > 0 && numel > ((size_t)-1) / nFields) || nchildren > r.remaining() / sizeof(int))
+			return false;
+		mxArray *mx = type == MAT_CELL ? mxCreateCellArray(ndim, dims) :
+			mxCreateStructArray(ndim, dims, nFields, nFields > 0 ? &fieldNames[0] : (const char **)0);
+		for(size_t i=0;i<nchildren;i++) {
+			mxArray *child;
+			if(!build(r, arena, payloadLeft, depth + 1, &child)) {
+				mxDestroyArray(mx);
+				return false;
+			}
+			if(type == MAT_CELL)
+				mxSetCell(mx, i, child);
+			else
+				mxSetFieldByNumber(mx, i / nFields, (int)(i % nFields), child);
+		}
+		*out = mx;
+		return true;
+	}
+
+	int complexity;
+	if(!r.get_int(complexity) || (complexity != MAT_REAL && complexity != MAT_COMPLEX) ||
+		!r.get_dims(ndim, dims, numel))
+		return false;
+	if(complexity == MAT_COMPLEX && (type == MAT_LOGICAL || type == MAT_CHAR))
+		return false;
+	size_t elementSize = MatVar::varSize[type];
+	if(numel > MSV2_MAX_PAYLOAD / elementSize)
+		return false;
+	unsigned long long len = (unsigned long long)numel * elementSize;
+	if(len * (complexity == MAT_COMPLEX ? 2 : 1) > payloadLeft)
+		return false;
+	payloadLeft -= len * (complexity == MAT_COMPLEX ? 2 : 1);
+
+	mxArray *mx;
+	if(type == MAT_LOGICAL)
+		mx = mxCreateLogicalArray(ndim, dims);
+	else if(type == MAT_CHAR)
+		mx = mxCreateCharArray(ndim, dims);
+	else {
+		static const mxClassID ids[MAT_VAREND] = {
+			mxUNKNOWN_CLASS, mxLOGICAL_CLASS, mxCHAR_CLASS, mxUINT8_CLASS, mxINT8_CLASS,
+			mxUINT16_CLASS, mxINT16_CLASS, mxUINT32_CLASS, mxINT32_CLASS, mxUINT64_CLASS,
+			mxINT64_CLASS, mxSINGLE_CLASS, mxDOUBLE_CLASS, mxSTRUCT_CLASS, mxCELL_CLASS};
+		mx = mxCreateNumericArray(ndim, dims, ids[type], complexity == MAT_COMPLEX ? mxCOMPLEX : mxREAL);
+	}
+	MsArena::Segment seg;
+	seg.ext = (char *)mxGetData(mx);
+	seg.offset = elementSize;	// only used to swap the byte order
+	seg.length = (size_t)len;
+	arena->segments.push_back(seg);
+	if(complexity == MAT_COMPLEX) {
+		seg.ext = (char *)mxGetImagData(mx);
+		arena->segments.push_back(seg);
+	}
+	*out = mx;
+	return true;
+}
+
+int msv2_header(const char *header, unsigned int *descLength, unsigned long long *payloadLength)
+{
+	memcpy(descLength, header + 4, sizeof(*descLength));
+	memcpy(payloadLength, header + 8, sizeof(*payloadLength));
+#ifdef _BIG_ENDIAN_
+	MatVar::swap4((unsigned char *)descLength);
+	MatVar::swap8((unsigned char *)payloadLength);
+#endif
+	if(*descLength < sizeof(int) || *descLength > MSV2_MAX_DESCRIPTOR || *payloadLength > MSV2_MAX_PAYLOAD)
+		return -2;
+	return 0;
+}
+
+// Creates the variable from its descriptor and queues its leaves in
+// arena->segments
+static int msv2_build(const char *desc, unsigned int descLength, unsigned long long payloadLength,
+					  MsArena *arena, mxArray **out)
+{
+	arena->segments.clear();
+	arena->iov.clear();
+	DescriptorReader r(desc, descLength);
+	unsigned long long payloadLeft = payloadLength;
+	mxArray *mx;
+	if(!build(r, arena, payloadLeft, 0, &mx) || payloadLeft != 0 || r.remaining() != 0) {
+		if(mx)
+			mxDestroyArray(mx);
+		return -2;
+	}
+	*out = mx;
+	return 0;
+}
+
+static void msv2_swap_leaves(MsArena *arena)
+{
+#ifdef _BIG_ENDIAN_
+	for(size_t i=0;i<arena->segments.size();i++) {
+		const MsArena::Segment &seg = arena->segments[i];
+		MatVar::swaparr((unsigned char *)seg.ext, (int)(seg.length / seg.offset), (int)seg.offset);
+	}
+#endif
+}
+
+int msv2_unpack(const char *data, unsigned int descLength, unsigned long long payloadLength,
+				MsArena *arena, mxArray **out)
+{
+	*out = (mxArray *)0;
+	mxArray *mx;
+	if(msv2_build(data, descLength, payloadLength, arena, &mx) < 0)
+		return -2;
+	data += descLength;
+	for(size_t i=0;i<arena->segments.size();i++) {
+		const MsArena::Segment &seg = arena->segments[i];
+		if(seg.length > 0)
+			memcpy(seg.ext, data, seg.length);
+		data += seg.length;
+	}
+	msv2_swap_leaves(arena);
+	*out = mx;
+	return 0;
+}
+
+int msv2_recv(int sock, const char *header, MsArena *arena, mxArray **out)
+{
+	*out = (mxArray *)0;
+	unsigned int descLength;
+	unsigned long long payloadLength;
+	if(msv2_header(header, &descLength, &payloadLength) < 0)
+		return -2;
+
+	// small payloads come along with the descriptor
+	bool inlined = payloadLength <= MSV2_INLINE_PAYLOAD;
+	size_t len = descLength + (inlined ? (size_t)payloadLength : 0);
+	arena->buffer.resize(len);
+	if(msv2_recv_all(sock, &arena->buffer[0], len) < 0) {
+		arena->trim();
+		return -1;
+	}
+
+	int ret;
+	if(inlined)
+		ret = msv2_unpack(&arena->buffer[0], descLength, payloadLength, arena, out);
+	else {
+		mxArray *mx;
+		ret = msv2_build(&arena->buffer[0], descLength, payloadLength, arena, &mx);
+		if(ret == 0) {
+			// numeric data goes straight into the mxArrays
+			msv2_build_iov(arena);
+			if(!arena->iov.empty() && msv2_transfer(sock, &arena->iov[0], arena->iov.size(), false) < 0) {
+				mxDestroyArray(mx);
+				ret = -1;
+			}
+			else {
+				msv2_swap_leaves(arena);
+				*out = mx;
+			}
+		}
+	}
+	arena->trim();
+	return ret;
+}
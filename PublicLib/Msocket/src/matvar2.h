@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////
+//
+// Name:   matvar2.h
+//
+// Description:
+//
+//    Version 2 of the mssend/msrecv wire format.  A message
+//    is a fixed header, a descriptor and a payload:
+//
+//      header     - MSV2_MAGIC, descriptor length (uint32)
+//                   and payload length (uint64)
+//      descriptor - the variable tree in the MatVar layout
+//                   (type, complexity, ndim, dims, field
+//                   names), without any numeric data
+//      payload    - the data of every numeric leaf, real
+//                   part then imaginary part, in tree order
+//
+//    The payload is sent straight from mxGetData with a
+//    gather write and received with a scatter read directly
+//    into the mxArrays of the result, so numeric data is
+//    never copied into an intermediate buffer.  Leaves
+//    smaller than MSV2_SMALL_LEAF are coalesced into the
+//    socket's arena so that messages made of many scalars
+//    and short strings stay a handful of buffers.
+//
+//    Payloads up to MSV2_INLINE_PAYLOAD are received with
+//    the descriptor in one call and copied out of the arena,
+//    which is cheaper than scattering many tiny leaves.
+//
+//    A v1 message starts with its (positive) length and is
+//    at least 20 bytes long, so the receiver reads the first
+//    MSV2_HEADER_SIZE bytes and tells the two formats apart
+//    from the first four.  All values are little-endian.
+//
+//    Every socket keeps an arena (descriptor buffer, iovec
+//    and leaf lists) that is reused from one message to the
+//    next, so steady-state messaging allocates nothing
+//    besides the returned mxArray.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef _MATVAR2_H_
+#define _MATVAR2_H_
+
+#include <stddef.h>
+#include <vector>
+
+#if defined(WIN32) || defined(_WIN32)
+#include <winsock2.h>
+typedef WSABUF MsIoVec;
+#define MSIOV_BASE(v) ((v).buf)
+#define MSIOV_LEN(v) ((v).len)
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/select.h>
+#include <unistd.h>
+typedef struct iovec MsIoVec;
+#define MSIOV_BASE(v) ((v).iov_base)
+#define MSIOV_LEN(v) ((v).iov_len)
+#endif
+
+#include <mex.h>
+#include <matvar.h>
+
+#define MSV2_MAGIC 0x3276534D			// "MSv2"
+#define MSV2_HEADER_SIZE 16
+#define MSV2_MAX_DESCRIPTOR (64 << 20)
+#define MSV2_SMALL_LEAF 256
+#define MSV2_INLINE_PAYLOAD (64 << 10)
+#define MSV2_MAX_IOV 1024
+#define MSV2_MAX_CHUNK (1 << 30)		// WSABUF lengths are 32 bit
+#define MSV2_ARENA_KEEP (4 << 20)		// larger buffers are released after the message
+
+// Larger payloads are refused by both ends, so that a corrupted or
+// hostile header cannot make the receiver allocate without bound:
+// 4 GB (1 GB in 32 bit builds).  Can be changed at compile time
+// (mex -DMSV2_MAX_PAYLOAD=...).
+#ifndef MSV2_MAX_PAYLOAD
+#define MSV2_MAX_PAYLOAD (sizeof(size_t) > 4 ? (4ULL << 30) : (1ULL << 30))
+#endif
+
+typedef struct {
+	unsigned int magic;
+	unsigned int descLength;
+	unsigned long long payloadLength;
+} MsV2Header;
+
+class MsArena {
+ public:
+	std::vector<char> buffer;	// header + descriptor (send), descriptor or v1 message (recv)
+	std::vector<char> small;	// coalesced small leaves
+	std::vector<MsIoVec> iov;
+
+	// a payload segment: either external memory or an offset into "small".
+	// Received segments are always external and keep their element size
+	// in offset.
+	struct Segment {
+		char *ext;
+		size_t offset;
+		size_t length;
+	};
+	std::vector<Segment> segments;
+
+	void trim(void);
+};
+
+// Arena of a socket; all arenas are freed when the mex file is cleared
+MsArena *msv2_arena(int sock);
+
+// Sends mx; returns the number of bytes sent, or -1
+long long msv2_send(int sock, const mxArray *mx, MsArena *arena);
+
+// Lays out the message of mx in arena->iov (header and descriptor in
+// arena->buffer, numeric data in place); returns its length, or -1.
+// The iovecs are valid until mx or the arena change.
+long long msv2_prepare(const mxArray *mx, MsArena *arena);
+
+// Reads the lengths of an MSV2_HEADER_SIZE bytes header; returns -2 if
+// they are out of range
+int msv2_header(const char *header, unsigned int *descLength, unsigned long long *payloadLength);
+
+// Creates the variable of a message held in memory (descriptor then
+// payload, as they follow the header).  Returns 0 or -2.
+int msv2_unpack(const char *data, unsigned int descLength, unsigned long long payloadLength,
+				MsArena *arena, mxArray **out);
+
+// Receives the rest of a message whose MSV2_HEADER_SIZE bytes header
+// (starting with MSV2_MAGIC) was already read.  Returns 0 and the
+// variable in *out, -1 on a socket error, or -2 on a malformed message
+// (the connection should then be closed)
+int msv2_recv(int sock, const char *header, MsArena *arena, mxArray **out);
+
+// Receives exactly len bytes
+int msv2_recv_all(int sock, char *data, size_t len);
+
+#endif
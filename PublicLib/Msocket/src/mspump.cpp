@@ -0,0 +1,625 @@
+////////////////////////////////////////////////////////////
+//
+// Name:   mspump.cpp
+//
+// Description:
+//
+//    This is part of the "msocket" suite of TCP/IP
+//    funcitons for MATLAB.  It is a message pump that
+//    serves several sockets in one call:
+//
+//      mspump('Add',sock)        - registers a socket
+//      mspump('Remove',sock)     - unregisters it
+//      [acVars,aiSock,aiLost] = mspump('Poll',timeout)
+//                                - every complete message of
+//                                  every socket, and the sockets
+//                                  that were lost
+//      ret = mspump('Send',sock,var[,version])
+//                                - queues a variable
+//      pending = mspump('Flush',timeout)
+//                                - drains the send queues
+//
+//    Registered sockets are non-blocking.  Readiness is
+//    taken from epoll (edge triggered) on Linux, poll on
+//    other UNIX systems and select on Windows.  A ready
+//    socket is read until it would block into its own
+//    input buffer, which is cut into v1 (matvar.cpp) and
+//    v2 (matvar2.h) messages, so a slow or half-sent
+//    message on one socket never delays the others.
+//    The unparsed input of a socket is held to
+//    MSPUMP_MAX_INPUT (or the message being received);
+//    the rest waits in the socket until Poll catches up.
+//
+//    "Send" writes what it can right away with a gather
+//    write straight from the variable; the rest is copied
+//    into the socket's send queue, which "Poll" and
+//    "Flush" drain.  Input buffers, send queues and
+//    arenas are kept between calls.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+////////////////////////////////////////////////////////////
+
+#include <mex.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <map>
+#include <vector>
+
+#include <matvar.h>
+#include <matvar2.h>
+
+#if defined(WIN32) || defined(_WIN32)
+#define MSPUMP_SELECT
+#elif defined(__linux__)
+#define MSPUMP_EPOLL
+#include <sys/epoll.h>
+#include <fcntl.h>
+#else
+#define MSPUMP_POLL
+#include <poll.h>
+#include <fcntl.h>
+#endif
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/time.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MSPUMP_READ_CHUNK (64 << 10)
+#define MSPUMP_COMPACT (1 << 20)		// input consumed before the buffer is compacted
+#ifndef MSPUMP_MAX_INPUT
+#define MSPUMP_MAX_INPUT (16 << 20)		// unparsed input read ahead of Poll
+#endif
+
+typedef struct {
+	int sock;
+	std::vector<char> in;		// received bytes; in[head..] are not parsed yet
+	size_t head;
+	size_t need;				// size of the message at in[head], once its header is in
+	bool unread;				// reading stopped at the input limit
+	std::vector<char> out;		// queued bytes; out[outHead..] are not sent yet
+	size_t outHead;
+	MsArena arena;
+	bool lost;
+} PumpSocket;
+
+static std::map<int, PumpSocket *> sockets;
+#ifdef MSPUMP_EPOLL
+static int epfd = -1;
+#endif
+
+////////////////////////////////////////////////////////////
+// Sockets
+
+static bool would_block(void)
+{
+#if defined(WIN32) || defined(_WIN32)
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static void set_blocking(int sock, bool blocking)
+{
+#if defined(WIN32) || defined(_WIN32)
+	u_long mode = blocking ? 0 : 1;
+	ioctlsocket(sock, FIONBIO, &mode);
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+static double now(void)
+{
+#if defined(WIN32) || defined(_WIN32)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, (struct timezone *)0);
+	return tv.tv_sec + tv.tv_usec * 1.0E-6;
+#endif
+}
+
+static void remove_socket(int sock)
+{
+	std::map<int, PumpSocket *>::iterator it = sockets.find(sock);
+	if(it == sockets.end())
+		return;
+#ifdef MSPUMP_EPOLL
+	epoll_ctl(epfd, EPOLL_CTL_DEL, sock, (struct epoll_event *)0);
+#endif
+	if(!it->second->lost)
+		set_blocking(sock, true);
+	delete it->second;
+	sockets.erase(it);
+}
+
+static void free_pump(void)
+{
+	while(!sockets.empty())
+		remove_socket(sockets.begin()->first);
+#ifdef MSPUMP_EPOLL
+	if(epfd >= 0)
+		close(epfd);
+	epfd = -1;
+#endif
+}
+
+static int add_socket(int sock)
+{
+	if(sockets.find(sock) != sockets.end())
+		return 0;
+#ifdef MSPUMP_EPOLL
+	if(epfd < 0 && (epfd = epoll_create(16)) < 0) {
+		perror("epoll_create");
+		return -1;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = sock;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+#endif
+	PumpSocket *ps = new PumpSocket;
+	ps->sock = sock;
+	ps->head = 0;
+	ps->need = 0;
+	ps->unread = false;
+	ps->outHead = 0;
+	ps->lost = false;
+	sockets[sock] = ps;
+	set_blocking(sock, false);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Receiving
+
+// Reads until the socket would block, or until the unparsed input
+// reaches the limit.  Edge triggered readiness does not report the
+// rest again, so Poll reads such sockets without waiting.
+static void drain_input(PumpSocket *ps)
+{
+	ps->unread = false;
+	if(ps->lost)
+		return;
+	size_t limit = ps->need > MSPUMP_MAX_INPUT ? ps->need : MSPUMP_MAX_INPUT;
+	for(;;) {
+		size_t used = ps->in.size();
+		if(used - ps->head >= limit) {
+			ps->unread = true;
+			return;
+		}
+		ps->in.resize(used + MSPUMP_READ_CHUNK);
+		int ret = ::recv(ps->sock, &ps->in[0] + used, MSPUMP_READ_CHUNK, 0);
+		ps->in.resize(used + (ret > 0 ? ret : 0));
+		if(ret > 0)
+			continue;
+		if(ret < 0 && would_block())
+			return;
+		// closed by the peer, or an error
+		ps->lost = true;
+		return;
+	}
+}
+
+// Cuts the complete messages out of the input buffer
+static void parse_input(PumpSocket *ps, std::vector<mxArray *> &vars, std::vector<int> &owners)
+{
+	for(;;) {
+		size_t avail = ps->in.size() - ps->head;
+		const char *p = avail > 0 ? &ps->in[0] + ps->head : (const char *)0;
+		ps->need = 0;
+		if(avail < sizeof(int))
+			break;
+		int len;
+		memcpy(&len, p, sizeof(int));
+#ifdef _BIG_ENDIAN_
+		MatVar::swap4((unsigned char *)&len);
+#endif
+		mxArray *mx = (mxArray *)0;
+		if((unsigned int)len == MSV2_MAGIC) {
+			unsigned int descLength;
+			unsigned long long payloadLength;
+			if(avail < MSV2_HEADER_SIZE)
+				break;
+			if(msv2_header(p, &descLength, &payloadLength) < 0) {
+				ps->lost = true;
+				break;
+			}
+			unsigned long long total = MSV2_HEADER_SIZE + descLength + payloadLength;
+			if(avail < total) {
+				ps->need = (size_t)total;
+				break;
+			}
+			if(msv2_unpack(p + MSV2_HEADER_SIZE, descLength, payloadLength, &ps->arena, &mx) < 0) {
+				ps->lost = true;
+				break;
+			}
+			ps->head += (size_t)total;
+		}
+		else {
+			if(len < MSV2_HEADER_SIZE - (int)sizeof(int)) {
+				ps->lost = true;
+				break;
+			}
+			if(avail - sizeof(int) < (size_t)len) {
+				ps->need = sizeof(int) + len;
+				break;
+			}
+			MatVar mv;
+			mv.create((void *)(p + sizeof(int)));
+			mx = mv.get_mxarray();
+			ps->head += sizeof(int) + len;
+		}
+		vars.push_back(mx ? mx : mxCreateNumericMatrix(0,0,mxDOUBLE_CLASS,mxREAL));
+		owners.push_back(ps->sock);
+	}
+
+	if(ps->head == ps->in.size() && ps->head > 0) {
+		ps->in.clear();
+		ps->head = 0;
+	}
+	else if(ps->head > MSPUMP_COMPACT) {
+		ps->in.erase(ps->in.begin(), ps->in.begin() + ps->head);
+		ps->head = 0;
+	}
+	ps->arena.trim();
+}
+
+////////////////////////////////////////////////////////////
+// Sending
+
+// Writes the iovecs until the socket would block; returns the number of
+// bytes written, or -1.  *sent is the number of iovecs written completely;
+// a partly written one is advanced past what was written.
+static long long write_iov(int sock, MsIoVec *iov, size_t n, size_t *sent)
+{
+	long long written = 0;
+	*sent = 0;
+	while(n > 0) {
+		size_t batch = n < MSV2_MAX_IOV ? n : MSV2_MAX_IOV;
+		size_t done;
+#if defined(WIN32) || defined(_WIN32)
+		DWORD transferred = 0;
+		if(WSASend(sock, iov, (DWORD)batch, &transferred, 0, NULL, NULL) != 0)
+			return would_block() ? written : -1;
+		done = transferred;
+#else
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = batch;
+		ssize_t ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		if(ret < 0)
+			return would_block() ? written : -1;
+		done = (size_t)ret;
+#endif
+		written += done;
+		while(n > 0 && done >= MSIOV_LEN(*iov)) {
+			done -= MSIOV_LEN(*iov);
+			iov++;
+			n--;
+			(*sent)++;
+		}
+		if(done > 0) {
+			MSIOV_BASE(*iov) = (char *)MSIOV_BASE(*iov) + done;
+			MSIOV_LEN(*iov) -= done;
+			// the kernel buffer is full
+			return written;
+		}
+	}
+	return written;
+}
+
+static void drain_output(PumpSocket *ps)
+{
+	if(ps->lost || ps->outHead == ps->out.size())
+		return;
+	MsIoVec v;
+	MSIOV_BASE(v) = &ps->out[0] + ps->outHead;
+	MSIOV_LEN(v) = ps->out.size() - ps->outHead;
+	size_t sent;
+	long long ret = write_iov(ps->sock, &v, 1, &sent);
+	if(ret < 0) {
+		ps->lost = true;
+		return;
+	}
+	ps->outHead += (size_t)ret;
+	if(ps->outHead == ps->out.size()) {
+		ps->out.clear();
+		ps->outHead = 0;
+	}
+}
+
+// Returns the number of bytes accepted, or -1
+static long long send_var(PumpSocket *ps, const mxArray *mx, int version)
+{
+	if(ps->lost)
+		return -1;
+	MsArena *arena = &ps->arena;
+	long long total;
+	if(version >= 2) {
+		total = msv2_prepare(mx, arena);
+		if(total < 0) {
+			arena->trim();
+			return -1;
+		}
+	}
+	else {
+		MatVar mv;
+		mv.create(mx);
+		int mvlen = mv.get_serialize_length();
+		arena->buffer.resize(sizeof(int) + mvlen);
+		int smvlen = mvlen;
+#ifdef _BIG_ENDIAN_
+		MatVar::swap4((unsigned char *)&smvlen);
+#endif
+		memcpy(&arena->buffer[0], &smvlen, sizeof(int));
+		mv.serialize(&arena->buffer[0] + sizeof(int));
+		MsIoVec v;
+		MSIOV_BASE(v) = &arena->buffer[0];
+		MSIOV_LEN(v) = arena->buffer.size();
+		arena->iov.clear();
+		arena->iov.push_back(v);
+		total = (long long)arena->buffer.size();
+	}
+
+	// messages leave in order: only write directly if nothing is queued
+	size_t sent = 0;
+	if(ps->outHead == ps->out.size()) {
+		ps->out.clear();
+		ps->outHead = 0;
+		if(write_iov(ps->sock, &arena->iov[0], arena->iov.size(), &sent) < 0) {
+			ps->lost = true;
+			arena->trim();
+			return -1;
+		}
+	}
+	for(size_t i=sent;i<arena->iov.size();i++) {
+		const char *base = (const char *)MSIOV_BASE(arena->iov[i]);
+		ps->out.insert(ps->out.end(), base, base + MSIOV_LEN(arena->iov[i]));
+	}
+	arena->trim();
+	return total;
+}
+
+static bool output_pending(void)
+{
+	for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+		if(!it->second->lost && it->second->outHead < it->second->out.size())
+			return true;
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+// Readiness
+
+// Waits up to timeout seconds (< 0: forever) and returns the sockets
+// that may be read
+static void wait_ready(double timeout, bool wantWrite, std::vector<PumpSocket *> &ready)
+{
+	ready.clear();
+#ifdef MSPUMP_EPOLL
+	struct epoll_event events[64];
+	int ms = timeout < 0 ? -1 : (int)ceil(timeout * 1000.0);
+	int n = epoll_wait(epfd, events, 64, ms);
+	for(int i=0;i<n;i++) {
+		std::map<int, PumpSocket *>::iterator it = sockets.find(events[i].data.fd);
+		if(it != sockets.end() && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+			ready.push_back(it->second);
+	}
+	// with more than 64 ready sockets the rest are reported next time
+#elif defined(MSPUMP_POLL)
+	std::vector<struct pollfd> fds;
+	for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++) {
+		struct pollfd p;
+		p.fd = it->first;
+		p.events = POLLIN;
+		if(wantWrite && it->second->outHead < it->second->out.size())
+			p.events |= POLLOUT;
+		p.revents = 0;
+		fds.push_back(p);
+	}
+	int ms = timeout < 0 ? -1 : (int)ceil(timeout * 1000.0);
+	if(poll(fds.empty() ? (struct pollfd *)0 : &fds[0], fds.size(), ms) <= 0)
+		return;
+	for(size_t i=0;i<fds.size();i++)
+		if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+			ready.push_back(sockets[fds[i].fd]);
+#else
+	fd_set readfds, writefds, exceptfds;
+	FD_ZERO(&readfds);
+	FD_ZERO(&writefds);
+	FD_ZERO(&exceptfds);
+	int maxfd = -1;
+	for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++) {
+		FD_SET(it->first, &readfds);
+		FD_SET(it->first, &exceptfds);
+		if(wantWrite && it->second->outHead < it->second->out.size())
+			FD_SET(it->first, &writefds);
+		if(it->first > maxfd)
+			maxfd = it->first;
+	}
+	struct timeval tv;
+	tv.tv_sec = (int) timeout;
+	tv.tv_usec = (int) (fmod(timeout,1.0)*1.0E6);
+	if(select(maxfd+1, &readfds, &writefds, &exceptfds, timeout < 0 ? (struct timeval *)0 : &tv) <= 0)
+		return;
+	for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+		if(FD_ISSET(it->first, &readfds) || FD_ISSET(it->first, &exceptfds))
+			ready.push_back(it->second);
+#endif
+}
+
+static void poll_sockets(double timeout, std::vector<mxArray *> &vars, std::vector<int> &owners,
+						 std::vector<int> &lost)
+{
+	std::vector<PumpSocket *> ready;
+	double deadline = now() + timeout;
+	double wait = timeout;
+	for(;;) {
+		bool unread = false;
+		for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+			unread = unread || it->second->unread;
+		wait_ready(unread ? 0 : wait, true, ready);
+		for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+			if(it->second->unread)
+				ready.push_back(it->second);
+		for(size_t i=0;i<ready.size();i++)
+			drain_input(ready[i]);
+		// input may also have been read by Flush
+		for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++) {
+			parse_input(it->second, vars, owners);
+			drain_output(it->second);
+		}
+		if(!vars.empty() || timeout == 0)
+			break;
+		bool anyLost = false;
+		for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+			anyLost = anyLost || it->second->lost;
+		if(anyLost)
+			break;
+		if(timeout > 0) {
+			wait = deadline - now();
+			if(wait <= 0)
+				break;
+		}
+	}
+
+	// lost sockets leave the pump; messages received before are kept
+	for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+		if(it->second->lost)
+			lost.push_back(it->first);
+	for(size_t i=0;i<lost.size();i++)
+		remove_socket(lost[i]);
+}
+
+////////////////////////////////////////////////////////////
+
+static mxArray *int_vector(const std::vector<int> &v)
+{
+	mxArray *mx = mxCreateNumericMatrix(1,(mwSize)v.size(),mxDOUBLE_CLASS,mxREAL);
+	double *pr = mxGetPr(mx);
+	for(size_t i=0;i<v.size();i++)
+		pr[i] = v[i];
+	return mx;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+								 int nrhs, const mxArray *prhs[])
+{
+	static bool registered = false;
+	if(!registered) {
+		mexAtExit(free_pump);
+		registered = true;
+	}
+
+	if(nrhs < 1 || !mxIsChar(prhs[0])) {
+		mexPrintf("Must input a command (Add, Remove, Poll, Send or Flush).\n");
+		return;
+	}
+	char command[16];
+	mxGetString(prhs[0], command, sizeof(command));
+
+	if(strcmp(command, "Add") == 0 || strcmp(command, "Remove") == 0) {
+		if(nrhs < 2 || !mxIsNumeric(prhs[1])) {
+			mexPrintf("Second argument must be a socket.\n");
+			return;
+		}
+		int sock = (int)mxGetScalar(prhs[1]);
+		int ret = 0;
+		if(command[0] == 'A')
+			ret = add_socket(sock);
+		else
+			remove_socket(sock);
+		plhs[0] = mxCreateDoubleScalar(ret);
+		return;
+	}
+
+	if(strcmp(command, "Poll") == 0) {
+		double timeout = 0;
+		if(nrhs > 1) {
+			if(!mxIsNumeric(prhs[1])) {
+				mexPrintf("2nd argument (timeout in s) must be numeric.\n");
+				return;
+			}
+			timeout = mxGetScalar(prhs[1]);
+		}
+		std::vector<mxArray *> vars;
+		std::vector<int> owners, lost;
+		if(!sockets.empty())
+			poll_sockets(timeout, vars, owners, lost);
+		plhs[0] = mxCreateCellMatrix(1,(mwSize)vars.size());
+		for(size_t i=0;i<vars.size();i++)
+			mxSetCell(plhs[0], i, vars[i]);
+		if(nlhs > 1)
+			plhs[1] = int_vector(owners);
+		if(nlhs > 2)
+			plhs[2] = int_vector(lost);
+		return;
+	}
+
+	if(strcmp(command, "Send") == 0) {
+		if(nrhs < 3 || !mxIsNumeric(prhs[1])) {
+			mexPrintf("Must input a socket and a variable.\n");
+			return;
+		}
+		int sock = (int)mxGetScalar(prhs[1]);
+		int version = nrhs > 3 ? (int)mxGetScalar(prhs[3]) : 1;
+#ifdef _BIG_ENDIAN_
+		version = 1;
+#endif
+		std::map<int, PumpSocket *>::iterator it = sockets.find(sock);
+		long long ret = -1;
+		if(it == sockets.end())
+			mexPrintf("mspump: socket %d was not added.\n", sock);
+		else
+			ret = send_var(it->second, prhs[2], version);
+		plhs[0] = mxCreateDoubleScalar((double)ret);
+		return;
+	}
+
+	if(strcmp(command, "Flush") == 0) {
+		double timeout = nrhs > 1 ? mxGetScalar(prhs[1]) : 0;
+		double deadline = now() + timeout;
+		std::vector<PumpSocket *> ready;
+		for(;;) {
+			for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+				drain_output(it->second);
+			if(!output_pending())
+				break;
+			double wait = timeout < 0 ? 0.1 : deadline - now();
+			if(wait <= 0)
+				break;
+			// readiness is edge triggered, so input is read now and
+			// parsed by the next Poll
+			wait_ready(wait < 0.01 ? wait : 0.01, true, ready);
+			for(size_t i=0;i<ready.size();i++)
+				drain_input(ready[i]);
+		}
+		double pending = 0;
+		for(std::map<int, PumpSocket *>::iterator it = sockets.begin(); it != sockets.end(); it++)
+			pending += (double)(it->second->out.size() - it->second->outHead);
+		plhs[0] = mxCreateDoubleScalar(pending);
+		return;
+	}
+
+	mexPrintf("mspump: unknown command %s\n", command);
+} // end of mexFunction
@@ -11,7 +11,8 @@
 //    This is part of the "msocket" suite of TCP/IP 
 //    funcitons for MATLAB.  It is a wrapper for the
 //    "recv" socket function call. The data send is a serialized
-//    MALTAB variable in a format described by matvar.cpp
+//    MALTAB variable in a format described by matvar.cpp (v1)
+//    or matvar2.h (v2); the format is detected per message.
 //
 // Copyright (c) 2006 MIT Lincoln Laboratory
 //
@@ -34,10 +35,10 @@
 
 #include <mex.h>
 #include <math.h>
+#include <string.h>
 
 #include <matvar.h>
-
-#include <winsock2.h>
+#include <matvar2.h>
 
 void mexFunction(int nlhs, mxArray *plhs[],
 								 int nrhs, const mxArray *prhs[])
@@ -45,7 +46,7 @@ void mexFunction(int nlhs, mxArray *plhs[],
 	int sock = -1;
 	int recvlen;
 	int ret;
-	char *cdata = (char *)0;
+	char header[MSV2_HEADER_SIZE];
 	MatVar mv;
 	int cnt;
 	double timeout = -1;
@@ -76,12 +77,12 @@ void mexFunction(int nlhs, mxArray *plhs[],
 	FD_SET(sock,&exceptfds);
 
 	if(timeout < 0)
-		select(sock,&readfds,&writefds,&exceptfds,(struct timeval *)0);
+		select(sock+1,&readfds,&writefds,&exceptfds,(struct timeval *)0);
 	else {
 		struct timeval tv;
 		tv.tv_sec = (int) timeout;
 		tv.tv_usec = (int) (fmod(timeout,1.0)*1.0E6);
-		select(sock,&readfds,&writefds,&exceptfds,&tv);
+		select(sock+1,&readfds,&writefds,&exceptfds,&tv);
 	}
 	
 
@@ -92,15 +93,16 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		return;
 	}
 
-	// Receive the count
+	// Receive the count (v1) or the v2 header. A v1 message is at
+	// least 20 bytes long, so both start with MSV2_HEADER_SIZE bytes.
 	cnt = 0;
     int watchdogcounter = 0;
     int iWatchDogTimeOut = 10000;
-	while (cnt < (int) sizeof(int)) {
+	while (cnt < MSV2_HEADER_SIZE) {
         
         
-		ret = ::recv(sock,((char *)&recvlen)+cnt,
-					sizeof(int)-cnt,0);
+		ret = ::recv(sock,header+cnt,
+					MSV2_HEADER_SIZE-cnt,0);
     
         watchdogcounter += (ret == 0);
         
@@ -114,44 +116,58 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		}
 		cnt += ret;
 	}
+	memcpy(&recvlen,header,sizeof(int));
 #ifdef _BIG_ENDIAN_
     unsigned char *tmp = (unsigned char *)&recvlen;
     unsigned char t;
     t = tmp[0];tmp[0] = tmp[3];tmp[3] = t;
     t = tmp[1];tmp[1] = tmp[2];tmp[2] = t;
 #endif
-	if(recvlen <= 0) {
+	MsArena *arena = msv2_arena(sock);
+	if((unsigned int)recvlen == MSV2_MAGIC) {
+		// v2: numeric data is received straight into the result
+		mxArray *mx;
+		ret = msv2_recv(sock,header,arena,&mx);
+		if(ret < 0) {
+			if(ret == -1)
+				perror("recv");
+			else
+				mexPrintf("msrecv: malformed message\n");
+			plhs[0] = mxCreateNumericMatrix(0,0,mxDOUBLE_CLASS,mxREAL);
+			if(nlhs > 1)
+				plhs[1] = mxCreateDoubleScalar(ret == -1 ? -1.0 : -3.0);
+			return;
+		}
+		plhs[0] = mx ? mx : mxCreateNumericMatrix(0,0,mxDOUBLE_CLASS,mxREAL);
+		if(nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(0.0);
+		return;
+	}
+	if(recvlen < MSV2_HEADER_SIZE - (int)sizeof(int)) {
 		plhs[0] = mxCreateNumericMatrix(0,0,mxDOUBLE_CLASS,mxREAL);
 		if(nlhs > 1)
 			plhs[1] = mxCreateDoubleScalar(-1.0);
 		return;
 	}
-    
-      
-      
-	      
-    
-	// Receive the array
-	cdata = new char[recvlen];
-	cnt = 0;
-	while(cnt < recvlen) {
-		ret = recv(sock,(cdata+cnt),recvlen-cnt,0);
-		if(ret == -1) {
-			delete[] cdata;
-			perror("recv");
-			plhs[0] = mxCreateNumericMatrix(0,0,mxDOUBLE_CLASS,mxREAL);
-			if(nlhs > 1)
-				plhs[1] = mxCreateDoubleScalar(-1.0);
-			return;
-		}
-		cnt += ret;
+
+	// Receive the rest of the array into the socket's arena
+	arena->buffer.resize(recvlen);
+	cnt = MSV2_HEADER_SIZE - sizeof(int);
+	memcpy(&arena->buffer[0],header+sizeof(int),cnt);
+	if(msv2_recv_all(sock,&arena->buffer[0]+cnt,recvlen-cnt) < 0) {
+		arena->trim();
+		perror("recv");
+		plhs[0] = mxCreateNumericMatrix(0,0,mxDOUBLE_CLASS,mxREAL);
+		if(nlhs > 1)
+			plhs[1] = mxCreateDoubleScalar(-1.0);
+		return;
 	}
 	
-	mv.create((void *)cdata);
+	mv.create((void *)&arena->buffer[0]);
 	plhs[0] = mv.get_mxarray();
 	if(nlhs > 1)
 		plhs[1] = mxCreateDoubleScalar(0.0);
-	if(cdata) delete[] cdata;
+	arena->trim();
 		
 	return;
 } // end of mexFunction
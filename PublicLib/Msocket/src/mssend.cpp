@@ -11,7 +11,9 @@
 //    This is part of the "msocket" suite of TCP/IP 
 //    funcitons for MATLAB.  It is a wrapper for the
 //    "send" socket function call. The data send is a serialized
-//    MALTAB variable in a format described by matvar.cpp
+//    MALTAB variable in the v1 format of matvar.cpp, or in the
+//    v2 format described by matvar2.h when the receiver is known
+//    to take it (mssend(sock,var,2)).
 //
 // Copyright (c) 2006 MIT Lincoln Laboratory
 //
@@ -35,15 +37,14 @@
 #include <mex.h>
 
 #include <matvar.h>
-
-#include <winsock2.h>
+#include <matvar2.h>
 
 void mexFunction(int nlhs, mxArray *plhs[],
 								 int nrhs, const mxArray *prhs[])
 {
 	int *ret;
 	int sock;
-		fd_set readfds,writefds,exceptfds;
+	int version = 1;
 
 	if(nrhs < 2) {
 		mexPrintf("Must input a socket and a variable.\n");
@@ -55,6 +56,12 @@ void mexFunction(int nlhs, mxArray *plhs[],
 	}
 
 	sock = (int)mxGetScalar(prhs[0]);
+	if(nrhs > 2)
+		version = (int)mxGetScalar(prhs[2]);
+#ifdef _BIG_ENDIAN_
+	// v2 payloads are sent as they are in memory
+	version = 1;
+#endif
 
 	plhs[0] = mxCreateNumericMatrix(1,1,mxINT32_CLASS,mxREAL);
 	ret = (int *)mxGetPr(plhs[0]);
@@ -78,6 +85,15 @@ void mexFunction(int nlhs, mxArray *plhs[],
     mexPrintf("Exp = %d\n",Tmp2);
     */
     
+	MsArena *arena = msv2_arena(sock);
+	if(version >= 2) {
+		long long sent = msv2_send(sock,prhs[1],arena);
+		if(sent < 0)
+			perror("send");
+		ret[0] = sent < 0 ? -1 : (int)(sent > 0x7fffffff ? 0x7fffffff : sent);
+		return;
+	}
+
 	MatVar mv;
 	mv.create(prhs[1]);
 	int mvlen = mv.get_serialize_length();
@@ -96,17 +112,17 @@ void mexFunction(int nlhs, mxArray *plhs[],
 	}
 
 	int cnt = 0;
-	char *cdata = new char[mvlen];
+	arena->buffer.resize(mvlen);
+	char *cdata = &arena->buffer[0];
 	mv.serialize(cdata);
 	while(cnt < mvlen) {
 		ret[0] = ::send(sock,cdata+cnt,mvlen-cnt,0);
 		if(ret[0] == -1) {
 			perror("send");
-			delete[] cdata;
-			return;
+			break;
 		}
 		cnt += ret[0];
 	}
-	delete[] cdata;
+	arena->trim();
 	return;
 } // end of mexFunction
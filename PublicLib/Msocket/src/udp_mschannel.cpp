@@ -0,0 +1,458 @@
+////////////////////////////////////////////////////////////
+//
+// Name:   udp_mschannel.cpp
+//
+// Description:
+//
+//    This is part of the "msocket" suite of TCP/IP
+//    funcitons for MATLAB.  It attaches a receive thread
+//    to a UDP socket, so datagrams are taken off the
+//    socket as they arrive instead of once per MATLAB
+//    poll:
+//
+//      udp_mschannel('Open',sock[,ringsize[,maxlen]])
+//      [acData,afTime,iDropped,iTruncated] = udp_mschannel('Read',sock)
+//      ret = udp_mschannel('Send',sock,data[,terminate])
+//      udp_mschannel('Close',sock)
+//
+//    On Linux the thread reads batches with recvmmsg
+//    straight into the slots of a ring, and every datagram
+//    carries its kernel receive time (SO_TIMESTAMPNS).
+//    Elsewhere datagrams are read one by one and stamped
+//    when read.  Times are in seconds on the GetSecs
+//    clock (ClockGetSecs of PrecisionClock.h: CLOCK_MONOTONIC
+//    on UNIX, the performance counter on Windows).  Kernel
+//    stamps are CLOCK_REALTIME and are moved onto that clock
+//    with the realtime - monotonic offset, measured again
+//    for every batch so that NTP steps are followed.
+//
+//    When MATLAB does not drain the ring in time the
+//    newest datagrams are dropped and counted.  "Send"
+//    writes a cell array of datagrams with one sendmmsg
+//    call where available.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+////////////////////////////////////////////////////////////
+
+#include <mex.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#if defined(WIN32) || defined(_WIN32)
+#include <winsock2.h>
+#else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+#include "../../../MEX_Code/GetSecs_x64/PrecisionClock.h"
+
+#if defined(__linux__)
+#define UDP_MMSG
+#endif
+
+#define UDP_DEFAULT_RING 4096
+#define UDP_DEFAULT_MAXLEN 1472		// payload of a 1500 byte Ethernet frame
+#define UDP_BATCH 64
+#define UDP_POLL_MS 50				// how often the thread checks for Close
+
+typedef struct {
+	double time;
+	unsigned int length;
+} UdpSlot;
+
+class UdpChannel {
+ public:
+	UdpChannel(int sock, unsigned int ringSize, unsigned int maxLength);
+	~UdpChannel();
+
+	// MATLAB thread
+	void read(mxArray *plhs[], int nlhs);
+
+	std::atomic<unsigned int> dropped;
+	std::atomic<unsigned int> truncated;
+
+ private:
+	void run(void);
+	bool wait_readable(void);
+	void receive(void);
+	unsigned int free_slots(void) const {
+		return ringSize - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+	}
+	char *slot_data(unsigned int k) { return &data[(size_t)(k & (ringSize - 1)) * maxLength]; }
+	UdpSlot &slot(unsigned int k) { return slots[k & (ringSize - 1)]; }
+
+	int sock;
+	unsigned int ringSize;		// a power of two
+	unsigned int maxLength;
+	std::vector<UdpSlot> slots;
+	std::vector<char> data;
+	std::vector<char> scratch;	// datagrams that do not fit in the ring
+	std::atomic<unsigned int> head;	// written by the thread
+	std::atomic<unsigned int> tail;	// written by MATLAB
+	std::atomic<bool> running;
+	std::thread worker;
+};
+
+static std::map<int, UdpChannel *> channels;
+
+////////////////////////////////////////////////////////////
+// Clock
+
+#ifdef UDP_MMSG
+// CLOCK_REALTIME - CLOCK_MONOTONIC, from the tightest of a few
+// monotonic / realtime / monotonic brackets
+static double realtime_offset(void)
+{
+	double best = 1e30, offset = 0;
+	for(int k=0;k<3;k++) {
+		double before = ClockGetSecs();
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		double after = ClockGetSecs();
+		if(after - before < best) {
+			best = after - before;
+			offset = (ts.tv_sec + ts.tv_nsec * 1.0E-9) - (before + after) / 2;
+		}
+	}
+	return offset;
+}
+#endif
+
+////////////////////////////////////////////////////////////
+// Receive thread
+
+UdpChannel::UdpChannel(int sock_, unsigned int ringSize_, unsigned int maxLength_)
+	: dropped(0), truncated(0), sock(sock_), maxLength(maxLength_), head(0), tail(0), running(true)
+{
+	ringSize = 1;
+	while(ringSize < ringSize_)
+		ringSize <<= 1;
+	slots.resize(ringSize);
+	data.resize((size_t)ringSize * maxLength);
+	scratch.resize(maxLength);
+#ifdef UDP_MMSG
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+#endif
+	worker = std::thread(&UdpChannel::run, this);
+}
+
+UdpChannel::~UdpChannel()
+{
+	running = false;
+	worker.join();
+#ifdef UDP_MMSG
+	int zero = 0;
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &zero, sizeof(zero));
+#endif
+}
+
+bool UdpChannel::wait_readable(void)
+{
+#if defined(WIN32) || defined(_WIN32)
+	fd_set readfds;
+	FD_ZERO(&readfds);
+	FD_SET(sock,&readfds);
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = UDP_POLL_MS * 1000;
+	return select(sock+1,&readfds,(fd_set *)0,(fd_set *)0,&tv) > 0;
+#else
+	struct pollfd p;
+	p.fd = sock;
+	p.events = POLLIN;
+	p.revents = 0;
+	return poll(&p, 1, UDP_POLL_MS) > 0;
+#endif
+}
+
+#ifdef UDP_MMSG
+
+// Reads every pending datagram, in batches, into the free slots
+void UdpChannel::receive(void)
+{
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	char control[UDP_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+
+	for(;;) {
+		unsigned int h = head.load(std::memory_order_relaxed);
+		unsigned int n = free_slots();
+		bool full = n == 0;
+		if(n > UDP_BATCH)
+			n = UDP_BATCH;
+		if(full)
+			n = 1;
+		// a slot's storage is contiguous only up to the end of the ring
+		unsigned int toEnd = ringSize - (h & (ringSize - 1));
+		if(n > toEnd)
+			n = toEnd;
+		for(unsigned int i=0;i<n;i++) {
+			iov[i].iov_base = full ? &scratch[0] : slot_data(h + i);
+			iov[i].iov_len = maxLength;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+			msgs[i].msg_len = 0;
+		}
+		int got = recvmmsg(sock, msgs, n, MSG_DONTWAIT, (struct timespec *)0);
+		if(got <= 0)
+			return;
+		double fallback = ClockGetSecs();
+		if(full) {
+			dropped += got;
+			continue;
+		}
+		double offset = realtime_offset();
+		for(int i=0;i<got;i++) {
+			UdpSlot &s = slot(h + i);
+			s.length = msgs[i].msg_len;
+			s.time = fallback;
+			if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				truncated++;
+			for(struct cmsghdr *c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c; c = CMSG_NXTHDR(&msgs[i].msg_hdr, c)) {
+				if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+					struct timespec ts;
+					memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+					s.time = ts.tv_sec + ts.tv_nsec * 1.0E-9 - offset;
+				}
+			}
+		}
+		head.store(h + got, std::memory_order_release);
+		if(got < (int)n)
+			return;
+	}
+}
+
+#else
+
+void UdpChannel::receive(void)
+{
+	for(;;) {
+		unsigned int h = head.load(std::memory_order_relaxed);
+		bool full = free_slots() == 0;
+		char *buf = full ? &scratch[0] : slot_data(h);
+#if defined(WIN32) || defined(_WIN32)
+		u_long pending = 0;
+		if(ioctlsocket(sock, FIONREAD, &pending) != 0 || pending == 0)
+			return;
+		int ret = recv(sock, buf, maxLength, 0);
+		if(ret < 0 && WSAGetLastError() == WSAEMSGSIZE) {
+			truncated++;
+			ret = maxLength;
+		}
+#else
+		int ret = recv(sock, buf, maxLength, MSG_DONTWAIT);
+#endif
+		if(ret < 0)
+			return;
+		if(full) {
+			dropped++;
+			continue;
+		}
+		UdpSlot &s = slot(h);
+		s.length = ret;
+		s.time = ClockGetSecs();
+		head.store(h + 1, std::memory_order_release);
+	}
+}
+
+#endif
+
+void UdpChannel::run(void)
+{
+	while(running) {
+		if(wait_readable())
+			receive();
+	}
+}
+
+// Hands every datagram received so far to MATLAB
+void UdpChannel::read(mxArray *plhs[], int nlhs)
+{
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	unsigned int n = head.load(std::memory_order_acquire) - t;
+	plhs[0] = mxCreateCellMatrix(1,n);
+	double *times = (double *)0;
+	if(nlhs > 1) {
+		plhs[1] = mxCreateNumericMatrix(1,n,mxDOUBLE_CLASS,mxREAL);
+		times = mxGetPr(plhs[1]);
+	}
+	for(unsigned int i=0;i<n;i++) {
+		UdpSlot &s = slot(t + i);
+		unsigned int len = s.length < maxLength ? s.length : maxLength;
+		mxArray *mx = mxCreateNumericMatrix(len,1,mxUINT8_CLASS,mxREAL);
+		memcpy(mxGetData(mx), slot_data(t + i), len);
+		mxSetCell(plhs[0], i, mx);
+		if(times)
+			times[i] = s.time;
+	}
+	tail.store(t + n, std::memory_order_release);
+	if(nlhs > 2)
+		plhs[2] = mxCreateDoubleScalar(dropped.exchange(0));
+	if(nlhs > 3)
+		plhs[3] = mxCreateDoubleScalar(truncated.exchange(0));
+}
+
+////////////////////////////////////////////////////////////
+// Sending
+
+// Sends each datagram of acData (a cell array of numeric arrays, or one
+// numeric array) on a connected socket. Returns the number sent, or -1.
+static int send_datagrams(int sock, const mxArray *acData, bool terminate)
+{
+	std::vector<const mxArray *> items;
+	if(mxIsCell(acData)) {
+		for(size_t i=0;i<mxGetNumberOfElements(acData);i++) {
+			const mxArray *mx = mxGetCell(acData, i);
+			if(!mx || !mxIsNumeric(mx)) {
+				mexPrintf("Datagrams must be numeric.\n");
+				return -1;
+			}
+			items.push_back(mx);
+		}
+	}
+	else if(mxIsNumeric(acData))
+		items.push_back(acData);
+	else {
+		mexPrintf("send variable must be numeric.\n");
+		return -1;
+	}
+
+	// the trailing 0 of udp_mssendraw_mod goes in a second buffer
+	static char zero = 0;
+	int sent = 0;
+#ifdef UDP_MMSG
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH][2];
+	while(sent < (int)items.size()) {
+		int n = (int)items.size() - sent;
+		if(n > UDP_BATCH)
+			n = UDP_BATCH;
+		for(int i=0;i<n;i++) {
+			const mxArray *mx = items[sent + i];
+			iov[i][0].iov_base = mxGetData(mx);
+			iov[i][0].iov_len = mxGetNumberOfElements(mx) * mxGetElementSize(mx);
+			iov[i][1].iov_base = &zero;
+			iov[i][1].iov_len = 1;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = iov[i];
+			msgs[i].msg_hdr.msg_iovlen = terminate ? 2 : 1;
+		}
+		int ret = sendmmsg(sock, msgs, n, 0);
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("sendmmsg");
+			return sent > 0 ? sent : -1;
+		}
+		sent += ret;
+	}
+#else
+	std::vector<char> buf;
+	for(;sent < (int)items.size();sent++) {
+		const mxArray *mx = items[sent];
+		const char *p = (const char *)mxGetData(mx);
+		size_t len = mxGetNumberOfElements(mx) * mxGetElementSize(mx);
+		if(terminate) {
+			buf.assign(p, p + len);
+			buf.push_back(zero);
+			p = &buf[0];
+			len++;
+		}
+		if(send(sock, p, (int)len, 0) < 0) {
+			perror("send");
+			return sent > 0 ? sent : -1;
+		}
+	}
+#endif
+	return sent;
+}
+
+////////////////////////////////////////////////////////////
+
+static void close_channels(void)
+{
+	for(std::map<int, UdpChannel *>::iterator it = channels.begin(); it != channels.end(); it++)
+		delete it->second;
+	channels.clear();
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+								 int nrhs, const mxArray *prhs[])
+{
+	static bool registered = false;
+	if(!registered) {
+		mexAtExit(close_channels);
+		registered = true;
+	}
+
+	if(nrhs < 2 || !mxIsChar(prhs[0]) || !mxIsNumeric(prhs[1])) {
+		mexPrintf("Must input a command (Open, Read, Send or Close) and a socket.\n");
+		return;
+	}
+	char command[8];
+	mxGetString(prhs[0], command, sizeof(command));
+	int sock = (int)mxGetScalar(prhs[1]);
+	std::map<int, UdpChannel *>::iterator it = channels.find(sock);
+
+	if(strcmp(command, "Open") == 0) {
+		if(it == channels.end()) {
+			double ringSize = nrhs > 2 ? mxGetScalar(prhs[2]) : UDP_DEFAULT_RING;
+			double maxLength = nrhs > 3 ? mxGetScalar(prhs[3]) : UDP_DEFAULT_MAXLEN;
+			if(ringSize < 1 || ringSize > (1 << 24) || maxLength < 1 || maxLength > 65536) {
+				mexPrintf("Invalid ring size or datagram length.\n");
+				return;
+			}
+			channels[sock] = new UdpChannel(sock, (unsigned int)ringSize, (unsigned int)maxLength);
+		}
+		plhs[0] = mxCreateDoubleScalar(0.0);
+		return;
+	}
+
+	if(strcmp(command, "Send") == 0) {
+		if(nrhs < 3) {
+			mexPrintf("Must input a socket and a variable.\n");
+			return;
+		}
+		bool terminate = nrhs > 3 && mxGetScalar(prhs[3]) != 0;
+		plhs[0] = mxCreateDoubleScalar(send_datagrams(sock, prhs[2], terminate));
+		return;
+	}
+
+	if(it == channels.end()) {
+		mexPrintf("udp_mschannel: socket %d was not opened.\n", sock);
+		return;
+	}
+
+	if(strcmp(command, "Read") == 0) {
+		it->second->read(plhs, nlhs);
+		return;
+	}
+
+	if(strcmp(command, "Close") == 0) {
+		delete it->second;
+		channels.erase(it);
+		return;
+	}
+
+	mexPrintf("udp_mschannel: unknown command %s\n", command);
+} // end of mexFunction
@@ -0,0 +1,32 @@
+% FUNCTION [acData,afTime,iDropped,iTruncated] = udp_mschannel(strCommand,sock,...)
+%
+% Description:
+%
+%    Receives datagrams on a UDP socket in a background thread, so
+%    bursts are not lost between MATLAB polls and every datagram
+%    has a receive time.
+%
+%    udp_mschannel('Open',sock,iRingSize,iMaxLength)
+%       starts the thread on a socket from "udp_mslisten" or
+%       "udp_msconnect".  "iRingSize" (default 4096) datagrams of
+%       up to "iMaxLength" (default 1472) bytes are kept until read.
+%
+%    [acData,afTime,iDropped,iTruncated] = udp_mschannel('Read',sock)
+%       returns every datagram received since the last call as a
+%       cell array of uint8 column vectors, with its receive time in
+%       "afTime" (seconds, GetSecs clock; taken by the kernel on
+%       Linux).  "iDropped" counts datagrams lost because the ring
+%       was full, "iTruncated" those longer than "iMaxLength".
+%
+%    ret = udp_mschannel('Send',sock,data,bTerminate)
+%       sends "data" (a numeric array, or a cell array of them, one
+%       datagram each) on a connected socket.  With "bTerminate" a
+%       0 byte is appended, like "udp_mssendraw_mod".  Returns the
+%       number of datagrams sent, or -1.
+%
+%    udp_mschannel('Close',sock)
+%       stops the thread; the socket stays open.
+%
+%    While a channel is open the socket should not be read with
+%    "udp_msrecvraw".
+%